@@ -0,0 +1,237 @@
+/*
+  Minimal stackless coroutine executor for the water monitor firmware.
+
+  Coroutine frames come from a fixed pool (no heap). A suspended task waits
+  on a predicate, a deadline, or both; the sketch calls executor.run_once()
+  from loop() and every task whose condition holds (or whose deadline has
+  passed) is resumed once. Several network operations can therefore be in
+  flight without any of them blocking loop().
+
+  Needs C++20 coroutines (arm-none-eabi-gcc 10+ with -std=gnu++20
+  -fcoroutines). Without ARDUINO defined it uses CLOCK_MONOTONIC, so the
+  same executor runs on a Linux host against POSIX sockets.
+
+  Sockets plug in through two free functions found by overload resolution:
+    bool socket_readable(Sock& s);   // data buffered or peer closed
+    bool socket_writable(Sock& s);   // a write would not block
+*/
+#pragma once
+
+#include <coroutine>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+inline unsigned long async_millis() { return millis(); }
+#else
+#include <time.h>
+inline unsigned long async_millis() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+#endif
+
+#ifndef ASYNC_MAX_TASKS
+#define ASYNC_MAX_TASKS 4
+#endif
+#ifndef ASYNC_FRAME_SIZE
+#define ASYNC_FRAME_SIZE 512
+#endif
+
+const unsigned long ASYNC_FOREVER = 0xFFFFFFFFUL;
+
+// Fixed pool of coroutine frames, one slot per task
+class FramePool {
+ public:
+  static void* allocate(size_t size) {
+    if (size <= ASYNC_FRAME_SIZE) {
+      for (int i = 0; i < ASYNC_MAX_TASKS; i++) {
+        if (!used[i]) {
+          used[i] = true;
+          return slots[i];
+        }
+      }
+    }
+    failures++;
+    return nullptr;
+  }
+
+  static void release(void* frame) {
+    for (int i = 0; i < ASYNC_MAX_TASKS; i++) {
+      if (frame == slots[i]) {
+        used[i] = false;
+      }
+    }
+  }
+
+  static inline unsigned long failures = 0;  // Frame too big or pool full
+
+ private:
+  alignas(max_align_t) static inline uint8_t slots[ASYNC_MAX_TASKS][ASYNC_FRAME_SIZE];
+  static inline bool used[ASYNC_MAX_TASKS];
+};
+
+class Executor;
+
+// Fire-and-forget task. It starts suspended and is driven by the Executor;
+// the frame returns to the pool when the coroutine finishes.
+struct Task {
+  struct promise_type {
+    static void* operator new(size_t size) noexcept { return FramePool::allocate(size); }
+    static void operator delete(void* frame) { FramePool::release(frame); }
+    static Task get_return_object_on_allocation_failure() { return Task(); }
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void();
+    void unhandled_exception() {}
+  };
+
+  Task() = default;
+  explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  explicit operator bool() const { return (bool)handle; }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+class Executor {
+ public:
+  // Queue a task; false if it has no frame or every slot is busy
+  bool spawn(Task task) {
+    if (!task) {
+      return false;
+    }
+    for (int i = 0; i < ASYNC_MAX_TASKS; i++) {
+      Waiter& w = waiters[i];
+      if (!w.handle) {
+        w.handle = task.handle;
+        w.check = nullptr;
+        w.ctx = nullptr;
+        w.deadline = async_millis();
+        w.hasDeadline = true;
+        return true;
+      }
+    }
+    task.handle.destroy();
+    return false;
+  }
+
+  // Resume every task that is ready. Never blocks.
+  void run_once() {
+    Executor* outer = active;
+    active = this;
+    for (int i = 0; i < ASYNC_MAX_TASKS; i++) {
+      Waiter& w = waiters[i];
+      if (!w.handle) {
+        continue;
+      }
+      bool ready = w.check != nullptr && w.check(w.ctx);
+      bool expired = w.hasDeadline && (long)(async_millis() - w.deadline) >= 0;
+      if (!ready && !expired) {
+        continue;
+      }
+      w.timedOut = !ready;
+      running = i;
+      std::coroutine_handle<> h = w.handle;
+      h.resume();
+      running = -1;
+    }
+    resumes++;
+    active = outer;
+  }
+
+  // Number of live tasks
+  int pending() const {
+    int n = 0;
+    for (int i = 0; i < ASYNC_MAX_TASKS; i++) {
+      n += waiters[i].handle ? 1 : 0;
+    }
+    return n;
+  }
+
+  // Called by awaitables from await_suspend() of the running task
+  void wait(bool (*check)(void*), void* ctx, unsigned long timeoutMs) {
+    Waiter& w = waiters[running];
+    w.check = check;
+    w.ctx = ctx;
+    w.hasDeadline = timeoutMs != ASYNC_FOREVER;
+    w.deadline = async_millis() + (w.hasDeadline ? timeoutMs : 0);
+    w.timedOut = false;
+  }
+
+  bool timed_out() const { return waiters[running].timedOut; }
+
+  void finish() { waiters[running].handle = nullptr; }
+
+  static inline Executor* active = nullptr;
+  unsigned long resumes = 0;
+
+ private:
+  struct Waiter {
+    std::coroutine_handle<> handle;
+    bool (*check)(void*);
+    void* ctx;
+    unsigned long deadline;
+    bool hasDeadline;
+    bool timedOut;
+  };
+
+  Waiter waiters[ASYNC_MAX_TASKS] = {};
+  int running = -1;
+};
+
+inline void Task::promise_type::return_void() {
+  Executor::active->finish();
+}
+
+// co_await until(pred, timeout): true when pred() held, false on timeout.
+// The predicate lives in the awaiter, which lives in the coroutine frame.
+template <class Pred>
+struct Until {
+  Pred pred;
+  unsigned long timeoutMs;
+
+  bool await_ready() { return pred(); }
+  void await_suspend(std::coroutine_handle<>) {
+    Executor::active->wait(&Until::thunk, this, timeoutMs);
+  }
+  bool await_resume() {
+    return !Executor::active->timed_out() || pred();
+  }
+  static bool thunk(void* self) { return static_cast<Until*>(self)->pred(); }
+};
+
+template <class Pred>
+Until<Pred> until(Pred pred, unsigned long timeoutMs = ASYNC_FOREVER) {
+  return Until<Pred>{ pred, timeoutMs };
+}
+
+// co_await sleep_ms(ms): resumes on the first run_once() after ms elapse
+struct SleepFor {
+  unsigned long ms;
+
+  bool await_ready() { return false; }
+  void await_suspend(std::coroutine_handle<>) {
+    Executor::active->wait(nullptr, nullptr, ms);
+  }
+  void await_resume() {}
+};
+
+inline SleepFor sleep_ms(unsigned long ms) { return SleepFor{ ms }; }
+inline SleepFor yield_now() { return SleepFor{ 0 }; }
+
+// Socket readiness with a timeout; true when ready, false on timeout
+template <class Sock>
+auto readable(Sock& s, unsigned long timeoutMs) {
+  return until([&s] { return socket_readable(s); }, timeoutMs);
+}
+
+template <class Sock>
+auto writable(Sock& s, unsigned long timeoutMs) {
+  return until([&s] { return socket_writable(s); }, timeoutMs);
+}
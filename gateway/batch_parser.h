@@ -0,0 +1,521 @@
+/*
+  SIMD parser for batches of firmware frames.
+
+  A body is one frame object or a JSON array of them:
+    [{"T":436.63,"PH":6.61,"S":12,"TA":5022,"TS":5022},{"C":609.52,...}]
+  Parsing runs in two stages, after simdjson:
+
+  1. Structural index. Each 64-byte block is classified with vector
+     compares (AVX2, or SSE4.2 PCMPESTRM) into bitmasks of quotes and
+     { } [ ] : , characters. A carry-less multiply by all-ones turns the
+     quote mask into an in-string mask, which removes structural
+     characters inside strings. The surviving positions are written to an
+     index array. Blocks that contain a backslash go through the scalar
+     classifier, which tracks escapes; the firmware never sends one.
+
+  2. Walk the index. Keys are compared in place. Channel values are
+     converted straight into hundredths (Reading::centi) from their
+     decimal digits, which covers everything build_uplink_frame() emits.
+     Any other number syntax falls back to std::from_chars.
+
+  The ISA is chosen at run time. Non-x86 builds use the scalar
+  classifier.
+*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_PARSER_X86 1
+#else
+#define BATCH_PARSER_X86 0
+#endif
+
+#include "reading_parser.h"
+
+class BatchParser {
+ public:
+  enum Isa { ISA_SCALAR, ISA_SSE42, ISA_AVX2 };
+
+  static Isa best_isa() {
+#if BATCH_PARSER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("pclmul")) {
+      return ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+      return ISA_SSE42;
+    }
+#endif
+    return ISA_SCALAR;
+  }
+
+  explicit BatchParser(Isa isa = best_isa()) : isa_(isa) {
+    readings_.reserve(64);
+    index_.resize(4096 + 64);
+  }
+
+  // PARSE_OK when at least one frame carried a channel; readings() then
+  // holds every frame of the batch in order
+  ParseResult parse(const char* data, size_t len) {
+    readings_.clear();
+    if (!build_index(data, len)) {
+      return PARSE_ERROR;
+    }
+    buf_ = data;
+    len_ = len;
+    k_ = 0;
+    last_ = 0;
+    depth_ = 0;
+    if (!top_level()) {
+      return PARSE_ERROR;
+    }
+    for (const Reading& r : readings_) {
+      if (r.present) {
+        return PARSE_OK;
+      }
+    }
+    return PARSE_EMPTY;
+  }
+
+  const std::vector<Reading>& readings() const { return readings_; }
+  Isa isa() const { return isa_; }
+
+ private:
+  // ---- Stage 1: structural index ----
+
+  struct BlockMasks {
+    uint64_t quote;       // '"'
+    uint64_t backslash;   // '\\'
+    uint64_t op;          // { } [ ] : ,
+  };
+
+  static bool is_op(uint8_t c) {
+    return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+  }
+
+  static void classify_scalar(const uint8_t* p, BlockMasks& m) {
+    m = BlockMasks();
+    for (int i = 0; i < 64; i++) {
+      uint64_t bit = 1ULL << i;
+      m.quote |= p[i] == '"' ? bit : 0;
+      m.backslash |= p[i] == '\\' ? bit : 0;
+      m.op |= is_op(p[i]) ? bit : 0;
+    }
+  }
+
+#if BATCH_PARSER_X86
+  __attribute__((target("avx2"))) static void classify_avx2(const uint8_t* p, BlockMasks& m) {
+    uint64_t masks[3] = {};
+    for (int half = 0; half < 2; half++) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(p + 32 * half));
+      __m256i op = _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'))),
+          _mm256_or_si256(
+              _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']'))),
+              _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')))));
+      __m256i quote = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+      __m256i bs = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+      masks[0] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(quote) << (32 * half);
+      masks[1] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(bs) << (32 * half);
+      masks[2] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << (32 * half);
+    }
+    m.quote = masks[0];
+    m.backslash = masks[1];
+    m.op = masks[2];
+  }
+
+  __attribute__((target("sse4.2"))) static void classify_sse42(const uint8_t* p, BlockMasks& m) {
+    const __m128i ops = _mm_setr_epi8('{', '}', '[', ']', ':', ',', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const int mode = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK;
+    m = BlockMasks();
+    for (int q = 0; q < 4; q++) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * q));
+      uint64_t op = (uint16_t)_mm_cvtsi128_si32(_mm_cmpestrm(ops, 6, v, 16, mode));
+      uint64_t quote = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+      uint64_t bs = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+      m.op |= op << (16 * q);
+      m.quote |= quote << (16 * q);
+      m.backslash |= bs << (16 * q);
+    }
+  }
+
+  // Bit i set when an odd number of quotes precede or sit at position i
+  __attribute__((target("pclmul,sse2"))) static uint64_t prefix_xor_clmul(uint64_t x) {
+    __m128i r = _mm_clmulepi64_si128(_mm_set_epi64x(0, (long long)x), _mm_set1_epi8((char)0xFF), 0);
+    return (uint64_t)_mm_cvtsi128_si64(r);
+  }
+#endif
+
+  static uint64_t prefix_xor_scalar(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+  }
+
+  // Block with escapes: walk it byte by byte, carrying string state
+  static uint64_t structurals_with_escapes(const uint8_t* p, bool& inString, bool& escaped) {
+    uint64_t out = 0;
+    for (int i = 0; i < 64; i++) {
+      uint8_t c = p[i];
+      if (inString) {
+        if (escaped) {
+          escaped = false;
+        } else if (c == '\\') {
+          escaped = true;
+        } else if (c == '"') {
+          inString = false;
+          out |= 1ULL << i;
+        }
+      } else if (c == '"') {
+        inString = true;
+        out |= 1ULL << i;
+      } else if (is_op(c)) {
+        out |= 1ULL << i;
+      }
+    }
+    return out;
+  }
+
+  bool build_index(const char* data, size_t len) {
+    if (index_.size() < len + 1) {
+      index_.resize(len + 64);
+    }
+    uint32_t* out = index_.data();
+    size_t n = 0;
+    bool inString = false;
+    bool escaped = false;
+    uint8_t tail[64];
+
+    for (size_t base = 0; base < len; base += 64) {
+      const uint8_t* p = (const uint8_t*)data + base;
+      if (len - base < 64) {
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, p, len - base);
+        p = tail;
+      }
+
+      BlockMasks m;
+#if BATCH_PARSER_X86
+      if (isa_ == ISA_AVX2) {
+        classify_avx2(p, m);
+      } else if (isa_ == ISA_SSE42) {
+        classify_sse42(p, m);
+      } else {
+        classify_scalar(p, m);
+      }
+#else
+      classify_scalar(p, m);
+#endif
+
+      uint64_t structurals;
+      if (m.backslash || escaped) {
+        structurals = structurals_with_escapes(p, inString, escaped);
+      } else {
+#if BATCH_PARSER_X86
+        uint64_t strings = isa_ == ISA_SCALAR ? prefix_xor_scalar(m.quote) : prefix_xor_clmul(m.quote);
+#else
+        uint64_t strings = prefix_xor_scalar(m.quote);
+#endif
+        strings ^= inString ? ~0ULL : 0;
+        inString = (strings >> 63) != 0;
+        structurals = (m.op & ~strings) | m.quote;
+      }
+
+      while (structurals) {
+        out[n++] = (uint32_t)(base + __builtin_ctzll(structurals));
+        structurals &= structurals - 1;
+      }
+    }
+    n_ = n;
+    idx_ = out;
+    return !inString;   // Unterminated string
+  }
+
+  // ---- Stage 2: walk the index ----
+
+  static const int MAX_DEPTH = 16;
+
+  char tok() const { return k_ < n_ ? buf_[idx_[k_]] : 0; }
+  uint32_t pos() const { return k_ < n_ ? idx_[k_] : (uint32_t)len_; }
+
+  static bool is_ws(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+  bool blank_to(uint32_t end) const {
+    for (uint32_t i = last_; i < end; i++) {
+      if (!is_ws(buf_[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Consume the next token if it is c with only whitespace before it
+  bool take(char c) {
+    if (tok() != c || !blank_to(pos())) {
+      return false;
+    }
+    last_ = pos() + 1;
+    k_++;
+    return true;
+  }
+
+  // Scalar value (number or literal) up to the next structural character
+  bool scalar(const char*& b, const char*& e) {
+    b = buf_ + last_;
+    e = buf_ + pos();
+    while (b < e && is_ws(*b)) {
+      b++;
+    }
+    while (e > b && is_ws(e[-1])) {
+      e--;
+    }
+    last_ = pos();
+    return b < e;
+  }
+
+  bool top_level() {
+    if (take('[')) {
+      if (!take(']')) {
+        do {
+          readings_.emplace_back();
+          Reading& r = readings_.back();
+          traceSeen_ = 0;
+          if (!object([this, &r](const char* k, size_t kl) { return top_field(k, kl, r); })) {
+            return false;
+          }
+          r.hasTrace = traceSeen_ == 0x07;
+        } while (take(','));
+        if (!take(']')) {
+          return false;
+        }
+      }
+    } else {
+      readings_.emplace_back();
+      Reading& r = readings_.back();
+      traceSeen_ = 0;
+      if (!object([this, &r](const char* k, size_t kl) { return top_field(k, kl, r); })) {
+        return false;
+      }
+      r.hasTrace = traceSeen_ == 0x07;
+    }
+    return k_ == n_ && blank_to((uint32_t)len_);
+  }
+
+  template <class Field>
+  bool object(Field field) {
+    if (!take('{')) {
+      return false;
+    }
+    if (take('}')) {
+      return true;
+    }
+    do {
+      if (!take('"')) {
+        return false;
+      }
+      const char* key = buf_ + last_;
+      size_t keyLen = pos() - last_;
+      if (tok() != '"') {
+        return false;
+      }
+      last_ = pos() + 1;
+      k_++;
+      if (!take(':') || !field(key, keyLen)) {
+        return false;
+      }
+    } while (take(','));
+    return take('}');
+  }
+
+  static int channel_index(const char* key, size_t len) {
+    if (len == 1) {
+      return key[0] == 'T' ? CH_T : key[0] == 'C' ? CH_C : -1;
+    }
+    return len == 2 && key[0] == 'P' && key[1] == 'H' ? CH_PH : -1;
+  }
+
+  bool top_field(const char* key, size_t len, Reading& r) {
+    int ch = channel_index(key, len);
+    const char* b;
+    const char* e;
+    if (ch >= 0) {
+      if (!scalar(b, e) || !centi(b, e, r.centi[ch])) {
+        return false;
+      }
+      r.value[ch] = r.centi[ch] / 100.0;
+      r.present |= 1 << ch;
+      return true;
+    }
+    if (len == 1 && key[0] == 'Q' && tok() == '{' && blank_to(pos())) {
+      return object([this, &r](const char* k, size_t kl) { return quality_field(k, kl, r); });
+    }
+    if (len == 1 && key[0] == 'D' && take('"')) {
+      const char* id = buf_ + last_;
+      if (tok() != '"') {
+        return false;
+      }
+      r.device = device_from_id(id, pos() - last_);
+      last_ = pos() + 1;
+      k_++;
+      return true;
+    }
+    int trace = len == 1 && key[0] == 'S' ? 0
+                : len == 2 && key[0] == 'T' && key[1] == 'A' ? 1
+                : len == 2 && key[0] == 'T' && key[1] == 'S' ? 2 : -1;
+    if (trace >= 0) {
+      uint32_t* fields[3] = { &r.seq, &r.acquiredMs, &r.sentMs };
+      if (!scalar(b, e) || !uint_field(b, e, *fields[trace])) {
+        return false;
+      }
+      traceSeen_ |= 1 << trace;
+      return true;
+    }
+    return skip_value();
+  }
+
+  bool quality_field(const char* key, size_t len, Reading& r) {
+    int ch = channel_index(key, len);
+    if (ch < 0) {
+      return skip_value();
+    }
+    const char* b;
+    const char* e;
+    uint32_t flags;
+    if (!scalar(b, e) || !uint_field(b, e, flags)) {
+      return false;
+    }
+    r.quality[ch] = (uint8_t)flags;
+    return true;
+  }
+
+  bool skip_value() {
+    if (++depth_ > MAX_DEPTH) {
+      return false;
+    }
+    bool ok;
+    char t = tok();
+    if (t == '{' && blank_to(pos())) {
+      ok = object([this](const char*, size_t) { return skip_value(); });
+    } else if (t == '[' && blank_to(pos())) {
+      take('[');
+      ok = take(']');
+      if (!ok) {
+        do {
+          ok = skip_value();
+        } while (ok && take(','));
+        ok = ok && take(']');
+      }
+    } else if (t == '"' && blank_to(pos())) {
+      take('"');
+      ok = tok() == '"';
+      last_ = pos() + 1;
+      k_++;
+    } else {
+      const char* b;
+      const char* e;
+      ok = scalar(b, e) && (literal(b, e, "true") || literal(b, e, "false") || literal(b, e, "null")
+                            || number_double(b, e));
+    }
+    depth_--;
+    return ok;
+  }
+
+  static bool literal(const char* b, const char* e, const char* word) {
+    size_t n = strlen(word);
+    return (size_t)(e - b) == n && memcmp(b, word, n) == 0;
+  }
+
+  static bool number_double(const char* b, const char* e, double* out = nullptr) {
+    double v;
+    auto r = std::from_chars(b, e, v);
+    if (r.ec != std::errc() || r.ptr != e) {
+      return false;
+    }
+    if (out) {
+      *out = v;
+    }
+    return true;
+  }
+
+  // -?d{1,9}(.d+)? straight to hundredths; anything else via from_chars
+  static bool centi(const char* b, const char* e, int32_t& out) {
+    const char* p = b;
+    bool neg = p < e && *p == '-';
+    p += neg;
+    const char* digits = p;
+    int64_t whole = 0;
+    while (p < e && (unsigned)(*p - '0') < 10 && p - digits < 9) {
+      whole = whole * 10 + (*p++ - '0');
+    }
+    if (p > digits && (p == e || *p == '.')) {
+      int64_t frac = 0;
+      bool ok = true;
+      if (p < e) {
+        const char* f = ++p;
+        int d[3] = { 0, 0, 0 };
+        while (p < e && (unsigned)(*p - '0') < 10) {
+          if (p - f < 3) {
+            d[p - f] = *p - '0';
+          }
+          p++;
+        }
+        ok = p > f && p == e;
+        frac = d[0] * 10 + d[1] + (d[2] >= 5);
+      }
+      if (ok) {
+        int64_t c = neg ? -(whole * 100 + frac) : whole * 100 + frac;
+        out = c > INT32_MAX ? INT32_MAX : c < INT32_MIN ? INT32_MIN : (int32_t)c;
+        return true;
+      }
+    }
+    double v;
+    if (!number_double(b, e, &v)) {
+      return false;
+    }
+    out = centi_from_double(v);
+    return true;
+  }
+
+  static bool uint_field(const char* b, const char* e, uint32_t& out) {
+    if (e - b <= 9) {
+      uint32_t v = 0;
+      const char* p = b;
+      while (p < e && (unsigned)(*p - '0') < 10) {
+        v = v * 10 + (*p++ - '0');
+      }
+      if (p == e && p > b) {
+        out = v;
+        return true;
+      }
+    }
+    double v;
+    if (!number_double(b, e, &v)) {
+      return false;
+    }
+    out = u32_from_double(v);
+    return true;
+  }
+
+  Isa isa_;
+  std::vector<uint32_t> index_;
+  std::vector<Reading> readings_;
+
+  const char* buf_ = nullptr;
+  size_t len_ = 0;
+  const uint32_t* idx_ = nullptr;
+  size_t n_ = 0;
+  size_t k_ = 0;          // Next structural token
+  uint32_t last_ = 0;     // First byte after the last consumed token
+  int depth_ = 0;
+  uint8_t traceSeen_ = 0;
+};
@@ -0,0 +1,126 @@
+/*
+  Throughput of BatchParser against a general JSON library (jsoncpp) on
+  batches of real firmware frames.
+
+  Build:
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src -I/usr/include/jsoncpp \
+        gateway/batch_parser_bench.cpp -ljsoncpp -lbenchmark -lpthread -o batch_parser_bench
+
+  Run:
+    ./batch_parser_bench
+
+  bytes_per_second is input bytes parsed; frames/s counts readings.
+*/
+#include <benchmark/benchmark.h>
+#include <json/json.h>
+
+#include <memory>
+#include <string>
+
+#include "firmware_sim.h"
+#include "batch_parser.h"
+
+static const int BATCH_FRAMES = 32;
+
+// A batch body of firmware frames, as a backfilling board would send it
+static const std::string& firmware_batch() {
+  static std::string batch;
+  if (batch.empty()) {
+    batch = "[";
+    for (int b = 0; b < BATCH_FRAMES; b++) {
+      for (int i = 0; i < NUM_CHANNELS; i++) {
+        channels[i].pending = (b + i) % 3 != 0;
+        channels[i].value = 100.0f * (i + 1) + 0.37f * b;
+        channels[i].quality = b % 11 == 0 ? QF_NOISY : 0;
+        channels[i].reportTime = millis();
+      }
+      size_t len = build_uplink_frame();
+      batch += (b ? "," : "") + std::string(jsonBuf, len);
+      delay(1000);
+    }
+    batch += "]";
+  }
+  return batch;
+}
+
+static void run_batch_parser(benchmark::State& state, BatchParser::Isa isa) {
+  if (isa > BatchParser::best_isa()) {
+    state.SkipWithError("ISA not supported on this CPU");
+    return;
+  }
+  const std::string& body = firmware_batch();
+  BatchParser parser(isa);
+  for (auto _ : state) {
+    ParseResult r = parser.parse(body.data(), body.size());
+    benchmark::DoNotOptimize(r);
+    benchmark::DoNotOptimize(parser.readings().data());
+  }
+  state.SetBytesProcessed(state.iterations() * body.size());
+  state.counters["frames/s"] = benchmark::Counter(state.iterations() * BATCH_FRAMES, benchmark::Counter::kIsRate);
+}
+
+static void BM_BatchAvx2(benchmark::State& state) { run_batch_parser(state, BatchParser::ISA_AVX2); }
+static void BM_BatchSse42(benchmark::State& state) { run_batch_parser(state, BatchParser::ISA_SSE42); }
+static void BM_BatchScalar(benchmark::State& state) { run_batch_parser(state, BatchParser::ISA_SCALAR); }
+
+// The single-frame reference parser, one call per element
+static void BM_ReferenceParser(benchmark::State& state) {
+  const std::string& body = firmware_batch();
+  std::vector<std::pair<size_t, size_t>> frames;
+  for (size_t start = 1; start < body.size();) {
+    size_t end = body.find('}', body.find("\"TS\"", start)) + 1;
+    frames.emplace_back(start, end - start);
+    start = end + 1;
+  }
+  Reading r;
+  for (auto _ : state) {
+    for (const auto& f : frames) {
+      benchmark::DoNotOptimize(ReadingParser::parse(body.data() + f.first, f.second, r));
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * body.size());
+  state.counters["frames/s"] = benchmark::Counter(state.iterations() * BATCH_FRAMES, benchmark::Counter::kIsRate);
+}
+
+// General-purpose DOM parse plus field extraction into the same Reading
+static void BM_Jsoncpp(benchmark::State& state) {
+  const std::string& body = firmware_batch();
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  std::vector<Reading> readings(BATCH_FRAMES);
+  for (auto _ : state) {
+    Json::Value root;
+    std::string errors;
+    if (!reader->parse(body.data(), body.data() + body.size(), &root, &errors)) {
+      state.SkipWithError("jsoncpp parse failed");
+      return;
+    }
+    for (Json::ArrayIndex b = 0; b < root.size(); b++) {
+      const Json::Value& frame = root[b];
+      Reading& r = readings[b];
+      r = Reading();
+      for (int ch = 0; ch < NUM_SENSOR_CHANNELS; ch++) {
+        const Json::Value* v = frame.find(CHANNEL_KEYS[ch], CHANNEL_KEYS[ch] + strlen(CHANNEL_KEYS[ch]));
+        if (v) {
+          r.value[ch] = v->asDouble();
+          r.centi[ch] = centi_from_double(r.value[ch]);
+          r.present |= 1 << ch;
+        }
+      }
+      r.seq = frame["S"].asUInt();
+      r.acquiredMs = frame["TA"].asUInt();
+      r.sentMs = frame["TS"].asUInt();
+    }
+    benchmark::DoNotOptimize(readings.data());
+  }
+  state.SetBytesProcessed(state.iterations() * body.size());
+  state.counters["frames/s"] = benchmark::Counter(state.iterations() * BATCH_FRAMES, benchmark::Counter::kIsRate);
+}
+
+BENCHMARK(BM_BatchAvx2);
+BENCHMARK(BM_BatchSse42);
+BENCHMARK(BM_BatchScalar);
+BENCHMARK(BM_ReferenceParser);
+BENCHMARK(BM_Jsoncpp);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,198 @@
+/*
+  Differential check of BatchParser against the firmware's encoder and the
+  reference ReadingParser.
+
+  Frames come from build_uplink_frame() in the host build of the firmware,
+  with random channel values, partial frames and quality flags. Each frame
+  must parse back to the firmware's own hundredths on every ISA. Frames
+  are then batched into arrays with random whitespace, and finally
+  mutated byte by byte. On mutated input all ISAs must agree exactly. A
+  single object must also agree with ReadingParser on accept/reject,
+  flags and trace fields, with values within one hundredth: the fast path
+  rounds decimal digits, the reference rounds the binary double.
+
+  Build:
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        gateway/batch_parser_fuzz.cpp -o batch_parser_fuzz
+
+  Run:
+    ./batch_parser_fuzz 200000
+*/
+#include <stdlib.h>
+
+#include <random>
+#include <string>
+
+#include "firmware_sim.h"
+#include "batch_parser.h"
+
+static std::mt19937 rng(12345);
+static unsigned long failures = 0;
+
+static int rand_int(int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(rng); }
+
+static void fail(const char* what, const std::string& input) {
+  if (failures++ < 10) {
+    printf("MISMATCH (%s): %s\n", what, input.c_str());
+  }
+}
+
+struct Expected {
+  uint8_t present = 0;
+  int32_t centi[NUM_SENSOR_CHANNELS] = {};
+  uint8_t quality[NUM_SENSOR_CHANNELS] = {};
+  uint32_t seq = 0;
+};
+
+// One firmware frame from random channel state
+static std::string firmware_frame(Expected& exp) {
+  static const float ranges[NUM_SENSOR_CHANNELS][2] = { { 0, 3000 }, { 0, 14 }, { 0, 5000 } };
+  exp = Expected();
+  do {
+    for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+      SensorChannel& ch = channels[i];
+      ch.pending = rand_int(0, 2) != 0;
+      float lo = ranges[i][0], hi = ranges[i][1];
+      switch (rand_int(0, 9)) {
+        case 0: ch.value = 0; break;
+        case 1: ch.value = -std::uniform_real_distribution<float>(0, hi)(rng); break;
+        case 2: ch.value = (float)rand_int(0, 1000000); break;
+        default: ch.value = std::uniform_real_distribution<float>(lo, hi)(rng);
+      }
+      ch.quality = rand_int(0, 4) == 0 ? (uint8_t)rand_int(1, 15) : 0;
+      if (ch.pending) {
+        exp.present |= 1 << i;
+        exp.centi[i] = (int32_t)round(ch.value * 100);
+        exp.quality[i] = ch.quality;
+      }
+    }
+  } while (!exp.present);
+  exp.seq = (uint32_t)frameSeq;
+  size_t len = build_uplink_frame();
+  return std::string(jsonBuf, len);
+}
+
+static bool same(const Reading& a, const Reading& b, int tolerance) {
+  if (a.device != b.device || a.present != b.present || a.hasTrace != b.hasTrace || a.seq != b.seq
+      || a.acquiredMs != b.acquiredMs || a.sentMs != b.sentMs) {
+    return false;
+  }
+  for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+    if ((a.present & (1 << i)) && (a.quality[i] != b.quality[i] || abs(a.centi[i] - b.centi[i]) > tolerance)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool matches(const Reading& r, const Expected& exp) {
+  if (r.device != device_from_id(deviceIdHex, 12) || r.present != exp.present || !r.hasTrace || r.seq != exp.seq) {
+    return false;
+  }
+  for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+    if ((exp.present & (1 << i)) && (r.centi[i] != exp.centi[i] || r.quality[i] != exp.quality[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string whitespace() {
+  static const char ws[] = " \t\r\n";
+  std::string s;
+  for (int n = rand_int(0, 2) == 0 ? rand_int(1, 3) : 0; n > 0; n--) {
+    s += ws[rand_int(0, 3)];
+  }
+  return s;
+}
+
+static std::string mutate(std::string s) {
+  static const char alphabet[] = "{}[]:,\"\\ 0123456789.-eE+TPHCQSA\nxtrufalsn";
+  for (int n = rand_int(1, 4); n > 0 && !s.empty(); n--) {
+    size_t at = rand_int(0, (int)s.size() - 1);
+    char c = alphabet[rand_int(0, sizeof(alphabet) - 2)];
+    switch (rand_int(0, 3)) {
+      case 0: s[at] = c; break;
+      case 1: s.insert(at, 1, c); break;
+      case 2: s.erase(at, 1); break;
+      default: s.resize(at);
+    }
+  }
+  return s;
+}
+
+int main(int argc, char** argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 100000;
+  BatchParser::Isa best = BatchParser::best_isa();
+  BatchParser parsers[3] = { BatchParser(BatchParser::ISA_SCALAR), BatchParser(BatchParser::ISA_SSE42),
+                             BatchParser(BatchParser::ISA_AVX2) };
+  int numIsas = best + 1;
+  printf("ISAs checked: scalar%s%s\n", numIsas > 1 ? " sse4.2" : "", numIsas > 2 ? " avx2" : "");
+  init_device_id();
+
+  unsigned long mutatedAccepted = 0;
+  for (long it = 0; it < iterations; it++) {
+    // 1. Firmware frames round-trip exactly
+    int batchSize = rand_int(1, 8);
+    std::vector<Expected> expected(batchSize);
+    std::string batch = whitespace() + "[";
+    std::string single;
+    for (int b = 0; b < batchSize; b++) {
+      single = firmware_frame(expected[b]);
+      batch += (b ? "," : "") + whitespace() + single + whitespace();
+    }
+    batch += "]" + whitespace();
+
+    Reading ref;
+    if (ReadingParser::parse(single.data(), single.size(), ref) != PARSE_OK || !matches(ref, expected.back())) {
+      fail("reference vs firmware", single);
+    }
+    for (int isa = 0; isa < numIsas; isa++) {
+      BatchParser& p = parsers[isa];
+      if (p.parse(single.data(), single.size()) != PARSE_OK || !matches(p.readings()[0], expected.back())) {
+        fail("frame vs firmware", single);
+      }
+      if (p.parse(batch.data(), batch.size()) != PARSE_OK || (int)p.readings().size() != batchSize) {
+        fail("batch", batch);
+        continue;
+      }
+      for (int b = 0; b < batchSize; b++) {
+        if (!matches(p.readings()[b], expected[b])) {
+          fail("batch element vs firmware", batch);
+        }
+      }
+    }
+
+    // 2. Mutated input: ISAs agree, single objects agree with the reference
+    bool object = rand_int(0, 1) == 0;
+    std::string input = mutate(object ? single : batch);
+    ParseResult results[3];
+    for (int isa = 0; isa < numIsas; isa++) {
+      results[isa] = parsers[isa].parse(input.data(), input.size());
+    }
+    for (int isa = 1; isa < numIsas; isa++) {
+      bool agree = results[isa] == results[0]
+                   && parsers[isa].readings().size() == parsers[0].readings().size();
+      for (size_t r = 0; agree && results[0] != PARSE_ERROR && r < parsers[0].readings().size(); r++) {
+        agree = same(parsers[isa].readings()[r], parsers[0].readings()[r], 0);
+      }
+      if (!agree) {
+        fail("ISA disagreement", input);
+      }
+    }
+    if (object && input.find('[') == std::string::npos) {
+      ParseResult refResult = ReadingParser::parse(input.data(), input.size(), ref);
+      bool agree = refResult == results[0];
+      if (agree && refResult != PARSE_ERROR) {
+        agree = same(ref, parsers[0].readings()[0], 1);
+      }
+      if (!agree) {
+        fail("reference disagreement", input);
+      }
+    }
+    mutatedAccepted += results[0] != PARSE_ERROR;
+  }
+
+  printf("%ld iterations, %lu mutated inputs still valid, %lu mismatches\n", iterations, mutatedAccepted, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+/*
+  Backlog ingest against the latest-value table, over a loopback socket.
+
+  Each case posts one batch of frames, as the firmware uploads them after
+  an outage, and checks what the table holds for each device, which
+  readings went to onReading (one per device, its newest) and how many to
+  onBackfill. Frames are partial, as swing-door trending and per-channel
+  report periods make them: a channel whose newest value sits in an older
+  frame of the batch must still reach the table. A live swing-door batch,
+  whose points can be most of a minute old, must not count as a backlog.
+
+  Build:
+    g++ -std=gnu++17 -O2 gateway/ingest_backfill_test.cpp -o ingest_backfill_test
+
+  Run:
+    ./ingest_backfill_test
+
+  Exits 1 if any case fails.
+*/
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "ingest_server.h"
+
+static const uint64_t DEV_A = 0xa1;
+static const uint64_t DEV_B = 0xb2;
+
+static int failures = 0;
+
+static void check(bool ok, const char* test, const char* what) {
+  if (!ok) {
+    printf("FAIL %s: %s\n", test, what);
+    failures++;
+  }
+}
+
+static int connect_to(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// POST body and run the server until the response arrives; its status
+static int post(IngestServer& server, int fd, const std::string& body) {
+  std::string req = "POST /water-monitor/publish HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n"
+                    "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n"
+                    + body;
+  if (send(fd, req.data(), req.size(), 0) != (ssize_t)req.size()) {
+    return 0;
+  }
+  char buf[512];
+  for (int i = 0; i < 100; i++) {
+    server.run_once(10);
+    pollfd p = { fd, POLLIN, 0 };
+    if (poll(&p, 1, 0) == 1) {
+      ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+      if (n <= 0) {
+        return 0;
+      }
+      buf[n] = '\0';
+      return atoi(buf + 9);
+    }
+  }
+  return 0;
+}
+
+// A frame of device dev: channels as "K":v pairs, acquired at ta, sent at
+// ts (device millis())
+static std::string frame(uint64_t dev, const char* channels, int seq, uint32_t ta, uint32_t ts) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), "{\"D\":\"%012llx\",%s,\"S\":%d,\"TA\":%u,\"TS\":%u}", (unsigned long long)dev, channels,
+           seq, ta, ts);
+  return buf;
+}
+
+static std::string batch(const std::vector<std::string>& frames) {
+  std::string body = "[";
+  for (const std::string& f : frames) {
+    body += (body.size() > 1 ? "," : "") + f;
+  }
+  return body + "]";
+}
+
+struct Case {
+  IngestServer server;
+  int fd = -1;
+  std::vector<Reading> live;
+  size_t backfilled = 0;
+
+  Case() {
+    server.onReading = [this](const Reading& r) { live.push_back(r); };
+    server.onBackfill = [this](const Reading*, size_t n) { backfilled += n; };
+    if (server.start(0)) {
+      fd = connect_to(server.port());
+    }
+  }
+  ~Case() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  LatestValue latest(uint64_t device) {
+    LatestValue v = {};
+    server.latest().read(device, v);
+    return v;
+  }
+};
+
+// Each channel's newest value sits in a different frame: pH kept at t-2,
+// T at t-1, C at t. Two devices interleaved, listed newest first for B.
+static void partial_frames() {
+  const char* test = "partial frames";
+  Case c;
+  uint32_t ts = 120000;
+  int status = post(c.server, c.fd,
+                    batch({ frame(DEV_A, "\"PH\":6.5", 1, 1000, ts), frame(DEV_B, "\"C\":700.25", 7, 3000, ts),
+                            frame(DEV_A, "\"T\":12.25", 2, 2000, ts), frame(DEV_B, "\"PH\":7.75", 6, 2000, ts),
+                            frame(DEV_A, "\"C\":512.5", 3, 3000, ts) }));
+  check(status == 200, test, "status 200");
+
+  LatestValue a = c.latest(DEV_A);
+  check(a.present == 7, test, "A has all three channels");
+  check(a.centi[CH_PH] == 650 && a.centi[CH_T] == 1225 && a.centi[CH_C] == 51250, test, "A values");
+  check(a.seq == 3 && a.acquiredMs == 3000, test, "A trace from its newest frame");
+  check(a.updates == 1, test, "A merged in one update");
+
+  LatestValue b = c.latest(DEV_B);
+  check(b.present == ((1 << CH_PH) | (1 << CH_C)), test, "B has PH and C");
+  check(b.centi[CH_PH] == 775 && b.centi[CH_C] == 70025, test, "B values");
+  check(b.seq == 7, test, "B trace from its newest frame");
+
+  check(c.live.size() == 2, test, "one live reading per device");
+  for (const Reading& r : c.live) {
+    check(r.seq == (r.device == DEV_A ? 3u : 7u), test, "live reading is the device's newest frame");
+    check(r.present == (1 << CH_C), test, "live reading carries only its own channels");
+  }
+  check(c.backfilled == 3, test, "older frames go to onBackfill");
+}
+
+// A channel reported twice: the newer value wins whatever the order in
+// the batch, and channels the backlog lacks keep their earlier value
+static void newest_wins() {
+  const char* test = "newest wins";
+  Case c;
+  check(post(c.server, c.fd, frame(DEV_A, "\"T\":10.5,\"PH\":7", 1, 500, 500)) == 200, test, "live frame");
+  int status = post(c.server, c.fd,
+                    batch({ frame(DEV_A, "\"PH\":8.25", 4, 40000, 200000), frame(DEV_A, "\"PH\":6", 2, 20000, 200000),
+                            frame(DEV_A, "\"C\":300", 3, 30000, 200000) }));
+  check(status == 200, test, "status 200");
+  LatestValue a = c.latest(DEV_A);
+  check(a.present == 7, test, "all channels present");
+  check(a.centi[CH_PH] == 825, test, "newest PH");
+  check(a.centi[CH_T] == 1050, test, "T kept from before the backlog");
+  check(a.centi[CH_C] == 30000, test, "C from an older frame");
+  check(a.seq == 4, test, "trace from the newest frame");
+}
+
+// Kept points as a live swing-door uplink sends them: per channel in time
+// order, the oldest at the max interval (60 s) plus the uplink interval
+static void swing_door_live() {
+  const char* test = "swing-door batch is live";
+  Case c;
+  uint32_t ts = 500000;
+  int status = post(c.server, c.fd,
+                    batch({ frame(DEV_A, "\"PH\":7.5", 10, ts - 61000, ts), frame(DEV_A, "\"T\":20", 11, ts - 11000, ts),
+                            frame(DEV_A, "\"PH\":7.25", 12, ts - 1000, ts) }));
+  check(status == 200, test, "status 200");
+  check(c.backfilled == 0 && c.server.stats().backfillBatches == 0, test, "nothing backfilled");
+  check(c.live.size() == 3, test, "every point live");
+  LatestValue a = c.latest(DEV_A);
+  check(a.centi[CH_PH] == 725 && a.centi[CH_T] == 2000, test, "newest values");
+  check(a.seq == 12, test, "trace from the last frame");
+}
+
+int main() {
+  partial_frames();
+  newest_wins();
+  swing_door_live();
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All backlog checks passed\n");
+  return 0;
+}
@@ -0,0 +1,148 @@
+/*
+  Native ingest gateway for the water monitor fleet.
+
+  Terminates the firmware's keep-alive POST /water-monitor/publish
+  connections (see ingest_server.h) in place of the FastAPI endpoint, which
+  parses every frame with json.loads and schedules an asyncio task per
+  reading.
+
+  Build:
+    g++ -std=gnu++17 -O2 gateway/ingest_gateway.cpp -lpthread -o ingest_gateway
+
+  Run (readings are kept in the time-series store under data-dir):
+    ./ingest_gateway 8000 /var/lib/water-monitor
+    ./ingest_gateway --shards 8 --uring 8000 /var/lib/water-monitor
+
+  --shards N runs N shard threads, one per core, sharing the port through
+  SO_REUSEPORT (shard_gateway.h); keep N fixed for a data directory.
+  --uring serves the devices through the io_uring backend (uring_server.h)
+  instead of epoll, falling back to epoll where io_uring is unavailable.
+
+  Dashboards subscribe on the same port (ws://host:8000/water-monitor);
+  each accepted frame is pushed to them through the fan-out hub
+  (ws_hub.h), which runs on the main thread.
+
+  Backlogs that boards upload after an outage (see ingest_server.h) are
+  appended to the store as per-series runs; only their newest reading is
+  pushed to dashboards.
+
+  Prints request counters, the number of devices seen, the backfill rate
+  and the requests per shard every 5 seconds.
+*/
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+#include "shard_gateway.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void on_signal(int) { stopRequested = 1; }
+
+static double monotonic_s() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <class Server>
+static int serve(int shards, uint16_t port, const std::string& dataDir, const char* backend) {
+  WsHub hub;
+  if (!hub.start(-1)) {
+    perror("ingest_gateway: hub");
+    return 1;
+  }
+  ShardedGateway<Server> gateway;
+  if (!gateway.start(shards, port, dataDir, true)) {
+    perror("ingest_gateway: start");
+    return 1;
+  }
+  printf("Listening on port %u (%s, %d shard%s)\n", gateway.port(), backend, shards, shards == 1 ? "" : "s");
+
+  double lastReport = monotonic_s();
+  ShardStats last = gateway.stats();
+  while (!stopRequested) {
+    pollfd fds[2] = { { hub.epoll_fd(), POLLIN, 0 }, { gateway.hub_fd(), POLLIN, 0 } };
+    if (poll(fds, 2, 200) > 0) {
+      if (fds[1].revents) {
+        gateway.drain_to_hub(hub);
+      }
+      hub.run_once(0);
+    }
+
+    double now = monotonic_s();
+    if (now - lastReport >= 5.0) {
+      ShardStats st = gateway.stats();
+      const IngestStats& s = st.ingest;
+      const HubStats& h = hub.stats();
+      double dt = now - lastReport;
+      printf("conns %llu  req/s %.0f  200 %llu  202 %llu  rejected %llu  devices %zu  subs %llu  coalesced %llu\n",
+             (unsigned long long)s.connections, (s.requests - last.ingest.requests) / dt, (unsigned long long)s.ok,
+             (unsigned long long)s.accepted, (unsigned long long)s.rejected, gateway.latest().size(),
+             (unsigned long long)h.subscribers, (unsigned long long)h.coalesced);
+      if (s.backfillReadings != last.ingest.backfillReadings) {
+        printf("backfill  batches %llu  readings %llu  readings/s %.0f\n", (unsigned long long)s.backfillBatches,
+               (unsigned long long)s.backfillReadings,
+               (s.backfillReadings - last.ingest.backfillReadings) / dt);
+      }
+      if (shards > 1) {
+        printf("shards   ");
+        for (size_t k = 0; k < st.requests.size(); k++) {
+          printf(" %.0f", (st.requests[k] - last.requests[k]) / dt);
+        }
+        printf(" req/s  points/s %.0f (%.0f handed off)  hub drops %llu\n", (st.points - last.points) / dt,
+               (st.handedOff - last.handedOff) / dt, (unsigned long long)st.hubDropped);
+      }
+      fflush(stdout);
+      lastReport = now;
+      last = st;
+    }
+  }
+  if (!gateway.stop()) {
+    perror("ingest_gateway: flush");
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  int shards = 1;
+  bool useUring = false;
+  int arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if (strcmp(argv[arg], "--uring") == 0) {
+      useUring = true;
+    } else if (strcmp(argv[arg], "--shards") == 0 && arg + 1 < argc) {
+      shards = atoi(argv[++arg]);
+    } else {
+      break;
+    }
+  }
+  if (shards < 1 || (arg < argc && strncmp(argv[arg], "--", 2) == 0)) {
+    fprintf(stderr, "usage: ingest_gateway [--shards N] [--uring] [port] [data-dir]\n");
+    return 2;
+  }
+  uint16_t port = argc > arg ? (uint16_t)atoi(argv[arg]) : 8000;
+  std::string dataDir = argc > arg + 1 ? argv[arg + 1] : "";
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  if (useUring) {
+    // Probe once: a kernel without io_uring (or with it disabled) gets epoll
+    bool available;
+    {
+      UringIngestServer probe;
+      available = probe.start(0);
+    }
+    if (available) {
+      return serve<UringIngestServer>(shards, port, dataDir, "io_uring");
+    }
+    perror("ingest_gateway: io_uring unavailable, using epoll");
+  }
+  return serve<IngestServer>(shards, port, dataDir, "epoll");
+}
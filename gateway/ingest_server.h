@@ -0,0 +1,556 @@
+/*
+  Keep-alive HTTP/1.1 ingest server for the firmware uplink.
+
+  Accepts exactly what write_uplink_request() sends:
+    POST /water-monitor/publish HTTP/1.1
+    Host: ...
+    Connection: keep-alive
+    Content-Type: application/json
+    Content-Length: N
+
+    {"T":..,"PH":..,"C":..}
+  or a JSON array of such frames (a batch), and answers like http_publisher_endpoint() in water_monitor.py:
+  200 when a frame carried at least one channel (merged into its device's
+  entry of the latest-value table), 202 when none did, 400 when the body
+  did not parse.
+
+  IngestProtocol holds everything but the socket I/O: request parsing,
+  ingest, callbacks and counters. IngestServer drives it from one thread
+  and one level-triggered epoll set; uring_server.h is the io_uring
+  backend with the same interface. Each connection owns a fixed receive
+  buffer; requests are parsed in place (pipelined requests are handled in
+  order) and responses are small constant strings, so the steady state
+  does no allocation per request.
+
+  A batch holding a reading older than INGEST_BACKFILL_AGE_MS (TS - TA,
+  both device millis()) is a backlog uploaded after an outage. Live
+  swing-door batches are older than single frames: a kept point is up to
+  a report period (10 s for pH in water_monitor.c) plus an uplink
+  interval old when sent, and never more than the swing-door max interval
+  (sdtMaxInterval, 60 s), so the default sits above that bound; firmware
+  with longer max intervals needs a larger value. Frames are
+  partial (a batch may hold pH at one time and turbidity at the next), so
+  each device's readings are folded oldest first into one merged update
+  of the latest-value table. Only the newest reading of each device is
+  passed to onReading; the rest go to onBackfill in one call, sorted
+  oldest first per device, so storage can append them as runs and
+  dashboards see one update per batch instead of a replay.
+*/
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "batch_parser.h"
+#include "latest_table.h"
+
+#ifndef INGEST_RX_SIZE
+#define INGEST_RX_SIZE 4096   // Largest request (headers + body) accepted
+#endif
+#ifndef INGEST_TX_SIZE
+#define INGEST_TX_SIZE 4096   // Queued responses per connection
+#endif
+#ifndef INGEST_BACKFILL_AGE_MS
+#define INGEST_BACKFILL_AGE_MS 90000   // Older readings make a batch a backlog
+#endif
+
+const char INGEST_PATH[] = "/water-monitor/publish";
+
+struct IngestStats {
+  uint64_t connections = 0;
+  uint64_t requests = 0;
+  uint64_t ok = 0;          // 200
+  uint64_t accepted = 0;    // 202
+  uint64_t rejected = 0;    // 400 / 404 / 413
+  uint64_t backfillBatches = 0;
+  uint64_t backfillReadings = 0;   // Passed to onBackfill, not live
+};
+
+// Time from acquisition to send on the device clock; 0 without a trace
+inline uint32_t reading_age_ms(const Reading& r) {
+  return r.hasTrace ? r.sentMs - r.acquiredMs : 0;
+}
+
+class IngestProtocol {
+ public:
+  IngestProtocol() : ownLatest_(new LatestTable()), latest_(ownLatest_.get()) {}
+
+  // Merge into a table shared with other servers
+  explicit IngestProtocol(LatestTable& latest) : latest_(&latest) {}
+
+  // Called for every frame that answered 200, after the merge. For a
+  // backlog, once per device with its newest reading, after all of the
+  // device's readings in the batch were merged.
+  std::function<void(const Reading&)> onReading;
+
+  // Called once per backlog batch, before onReading for its newest
+  // readings, with the readings that are only to be stored: grouped by
+  // device, oldest first within a device
+  std::function<void(const Reading* readings, size_t n)> onBackfill;
+
+  // Offered every request that is not a POST, once earlier responses are
+  // sent. Returning true takes the connection over: the fd and the bytes
+  // read from this request on belong to the callee (e.g. WsHub::adopt()),
+  // and the server forgets the fd without closing it.
+  std::function<bool(int fd, const char* data, size_t len)> onUpgrade;
+
+  const LatestTable& latest() const { return *latest_; }
+  const IngestStats& stats() const { return stats_; }
+
+ protected:
+  // Serve every complete request at the front of data and return the
+  // bytes consumed. respond(code, close) queues a response and returns
+  // false once the connection is closing; idle means no response is
+  // still unsent, so the connection may be upgraded (upgraded is then set).
+  template <class Respond>
+  size_t serve(int fd, const char* data, size_t len, bool idle, bool& upgraded, Respond respond) {
+    size_t pos = 0;
+    for (;;) {
+      const char* begin = data + pos;
+      size_t avail = len - pos;
+      const char* headerEnd = (const char*)memmem(begin, avail, "\r\n\r\n", 4);
+      if (!headerEnd) {
+        break;
+      }
+      size_t headerLen = headerEnd + 4 - begin;
+
+      bool post = false;
+      bool pathOk = false;
+      bool keepAlive = true;
+      bool badHeader = false;
+      size_t contentLength = 0;
+      parse_head(begin, headerLen, post, pathOk, keepAlive, badHeader, contentLength);
+      if (badHeader || contentLength > INGEST_RX_SIZE - headerLen) {
+        respond(badHeader ? 400 : 413, true);
+        break;
+      }
+      if (avail < headerLen + contentLength) {
+        break;   // Body still arriving
+      }
+
+      if (!post && onUpgrade && idle && pos == 0 && onUpgrade(fd, begin, avail)) {
+        upgraded = true;
+        return len;
+      }
+
+      int code;
+      if (!post || !pathOk) {
+        code = 404;
+      } else {
+        code = ingest(begin + headerLen, contentLength);
+      }
+      pos += headerLen + contentLength;
+      if (!respond(code, !keepAlive)) {
+        break;
+      }
+    }
+    return pos;
+  }
+
+  static const size_t RESPONSE_MAX = 128;
+
+  // Write the response for code into out (RESPONSE_MAX bytes) and count it
+  size_t format_response(char* out, int code, bool close) {
+    static const char* const OK = "HTTP/1.1 200 OK\r\ncontent-length: 0\r\n";
+    static const char* const ACCEPTED = "HTTP/1.1 202 Accepted\r\ncontent-length: 0\r\n";
+    static const char* const BAD = "HTTP/1.1 400 Bad Request\r\ncontent-length: 0\r\n";
+    static const char* const NOT_FOUND = "HTTP/1.1 404 Not Found\r\ncontent-length: 0\r\n";
+    static const char* const TOO_LARGE = "HTTP/1.1 413 Payload Too Large\r\ncontent-length: 0\r\n";
+    const char* head = code == 200 ? OK : code == 202 ? ACCEPTED : code == 400 ? BAD
+                       : code == 404 ? NOT_FOUND : TOO_LARGE;
+    stats_.requests++;
+    if (code == 200) {
+      stats_.ok++;
+    } else if (code == 202) {
+      stats_.accepted++;
+    } else {
+      stats_.rejected++;
+    }
+    const char* tail = close ? "connection: close\r\n\r\n" : "\r\n";
+    size_t headLen = strlen(head);
+    size_t tailLen = strlen(tail);
+    memcpy(out, head, headLen);
+    memcpy(out + headLen, tail, tailLen);
+    return headLen + tailLen;
+  }
+
+  IngestStats stats_;
+
+ private:
+  static void parse_head(const char* p, size_t len, bool& post, bool& pathOk, bool& keepAlive,
+                         bool& badHeader, size_t& contentLength) {
+    const char* end = p + len;
+    const char* eol = (const char*)memmem(p, len, "\r\n", 2);
+    // Request line: METHOD SP PATH SP VERSION
+    const char* sp1 = (const char*)memchr(p, ' ', eol - p);
+    const char* sp2 = sp1 ? (const char*)memchr(sp1 + 1, ' ', eol - sp1 - 1) : nullptr;
+    if (!sp2) {
+      badHeader = true;
+      return;
+    }
+    post = sp1 - p == 4 && memcmp(p, "POST", 4) == 0;
+    pathOk = (size_t)(sp2 - sp1 - 1) == sizeof(INGEST_PATH) - 1
+             && memcmp(sp1 + 1, INGEST_PATH, sizeof(INGEST_PATH) - 1) == 0;
+    keepAlive = eol - sp2 - 1 == 8 && memcmp(sp2 + 1, "HTTP/1.1", 8) == 0;
+
+    for (const char* line = eol + 2; line < end - 2; line = eol + 2) {
+      eol = (const char*)memmem(line, end - line, "\r\n", 2);
+      const char* colon = (const char*)memchr(line, ':', eol - line);
+      if (!colon) {
+        badHeader = true;
+        return;
+      }
+      const char* value = colon + 1;
+      while (value < eol && *value == ' ') {
+        value++;
+      }
+      size_t nameLen = colon - line;
+      if (nameLen == 14 && strncasecmp(line, "content-length", 14) == 0) {
+        contentLength = 0;
+        if (value == eol) {
+          badHeader = true;
+        }
+        for (const char* d = value; d < eol; d++) {
+          if (*d < '0' || *d > '9' || contentLength > INGEST_RX_SIZE) {
+            badHeader = true;
+            break;
+          }
+          contentLength = contentLength * 10 + (*d - '0');
+        }
+      } else if (nameLen == 10 && strncasecmp(line, "connection", 10) == 0) {
+        if (eol - value == 5 && strncasecmp(value, "close", 5) == 0) {
+          keepAlive = false;
+        } else if (eol - value == 10 && strncasecmp(value, "keep-alive", 10) == 0) {
+          keepAlive = true;
+        }
+      } else if (nameLen == 17 && strncasecmp(line, "transfer-encoding", 17) == 0) {
+        badHeader = true;   // The firmware never chunks
+      }
+    }
+  }
+
+  int ingest(const char* body, size_t len) {
+    if (len == 0) {
+      return 202;
+    }
+    switch (parser_.parse(body, len)) {
+      case PARSE_OK:
+        for (const Reading& r : parser_.readings()) {
+          if (r.present && reading_age_ms(r) > INGEST_BACKFILL_AGE_MS) {
+            ingest_backlog();
+            return 200;
+          }
+        }
+        for (const Reading& r : parser_.readings()) {
+          if (!r.present) {
+            continue;
+          }
+          latest_->update(r);
+          if (onReading) {
+            onReading(r);
+          }
+        }
+        return 200;
+      case PARSE_EMPTY:
+        return 202;
+      default:
+        return 400;
+    }
+  }
+
+  void ingest_backlog() {
+    backlog_.clear();
+    for (const Reading& r : parser_.readings()) {
+      if (r.present) {
+        backlog_.push_back(r);
+      }
+    }
+    // Oldest first within each device; ages share the batch's send time,
+    // so this also orders readings across a millis() wrap
+    std::stable_sort(backlog_.begin(), backlog_.end(), [](const Reading& a, const Reading& b) {
+      return a.device != b.device ? a.device < b.device : reading_age_ms(a) > reading_age_ms(b);
+    });
+    // Every reading of a device is folded into its merged update. The
+    // last one goes live, the rest are compacted to the front for storage.
+    live_.clear();
+    merged_.clear();
+    size_t stored = 0;
+    for (size_t i = 0; i < backlog_.size(); i++) {
+      if (i == 0 || backlog_[i - 1].device != backlog_[i].device) {
+        merged_.push_back(backlog_[i]);
+      } else {
+        fold(merged_.back(), backlog_[i]);
+      }
+      if (i + 1 == backlog_.size() || backlog_[i + 1].device != backlog_[i].device) {
+        live_.push_back(backlog_[i]);
+      } else {
+        backlog_[stored++] = backlog_[i];
+      }
+    }
+    stats_.backfillBatches++;
+    stats_.backfillReadings += stored;
+    if (stored > 0 && onBackfill) {
+      onBackfill(backlog_.data(), stored);
+    }
+    for (size_t i = 0; i < live_.size(); i++) {
+      latest_->update(merged_[i]);
+      if (onReading) {
+        onReading(live_[i]);
+      }
+    }
+  }
+
+  // Overlay a newer reading of the same device: its channels replace the
+  // older values, its trace fields replace the older ones
+  static void fold(Reading& into, const Reading& r) {
+    for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+      if (r.present & (1 << i)) {
+        into.value[i] = r.value[i];
+        into.centi[i] = r.centi[i];
+        into.quality[i] = r.quality[i];
+      }
+    }
+    into.present |= r.present;
+    into.hasTrace = r.hasTrace;
+    into.seq = r.seq;
+    into.acquiredMs = r.acquiredMs;
+    into.sentMs = r.sentMs;
+  }
+
+  BatchParser parser_;
+  std::vector<Reading> backlog_;
+  std::vector<Reading> live_;
+  std::vector<Reading> merged_;      // live_[i]'s device, all channels folded
+  std::unique_ptr<LatestTable> ownLatest_;
+  LatestTable* latest_;
+};
+
+class IngestServer : public IngestProtocol {
+ public:
+  IngestServer() {}
+
+  // Merge into a table shared with other servers
+  explicit IngestServer(LatestTable& latest) : IngestProtocol(latest) {}
+
+  ~IngestServer() {
+    for (auto& c : conns_) {
+      if (c) {
+        close(c->fd);
+      }
+    }
+    if (listenFd_ >= 0) {
+      close(listenFd_);
+    }
+    if (epollFd_ >= 0) {
+      close(epollFd_);
+    }
+  }
+
+  // Bind and listen; port 0 picks a free port (see port()). False on error.
+  bool start(uint16_t port, int backlog = 1024, bool reusePort = false) {
+    listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) {
+      return false;
+    }
+    int one = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reusePort) {
+      setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    socklen_t len = sizeof(addr);
+    if (bind(listenFd_, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd_, backlog) != 0
+        || getsockname(listenFd_, (sockaddr*)&addr, &len) != 0) {
+      return false;
+    }
+    port_ = ntohs(addr.sin_port);
+
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+      return false;
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd_;
+    return epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &ev) == 0;
+  }
+
+  uint16_t port() const { return port_; }
+  int epoll_fd() const { return epollFd_; }
+
+  // Wait up to timeoutMs for socket events and handle them
+  void run_once(int timeoutMs) {
+    epoll_event events[64];
+    int n = epoll_wait(epollFd_, events, 64, timeoutMs);
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == listenFd_) {
+        accept_all();
+        continue;
+      }
+      Conn* c = fd < (int)conns_.size() ? conns_[fd].get() : nullptr;
+      if (!c) {
+        continue;
+      }
+      if (events[i].events & EPOLLOUT) {
+        flush(*c);   // May close the connection
+      }
+      if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && conns_[fd]) {
+        on_readable(*c);
+      }
+    }
+  }
+
+ private:
+  struct Conn {
+    int fd;
+    size_t rxLen = 0;
+    size_t txLen = 0;
+    bool closing = false;     // Close once tx drains
+    bool wantWrite = false;   // EPOLLOUT registered
+    char rx[INGEST_RX_SIZE];
+    char tx[INGEST_TX_SIZE];
+  };
+
+  void accept_all() {
+    for (;;) {
+      int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        return;
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      if (fd >= (int)conns_.size()) {
+        conns_.resize(fd + 1);
+      }
+      conns_[fd].reset(new Conn());
+      conns_[fd]->fd = fd;
+      epoll_event ev = {};
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+      stats_.connections++;
+    }
+  }
+
+  void drop(Conn& c) {
+    int fd = c.fd;
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    conns_[fd].reset();
+  }
+
+  void on_readable(Conn& c) {
+    for (;;) {
+      if (c.rxLen == sizeof(c.rx)) {
+        // A full buffer without a complete request: too large to accept
+        respond(c, 413, true);
+        c.rxLen = 0;
+        break;
+      }
+      ssize_t n = recv(c.fd, c.rx + c.rxLen, sizeof(c.rx) - c.rxLen, 0);
+      if (n > 0) {
+        c.rxLen += n;
+        int fd = c.fd;
+        bool more = handle_requests(c);
+        if (!conns_[fd]) {
+          return;   // Handed over by onUpgrade
+        }
+        if (!more) {
+          break;
+        }
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        break;
+      }
+      drop(c);   // Peer closed or reset
+      return;
+    }
+    flush(c);
+  }
+
+  // Serve every complete request in rx; false once the connection closes
+  // or is handed over
+  bool handle_requests(Conn& c) {
+    if (c.closing) {
+      return false;
+    }
+    bool upgraded = false;
+    size_t pos = serve(c.fd, c.rx, c.rxLen, c.txLen == 0, upgraded, [this, &c](int code, bool close) {
+      respond(c, code, close);
+      return !c.closing;
+    });
+    if (upgraded) {
+      int fd = c.fd;
+      epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+      conns_[fd].reset();
+      return false;
+    }
+
+    // Keep any partial request at the front of the buffer
+    if (pos > 0) {
+      memmove(c.rx, c.rx + pos, c.rxLen - pos);
+      c.rxLen -= pos;
+    }
+    return !c.closing;
+  }
+
+  void respond(Conn& c, int code, bool close) {
+    if (c.txLen + RESPONSE_MAX > sizeof(c.tx)) {
+      flush(c);
+      if (c.txLen + RESPONSE_MAX > sizeof(c.tx)) {
+        c.closing = true;   // Client is not reading its responses
+        return;
+      }
+    }
+    c.txLen += format_response(c.tx + c.txLen, code, close);
+    c.closing |= close;
+  }
+
+  void flush(Conn& c) {
+    size_t sent = 0;
+    while (sent < c.txLen) {
+      ssize_t n = send(c.fd, c.tx + sent, c.txLen - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      sent += n;
+    }
+    memmove(c.tx, c.tx + sent, c.txLen - sent);
+    c.txLen -= sent;
+
+    if (c.txLen == 0 && c.closing) {
+      drop(c);
+      return;
+    }
+    bool wantWrite = c.txLen > 0;
+    if (wantWrite != c.wantWrite) {
+      c.wantWrite = wantWrite;
+      epoll_event ev = {};
+      ev.events = EPOLLIN | (wantWrite ? (uint32_t)EPOLLOUT : 0u);
+      ev.data.fd = c.fd;
+      epoll_ctl(epollFd_, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+  }
+
+  int listenFd_ = -1;
+  int epollFd_ = -1;
+  uint16_t port_ = 0;
+  std::vector<std::unique_ptr<Conn>> conns_;
+};
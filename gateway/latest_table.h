@@ -0,0 +1,259 @@
+/*
+  Latest merged values per device, shared by ingest and readers.
+
+  Replaces the single merged state (latest_data on the Python server), in
+  which two boards overwrote each other. Devices are spread over
+  LATEST_SHARDS shards by a hash of their key; each shard is a fixed
+  open-addressing table of cache-line-sized entries, so updates to one
+  device never false-share with another's.
+
+  Every entry is a seqlock:
+  - A writer makes the sequence odd with a CAS, merges the reading into
+    the payload and makes it even again. Writers of the same device
+    serialize on that CAS; different devices never contend.
+  - A reader copies the payload and retries if the sequence was odd or
+    moved meanwhile. Readers never write shared memory.
+  The payload is stored as relaxed atomic words with the fences of the
+  C++ seqlock idiom, so the racing copy is well defined.
+
+  Only inserting a new device takes its shard's lock. Entries are never
+  removed; a full shard rejects new devices (counted in rejected()).
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "reading_parser.h"
+
+#ifndef LATEST_SHARDS
+#define LATEST_SHARDS 16
+#endif
+
+const uint64_t LATEST_EMPTY = ~0ULL;   // Device keys use 56 bits
+
+// Spreads device keys, which are often consecutive MACs (murmur3 finalizer)
+inline uint64_t device_hash(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  return x ^ (x >> 33);
+}
+
+// A device's channels merged across partial frames, plus the trace
+// fields of its last frame
+struct LatestValue {
+  uint8_t present;
+  uint8_t hasTrace;
+  uint8_t quality[NUM_SENSOR_CHANNELS];
+  int32_t centi[NUM_SENSOR_CHANNELS];
+  uint32_t seq;
+  uint32_t acquiredMs;
+  uint32_t sentMs;
+  uint32_t updates;
+
+  void merge(const Reading& r) {
+    for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+      if (r.present & (1 << i)) {
+        centi[i] = r.centi[i];
+        quality[i] = r.quality[i];
+      }
+    }
+    present |= r.present;
+    hasTrace = r.hasTrace;
+    seq = r.seq;
+    acquiredMs = r.acquiredMs;
+    sentMs = r.sentMs;
+    updates++;
+  }
+};
+
+const int LATEST_WORDS = (sizeof(LatestValue) + 7) / 8;
+
+struct alignas(64) LatestEntry {
+  std::atomic<uint64_t> seq{ 0 };
+  std::atomic<uint64_t> device{ LATEST_EMPTY };
+  std::atomic<uint64_t> words[LATEST_WORDS] = {};
+};
+
+static_assert(sizeof(LatestEntry) == 64, "one entry per cache line");
+
+class LatestTable {
+ public:
+  // Room for at least `devices` devices at half load
+  explicit LatestTable(size_t devices = 4096) {
+    size_t perShard = 16;
+    while (perShard < 2 * devices / LATEST_SHARDS) {
+      perShard <<= 1;
+    }
+    for (Shard& s : shards_) {
+      s.mask = perShard - 1;
+      s.entries.reset(new LatestEntry[perShard]);
+    }
+  }
+
+  // Merge a frame into its device's entry; false if the device is new
+  // and its shard is full
+  bool update(const Reading& r) {
+    LatestEntry* e = insert(r.device);
+    if (!e) {
+      return false;
+    }
+    uint64_t s = e->seq.load(std::memory_order_relaxed);
+    for (int spins = 0;; spins++) {
+      if (s & 1) {
+        backoff(spins);
+        s = e->seq.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (e->seq.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    // Sole writer until the sequence is even again
+    uint64_t w[LATEST_WORDS];
+    for (int i = 0; i < LATEST_WORDS; i++) {
+      w[i] = e->words[i].load(std::memory_order_relaxed);
+    }
+    LatestValue v;
+    memcpy(&v, w, sizeof(v));
+    v.merge(r);
+    memcpy(w, &v, sizeof(v));
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < LATEST_WORDS; i++) {
+      e->words[i].store(w[i], std::memory_order_relaxed);
+    }
+    e->seq.store(s + 2, std::memory_order_release);
+    return true;
+  }
+
+  // Consistent snapshot of a device; false if it never reported
+  bool read(uint64_t device, LatestValue& out) const {
+    const LatestEntry* e = lookup(device);
+    if (!e) {
+      return false;
+    }
+    snapshot(*e, out);
+    return out.present != 0;
+  }
+
+  // f(device, const LatestValue&) for every device, one snapshot each
+  template <class F>
+  void for_each(F f) const {
+    for (const Shard& s : shards_) {
+      for (size_t i = 0; i <= s.mask; i++) {
+        uint64_t device = s.entries[i].device.load(std::memory_order_acquire);
+        if (device != LATEST_EMPTY) {
+          LatestValue v;
+          snapshot(s.entries[i], v);
+          f(device, v);
+        }
+      }
+    }
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (const Shard& s : shards_) {
+      n += s.size.load(std::memory_order_relaxed);
+    }
+    return n;
+  }
+
+  uint64_t rejected() const { return rejected_.load(std::memory_order_relaxed); }
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic_flag insertLock = ATOMIC_FLAG_INIT;
+    std::atomic<uint32_t> size{ 0 };
+    size_t mask = 0;
+    std::unique_ptr<LatestEntry[]> entries;
+  };
+
+  // A writer preempted inside its section holds everyone else on that
+  // entry; stop burning the core it may need to finish
+  static void backoff(int spins) {
+    if (spins >= 64) {
+      std::this_thread::yield();
+    }
+  }
+
+  static void snapshot(const LatestEntry& e, LatestValue& out) {
+    uint64_t w[LATEST_WORDS];
+    for (int spins = 0;; spins++) {
+      uint64_t s1 = e.seq.load(std::memory_order_acquire);
+      if (s1 & 1) {
+        backoff(spins);
+        continue;
+      }
+      for (int i = 0; i < LATEST_WORDS; i++) {
+        w[i] = e.words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (e.seq.load(std::memory_order_relaxed) == s1) {
+        break;
+      }
+    }
+    memcpy(&out, w, sizeof(out));
+  }
+
+  // Linear probe from the device's home slot
+  const LatestEntry* lookup(uint64_t device) const {
+    uint64_t h = device_hash(device);
+    const Shard& s = shards_[h % LATEST_SHARDS];
+    for (size_t n = 0, i = (h >> 32) & s.mask; n <= s.mask; n++, i = (i + 1) & s.mask) {
+      uint64_t key = s.entries[i].device.load(std::memory_order_acquire);
+      if (key == device) {
+        return &s.entries[i];
+      }
+      if (key == LATEST_EMPTY) {
+        break;
+      }
+    }
+    return nullptr;
+  }
+
+  // lookup(), inserting a new device under its shard's lock
+  LatestEntry* insert(uint64_t device) {
+    if (const LatestEntry* e = lookup(device)) {
+      return const_cast<LatestEntry*>(e);
+    }
+    uint64_t h = device_hash(device);
+    Shard& s = shards_[h % LATEST_SHARDS];
+    size_t start = (h >> 32) & s.mask;
+    for (int spins = 0; s.insertLock.test_and_set(std::memory_order_acquire); spins++) {
+      backoff(spins);
+    }
+    LatestEntry* found = nullptr;
+    for (size_t n = 0, i = start; n <= s.mask; n++, i = (i + 1) & s.mask) {
+      uint64_t key = s.entries[i].device.load(std::memory_order_relaxed);
+      if (key == device) {
+        found = &s.entries[i];
+        break;
+      }
+      // Leave one slot free so lookups of absent devices terminate
+      if (key == LATEST_EMPTY && s.size.load(std::memory_order_relaxed) < s.mask) {
+        s.entries[i].device.store(device, std::memory_order_release);
+        s.size.fetch_add(1, std::memory_order_relaxed);
+        found = &s.entries[i];
+        break;
+      }
+      if (key == LATEST_EMPTY) {
+        break;
+      }
+    }
+    s.insertLock.clear(std::memory_order_release);
+    if (!found) {
+      rejected_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return found;
+  }
+
+  Shard shards_[LATEST_SHARDS];
+  std::atomic<uint64_t> rejected_{ 0 };
+};
@@ -0,0 +1,180 @@
+/*
+  Multithreaded benchmark for the latest-value table against the single
+  mutex-guarded map it replaces.
+
+  For 1..--threads threads, every thread runs the same mix for --seconds:
+  a --writes fraction of operations merge a reading into a random one of
+  --devices devices (as ingest does), the rest read a snapshot of one (as
+  /latest and the hub do). Writers stamp every channel with the reading's
+  sequence number, so a reader that ever sees channels from two different
+  writes reports a torn read.
+
+  Build:
+    g++ -std=gnu++17 -O2 gateway/latest_table_bench.cpp -lpthread -o latest_table_bench
+
+  Run:
+    ./latest_table_bench --threads 8 --devices 1000 --writes 0.1
+*/
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "latest_table.h"
+
+struct BenchConfig {
+  int threads = 4;
+  int devices = 1000;
+  double writes = 0.1;   // Fraction of operations that update
+  double seconds = 1;
+};
+
+// The previous design: one merged state behind one lock
+class MutexTable {
+ public:
+  bool update(const Reading& r) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    map_[r.device].merge(r);
+    return true;
+  }
+
+  bool read(uint64_t device, LatestValue& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(device);
+    if (it == map_.end()) {
+      return false;
+    }
+    out = it->second;
+    return true;
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_map<uint64_t, LatestValue> map_;
+};
+
+struct Result {
+  double mops;
+  uint64_t torn;
+};
+
+static double now_s() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t device_key(uint64_t i) {
+  return 0x020000000000ULL + i;
+}
+
+template <class Table>
+static Result run(Table& table, const BenchConfig& cfg, int threads) {
+  std::atomic<bool> go(false), stop(false);
+  std::atomic<uint64_t> ops(0), torn(0);
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++) {
+    pool.emplace_back([&, t] {
+      uint64_t rng = 0x9E3779B97F4A7C15ULL * (t + 1);
+      uint32_t writeBelow = (uint32_t)(cfg.writes * 65536);
+      Reading r;
+      r.present = 0x07;
+      r.hasTrace = true;
+      LatestValue v;
+      uint64_t n = 0, bad = 0;
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int k = 0; k < 256; k++) {
+          rng ^= rng << 13;
+          rng ^= rng >> 7;
+          rng ^= rng << 17;
+          uint64_t device = device_key((rng >> 16) % cfg.devices);
+          if ((rng & 0xFFFF) < writeBelow) {
+            r.device = device;
+            r.seq = (uint32_t)(rng >> 32);
+            for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+              r.centi[i] = (int32_t)r.seq;
+            }
+            table.update(r);
+          } else if (table.read(device, v)) {
+            bad += v.centi[0] != (int32_t)v.seq || v.centi[1] != v.centi[0] || v.centi[2] != v.centi[0];
+          }
+        }
+        n += 256;
+      }
+      ops += n;
+      torn += bad;
+    });
+  }
+  double start = now_s();
+  go.store(true, std::memory_order_release);
+  while (now_s() - start < cfg.seconds) {
+    usleep(10000);
+  }
+  stop = true;
+  for (std::thread& th : pool) {
+    th.join();
+  }
+  return { ops.load() / (now_s() - start) / 1e6, torn.load() };
+}
+
+static bool parse_args(int argc, char** argv, BenchConfig& cfg) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    const char* value = argv[i + 1];
+    if (flag == "--threads") {
+      cfg.threads = atoi(value);
+    } else if (flag == "--devices") {
+      cfg.devices = atoi(value);
+    } else if (flag == "--writes") {
+      cfg.writes = atof(value);
+    } else if (flag == "--seconds") {
+      cfg.seconds = atof(value);
+    } else {
+      return false;
+    }
+  }
+  return (argc % 2) == 1 && cfg.threads > 0 && cfg.devices > 0 && cfg.writes >= 0 && cfg.writes <= 1;
+}
+
+int main(int argc, char** argv) {
+  BenchConfig cfg;
+  if (!parse_args(argc, argv, cfg)) {
+    fprintf(stderr, "usage: latest_table_bench [--threads N] [--devices N] [--writes F] [--seconds S]\n");
+    return 2;
+  }
+
+  printf("%d devices, %.0f%% writes, %u hardware threads\n", cfg.devices, cfg.writes * 100,
+         std::thread::hardware_concurrency());
+  printf("threads   seqlock Mops/s   mutex Mops/s   speedup\n");
+  uint64_t torn = 0;
+  for (int threads = 1; threads <= cfg.threads; threads *= 2) {
+    LatestTable table(cfg.devices);
+    MutexTable baseline;
+    // Every device reported once, so reads always find an entry
+    Reading r;
+    r.present = 0x07;
+    for (int i = 0; i < cfg.devices; i++) {
+      r.device = device_key(i);
+      table.update(r);
+      baseline.update(r);
+    }
+    Result a = run(table, cfg, threads);
+    Result b = run(baseline, cfg, threads);
+    printf("%7d   %14.1f   %12.1f   %6.1fx\n", threads, a.mops, b.mops, a.mops / b.mops);
+    torn += a.torn + b.torn;
+    if (threads < cfg.threads && threads * 2 > cfg.threads) {
+      threads = cfg.threads / 2;
+    }
+  }
+  printf("Torn reads %llu\n", (unsigned long long)torn);
+  return torn ? 1 : 0;
+}
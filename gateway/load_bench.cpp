@@ -0,0 +1,453 @@
+/*
+  Load benchmark for the ingest gateway, driven by the host build of the
+  firmware.
+
+  The firmware runs first on the simulated clock (host/firmware_sim.h) and
+  every request it writes is captured byte for byte, so the load is exactly
+  what a fleet of boards sends: same headers, partial frames, quality flags
+  and trace fields. Those requests are then replayed over many keep-alive
+  connections, one request in flight per connection like the firmware.
+
+  --backend picks the in-process gateway's socket layer: epoll
+  (ingest_server.h), io_uring (uring_server.h) or both in turn, adding the
+  gateway thread's CPU time per request to the client-side numbers.
+
+  --shards N runs the sharded gateway (shard_gateway.h) with 1, 2, 4 ..
+  N shards in turn and prints how throughput scales. Every connection
+  then poses as its own board (the "D" of each frame is rewritten), so
+  points are spread over the owner shards; --dir also stores them. The
+  client threads share the machine, so leave them cores of their own.
+
+  With --backfill N, every N consecutive frames are sent as one backlog
+  batch instead, stamped as sent two minutes after the newest was acquired,
+  like a board catching up after an outage; the gateway stores all but the
+  newest and reports them separately.
+
+  Build (blocking uplink path, so the firmware runs on the simulated clock):
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        gateway/load_bench.cpp -lpthread -o load_bench
+
+  Run against an in-process gateway, or any server (e.g. uvicorn) by port:
+    ./load_bench --connections 256 --threads 4 --seconds 10
+    ./load_bench --connections 1024 --backend both
+    ./load_bench --connections 1024 --threads 8 --shards 8 --dir /tmp/shards
+    ./load_bench --port 8000 --connections 64
+    ./load_bench --connections 64 --backfill 25
+*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "firmware_sim.h"
+#include "shard_gateway.h"
+
+struct BenchConfig {
+  int connections = 256;
+  int threads = 4;
+  double seconds = 5.0;
+  int frames = 1000;
+  uint16_t port = 0;   // 0: start an in-process gateway
+  int backfill = 0;    // Frames per backlog batch, 0 for live frames
+  std::string backend = "epoll";   // In-process gateway: epoll, uring or both
+  int shards = 0;      // >0: scale the sharded gateway up to this many shards
+  std::string dir;     // Store directory for the sharded gateway
+};
+
+struct LoadResult {
+  double elapsed = 0;
+  double rps = 0;
+  uint32_t p50 = 0;
+  uint32_t p99 = 0;
+};
+
+struct ClientResult {
+  std::vector<uint32_t> latencyUs;
+  uint64_t status[6] = {};   // By status class (1xx..5xx), [0] = errors
+};
+
+static uint64_t now_us() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Run the firmware until it has sent `frames` uplinks; return each request
+static std::vector<std::string> capture_firmware_requests(int frames) {
+  std::vector<std::string> requests;
+  sim::adcSource = [](uint8_t pin) {
+    // Slow drift plus a little noise so frames differ like real ones
+    return 2048 + (int)(600.0 * sin(sim::clockUs / 7e6 + pin)) + (int)(rand() % 9) - 4;
+  };
+  firmware_setup();
+  unsigned long sent = uplinkCount;
+  while ((int)requests.size() < frames) {
+    firmware_loop();
+    delay(10);
+    if (uplinkCount != sent) {
+      sent = uplinkCount;
+      requests.push_back(sim::net.lastRequest);
+    }
+  }
+  return requests;
+}
+
+// Join every n frames into one JSON array whose TS are all two minutes past
+// the last frame's TS, so each reading is at least that old when sent
+static std::vector<std::string> backlog_requests(const std::vector<std::string>& requests, int n) {
+  std::vector<std::string> out;
+  for (size_t first = 0; first + n <= requests.size(); first += n) {
+    std::vector<std::string> frames;
+    for (size_t i = first; i < first + n; i++) {
+      frames.push_back(requests[i].substr(requests[i].find("\r\n\r\n") + 4));
+    }
+    size_t ts = frames.back().find("\"TS\":");
+    unsigned long sentMs = strtoul(frames.back().c_str() + ts + 5, nullptr, 10) + 120000;
+    std::string body = "[";
+    for (std::string& f : frames) {
+      ts = f.find("\"TS\":") + 5;
+      f.replace(ts, f.find_first_not_of("0123456789", ts) - ts, std::to_string(sentMs));
+      body += (body.size() > 1 ? "," : "") + f;
+    }
+    body += "]";
+    out.push_back("POST /water-monitor/publish HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n"
+                  "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n"
+                  + body);
+  }
+  return out;
+}
+
+static int connect_to(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// Read one response; returns the status code or 0 on error
+static int read_response(int fd, std::string& buf) {
+  buf.clear();
+  char chunk[512];
+  for (;;) {
+    size_t headerEnd = buf.find("\r\n\r\n");
+    if (headerEnd != std::string::npos) {
+      size_t bodyLen = 0;
+      size_t cl = buf.find("ength: ");
+      if (cl != std::string::npos && cl < headerEnd) {
+        bodyLen = strtoul(buf.c_str() + cl + 7, nullptr, 10);
+      }
+      while (buf.size() < headerEnd + 4 + bodyLen) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+          return 0;
+        }
+        buf.append(chunk, n);
+      }
+      return buf.size() > 12 ? atoi(buf.c_str() + 9) : 0;
+    }
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+      return 0;
+    }
+    buf.append(chunk, n);
+  }
+}
+
+// Give every "D" in a request the 12 hex digits of device
+static void set_device(std::string& req, uint64_t device) {
+  static const char DIGITS[] = "0123456789abcdef";
+  for (size_t at = req.find("\"D\":\""); at != std::string::npos; at = req.find("\"D\":\"", at + 1)) {
+    for (int i = 0; i < 12 && at + 5 + i < req.size(); i++) {
+      req[at + 5 + i] = DIGITS[(device >> (44 - 4 * i)) & 0xF];
+    }
+  }
+}
+
+// Connections pose as boards firstDevice, firstDevice + 1, ..
+static void client_thread(uint16_t port, int connections, const std::vector<std::string>& requests,
+                          unsigned seed, uint64_t firstDevice, std::atomic<bool>& stop, ClientResult& result) {
+  std::vector<int> fds;
+  for (int i = 0; i < connections; i++) {
+    int fd = connect_to(port);
+    if (fd >= 0) {
+      fds.push_back(fd);
+    } else {
+      result.status[0]++;
+    }
+  }
+  std::vector<uint64_t> sentAt(fds.size());
+  std::string req;
+  std::string buf;
+  buf.reserve(1024);
+  result.latencyUs.reserve(1 << 20);
+  size_t next = seed % requests.size();
+
+  while (!stop.load(std::memory_order_relaxed) && !fds.empty()) {
+    // One request in flight per connection, as each board has
+    for (size_t i = 0; i < fds.size(); i++) {
+      req = requests[next];
+      next = (next + 1) % requests.size();
+      if (firstDevice) {
+        set_device(req, firstDevice + i);
+      }
+      sentAt[i] = now_us();
+      if (send(fds[i], req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t)req.size()) {
+        result.status[0]++;
+      }
+    }
+    for (size_t i = 0; i < fds.size(); i++) {
+      int code = read_response(fds[i], buf);
+      result.latencyUs.push_back((uint32_t)(now_us() - sentAt[i]));
+      result.status[code >= 100 && code < 600 ? code / 100 : 0]++;
+    }
+  }
+  for (int fd : fds) {
+    close(fd);
+  }
+}
+
+// Replay the requests against the gateway on port; false on any error or
+// non-2xx response
+static bool run_load(const BenchConfig& cfg, uint16_t port, const std::vector<std::string>& requests, size_t bytes,
+                     LoadResult& result, bool ownDevices = false) {
+  std::atomic<bool> stop(false);
+  std::vector<ClientResult> results(cfg.threads);
+  std::vector<std::thread> clients;
+  uint64_t start = now_us();
+  for (int t = 0; t < cfg.threads; t++) {
+    int share = cfg.connections / cfg.threads + (t < cfg.connections % cfg.threads ? 1 : 0);
+    uint64_t firstDevice = ownDevices ? 0x020000000000ULL + (uint64_t)t * 1000000 : 0;
+    clients.emplace_back(client_thread, port, share, std::cref(requests), (unsigned)t * 7919, firstDevice,
+                         std::ref(stop), std::ref(results[t]));
+  }
+  usleep((useconds_t)(cfg.seconds * 1e6));
+  stop = true;
+  for (std::thread& t : clients) {
+    t.join();
+  }
+  double elapsed = (now_us() - start) / 1e6;
+
+  std::vector<uint32_t> latency;
+  uint64_t status[6] = {};
+  for (const ClientResult& r : results) {
+    latency.insert(latency.end(), r.latencyUs.begin(), r.latencyUs.end());
+    for (int i = 0; i < 6; i++) {
+      status[i] += r.status[i];
+    }
+  }
+  if (latency.empty()) {
+    printf("No responses\n");
+    return false;
+  }
+  std::sort(latency.begin(), latency.end());
+  auto pct = [&latency](double p) { return latency[std::min(latency.size() - 1, (size_t)(p / 100 * latency.size()))]; };
+
+  printf("Connections %d  threads %d  %.1f s\n", cfg.connections, cfg.threads, elapsed);
+  printf("Requests    %zu  (%.0f req/s, %.1f MB/s in)\n", latency.size(), latency.size() / elapsed,
+         latency.size() * ((double)bytes / requests.size()) / elapsed / 1e6);
+  printf("Latency us  p50 %u  p90 %u  p99 %u  max %u\n", pct(50), pct(90), pct(99), latency.back());
+  printf("Status      2xx %llu  4xx %llu  5xx %llu  errors %llu\n", (unsigned long long)status[2],
+         (unsigned long long)status[4], (unsigned long long)status[5], (unsigned long long)status[0]);
+  result.elapsed = elapsed;
+  result.rps = latency.size() / elapsed;
+  result.p50 = pct(50);
+  result.p99 = pct(99);
+  return status[0] == 0 && status[4] == 0 && status[5] == 0;
+}
+
+static double thread_cpu_s() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run the load against an in-process gateway on its own thread and add
+// its CPU time (and io_uring_enter() calls) per request
+template <class Server>
+static bool bench_gateway(const char* name, const BenchConfig& cfg, const std::vector<std::string>& requests,
+                          size_t bytes) {
+  Server server;
+  uint64_t live = 0;
+  server.onReading = [&live](const Reading&) { live++; };
+  if (!server.start(0)) {
+    fprintf(stderr, "load_bench: %s gateway: %s\n", name, strerror(errno));
+    return false;
+  }
+  std::atomic<bool> serverStop(false);
+  double cpuS = 0;
+  std::thread serverThread([&] {
+    while (!serverStop.load(std::memory_order_relaxed)) {
+      server.run_once(50);
+    }
+    cpuS = thread_cpu_s();
+  });
+
+  printf("\n%s backend\n", name);
+  LoadResult load;
+  bool ok = run_load(cfg, server.port(), requests, bytes, load);
+  double elapsed = load.elapsed;
+  serverStop = true;
+  serverThread.join();
+
+  const IngestStats& s = server.stats();
+  printf("Gateway     200 %llu  202 %llu  rejected %llu\n", (unsigned long long)s.ok,
+         (unsigned long long)s.accepted, (unsigned long long)s.rejected);
+  printf("Server CPU  %.2f us/request  (%.0f%% of a core)\n", s.requests ? cpuS * 1e6 / s.requests : 0.0,
+         cpuS / elapsed * 100);
+  if constexpr (std::is_same<Server, UringIngestServer>::value) {
+    printf("Syscalls    %.3f io_uring_enter/request\n", s.requests ? (double)server.enters() / s.requests : 0.0);
+  }
+  if (s.backfillBatches > 0) {
+    printf("Backfill    %llu batches  %llu readings stored only (%.0f/s)  %llu live\n",
+           (unsigned long long)s.backfillBatches, (unsigned long long)s.backfillReadings,
+           s.backfillReadings / elapsed, (unsigned long long)live);
+  }
+  return ok;
+}
+
+// Run the load against the sharded gateway at 1, 2, 4 .. cfg.shards shards
+template <class Server>
+static bool bench_shards(const char* name, const BenchConfig& cfg, const std::vector<std::string>& requests,
+                         size_t bytes) {
+  struct Row {
+    int shards;
+    LoadResult load;
+    ShardStats stats;
+  };
+  std::vector<Row> rows;
+  bool ok = true;
+  for (int n = 1; n <= cfg.shards; n = n < cfg.shards && n * 2 > cfg.shards ? cfg.shards : n * 2) {
+    std::string dir;
+    if (!cfg.dir.empty()) {
+      mkdir(cfg.dir.c_str(), 0755);
+      dir = cfg.dir + "/" + name + "-" + std::to_string(n);
+      std::string wipe = "rm -rf " + dir;
+      if (system(wipe.c_str()) != 0 || mkdir(dir.c_str(), 0755) != 0) {
+        return false;
+      }
+    }
+    ShardedGateway<Server> gateway;
+    if (!gateway.start(n, 0, dir, false)) {
+      fprintf(stderr, "load_bench: %s shards: %s\n", name, strerror(errno));
+      return false;
+    }
+    printf("\n%s backend, %d shard%s\n", name, n, n == 1 ? "" : "s");
+    Row row;
+    row.shards = n;
+    ok &= run_load(cfg, gateway.port(), requests, bytes, row.load, true);
+    ok &= gateway.stop();
+    row.stats = gateway.stats();
+    rows.push_back(row);
+    if (n == cfg.shards) {
+      break;
+    }
+  }
+
+  printf("\n%s scaling (%u hardware threads, %d client threads)\n", name, std::thread::hardware_concurrency(),
+         cfg.threads);
+  printf("shards      req/s  speedup  p50 us  p99 us  points/s  handed off  busiest shard\n");
+  for (const Row& r : rows) {
+    uint64_t busiest = *std::max_element(r.stats.requests.begin(), r.stats.requests.end());
+    printf("%6d  %9.0f  %6.2fx  %6u  %6u  %8.0f  %9.0f%%  %12.0f%%\n", r.shards, r.load.rps,
+           r.load.rps / rows[0].load.rps, r.load.p50, r.load.p99, r.stats.points / r.load.elapsed,
+           r.stats.points ? 100.0 * r.stats.handedOff / r.stats.points : 0.0,
+           r.stats.ingest.requests ? 100.0 * busiest / r.stats.ingest.requests : 0.0);
+  }
+  return ok;
+}
+
+static bool parse_args(int argc, char** argv, BenchConfig& cfg) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    const char* value = argv[i + 1];
+    if (flag == "--connections") {
+      cfg.connections = atoi(value);
+    } else if (flag == "--threads") {
+      cfg.threads = atoi(value);
+    } else if (flag == "--seconds") {
+      cfg.seconds = atof(value);
+    } else if (flag == "--frames") {
+      cfg.frames = atoi(value);
+    } else if (flag == "--port") {
+      cfg.port = (uint16_t)atoi(value);
+    } else if (flag == "--backend") {
+      cfg.backend = value;
+    } else if (flag == "--shards") {
+      cfg.shards = atoi(value);
+    } else if (flag == "--dir") {
+      cfg.dir = value;
+    } else if (flag == "--backfill") {
+      cfg.backfill = atoi(value);
+    } else {
+      return false;
+    }
+  }
+  return (argc % 2) == 1 && cfg.connections > 0 && cfg.threads > 0 && cfg.frames > 0
+         && cfg.backfill >= 0 && cfg.backfill <= cfg.frames && cfg.shards >= 0
+         && (cfg.backend == "epoll" || cfg.backend == "uring" || cfg.backend == "both");
+}
+
+int main(int argc, char** argv) {
+  BenchConfig cfg;
+  if (!parse_args(argc, argv, cfg)) {
+    fprintf(stderr, "usage: load_bench [--connections N] [--threads N] [--seconds S] [--frames N] [--port P]"
+                    " [--backend epoll|uring|both] [--backfill N]"
+                    " [--shards N] [--dir D]\n");
+    return 2;
+  }
+
+  std::vector<std::string> requests = capture_firmware_requests(cfg.frames);
+  size_t bytes = 0;
+  for (const std::string& r : requests) {
+    bytes += r.size();
+  }
+  printf("Captured %zu firmware requests (%.0f bytes avg)\n", requests.size(), (double)bytes / requests.size());
+  if (cfg.backfill > 0) {
+    requests = backlog_requests(requests, cfg.backfill);
+    bytes = 0;
+    for (const std::string& r : requests) {
+      bytes += r.size();
+    }
+    printf("Batched into %zu backlogs of %d frames (%.0f bytes avg)\n", requests.size(), cfg.backfill,
+           (double)bytes / requests.size());
+  }
+
+  if (cfg.port != 0) {
+    LoadResult load;
+    return run_load(cfg, cfg.port, requests, bytes, load) ? 0 : 1;
+  }
+  bool ok = true;
+  if (cfg.shards > 0) {
+    if (cfg.backend == "epoll" || cfg.backend == "both") {
+      ok &= bench_shards<IngestServer>("epoll", cfg, requests, bytes);
+    }
+    if (cfg.backend == "uring" || cfg.backend == "both") {
+      ok &= bench_shards<UringIngestServer>("io_uring", cfg, requests, bytes);
+    }
+    return ok ? 0 : 1;
+  }
+  if (cfg.backend == "epoll" || cfg.backend == "both") {
+    ok &= bench_gateway<IngestServer>("epoll", cfg, requests, bytes);
+  }
+  if (cfg.backend == "uring" || cfg.backend == "both") {
+    ok &= bench_gateway<UringIngestServer>("io_uring", cfg, requests, bytes);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+/*
+  Bounded lock-free queue from many producer threads to one consumer,
+  used between gateway shards (shard_gateway.h).
+
+  Vyukov's bounded queue specialised to one consumer: every cell carries
+  a sequence number telling producers when it is free and the consumer
+  when it is filled. Producers claim a cell with one CAS on the tail and
+  fill it in place; the consumer reads cells in order without any atomic
+  read-modify-write. Nothing allocates after construction and a full
+  queue is reported instead of waited on, so callers decide between
+  dropping and backing off.
+
+  Doorbell wakes a consumer that sleeps in poll(): producers write its
+  eventfd only while the consumer has armed it, so a busy consumer costs
+  them no syscall.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+
+template <class T, size_t N>
+class MpscRing {
+  static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+ public:
+  MpscRing() : cells_(new Cell[N]) {
+    for (size_t i = 0; i < N; i++) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Producers: claim a cell and fill(T&) it in place; false when full
+  template <class Fill>
+  bool push(Fill fill) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell* c;
+    for (;;) {
+      c = &cells_[pos & (N - 1)];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;   // The consumer has not freed this cell yet
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    fill(c->value);
+    c->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer: f(T&) for up to max filled cells in order; returns how many
+  template <class F>
+  size_t drain(F f, size_t max = N) {
+    size_t n = 0;
+    while (n < max) {
+      Cell& c = cells_[head_ & (N - 1)];
+      if (c.seq.load(std::memory_order_acquire) != head_ + 1) {
+        break;
+      }
+      f(c.value);
+      c.seq.store(head_ + N, std::memory_order_release);
+      head_++;
+      n++;
+    }
+    return n;
+  }
+
+  // Consumer: nothing ready to drain
+  bool empty() const { return cells_[head_ & (N - 1)].seq.load(std::memory_order_acquire) != head_ + 1; }
+
+ private:
+  struct alignas(64) Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  alignas(64) std::atomic<size_t> tail_{ 0 };
+  alignas(64) size_t head_ = 0;
+};
+
+class Doorbell {
+ public:
+  Doorbell() : fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+  ~Doorbell() { close(fd_); }
+  Doorbell(const Doorbell&) = delete;
+  Doorbell& operator=(const Doorbell&) = delete;
+
+  // Readable after a ring() while armed
+  int fd() const { return fd_; }
+
+  // Consumer, before checking its queues one last time and sleeping
+  void arm() {
+    armed_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // Consumer, after waking
+  void disarm() {
+    armed_.store(false, std::memory_order_relaxed);
+    uint64_t count;
+    while (read(fd_, &count, sizeof(count)) > 0) {
+    }
+  }
+
+  // Producer, after pushing
+  void ring() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (armed_.load(std::memory_order_relaxed) && armed_.exchange(false, std::memory_order_relaxed)) {
+      uint64_t one = 1;
+      ssize_t n = write(fd_, &one, sizeof(one));
+      (void)n;
+    }
+  }
+
+ private:
+  int fd_;
+  std::atomic<bool> armed_{ false };
+};
@@ -0,0 +1,303 @@
+/*
+  Zero-copy parser for the firmware's uplink frame.
+
+  The body is the object built by build_uplink_frame():
+    {"D":"f412fa5c33a0","T":436.63,"Q":{"T":8},"PH":6.61,"C":609.52,"S":12,"TA":5022,"TS":5022}
+  Channels are optional (each is reported at its own rate) and "Q" only
+  lists faulted channels. The parser walks the request buffer in place:
+  keys are compared without copying and numbers are converted straight from
+  the buffer. Unknown keys are skipped, so older servers' extra fields and
+  newer firmware fields do not break ingest.
+*/
+#pragma once
+
+#include <charconv>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+enum Channel { CH_T, CH_PH, CH_C, NUM_SENSOR_CHANNELS };
+
+const char* const CHANNEL_KEYS[NUM_SENSOR_CHANNELS] = { "T", "PH", "C" };
+
+struct Reading {
+  uint64_t device = 0;                      // "D" (device_from_id()), 0 when absent
+  uint8_t present = 0;                      // Bit per Channel
+  double value[NUM_SENSOR_CHANNELS] = {};
+  int32_t centi[NUM_SENSOR_CHANNELS] = {};  // value in hundredths (firmware precision)
+  uint8_t quality[NUM_SENSOR_CHANNELS] = {};  // QF_* flags, 0 = healthy
+  bool hasTrace = false;                    // S/TA/TS all present
+  uint32_t seq = 0;
+  uint32_t acquiredMs = 0;                  // TA, device millis()
+  uint32_t sentMs = 0;                      // TS, device millis()
+};
+
+enum ParseResult {
+  PARSE_OK,      // At least one channel
+  PARSE_EMPTY,   // Valid JSON without any channel (answered 202)
+  PARSE_ERROR,   // Malformed (answered 400)
+};
+
+// Hundredths, rounded half away from zero and saturated to int32
+inline int32_t centi_from_double(double v) {
+  if (!(v == v)) {
+    return 0;
+  }
+  double c = round(v * 100);
+  return c >= 2147483647.0 ? INT32_MAX : c <= -2147483648.0 ? INT32_MIN : (int32_t)c;
+}
+
+// Device key for a "D" value. The firmware sends its 48-bit ID (MAC) as 12
+// hex digits, which maps to itself; any other string is hashed (FNV-1a)
+// into the same 56 bits, so a key always fits series_key().
+inline uint64_t device_from_id(const char* id, size_t len) {
+  uint64_t v = 0;
+  size_t i = 0;
+  for (; i < len && i < 14; i++) {
+    char c = id[i];
+    int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    if (d < 0) {
+      break;
+    }
+    v = v << 4 | (uint64_t)d;
+  }
+  if (i == len) {
+    return v;
+  }
+  uint64_t h = 0xCBF29CE484222325ULL;
+  for (i = 0; i < len; i++) {
+    h = (h ^ (uint8_t)id[i]) * 0x100000001B3ULL;
+  }
+  return h & 0x00FFFFFFFFFFFFFFULL;
+}
+
+// Integer fields (sequence, millis(), flags), truncated and saturated
+inline uint32_t u32_from_double(double v) {
+  if (!(v > 0)) {
+    return 0;
+  }
+  return v >= 4294967295.0 ? UINT32_MAX : (uint32_t)v;
+}
+
+// Reference parser: one frame, one pass, any valid number syntax. The
+// ingest path uses BatchParser (batch_parser.h); this one is the oracle it
+// is checked against.
+class ReadingParser {
+ public:
+  static ParseResult parse(const char* data, size_t len, Reading& out) {
+    ReadingParser p(data, data + len);
+    out = Reading();
+    if (!p.object([&p, &out](const char* key, size_t keyLen) { return p.top_field(key, keyLen, out); })) {
+      return PARSE_ERROR;
+    }
+    p.ws();
+    if (p.cur_ != p.end_) {
+      return PARSE_ERROR;
+    }
+    out.hasTrace = p.traceSeen_ == 0x07;
+    return out.present ? PARSE_OK : PARSE_EMPTY;
+  }
+
+ private:
+  ReadingParser(const char* begin, const char* end) : cur_(begin), end_(end) {}
+
+  static int channel_index(const char* key, size_t len) {
+    for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+      if (strlen(CHANNEL_KEYS[i]) == len && memcmp(CHANNEL_KEYS[i], key, len) == 0) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  static bool key_is(const char* key, size_t len, const char* name) {
+    return strlen(name) == len && memcmp(name, key, len) == 0;
+  }
+
+  bool top_field(const char* key, size_t len, Reading& out) {
+    int ch = channel_index(key, len);
+    if (ch >= 0) {
+      if (!number(out.value[ch])) {
+        return false;
+      }
+      out.centi[ch] = centi_from_double(out.value[ch]);
+      out.present |= 1 << ch;
+      return true;
+    }
+    if (key_is(key, len, "Q")) {
+      ws();
+      if (cur_ < end_ && *cur_ == '{') {
+        return object([this, &out](const char* k, size_t kl) { return quality_field(k, kl, out); });
+      }
+      return skip_value();
+    }
+    if (key_is(key, len, "D")) {
+      ws();
+      if (cur_ < end_ && *cur_ == '"') {
+        const char* id;
+        size_t idLen;
+        if (!string(id, idLen)) {
+          return false;
+        }
+        out.device = device_from_id(id, idLen);
+        return true;
+      }
+      return skip_value();
+    }
+    int trace = key_is(key, len, "S") ? 0 : key_is(key, len, "TA") ? 1 : key_is(key, len, "TS") ? 2 : -1;
+    if (trace >= 0) {
+      double v;
+      if (!number(v)) {
+        return false;
+      }
+      uint32_t* fields[3] = { &out.seq, &out.acquiredMs, &out.sentMs };
+      *fields[trace] = u32_from_double(v);
+      traceSeen_ |= 1 << trace;
+      return true;
+    }
+    return skip_value();
+  }
+
+  bool quality_field(const char* key, size_t len, Reading& out) {
+    int ch = channel_index(key, len);
+    if (ch < 0) {
+      return skip_value();
+    }
+    double v;
+    if (!number(v)) {
+      return false;
+    }
+    out.quality[ch] = (uint8_t)u32_from_double(v);
+    return true;
+  }
+
+  void ws() {
+    while (cur_ < end_ && (*cur_ == ' ' || *cur_ == '\t' || *cur_ == '\r' || *cur_ == '\n')) {
+      cur_++;
+    }
+  }
+
+  bool expect(char c) {
+    ws();
+    if (cur_ < end_ && *cur_ == c) {
+      cur_++;
+      return true;
+    }
+    return false;
+  }
+
+  // String without escapes (the firmware never emits any); escaped strings
+  // are still skipped correctly, but their key never matches
+  bool string(const char*& s, size_t& len) {
+    if (!expect('"')) {
+      return false;
+    }
+    s = cur_;
+    while (cur_ < end_ && *cur_ != '"') {
+      if (*cur_ == '\\' && ++cur_ == end_) {
+        return false;
+      }
+      cur_++;
+    }
+    if (cur_ == end_) {
+      return false;
+    }
+    len = cur_ - s;
+    cur_++;
+    return true;
+  }
+
+  bool number(double& v) {
+    ws();
+    auto r = std::from_chars(cur_, end_, v);
+    if (r.ec != std::errc() || r.ptr == cur_) {
+      return false;
+    }
+    cur_ = r.ptr;
+    return true;
+  }
+
+  // {"key": value, ...}; field(key, len) consumes the value
+  template <class Field>
+  bool object(Field field) {
+    if (!expect('{')) {
+      return false;
+    }
+    if (expect('}')) {
+      return true;
+    }
+    for (;;) {
+      const char* key;
+      size_t len;
+      if (!string(key, len) || !expect(':') || !field(key, len)) {
+        return false;
+      }
+      if (expect(',')) {
+        continue;
+      }
+      return expect('}');
+    }
+  }
+
+  bool skip_value() {
+    ws();
+    if (cur_ == end_ || ++depth_ > MAX_DEPTH) {
+      return false;
+    }
+    bool ok;
+    const char* s;
+    size_t len;
+    double v;
+    switch (*cur_) {
+      case '{':
+        ok = object([this](const char*, size_t) { return skip_value(); });
+        break;
+      case '[':
+        cur_++;
+        ok = expect(']');
+        while (!ok) {
+          if (!skip_value()) {
+            break;
+          }
+          ok = expect(']');
+          if (!ok && !expect(',')) {
+            break;
+          }
+        }
+        break;
+      case '"':
+        ok = string(s, len);
+        break;
+      case 't':
+        ok = literal("true");
+        break;
+      case 'f':
+        ok = literal("false");
+        break;
+      case 'n':
+        ok = literal("null");
+        break;
+      default:
+        ok = number(v);
+    }
+    depth_--;
+    return ok;
+  }
+
+  bool literal(const char* word) {
+    size_t n = strlen(word);
+    if ((size_t)(end_ - cur_) < n || memcmp(cur_, word, n) != 0) {
+      return false;
+    }
+    cur_ += n;
+    return true;
+  }
+
+  static const int MAX_DEPTH = 16;
+
+  const char* cur_;
+  const char* end_;
+  int depth_ = 0;
+  uint8_t traceSeen_ = 0;
+};
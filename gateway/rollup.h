@@ -0,0 +1,137 @@
+/*
+  Downsampled rollups of a series for dashboard range queries.
+
+  Every point that reaches the store is also folded into a minute bucket
+  and an hour bucket (min / max / sum / count), so maintaining them costs
+  two compares and two adds per point. Buckets are appended in time order
+  and never revisited once a later bucket opens, like the head block of
+  the series itself.
+
+  A SeriesRollup covers the points of the head block only. Sealing writes
+  its buckets into the segment after the block's columns and clears it,
+  so memory stays bounded however long the store runs, and reopening maps
+  the buckets instead of decoding every point. A bucket that straddles two
+  blocks is stored in part with each; queries merge the parts.
+
+  The raw series (1 Hz from the firmware) is the 1 s level; a query is
+  served from the coarsest of raw, minute or hour whose buckets tile the
+  requested step (see TimeSeriesStore::query()). A month at one-hour
+  resolution then reads 720 buckets instead of 2.6M points.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+enum RollupTier { ROLLUP_MINUTE, ROLLUP_HOUR, NUM_ROLLUP_TIERS };
+
+const int64_t ROLLUP_WIDTH_MS[NUM_ROLLUP_TIERS] = { 60000, 3600000 };
+
+// Start of the width-aligned bucket holding t (floor, also for t < 0)
+inline int64_t bucket_start(int64_t t, int64_t width) {
+  int64_t r = t % width;
+  return r < 0 ? t - r - width : t - r;
+}
+
+// Summary of the points in [start, start + width); values in hundredths
+struct Aggregate {
+  int64_t start = 0;
+  int32_t min = INT32_MAX;
+  int32_t max = INT32_MIN;
+  int64_t sum = 0;
+  uint32_t count = 0;
+
+  void add(int32_t v) {
+    min = v < min ? v : min;
+    max = v > max ? v : max;
+    sum += v;
+    count++;
+  }
+
+  void merge(const Aggregate& a) {
+    min = a.min < min ? a.min : min;
+    max = a.max > max ? a.max : max;
+    sum += a.sum;
+    count += a.count;
+  }
+
+  double mean() const { return count ? (double)sum / count : 0; }
+};
+
+// Aggregates are written to segment files as they are in memory
+static_assert(sizeof(Aggregate) == 32, "Aggregate is part of the segment format");
+
+class SeriesRollup {
+ public:
+  // Points arrive in time order (the store drops older ones first)
+  void add(int64_t t, int32_t v) {
+    for (int i = 0; i < NUM_ROLLUP_TIERS; i++) {
+      std::vector<Aggregate>& b = tiers_[i];
+      int64_t start = bucket_start(t, ROLLUP_WIDTH_MS[i]);
+      if (b.empty() || b.back().start != start) {
+        b.emplace_back();
+        b.back().start = start;
+      }
+      b.back().add(v);
+    }
+  }
+
+  const std::vector<Aggregate>& tier(int i) const { return tiers_[i]; }
+
+  void clear() {
+    for (std::vector<Aggregate>& b : tiers_) {
+      b.clear();
+    }
+  }
+
+  size_t bytes() const {
+    size_t n = 0;
+    for (const std::vector<Aggregate>& b : tiers_) {
+      n += b.size() * sizeof(Aggregate);
+    }
+    return n;
+  }
+
+ private:
+  std::vector<Aggregate> tiers_[NUM_ROLLUP_TIERS];
+};
+
+// Re-buckets aggregates or points into step-aligned output buckets, which
+// must be fed in time order; f(const Aggregate&) for each non-empty one
+template <class F>
+class StepAccumulator {
+ public:
+  StepAccumulator(int64_t step, F& f) : step_(step), f_(f) {}
+  ~StepAccumulator() { finish(); }
+
+  void add(const Aggregate& a) {
+    open(a.start);
+    cur_.merge(a);
+  }
+
+  void add(int64_t t, int32_t v) {
+    open(t);
+    cur_.add(v);
+  }
+
+  void finish() {
+    if (cur_.count > 0) {
+      f_(cur_);
+      cur_ = Aggregate();
+    }
+  }
+
+ private:
+  void open(int64_t t) {
+    int64_t start = bucket_start(t, step_);
+    if (cur_.count > 0 && cur_.start != start) {
+      finish();
+    }
+    cur_.start = start;
+  }
+
+  int64_t step_;
+  F& f_;
+  Aggregate cur_;
+};
@@ -0,0 +1,406 @@
+/*
+  Shard-per-core ingest gateway.
+
+  Each shard is one thread, pinned to its own core, with its own ingest
+  server (epoll or io_uring backend) listening on the shared port through
+  SO_REUSEPORT. The kernel spreads new connections over the shards and a
+  connection stays on the shard that accepted it, so the request path
+  (recv, parse, merge, respond) touches no state of another shard. The
+  latest-value table is shared; its seqlock entries take no lock.
+
+  Storage is partitioned by device: every device belongs to one shard
+  (shard_of()) whose TimeSeriesStore holds its series, so no store is
+  ever touched by two threads. A shard buffers points for each owner in a
+  chunk and hands full chunks, and whatever is buffered at the end of a
+  pass, to the owner's inbox (MpscRing); points it owns itself skip the
+  queue. Updates for dashboards are formatted on the shard and queued to
+  the thread running the WebSocket hub, as are upgraded connections.
+
+  With one shard the store lives in the data directory itself, with N in
+  data-dir/shard-K. Device ownership follows N, so a data directory must
+  keep its shard count.
+*/
+#pragma once
+
+#include <pthread.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpsc_ring.h"
+#include "tsdb.h"
+#include "uring_server.h"
+#include "ws_hub.h"
+
+#ifndef SHARD_CHUNK_POINTS
+#define SHARD_CHUNK_POINTS 128   // Points per handoff between shards
+#endif
+#ifndef SHARD_INBOX_CHUNKS
+#define SHARD_INBOX_CHUNKS 256   // Chunks queued to one owner shard
+#endif
+#ifndef SHARD_HUB_MESSAGES
+#define SHARD_HUB_MESSAGES 4096  // Dashboard updates queued to the hub
+#endif
+
+struct StorePoint {
+  uint64_t device;
+  int64_t t;
+  int32_t v;
+  uint8_t channel;
+};
+
+struct PointChunk {
+  uint32_t n;
+  StorePoint points[SHARD_CHUNK_POINTS];
+};
+
+struct HubMessage {
+  uint64_t device;
+  uint32_t len;
+  char data[HUB_FRAME_SIZE];
+};
+
+struct HubAdoption {
+  int fd;
+  uint32_t len;
+  char data[HUB_RX_SIZE];
+};
+
+// Totals across shards; per-shard request counts show the balance
+struct ShardStats {
+  IngestStats ingest;
+  uint64_t points = 0;      // Appended to the stores
+  uint64_t handedOff = 0;   // Of those, received from another shard
+  uint64_t hubDropped = 0;  // Dashboard updates lost to a full hub queue
+  std::vector<uint64_t> requests;
+};
+
+inline int64_t shard_wall_ms() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+inline int server_fd(const IngestServer& s) { return s.epoll_fd(); }
+inline int server_fd(const UringIngestServer& s) { return s.ring_fd(); }
+
+template <class Server>
+class ShardedGateway {
+ public:
+  ~ShardedGateway() { stop(); }
+
+  // Bind every shard on port (0 picks one, see port()), open the stores
+  // when dataDir is set and start the shard threads. With publish, the
+  // caller drains updates into a hub with drain_to_hub().
+  bool start(int shards, uint16_t port, const std::string& dataDir, bool publish) {
+    publish_ = publish;
+    storing_ = !dataDir.empty();
+    for (int k = 0; k < shards; k++) {
+      shards_.emplace_back(new Shard(latest_));
+      Shard& sh = *shards_.back();
+      sh.index = k;
+      sh.outgoing.reset(new PointChunk[shards]());
+      if (!sh.server.start(port, 1024, shards > 1)) {
+        return false;
+      }
+      port = sh.server.port();
+      if (storing_) {
+        std::string dir = shards == 1 ? dataDir : dataDir + "/shard-" + std::to_string(k);
+        mkdir(dir.c_str(), 0755);
+        if (!sh.store.open(dir)) {
+          return false;
+        }
+      }
+      wire(sh);
+    }
+    port_ = port;
+    hubBell_.arm();
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (auto& sh : shards_) {
+      Shard* s = sh.get();
+      sh->thread = std::thread([this, s] { run(*s); });
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(s->index % cores, &set);
+      pthread_setaffinity_np(sh->thread.native_handle(), sizeof(set), &set);
+    }
+    return true;
+  }
+
+  // Join the shards, store what is still in flight and flush the stores
+  bool stop() {
+    if (shards_.empty() || stopping_.exchange(true)) {
+      return true;
+    }
+    for (auto& sh : shards_) {
+      sh->doorbell.ring();
+      if (sh->thread.joinable()) {
+        sh->thread.join();
+      }
+    }
+    bool ok = true;
+    for (auto& sh : shards_) {
+      for (size_t k = 0; k < shards_.size(); k++) {
+        apply(*shards_[k], sh->outgoing[k]);
+        sh->outgoing[k].n = 0;
+      }
+      for (const PointChunk& c : sh->leftover) {
+        apply(*shards_[shard_of(c.points[0].device)], c);
+      }
+      sh->leftover.clear();
+    }
+    for (auto& sh : shards_) {
+      Shard* s = sh.get();
+      s->inbox.drain([this, s](PointChunk& c) { apply(*s, c); });
+      ok &= !storing_ || s->store.flush();
+      publish_counters(*s);
+    }
+    return ok;
+  }
+
+  uint16_t port() const { return port_; }
+  int shards() const { return (int)shards_.size(); }
+  const LatestTable& latest() const { return latest_; }
+
+  // Hub thread: readable when updates or connections are queued
+  int hub_fd() const { return hubBell_.fd(); }
+
+  // Hub thread: adopt upgraded connections and publish queued updates
+  void drain_to_hub(WsHub& hub) {
+    hubBell_.disarm();
+    adoptions_.drain([&hub](HubAdoption& a) { hub.adopt(a.fd, a.data, a.len); });
+    messages_.drain([&hub](HubMessage& m) { hub.publish(m.device, m.data, m.len); });
+    hubBell_.arm();
+    if (!adoptions_.empty() || !messages_.empty()) {
+      hubBell_.ring();   // Raced with a producer: poll() again at once
+    }
+  }
+
+  ShardStats stats() const {
+    ShardStats st;
+    for (const auto& sh : shards_) {
+      const Counters& c = sh->counters;
+      st.ingest.connections += c.connections.load(std::memory_order_relaxed);
+      st.ingest.requests += c.requests.load(std::memory_order_relaxed);
+      st.ingest.ok += c.ok.load(std::memory_order_relaxed);
+      st.ingest.accepted += c.accepted.load(std::memory_order_relaxed);
+      st.ingest.rejected += c.rejected.load(std::memory_order_relaxed);
+      st.ingest.backfillBatches += c.backfillBatches.load(std::memory_order_relaxed);
+      st.ingest.backfillReadings += c.backfillReadings.load(std::memory_order_relaxed);
+      st.points += c.points.load(std::memory_order_relaxed);
+      st.handedOff += c.handedOff.load(std::memory_order_relaxed);
+      st.hubDropped += c.hubDropped.load(std::memory_order_relaxed);
+      st.requests.push_back(c.requests.load(std::memory_order_relaxed));
+    }
+    return st;
+  }
+
+ private:
+  // Snapshots of a shard's counters for other threads to read
+  struct Counters {
+    std::atomic<uint64_t> connections{ 0 };
+    std::atomic<uint64_t> requests{ 0 };
+    std::atomic<uint64_t> ok{ 0 };
+    std::atomic<uint64_t> accepted{ 0 };
+    std::atomic<uint64_t> rejected{ 0 };
+    std::atomic<uint64_t> backfillBatches{ 0 };
+    std::atomic<uint64_t> backfillReadings{ 0 };
+    std::atomic<uint64_t> points{ 0 };
+    std::atomic<uint64_t> handedOff{ 0 };
+    std::atomic<uint64_t> hubDropped{ 0 };
+  };
+
+  struct Shard {
+    explicit Shard(LatestTable& latest) : server(latest) {}
+
+    int index = 0;
+    Server server;
+    TimeSeriesStore store;
+    MpscRing<PointChunk, SHARD_INBOX_CHUNKS> inbox;
+    Doorbell doorbell;
+    std::unique_ptr<PointChunk[]> outgoing;   // One per owner shard
+    std::vector<PointChunk> leftover;         // Not handed off at shutdown
+    bool notifyHub = false;
+    uint64_t points = 0;
+    uint64_t handedOff = 0;
+    uint64_t hubDropped = 0;
+    std::vector<int64_t> runT;
+    std::vector<int32_t> runV;
+    Counters counters;
+    std::thread thread;
+  };
+
+  size_t shard_of(uint64_t device) const {
+    // High bits: the table's shards use the low ones
+    return (size_t)(device_hash(device) >> 40) % shards_.size();
+  }
+
+  void wire(Shard& sh) {
+    Shard* s = &sh;
+    sh.server.onReading = [this, s](const Reading& r) {
+      int64_t now = shard_wall_ms();
+      if (storing_) {
+        for (int ch = 0; ch < NUM_SENSOR_CHANNELS; ch++) {
+          if (r.present & (1 << ch)) {
+            emit(*s, r.device, ch, now - reading_age_ms(r), r.centi[ch]);
+          }
+        }
+      }
+      LatestValue latest;
+      if (!publish_ || !latest_.read(r.device, latest)) {
+        return;
+      }
+      bool queued = messages_.push([&](HubMessage& m) {
+        m.device = r.device;
+        m.len = (uint32_t)format_latest(m.data, sizeof(m.data), r.device, latest, now / 1000.0,
+                                        shard_wall_ms() / 1000.0);
+      });
+      s->hubDropped += !queued;
+      s->notifyHub |= queued;
+    };
+    // Backlogs arrive grouped by device: emit them per channel so the
+    // owner sees each series as one run
+    sh.server.onBackfill = [this, s](const Reading* readings, size_t n) {
+      if (!storing_) {
+        return;
+      }
+      int64_t now = shard_wall_ms();
+      for (size_t first = 0, end; first < n; first = end) {
+        for (end = first + 1; end < n && readings[end].device == readings[first].device; end++) {
+        }
+        for (int ch = 0; ch < NUM_SENSOR_CHANNELS; ch++) {
+          for (size_t i = first; i < end; i++) {
+            if (readings[i].present & (1 << ch)) {
+              emit(*s, readings[i].device, ch, now - reading_age_ms(readings[i]), readings[i].centi[ch]);
+            }
+          }
+        }
+      }
+    };
+    sh.server.onUpgrade = [this, s](int fd, const char* data, size_t len) {
+      if (!publish_ || len > HUB_RX_SIZE || !is_subscribe_request(data, len)) {
+        return false;
+      }
+      bool queued = adoptions_.push([&](HubAdoption& a) {
+        a.fd = fd;
+        a.len = (uint32_t)len;
+        memcpy(a.data, data, len);
+      });
+      s->notifyHub |= queued;
+      return queued;
+    };
+  }
+
+  void emit(Shard& sh, uint64_t device, int channel, int64_t t, int32_t v) {
+    size_t owner = shard_of(device);
+    PointChunk& c = sh.outgoing[owner];
+    c.points[c.n++] = StorePoint{ device, t, v, (uint8_t)channel };
+    if (c.n == SHARD_CHUNK_POINTS) {
+      hand_off(sh, owner);
+    }
+  }
+
+  // Pass the buffered points for owner on: appended directly when sh owns
+  // them, queued otherwise. A full inbox is waited out while draining our
+  // own, so two shards filling each other's inboxes cannot deadlock; once
+  // stopping, the chunk is left to stop() instead.
+  void hand_off(Shard& sh, size_t owner) {
+    PointChunk& c = sh.outgoing[owner];
+    if (c.n == 0) {
+      return;
+    }
+    if ((int)owner == sh.index) {
+      apply(sh, c);
+    } else {
+      Shard& to = *shards_[owner];
+      while (!to.inbox.push([&c](PointChunk& slot) {
+        slot.n = c.n;
+        memcpy(slot.points, c.points, c.n * sizeof(StorePoint));
+      })) {
+        if (stopping_.load(std::memory_order_relaxed)) {
+          sh.leftover.push_back(c);
+          break;
+        }
+        to.doorbell.ring();
+        drain_inbox(sh);
+        sched_yield();
+      }
+      to.doorbell.ring();
+    }
+    c.n = 0;
+  }
+
+  // Append a chunk to sh's store, consecutive points of one series as a run
+  void apply(Shard& sh, const PointChunk& c) {
+    for (uint32_t i = 0, end; i < c.n; i = end) {
+      const StorePoint& p = c.points[i];
+      sh.runT.clear();
+      sh.runV.clear();
+      for (end = i; end < c.n && c.points[end].device == p.device && c.points[end].channel == p.channel; end++) {
+        sh.runT.push_back(c.points[end].t);
+        sh.runV.push_back(c.points[end].v);
+      }
+      sh.store.append_run(p.device, p.channel, sh.runT.data(), sh.runV.data(), sh.runT.size());
+    }
+    sh.points += c.n;
+  }
+
+  void drain_inbox(Shard& sh) {
+    sh.inbox.drain([this, &sh](PointChunk& c) {
+      apply(sh, c);
+      sh.handedOff += c.n;
+    });
+  }
+
+  void run(Shard& sh) {
+    pollfd fds[2] = { { server_fd(sh.server), POLLIN, 0 }, { sh.doorbell.fd(), POLLIN, 0 } };
+    while (!stopping_.load(std::memory_order_relaxed)) {
+      sh.doorbell.arm();
+      poll(fds, 2, sh.inbox.empty() ? 200 : 0);
+      sh.doorbell.disarm();
+      sh.server.run_once(0);
+      drain_inbox(sh);
+      for (size_t k = 0; k < shards_.size(); k++) {
+        hand_off(sh, k);
+      }
+      if (sh.notifyHub) {
+        sh.notifyHub = false;
+        hubBell_.ring();
+      }
+      publish_counters(sh);
+    }
+    publish_counters(sh);
+  }
+
+  void publish_counters(Shard& sh) {
+    const IngestStats& s = sh.server.stats();
+    Counters& c = sh.counters;
+    c.connections.store(s.connections, std::memory_order_relaxed);
+    c.requests.store(s.requests, std::memory_order_relaxed);
+    c.ok.store(s.ok, std::memory_order_relaxed);
+    c.accepted.store(s.accepted, std::memory_order_relaxed);
+    c.rejected.store(s.rejected, std::memory_order_relaxed);
+    c.backfillBatches.store(s.backfillBatches, std::memory_order_relaxed);
+    c.backfillReadings.store(s.backfillReadings, std::memory_order_relaxed);
+    c.points.store(sh.points, std::memory_order_relaxed);
+    c.handedOff.store(sh.handedOff, std::memory_order_relaxed);
+    c.hubDropped.store(sh.hubDropped, std::memory_order_relaxed);
+  }
+
+  LatestTable latest_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  MpscRing<HubMessage, SHARD_HUB_MESSAGES> messages_;
+  MpscRing<HubAdoption, 64> adoptions_;
+  Doorbell hubBell_;
+  std::atomic<bool> stopping_{ false };
+  uint16_t port_ = 0;
+  bool publish_ = false;
+  bool storing_ = false;
+};
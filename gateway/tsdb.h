@@ -0,0 +1,558 @@
+/*
+  Embedded time-series store for firmware readings.
+
+  One series per (device, channel). Each series appends into an in-memory
+  head block; a full head block is sealed into an append-only segment
+  file and read back through mmap. Blocks are columnar: a timestamp
+  column and a value column, each a bit stream in the Gorilla style:
+
+    timestamps  first value raw (64 bits), then delta-of-delta codes
+                  0                      dod == 0
+                  10   + 7 bits          -64 .. 63
+                  110  + 9 bits          -256 .. 255
+                  1110 + 12 bits         -2048 .. 2047
+                  1111 + 64 bits         anything else
+    values      first value raw (32 bits), then zigzag(delta) codes
+                  0                      unchanged
+                  10   + 7 bits          |delta| < 64
+                  110  + 12 bits         |delta| < 2048
+                  1110 + 20 bits         |delta| < 512k
+                  1111 + 32 bits         anything else
+
+  Values are the firmware's fixed-point hundredths (Reading::centi), so
+  an integer delta replaces Gorilla's XOR of doubles: a slowly drifting
+  reading costs 1 or 9 bits instead of a mantissa's worth.
+
+  Segments are fixed-size sparse files (seg-NNNNNN.tsb) mapped once, so
+  block pointers stay valid. A sealed block is its header, the timestamp
+  column, the value column, then the block's minute and hour rollup
+  buckets. Reopening scans the block headers to rebuild the index. Head
+  blocks live only in memory until flush() or sealing; a crash loses at
+  most one head block per series.
+
+  Points must arrive in time order per series. Older points are counted in
+  Stats::outOfOrder and dropped. A device's backlog is appended with
+  append_run(), one series lookup and one order check per run.
+
+  Each series also keeps minute and hour rollups (rollup.h), updated on
+  append and sealed with the head block; query() serves downsampled
+  ranges from them. Only the head block's buckets are held in memory.
+*/
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rollup.h"
+
+#ifndef TSDB_BLOCK_POINTS
+#define TSDB_BLOCK_POINTS 3600           // One hour of 1 Hz data per block
+#endif
+#ifndef TSDB_SEGMENT_BYTES
+#define TSDB_SEGMENT_BYTES (64u << 20)   // Sparse segment file size
+#endif
+
+const uint32_t TSDB_BLOCK_MAGIC = 0x32425354;  // "TSB2": rollups after the columns
+
+// device is a 56-bit key (Reading::device)
+inline uint64_t series_key(uint64_t device, int channel) {
+  return device << 8 | (uint8_t)channel;
+}
+
+// MSB-first bit stream over 64-bit words
+class BitWriter {
+ public:
+  void write(uint64_t bits, int n) {
+    if (n == 0) {
+      return;
+    }
+    bits &= n == 64 ? ~0ULL : (1ULL << n) - 1;
+    int used = (int)(bitLen_ & 63);
+    if (used == 0) {
+      words_.push_back(0);
+    }
+    int room = 64 - used;
+    if (n <= room) {
+      words_.back() |= bits << (room - n);
+    } else {
+      words_.back() |= bits >> (n - room);
+      words_.push_back(bits << (64 - (n - room)));
+    }
+    bitLen_ += n;
+  }
+
+  void clear() {
+    words_.clear();
+    bitLen_ = 0;
+  }
+
+  const std::vector<uint64_t>& words() const { return words_; }
+  size_t bytes() const { return words_.size() * 8; }
+
+ private:
+  std::vector<uint64_t> words_;
+  uint64_t bitLen_ = 0;
+};
+
+class BitReader {
+ public:
+  explicit BitReader(const uint64_t* words) : words_(words) {}
+
+  uint64_t read(int n) {
+    if (n == 0) {
+      return 0;
+    }
+    size_t word = pos_ >> 6;
+    int offset = (int)(pos_ & 63);
+    uint64_t v = words_[word] << offset;
+    if (offset + n > 64) {
+      v |= words_[word + 1] >> (64 - offset);
+    }
+    pos_ += n;
+    return v >> (64 - n);
+  }
+
+  // Length of a run of 1 bits, at most max (prefix codes)
+  int ones(int max) {
+    int n = 0;
+    while (n < max && read(1)) {
+      n++;
+    }
+    return n;
+  }
+
+ private:
+  const uint64_t* words_;
+  size_t pos_ = 0;
+};
+
+inline int64_t sign_extend(uint64_t v, int bits) {
+  return (int64_t)(v << (64 - bits)) >> (64 - bits);
+}
+
+inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+inline int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+// Encoder for one block: both columns plus the state of the last points
+class BlockEncoder {
+ public:
+  void append(int64_t t, int32_t v) {
+    if (count_ == 0) {
+      ts_.write((uint64_t)t, 64);
+      vals_.write((uint32_t)v, 32);
+      first_ = t;
+    } else {
+      int64_t delta = t - lastT_;
+      int64_t dod = delta - lastDelta_;
+      if (dod == 0) {
+        ts_.write(0, 1);
+      } else if (dod >= -64 && dod <= 63) {
+        ts_.write(0x2, 2);
+        ts_.write((uint64_t)dod, 7);
+      } else if (dod >= -256 && dod <= 255) {
+        ts_.write(0x6, 3);
+        ts_.write((uint64_t)dod, 9);
+      } else if (dod >= -2048 && dod <= 2047) {
+        ts_.write(0xE, 4);
+        ts_.write((uint64_t)dod, 12);
+      } else {
+        ts_.write(0xF, 4);
+        ts_.write((uint64_t)dod, 64);
+      }
+      lastDelta_ = delta;
+
+      uint32_t z = zigzag((int32_t)((uint32_t)v - (uint32_t)lastV_));
+      if (z == 0) {
+        vals_.write(0, 1);
+      } else if (z < (1u << 7)) {
+        vals_.write(0x2, 2);
+        vals_.write(z, 7);
+      } else if (z < (1u << 12)) {
+        vals_.write(0x6, 3);
+        vals_.write(z, 12);
+      } else if (z < (1u << 20)) {
+        vals_.write(0xE, 4);
+        vals_.write(z, 20);
+      } else {
+        vals_.write(0xF, 4);
+        vals_.write(z, 32);
+      }
+    }
+    lastT_ = t;
+    lastV_ = v;
+    count_++;
+  }
+
+  void clear() {
+    ts_.clear();
+    vals_.clear();
+    count_ = 0;
+    lastDelta_ = 0;
+  }
+
+  uint32_t count() const { return count_; }
+  int64_t first() const { return first_; }
+  int64_t last() const { return lastT_; }
+  const BitWriter& timestamps() const { return ts_; }
+  const BitWriter& values() const { return vals_; }
+  size_t bytes() const { return ts_.bytes() + vals_.bytes(); }
+
+ private:
+  BitWriter ts_;
+  BitWriter vals_;
+  uint32_t count_ = 0;
+  int64_t first_ = 0;
+  int64_t lastT_ = 0;
+  int64_t lastDelta_ = 0;
+  int32_t lastV_ = 0;
+};
+
+// Decode count points; f(t, v) for those within [from, to]
+template <class F>
+void decode_block(const uint64_t* ts, const uint64_t* vals, uint32_t count, int64_t from, int64_t to, F f) {
+  static const int DOD_BITS[5] = { 0, 7, 9, 12, 64 };
+  static const int VAL_BITS[5] = { 0, 7, 12, 20, 32 };
+  BitReader tr(ts);
+  BitReader vr(vals);
+  int64_t t = (int64_t)tr.read(64);
+  int32_t v = (int32_t)vr.read(32);
+  int64_t delta = 0;
+  for (uint32_t i = 0;;) {
+    if (t > to) {
+      return;
+    }
+    if (t >= from) {
+      f(t, v);
+    }
+    if (++i == count) {
+      return;
+    }
+    int code = tr.ones(4);
+    if (code) {
+      delta += sign_extend(tr.read(DOD_BITS[code]), DOD_BITS[code]);
+    }
+    t += delta;
+    code = vr.ones(4);
+    if (code) {
+      v = (int32_t)((uint32_t)v + (uint32_t)unzigzag((uint32_t)vr.read(VAL_BITS[code])));
+    }
+  }
+}
+
+class TimeSeriesStore {
+ public:
+  struct Stats {
+    uint64_t points = 0;
+    uint64_t outOfOrder = 0;
+    uint64_t blocks = 0;        // Sealed
+    uint64_t sealedBytes = 0;   // Headers and columns in segments
+    uint64_t headBytes = 0;     // Columns still in memory
+    uint64_t rollupBytes = 0;   // Minute and hour buckets of head blocks
+    uint64_t sealedRollupBytes = 0;  // Same, of sealed blocks (in sealedBytes)
+    uint64_t series = 0;
+  };
+
+  ~TimeSeriesStore() { close_segments(); }
+
+  // Open (or create) the store in dir and index every sealed block
+  bool open(const std::string& dir) {
+    dir_ = dir;
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+      return false;
+    }
+    std::vector<std::string> names;
+    while (dirent* e = readdir(d)) {
+      if (strncmp(e->d_name, "seg-", 4) == 0) {
+        names.push_back(e->d_name);
+      }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    for (const std::string& name : names) {
+      if (!map_segment(dir_ + "/" + name) || !index_segment(segments_.back())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Append one point; t in ms, v in hundredths
+  void append(uint64_t device, int channel, int64_t t, int32_t v) {
+    Series& s = series_[series_key(device, channel)];
+    if (s.head.count() > 0 ? t < s.head.last() : (!s.blocks.empty() && t < s.blocks.back().tMax)) {
+      stats_.outOfOrder++;
+      return;
+    }
+    s.head.append(t, v);
+    s.rollup.add(t, v);
+    stats_.points++;
+    if (s.head.count() >= TSDB_BLOCK_POINTS) {
+      seal(series_key(device, channel), s);
+    }
+  }
+
+  // Append points sorted by time, e.g. a device's backlog after an outage;
+  // those older than the series' last point are dropped as one prefix
+  void append_run(uint64_t device, int channel, const int64_t* t, const int32_t* v, size_t n) {
+    uint64_t key = series_key(device, channel);
+    Series& s = series_[key];
+    int64_t last = s.head.count() > 0 ? s.head.last() : !s.blocks.empty() ? s.blocks.back().tMax : INT64_MIN;
+    size_t i = std::lower_bound(t, t + n, last) - t;
+    stats_.outOfOrder += i;
+    stats_.points += n - i;
+    for (; i < n; i++) {
+      s.head.append(t[i], v[i]);
+      s.rollup.add(t[i], v[i]);
+      if (s.head.count() >= TSDB_BLOCK_POINTS) {
+        seal(key, s);
+      }
+    }
+  }
+
+  // Seal every head block (e.g. on shutdown)
+  bool flush() {
+    for (auto& kv : series_) {
+      if (kv.second.head.count() > 0 && !seal(kv.first, kv.second)) {
+        return false;
+      }
+    }
+    for (Segment& seg : segments_) {
+      msync(seg.base, seg.used, MS_ASYNC);
+    }
+    return true;
+  }
+
+  // f(t, v) for every point in [from, to], in time order
+  template <class F>
+  void scan(uint64_t device, int channel, int64_t from, int64_t to, F f) const {
+    auto it = series_.find(series_key(device, channel));
+    if (it == series_.end()) {
+      return;
+    }
+    const Series& s = it->second;
+    // Blocks are in time order: skip those that end before the range
+    auto first = std::lower_bound(s.blocks.begin(), s.blocks.end(), from,
+                                  [](const BlockRef& b, int64_t t) { return b.tMax < t; });
+    for (auto b = first; b != s.blocks.end() && b->tMin <= to; ++b) {
+      decode_block(b->ts, b->vals, b->count, from, to, f);
+    }
+    if (s.head.count() > 0 && s.head.first() <= to && s.head.last() >= from) {
+      decode_block(s.head.timestamps().words().data(), s.head.values().words().data(), s.head.count(), from, to,
+                   f);
+    }
+  }
+
+  // f(const Aggregate&) for every step-wide bucket in [from, to] that holds
+  // points, in time order. Buckets are aligned to multiples of step and read
+  // from the coarsest rollup whose buckets tile it, so the range widens to
+  // whole rollup buckets; steps under a minute aggregate raw points.
+  template <class F>
+  void query(uint64_t device, int channel, int64_t from, int64_t to, int64_t step, F f) const {
+    auto it = series_.find(series_key(device, channel));
+    if (it == series_.end() || step <= 0) {
+      return;
+    }
+    const Series& s = it->second;
+    StepAccumulator<F> acc(step, f);
+    for (int tier = NUM_ROLLUP_TIERS - 1; tier >= 0; tier--) {
+      int64_t width = ROLLUP_WIDTH_MS[tier];
+      if (step % width != 0) {
+        continue;
+      }
+      // Blocks whose buckets all end before the range hold nothing for it
+      int64_t fromBucket = from < INT64_MIN + width ? INT64_MIN : bucket_start(from, width);
+      auto first = std::lower_bound(s.blocks.begin(), s.blocks.end(), fromBucket,
+                                    [](const BlockRef& b, int64_t t) { return b.tMax < t; });
+      for (auto b = first; b != s.blocks.end() && bucket_start(b->tMin, width) <= to; ++b) {
+        add_buckets(b->rollups[tier], b->rollups[tier] + b->rollupCount[tier], width, from, to, acc);
+      }
+      const std::vector<Aggregate>& head = s.rollup.tier(tier);
+      add_buckets(head.data(), head.data() + head.size(), width, from, to, acc);
+      return;
+    }
+    scan(device, channel, from, to, [&acc](int64_t t, int32_t v) { acc.add(t, v); });
+  }
+
+  Stats stats() const {
+    Stats st = stats_;
+    st.series = series_.size();
+    for (const auto& kv : series_) {
+      st.headBytes += kv.second.head.bytes();
+      st.rollupBytes += kv.second.rollup.bytes();
+    }
+    return st;
+  }
+
+ private:
+  struct BlockHeader {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t series;
+    int64_t tMin;
+    int64_t tMax;
+    uint32_t tsBytes;    // Timestamp column, whole words
+    uint32_t valBytes;   // Value column, whole words
+    uint32_t rollupCount[NUM_ROLLUP_TIERS];   // Buckets per tier after the columns
+  };
+
+  struct BlockRef {
+    int64_t tMin;
+    int64_t tMax;
+    uint32_t count;
+    const uint64_t* ts;
+    const uint64_t* vals;
+    const Aggregate* rollups[NUM_ROLLUP_TIERS];
+    uint32_t rollupCount[NUM_ROLLUP_TIERS];
+  };
+
+  // Feed the buckets of [a, end) that overlap [from, to] to acc
+  template <class Acc>
+  static void add_buckets(const Aggregate* a, const Aggregate* end, int64_t width, int64_t from, int64_t to,
+                          Acc& acc) {
+    a = std::lower_bound(a, end, from, [width](const Aggregate& x, int64_t t) { return x.start + width <= t; });
+    for (; a != end && a->start <= to; ++a) {
+      acc.add(*a);
+    }
+  }
+
+  // Index a block laid out as header, columns, then its rollup buckets
+  static BlockRef block_ref(const BlockHeader* h) {
+    const uint64_t* ts = (const uint64_t*)(h + 1);
+    const uint64_t* vals = ts + h->tsBytes / 8;
+    BlockRef b{ h->tMin, h->tMax, h->count, ts, vals, {}, {} };
+    const Aggregate* a = (const Aggregate*)(vals + h->valBytes / 8);
+    for (int i = 0; i < NUM_ROLLUP_TIERS; i++) {
+      b.rollups[i] = a;
+      b.rollupCount[i] = h->rollupCount[i];
+      a += h->rollupCount[i];
+    }
+    return b;
+  }
+
+  static size_t rollup_bytes(const BlockHeader* h) {
+    size_t n = 0;
+    for (int i = 0; i < NUM_ROLLUP_TIERS; i++) {
+      n += h->rollupCount[i];
+    }
+    return n * sizeof(Aggregate);
+  }
+
+  struct Series {
+    BlockEncoder head;
+    std::vector<BlockRef> blocks;
+    SeriesRollup rollup;
+  };
+
+  struct Segment {
+    int fd;
+    uint8_t* base;
+    size_t used;
+  };
+
+  bool map_segment(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    if (ftruncate(fd, TSDB_SEGMENT_BYTES) != 0) {
+      ::close(fd);
+      return false;
+    }
+    void* base = mmap(nullptr, TSDB_SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    segments_.push_back(Segment{ fd, (uint8_t*)base, 0 });
+    return true;
+  }
+
+  bool index_segment(Segment& seg) {
+    while (seg.used + sizeof(BlockHeader) <= TSDB_SEGMENT_BYTES) {
+      const BlockHeader* h = (const BlockHeader*)(seg.base + seg.used);
+      if (h->magic != TSDB_BLOCK_MAGIC) {
+        break;
+      }
+      size_t size = sizeof(BlockHeader) + h->tsBytes + h->valBytes + rollup_bytes(h);
+      if (seg.used + size > TSDB_SEGMENT_BYTES) {
+        break;
+      }
+      // Segments hold each series' blocks in time order
+      series_[h->series].blocks.push_back(block_ref(h));
+      stats_.points += h->count;
+      stats_.blocks++;
+      stats_.sealedBytes += size;
+      stats_.sealedRollupBytes += rollup_bytes(h);
+      seg.used += size;
+    }
+    return true;
+  }
+
+  bool seal(uint64_t key, Series& s) {
+    const BlockEncoder& head = s.head;
+    size_t rollupBytes = 0;
+    for (int i = 0; i < NUM_ROLLUP_TIERS; i++) {
+      rollupBytes += s.rollup.tier(i).size() * sizeof(Aggregate);
+    }
+    size_t size = sizeof(BlockHeader) + head.bytes() + rollupBytes;
+    if (segments_.empty() || segments_.back().used + size > TSDB_SEGMENT_BYTES) {
+      char name[32];
+      snprintf(name, sizeof(name), "/seg-%06zu.tsb", segments_.size());
+      if (!map_segment(dir_ + name)) {
+        return false;
+      }
+    }
+    Segment& seg = segments_.back();
+    BlockHeader* h = (BlockHeader*)(seg.base + seg.used);
+    uint64_t* ts = (uint64_t*)(h + 1);
+    uint64_t* vals = ts + head.timestamps().words().size();
+    memcpy(ts, head.timestamps().words().data(), head.timestamps().bytes());
+    memcpy(vals, head.values().words().data(), head.values().bytes());
+    Aggregate* a = (Aggregate*)(vals + head.values().words().size());
+    for (int i = 0; i < NUM_ROLLUP_TIERS; i++) {
+      const std::vector<Aggregate>& b = s.rollup.tier(i);
+      memcpy(a, b.data(), b.size() * sizeof(Aggregate));
+      a += b.size();
+    }
+    *h = BlockHeader{ 0, head.count(), key, head.first(), head.last(), (uint32_t)head.timestamps().bytes(),
+                      (uint32_t)head.values().bytes(), {} };
+    for (int i = 0; i < NUM_ROLLUP_TIERS; i++) {
+      h->rollupCount[i] = (uint32_t)s.rollup.tier(i).size();
+    }
+    // Magic last: a torn write leaves the block invisible on reopen
+    __atomic_store_n(&h->magic, TSDB_BLOCK_MAGIC, __ATOMIC_RELEASE);
+    seg.used += size;
+
+    s.blocks.push_back(block_ref(h));
+    s.head.clear();
+    s.rollup.clear();
+    stats_.blocks++;
+    stats_.sealedBytes += size;
+    stats_.sealedRollupBytes += rollupBytes;
+    return true;
+  }
+
+  void close_segments() {
+    for (Segment& seg : segments_) {
+      munmap(seg.base, TSDB_SEGMENT_BYTES);
+      ::close(seg.fd);
+    }
+    segments_.clear();
+  }
+
+  std::string dir_;
+  std::vector<Segment> segments_;
+  std::unordered_map<uint64_t, Series> series_;
+  Stats stats_;
+};
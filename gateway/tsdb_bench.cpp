@@ -0,0 +1,232 @@
+/*
+  Ingest, size and scan benchmark for the time-series store, on readings
+  produced by the host build of the firmware.
+
+  The firmware runs on the simulated clock for --hours and every uplink
+  frame is parsed as the gateway would (BatchParser). The resulting
+  per-channel series (T and C at 1 Hz, PH every 10 s, with the scheduler's
+  real timing jitter) are replayed for --devices boards, each offset in
+  time and value so no two series are identical.
+
+  Downsampled queries of the whole range are timed at 1 s (raw points),
+  1 min and 1 h steps, and the rollups, which are stored with the blocks
+  and mapped on reopen, are checked against the raw points they summarize.
+
+  Build:
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        gateway/tsdb_bench.cpp -o tsdb_bench
+
+  Run:
+    ./tsdb_bench --devices 100 --hours 24 --dir /tmp/tsdb
+*/
+#include <sys/stat.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "firmware_sim.h"
+#include "batch_parser.h"
+#include "tsdb.h"
+
+struct Sample {
+  int64_t t;
+  int channel;
+  int32_t centi;
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Run the firmware for the given simulated time; return every channel
+// sample it uplinked, stamped with the device's TS millis()
+static std::vector<Sample> firmware_samples(double hours) {
+  sim::adcSource = [](uint8_t pin) {
+    // Diurnal drift plus ADC noise
+    double day = sim::clockUs / 86400e6 * 2 * PI;
+    return 1800 + (int)(500.0 * sin(day + pin) + 40.0 * sin(sim::clockUs / 97e6 * (pin + 1))) + (int)(rand() % 7) - 3;
+  };
+  firmware_setup();
+  std::vector<Sample> out;
+  BatchParser parser;
+  unsigned long sent = uplinkCount;
+  unsigned long endMs = millis() + (unsigned long)(hours * 3600e3);
+  while (millis() < endMs) {
+    firmware_loop();
+    delay(20);
+    if (uplinkCount == sent) {
+      continue;
+    }
+    sent = uplinkCount;
+    const std::string& req = sim::net.lastRequest;
+    size_t body = req.find("\r\n\r\n") + 4;
+    if (parser.parse(req.data() + body, req.size() - body) != PARSE_OK) {
+      continue;
+    }
+    const Reading& r = parser.readings()[0];
+    for (int ch = 0; ch < NUM_SENSOR_CHANNELS; ch++) {
+      if (r.present & (1 << ch)) {
+        out.push_back(Sample{ (int64_t)r.sentMs, ch, r.centi[ch] });
+      }
+    }
+  }
+  return out;
+}
+
+int main(int argc, char** argv) {
+  int devices = 100;
+  double hours = 24;
+  std::string dir = "/tmp/tsdb_bench";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    if (flag == "--devices") {
+      devices = atoi(argv[i + 1]);
+    } else if (flag == "--hours") {
+      hours = atof(argv[i + 1]);
+    } else if (flag == "--dir") {
+      dir = argv[i + 1];
+    }
+  }
+  mkdir(dir.c_str(), 0755);
+  std::string wipe = "rm -f " + dir + "/seg-*.tsb";
+  if (system(wipe.c_str()) != 0) {
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Sample> samples = firmware_samples(hours);
+  printf("Firmware: %zu samples over %.1f h simulated in %.1f s\n", samples.size(), hours, seconds_since(start));
+
+  const int64_t epochMs = 1767225600000LL;   // 2026-01-01
+  uint64_t points = 0;
+  {
+    TimeSeriesStore store;
+    if (!store.open(dir)) {
+      perror("tsdb_bench: open");
+      return 1;
+    }
+    start = std::chrono::steady_clock::now();
+    // Interleaved like live ingest: every device's frame for a given time
+    for (const Sample& s : samples) {
+      for (int d = 0; d < devices; d++) {
+        store.append((uint32_t)d, s.channel, epochMs + s.t + d * 37, s.centi + d);
+      }
+    }
+    double ingest = seconds_since(start);
+    store.flush();
+    TimeSeriesStore::Stats st = store.stats();
+    points = st.points;
+    printf("Ingest:   %llu points, %llu series in %.2f s  (%.1f M points/s)\n", (unsigned long long)st.points,
+           (unsigned long long)st.series, ingest, st.points / ingest / 1e6);
+    printf("Size:     %llu blocks, %.2f MB  (%.2f bytes/point vs 12 raw), of which rollups %.2f MB\n",
+           (unsigned long long)st.blocks, st.sealedBytes / 1e6, (double)st.sealedBytes / st.points,
+           st.sealedRollupBytes / 1e6);
+  }
+
+  // Reopen from the segment files and scan through mmap
+  TimeSeriesStore store;
+  start = std::chrono::steady_clock::now();
+  if (!store.open(dir)) {
+    perror("tsdb_bench: reopen");
+    return 1;
+  }
+  printf("Reopen:   %.1f ms to index %llu blocks, %.2f MB of rollups in memory\n", seconds_since(start) * 1e3,
+         (unsigned long long)store.stats().blocks, store.stats().rollupBytes / 1e6);
+
+  uint64_t scanned = 0;
+  int64_t checksum = 0;
+  start = std::chrono::steady_clock::now();
+  for (int d = 0; d < devices; d++) {
+    for (int ch = 0; ch < NUM_SENSOR_CHANNELS; ch++) {
+      store.scan((uint32_t)d, ch, INT64_MIN, INT64_MAX, [&](int64_t, int32_t v) {
+        scanned++;
+        checksum += v;
+      });
+    }
+  }
+  double full = seconds_since(start);
+  printf("Scan:     %llu points in %.2f s  (%.1f M points/s, checksum %lld)\n", (unsigned long long)scanned, full,
+         scanned / full / 1e6, (long long)checksum);
+  if (scanned != points) {
+    printf("MISMATCH: scanned %llu of %llu points\n", (unsigned long long)scanned, (unsigned long long)points);
+    return 1;
+  }
+
+  // One hour of one channel from the middle of the range, many times
+  int64_t mid = epochMs + (int64_t)(hours * 1800e3);
+  const int queries = 1000;
+  uint64_t hits = 0;
+  start = std::chrono::steady_clock::now();
+  for (int q = 0; q < queries; q++) {
+    store.scan((uint32_t)(q % devices), CH_T, mid, mid + 3600000, [&](int64_t, int32_t) { hits++; });
+  }
+  printf("Range:    1 h of one series in %.1f us avg (%llu points each)\n", seconds_since(start) / queries * 1e6,
+         (unsigned long long)(hits / queries));
+
+  // The whole range of one series, downsampled for a dashboard chart
+  int64_t end = epochMs + (int64_t)(hours * 3600e3) + devices * 37;
+  const int64_t steps[] = { 1000, 60000, 3600000 };
+  for (int64_t step : steps) {
+    int reps = step == 1000 ? 20 : 1000;
+    uint64_t buckets = 0;
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < reps; q++) {
+      store.query((uint32_t)(q % devices), CH_T, epochMs, end, step, [&](const Aggregate&) { buckets++; });
+    }
+    printf("Query:    %.0f h at %5llds steps in %8.1f us avg (%llu buckets each)\n", hours, (long long)(step / 1000),
+           seconds_since(start) / reps * 1e6, (unsigned long long)(buckets / reps));
+  }
+
+  // Minute rollups against the raw points of every series
+  for (int d = 0; d < devices; d++) {
+    for (int ch = 0; ch < NUM_SENSOR_CHANNELS; ch++) {
+      std::vector<Aggregate> raw;
+      std::vector<Aggregate> rolled;
+      store.scan((uint32_t)d, ch, INT64_MIN, INT64_MAX, [&](int64_t t, int32_t v) {
+        if (raw.empty() || raw.back().start != bucket_start(t, 60000)) {
+          raw.emplace_back();
+          raw.back().start = bucket_start(t, 60000);
+        }
+        raw.back().add(v);
+      });
+      store.query((uint32_t)d, ch, INT64_MIN, INT64_MAX, 60000, [&](const Aggregate& a) { rolled.push_back(a); });
+      bool same = raw.size() == rolled.size();
+      for (size_t i = 0; same && i < raw.size(); i++) {
+        same = raw[i].start == rolled[i].start && raw[i].min == rolled[i].min && raw[i].max == rolled[i].max
+               && raw[i].sum == rolled[i].sum && raw[i].count == rolled[i].count;
+      }
+      if (!same) {
+        printf("MISMATCH: minute rollup of device %d channel %d\n", d, ch);
+        return 1;
+      }
+    }
+  }
+  // Hour buckets of a window that starts and ends inside blocks
+  int64_t from = mid + 1234567, to = from + 6 * 3600000;
+  for (int d = 0; d < devices; d++) {
+    for (int ch = 0; ch < NUM_SENSOR_CHANNELS; ch++) {
+      std::vector<Aggregate> raw;
+      std::vector<Aggregate> rolled;
+      store.scan((uint32_t)d, ch, bucket_start(from, 3600000), bucket_start(to, 3600000) + 3599999,
+                 [&](int64_t t, int32_t v) {
+                   if (raw.empty() || raw.back().start != bucket_start(t, 3600000)) {
+                     raw.emplace_back();
+                     raw.back().start = bucket_start(t, 3600000);
+                   }
+                   raw.back().add(v);
+                 });
+      store.query((uint32_t)d, ch, from, to, 3600000, [&](const Aggregate& a) { rolled.push_back(a); });
+      bool same = raw.size() == rolled.size();
+      for (size_t i = 0; same && i < raw.size(); i++) {
+        same = raw[i].start == rolled[i].start && raw[i].sum == rolled[i].sum && raw[i].count == rolled[i].count;
+      }
+      if (!same) {
+        printf("MISMATCH: hour rollup of device %d channel %d\n", d, ch);
+        return 1;
+      }
+    }
+  }
+  printf("Rollups:  minute and hour buckets match the raw points\n");
+  return 0;
+}
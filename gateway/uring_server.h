@@ -0,0 +1,501 @@
+/*
+  io_uring backend for the ingest server.
+
+  Same protocol, callbacks and counters as IngestServer (both derive from
+  IngestProtocol in ingest_server.h); only the socket I/O differs:
+  - One multishot accept stays armed on the listening socket.
+  - Every connection keeps one multishot recv armed that draws from a
+    ring of provided buffers shared by all connections, so an idle
+    connection pins no receive buffer. Requests that arrive whole (the
+    common case for the firmware's ~200 byte POSTs) are parsed straight
+    out of the provided buffer, which goes back to the ring at once; only
+    a partial request is copied into the connection.
+  - Responses are queued while a batch of completions is handled, then
+    each connection gets one SEND, submitted together with any recv
+    re-arms and buffer returns in a single io_uring_enter().
+  A burst of requests over many connections thus costs one syscall to
+  reap and answer it, where epoll needs an epoll_wait plus a recv and a
+  send per connection.
+
+  The rings are mapped and driven directly rather than through liburing.
+  Needs Linux 6.0 (multishot recv with buffer rings); start() fails where
+  io_uring is missing or disabled, and callers fall back to IngestServer.
+*/
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "ingest_server.h"
+
+#ifndef URING_ENTRIES
+#define URING_ENTRIES 4096       // Submission queue; the completion queue is 4x
+#endif
+#ifndef URING_BUFFERS
+#define URING_BUFFERS 4096       // Provided receive buffers, a power of two
+#endif
+#ifndef URING_BUFFER_SIZE
+#define URING_BUFFER_SIZE 2048
+#endif
+
+class UringIngestServer : public IngestProtocol {
+ public:
+  UringIngestServer() {}
+
+  // Merge into a table shared with other servers
+  explicit UringIngestServer(LatestTable& latest) : IngestProtocol(latest) {}
+
+  ~UringIngestServer() {
+    for (auto& c : conns_) {
+      if (c && !c->dead) {
+        close(c->fd);
+      }
+    }
+    if (listenFd_ >= 0) {
+      close(listenFd_);
+    }
+    // Closing the ring cancels whatever is still in flight
+    if (ringFd_ >= 0) {
+      close(ringFd_);
+    }
+    if (ring_) {
+      munmap(ring_, ringSize_);
+    }
+    if (sqes_) {
+      munmap(sqes_, sqEntries_ * sizeof(io_uring_sqe));
+    }
+    if (bufRing_) {
+      munmap(bufRing_, URING_BUFFERS * sizeof(io_uring_buf));
+    }
+    if (buffers_) {
+      munmap(buffers_, (size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+    }
+  }
+
+  // Bind, listen and arm the accept; port 0 picks a free port (see
+  // port()). False on error or without io_uring support.
+  bool start(uint16_t port, int backlog = 1024, bool reusePort = false) {
+    if (!setup_ring() || !setup_buffers()) {
+      return false;
+    }
+    listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) {
+      return false;
+    }
+    int one = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reusePort) {
+      setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    socklen_t len = sizeof(addr);
+    if (bind(listenFd_, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd_, backlog) != 0
+        || getsockname(listenFd_, (sockaddr*)&addr, &len) != 0) {
+      return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    arm_accept();
+    return enter(0, 0) >= 0;
+  }
+
+  uint16_t port() const { return port_; }
+
+  // Readable (poll()) when completions are waiting
+  int ring_fd() const { return ringFd_; }
+
+  // io_uring_enter() calls so far, for comparing syscalls per request
+  uint64_t enters() const { return enters_; }
+
+  // Wait up to timeoutMs for completions, handle them and submit the
+  // resulting sends and re-arms
+  void run_once(int timeoutMs) {
+    enter(timeoutMs != 0 ? 1 : 0, timeoutMs);
+    reap();
+    flush_dirty();
+    if (sqTail_ != __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE)) {
+      enter(0, 0);
+    }
+  }
+
+ private:
+  enum Op : uint8_t { OP_ACCEPT, OP_RECV, OP_SEND, OP_CANCEL };
+
+  struct Conn {
+    int fd;
+    uint32_t slot;
+    bool closing = false;     // Close once tx drains
+    bool dead = false;        // Closed or handed over; freed once idle
+    bool recvArmed = false;
+    bool sending = false;     // tx[txOff, txLen) being sent
+    bool dirty = false;       // In dirty_
+    size_t rxLen = 0;
+    size_t txOff = 0;
+    size_t txLen = 0;
+    char rx[INGEST_RX_SIZE];
+    char tx[INGEST_TX_SIZE];
+  };
+
+  static uint64_t user_data(uint32_t slot, Op op) { return (uint64_t)slot << 8 | op; }
+
+  bool setup_ring() {
+    io_uring_params p = {};
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = URING_ENTRIES * 4;
+    ringFd_ = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (ringFd_ < 0 && errno == EINVAL) {
+      p = {};
+      p.flags = IORING_SETUP_CQSIZE;
+      p.cq_entries = URING_ENTRIES * 4;
+      ringFd_ = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    }
+    uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if (ringFd_ < 0 || (p.features & needed) != needed) {
+      errno = ringFd_ < 0 ? errno : ENOSYS;
+      return false;
+    }
+    sqEntries_ = p.sq_entries;
+    ringSize_ = std::max(p.sq_off.array + p.sq_entries * sizeof(uint32_t),
+                         p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+    void* ring = mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_,
+                      IORING_OFF_SQ_RING);
+    void* sqes = mmap(nullptr, sqEntries_ * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+    if (ring == MAP_FAILED || sqes == MAP_FAILED) {
+      return false;
+    }
+    ring_ = (uint8_t*)ring;
+    sqes_ = (io_uring_sqe*)sqes;
+    sqHead_ = (uint32_t*)(ring_ + p.sq_off.head);
+    sqTailPtr_ = (uint32_t*)(ring_ + p.sq_off.tail);
+    sqMask_ = *(uint32_t*)(ring_ + p.sq_off.ring_mask);
+    cqHead_ = (uint32_t*)(ring_ + p.cq_off.head);
+    cqTail_ = (uint32_t*)(ring_ + p.cq_off.tail);
+    cqMask_ = *(uint32_t*)(ring_ + p.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe*)(ring_ + p.cq_off.cqes);
+    // Slot i of the submission ring always holds sqes_[i]
+    uint32_t* array = (uint32_t*)(ring_ + p.sq_off.array);
+    for (uint32_t i = 0; i < sqEntries_; i++) {
+      array[i] = i;
+    }
+    sqTail_ = *sqTailPtr_;
+    return true;
+  }
+
+  bool setup_buffers() {
+    void* ring = mmap(nullptr, URING_BUFFERS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void* buffers = mmap(nullptr, (size_t)URING_BUFFERS * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED || buffers == MAP_FAILED) {
+      return false;
+    }
+    bufRing_ = (io_uring_buf*)ring;
+    buffers_ = (char*)buffers;
+    io_uring_buf_reg reg = {};
+    reg.ring_addr = (uint64_t)(uintptr_t)bufRing_;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+      return false;
+    }
+    for (uint16_t bid = 0; bid < URING_BUFFERS; bid++) {
+      recycle(bid);
+    }
+    publish_buffers();
+    return true;
+  }
+
+  // Submit what is queued and wait for up to `wait` completions
+  int enter(unsigned wait, int timeoutMs) {
+    __atomic_store_n(sqTailPtr_, sqTail_, __ATOMIC_RELEASE);
+    unsigned submit = sqTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    __kernel_timespec ts = { timeoutMs / 1000, (long long)(timeoutMs % 1000) * 1000000 };
+    io_uring_getevents_arg arg = {};
+    arg.ts = timeoutMs > 0 ? (uint64_t)(uintptr_t)&ts : 0;
+    enters_++;
+    int n = (int)syscall(__NR_io_uring_enter, ringFd_, submit, wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                         &arg, sizeof(arg));
+    return n < 0 && (errno == ETIME || errno == EINTR) ? 0 : n;
+  }
+
+  io_uring_sqe* next_sqe() {
+    if (sqTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) == sqEntries_) {
+      enter(0, 0);   // Full: push what is queued first
+    }
+    io_uring_sqe* sqe = &sqes_[sqTail_ & sqMask_];
+    memset(sqe, 0, sizeof(*sqe));
+    sqTail_++;
+    return sqe;
+  }
+
+  void arm_accept() {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = user_data(0, OP_ACCEPT);
+  }
+
+  void arm_recv(Conn& c) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = user_data(c.slot, OP_RECV);
+    c.recvArmed = true;
+  }
+
+  void send_tx(Conn& c) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c.fd;
+    sqe->addr = (uint64_t)(uintptr_t)(c.tx + c.txOff);
+    sqe->len = (uint32_t)(c.txLen - c.txOff);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data(c.slot, OP_SEND);
+    c.sending = true;
+  }
+
+  void recycle(uint16_t bid) {
+    // Field by field: entry 0's resv word is the ring tail
+    io_uring_buf& b = bufRing_[bufTail_ & (URING_BUFFERS - 1)];
+    b.addr = (uint64_t)(uintptr_t)(buffers_ + (size_t)bid * URING_BUFFER_SIZE);
+    b.len = URING_BUFFER_SIZE;
+    b.bid = bid;
+    bufTail_++;
+  }
+
+  void publish_buffers() {
+    __atomic_store_n(&bufRing_[0].resv, bufTail_, __ATOMIC_RELEASE);
+  }
+
+  void reap() {
+    uint32_t head = *cqHead_;
+    uint32_t tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const io_uring_cqe& cqe = cqes_[head & cqMask_];
+      uint32_t slot = (uint32_t)(cqe.user_data >> 8);
+      switch ((Op)(cqe.user_data & 0xFF)) {
+        case OP_ACCEPT:
+          on_accept(cqe.res, cqe.flags);
+          break;
+        case OP_RECV:
+          on_recv(*conns_[slot], cqe.res, cqe.flags);
+          break;
+        case OP_SEND:
+          on_send(*conns_[slot], cqe.res);
+          break;
+        case OP_CANCEL:
+          break;
+      }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    publish_buffers();
+  }
+
+  void on_accept(int res, uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+      arm_accept();
+    }
+    if (res < 0) {
+      return;
+    }
+    int one = 1;
+    setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    uint32_t slot;
+    if (!free_.empty()) {
+      slot = free_.back();
+      free_.pop_back();
+    } else {
+      slot = (uint32_t)conns_.size();
+      conns_.emplace_back();
+    }
+    conns_[slot].reset(new Conn());
+    Conn& c = *conns_[slot];
+    c.fd = res;
+    c.slot = slot;
+    arm_recv(c);
+    stats_.connections++;
+  }
+
+  void on_recv(Conn& c, int res, uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+      c.recvArmed = false;
+    }
+    if (flags & IORING_CQE_F_BUFFER) {
+      uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+      if (res > 0 && !c.dead) {
+        receive(c, buffers_ + (size_t)bid * URING_BUFFER_SIZE, res);
+      }
+      recycle(bid);
+    }
+    if (!c.dead && (res == 0 || (res < 0 && res != -ENOBUFS))) {
+      close_conn(c);   // Peer closed or reset
+    } else if (!c.recvArmed && !c.dead) {
+      mark_dirty(c);   // Multishot ended (e.g. out of buffers): re-arm
+    }
+    release_if_idle(c);
+  }
+
+  void on_send(Conn& c, int res) {
+    c.sending = false;
+    if (res < 0) {
+      close_conn(c);
+    } else {
+      c.txOff += res;
+      if (c.txOff == c.txLen) {
+        c.txOff = c.txLen = 0;
+      }
+      mark_dirty(c);   // Send the rest, or close once drained
+    }
+    release_if_idle(c);
+  }
+
+  // Serve what arrived; whole requests straight from the buffer, partial
+  // ones through rx
+  void receive(Conn& c, const char* data, size_t n) {
+    if (c.closing) {
+      return;
+    }
+    if (c.rxLen == 0) {
+      size_t used = serve_conn(c, data, n);
+      data += used;
+      n -= used;
+    }
+    while (n > 0 && !c.closing && !c.dead) {
+      size_t take = std::min(n, sizeof(c.rx) - c.rxLen);
+      if (take == 0) {
+        // A full buffer without a complete request: too large to accept
+        respond(c, 413, true);
+        c.rxLen = 0;
+        return;
+      }
+      memcpy(c.rx + c.rxLen, data, take);
+      c.rxLen += take;
+      data += take;
+      n -= take;
+      size_t used = serve_conn(c, c.rx, c.rxLen);
+      if (c.dead) {
+        return;
+      }
+      memmove(c.rx, c.rx + used, c.rxLen - used);
+      c.rxLen -= used;
+    }
+  }
+
+  size_t serve_conn(Conn& c, const char* data, size_t len) {
+    bool upgraded = false;
+    size_t used = serve(c.fd, data, len, c.txLen == 0, upgraded, [this, &c](int code, bool close) {
+      respond(c, code, close);
+      return !c.closing;
+    });
+    if (upgraded) {
+      // The fd now belongs to the callee: stop receiving without closing
+      io_uring_sqe* sqe = next_sqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = user_data(c.slot, OP_RECV);
+      sqe->user_data = user_data(c.slot, OP_CANCEL);
+      c.dead = true;
+    }
+    return used;
+  }
+
+  void respond(Conn& c, int code, bool close) {
+    if (c.txLen + RESPONSE_MAX > sizeof(c.tx) && !c.sending && c.txOff > 0) {
+      memmove(c.tx, c.tx + c.txOff, c.txLen - c.txOff);
+      c.txLen -= c.txOff;
+      c.txOff = 0;
+    }
+    if (c.txLen + RESPONSE_MAX > sizeof(c.tx)) {
+      c.closing = true;   // Client is not reading its responses
+      mark_dirty(c);
+      return;
+    }
+    c.txLen += format_response(c.tx + c.txLen, code, close);
+    c.closing |= close;
+    mark_dirty(c);
+  }
+
+  void mark_dirty(Conn& c) {
+    if (!c.dirty) {
+      c.dirty = true;
+      dirty_.push_back(c.slot);
+    }
+  }
+
+  // One send per connection with queued responses, plus re-arms and closes
+  void flush_dirty() {
+    for (uint32_t slot : dirty_) {
+      Conn* c = conns_[slot].get();
+      if (!c) {
+        continue;
+      }
+      c->dirty = false;
+      if (c->dead) {
+        release_if_idle(*c);
+        continue;
+      }
+      if (!c->sending && c->txOff < c->txLen) {
+        send_tx(*c);
+      } else if (!c->sending && c->closing) {
+        close_conn(*c);
+        release_if_idle(*c);
+        continue;
+      }
+      if (!c->recvArmed && !c->closing) {
+        arm_recv(*c);
+      }
+    }
+    dirty_.clear();
+  }
+
+  void close_conn(Conn& c) {
+    if (c.dead) {
+      return;
+    }
+    c.dead = true;
+    // Ends the armed recv (and any send) so the Conn can be freed
+    shutdown(c.fd, SHUT_RDWR);
+    close(c.fd);
+  }
+
+  // Free a dead connection once the kernel no longer references it
+  void release_if_idle(Conn& c) {
+    if (c.dead && !c.recvArmed && !c.sending && !c.dirty) {
+      uint32_t slot = c.slot;
+      conns_[slot].reset();
+      free_.push_back(slot);
+    }
+  }
+
+  int listenFd_ = -1;
+  int ringFd_ = -1;
+  uint16_t port_ = 0;
+  uint8_t* ring_ = nullptr;
+  size_t ringSize_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  uint32_t sqEntries_ = 0;
+  uint32_t* sqHead_ = nullptr;
+  uint32_t* sqTailPtr_ = nullptr;
+  uint32_t sqTail_ = 0;   // Ours until enter() publishes it
+  uint32_t sqMask_ = 0;
+  uint32_t* cqHead_ = nullptr;
+  uint32_t* cqTail_ = nullptr;
+  uint32_t cqMask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+  io_uring_buf* bufRing_ = nullptr;
+  char* buffers_ = nullptr;
+  uint16_t bufTail_ = 0;
+  uint64_t enters_ = 0;
+  std::vector<std::unique_ptr<Conn>> conns_;
+  std::vector<uint32_t> free_;
+  std::vector<uint32_t> dirty_;
+};
@@ -0,0 +1,625 @@
+/*
+  WebSocket fan-out hub for dashboard subscribers.
+
+  Replaces client_endpoint() in water_monitor.py, which starts a task per
+  client that re-sends latest_data every 3 s, and the pub/sub endpoint,
+  which serializes every update once per subscriber. Here an update is
+  pushed only when it happens:
+
+  - publish() encodes the WebSocket frame once into a pooled, refcounted
+    HubFrame. Every subscriber's queue holds a reference to the same bytes.
+  - A subscriber whose socket is writable gets the frame straight away. A
+    slow one keeps at most one queued frame per device: a newer update
+    replaces the queued one (latest wins) instead of piling up behind it.
+    Only a frame already partly written is always finished.
+  - New subscribers first get the latest frame of every device, like the
+    initial send_json() of client_endpoint().
+
+  Subscribers connect with GET /water-monitor (the dashboard's URL) either
+  on the hub's own port or handed over from IngestServer::onUpgrade, so
+  devices and dashboards can share one port. Client text frames are read
+  and ignored; ping and close are answered.
+
+  One thread, one epoll set, like IngestServer.
+*/
+#pragma once
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "ingest_server.h"
+
+#ifndef HUB_FRAME_SIZE
+#define HUB_FRAME_SIZE 512   // Largest encoded frame (header + payload)
+#endif
+#ifndef HUB_RX_SIZE
+#define HUB_RX_SIZE 2048     // Handshake request (browsers send cookies)
+#endif
+
+const char HUB_PATH[] = "/water-monitor";
+const uint64_t HUB_CONTROL_KEY = ~0ULL;   // Queue slot for pong / close
+
+struct HubStats {
+  uint64_t subscribers = 0;   // Open now
+  uint64_t handshakes = 0;
+  uint64_t published = 0;     // Frames encoded
+  uint64_t delivered = 0;     // Frames fully written to a subscriber
+  uint64_t coalesced = 0;     // Queued frames replaced by a newer one
+  uint64_t dropped = 0;       // Connections closed on error or protocol violation
+  uint64_t frames = 0;        // HubFrames allocated (pool size)
+};
+
+// One encoded frame shared by every subscriber that queued it
+struct HubFrame {
+  uint32_t refs;
+  uint32_t len;
+  HubFrame* next;   // Free list
+  char data[HUB_FRAME_SIZE];
+};
+
+// SHA-1 of a short message (the handshake key), for Sec-WebSocket-Accept
+inline void sha1(const uint8_t* msg, size_t len, uint8_t out[20]) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  auto rol = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+  uint64_t bits = (uint64_t)len * 8;
+  size_t total = (len + 8) / 64 * 64 + 64;
+  for (size_t off = 0; off < total; off += 64) {
+    uint8_t block[64];
+    for (int i = 0; i < 64; i++) {
+      size_t p = off + i;
+      block[i] = p < len ? msg[p] : p == len ? 0x80 : p >= total - 8 ? (uint8_t)(bits >> (8 * (total - 1 - p))) : 0;
+    }
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = rol(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rol(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  for (int i = 0; i < 20; i++) {
+    out[i] = (uint8_t)(h[i / 4] >> (24 - 8 * (i % 4)));
+  }
+}
+
+// Sec-WebSocket-Accept for a Sec-WebSocket-Key (28 characters + NUL)
+inline void websocket_accept(const char* key, size_t keyLen, char out[29]) {
+  static const char GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  static const char B64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  uint8_t msg[128];
+  keyLen = keyLen < sizeof(msg) - sizeof(GUID) ? keyLen : sizeof(msg) - sizeof(GUID);
+  memcpy(msg, key, keyLen);
+  memcpy(msg + keyLen, GUID, sizeof(GUID) - 1);
+  uint8_t digest[21];
+  sha1(msg, keyLen + sizeof(GUID) - 1, digest);
+  digest[20] = 0;
+  for (int i = 0, o = 0; i < 21; i += 3, o += 4) {
+    uint32_t v = (uint32_t)digest[i] << 16 | (i + 1 < 21 ? digest[i + 1] << 8 : 0) | (i + 2 < 21 ? digest[i + 2] : 0);
+    out[o] = B64[v >> 18];
+    out[o + 1] = B64[(v >> 12) & 63];
+    out[o + 2] = B64[(v >> 6) & 63];
+    out[o + 3] = B64[v & 63];
+  }
+  out[27] = '=';
+  out[28] = 0;
+}
+
+// Dashboard message for a device: its merged channels and quality flags
+// (like latest_data), the device ID when frames carry one, and the trace
+// of its last frame. recvS / pubS are wall-clock seconds; "push" equals
+// "pub" because the frame is encoded once for every subscriber.
+inline size_t format_latest(char* out, size_t size, uint64_t device, const LatestValue& l, double recvS,
+                            double pubS) {
+  size_t n = 0;
+  auto put = [&](const char* fmt, auto... args) {
+    int w = snprintf(out + n, n < size ? size - n : 0, fmt, args...);
+    n += w > 0 ? (size_t)w : 0;
+  };
+  put("{");
+  const char* sep = "";
+  if (device) {
+    put("\"D\":\"%012llx\"", (unsigned long long)device);
+    sep = ",";
+  }
+  for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+    if (l.present & (1 << i)) {
+      put("%s\"%s\":%.2f", sep, CHANNEL_KEYS[i], l.centi[i] / 100.0);
+      sep = ",";
+    }
+  }
+  bool faulted = false;
+  for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+    if ((l.present & (1 << i)) && l.quality[i]) {
+      put("%s\"%s\":%u", faulted ? "," : ",\"Q\":{", CHANNEL_KEYS[i], l.quality[i]);
+      faulted = true;
+    }
+  }
+  if (faulted) {
+    put("}");
+  }
+  if (l.hasTrace) {
+    double acq = recvS - ((double)l.sentMs - l.acquiredMs) / 1000.0;
+    put(",\"trace\":{\"id\":%u,\"ta\":%u,\"ts\":%u,\"acq\":%.6f,\"recv\":%.6f,\"pub\":%.6f,\"push\":%.6f}", l.seq,
+        l.acquiredMs, l.sentMs, acq, recvS, pubS, pubS);
+  }
+  put("}");
+  return n < size ? n : 0;
+}
+
+// Request line of a dashboard subscription: GET /water-monitor HTTP/1.1
+inline bool is_subscribe_request(const char* p, size_t len) {
+  size_t pathLen = sizeof(HUB_PATH) - 1;
+  return len > 5 + pathLen && memcmp(p, "GET ", 4) == 0 && memcmp(p + 4, HUB_PATH, pathLen) == 0
+         && p[4 + pathLen] == ' ';
+}
+
+class WsHub {
+ public:
+  ~WsHub() {
+    for (auto& s : subs_) {
+      if (s) {
+        close(s->fd);
+      }
+    }
+    if (listenFd_ >= 0) {
+      close(listenFd_);
+    }
+    if (epollFd_ >= 0) {
+      close(epollFd_);
+    }
+  }
+
+  // Create the epoll set and, unless port is negative, a listener of its
+  // own (0 picks a free port). False on error.
+  bool start(int port, int backlog = 1024) {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+      return false;
+    }
+    if (port < 0) {
+      return true;
+    }
+    listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) {
+      return false;
+    }
+    int one = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    socklen_t len = sizeof(addr);
+    if (bind(listenFd_, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd_, backlog) != 0
+        || getsockname(listenFd_, (sockaddr*)&addr, &len) != 0) {
+      return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd_;
+    return epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &ev) == 0;
+  }
+
+  uint16_t port() const { return port_; }
+  int epoll_fd() const { return epollFd_; }
+
+  // Take over a connection whose first request bytes were already read
+  // (IngestServer::onUpgrade)
+  void adopt(int fd, const char* data, size_t len) {
+    Sub* s = add(fd);
+    if (!s) {
+      return;
+    }
+    if (len > sizeof(s->rx)) {
+      drop(*s, true);
+      return;
+    }
+    memcpy(s->rx, data, len);
+    s->rxLen = len;
+    if (handle_input(*s)) {
+      drain(*s);
+    }
+  }
+
+  // Wait up to timeoutMs for socket events and handle them
+  void run_once(int timeoutMs) {
+    epoll_event events[64];
+    int n = epoll_wait(epollFd_, events, 64, timeoutMs);
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == listenFd_) {
+        accept_all();
+        continue;
+      }
+      Sub* s = fd < (int)subs_.size() ? subs_[fd].get() : nullptr;
+      if (!s) {
+        continue;
+      }
+      if (events[i].events & EPOLLOUT) {
+        drain(*s);   // May close the connection
+      }
+      if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && subs_[fd]) {
+        on_readable(*s);
+      }
+    }
+  }
+
+  // Encode a text frame once and queue it for every open subscriber.
+  // False if the payload does not fit a HubFrame.
+  bool publish(uint64_t device, const char* payload, size_t len) {
+    HubFrame* f = frame(0x1, payload, len);
+    if (!f) {
+      return false;
+    }
+    stats_.published++;
+    HubFrame*& latest = latest_[device];
+    if (latest) {
+      unref(latest);
+    }
+    latest = f;   // The hub's own reference
+    // Index loop: drain() may drop a subscriber and reorder open_
+    for (size_t i = 0; i < open_.size();) {
+      Sub* s = open_[i];
+      enqueue(*s, device, f);
+      if (i < open_.size() && open_[i] == s) {
+        i++;
+      }
+    }
+    return true;
+  }
+
+  const HubStats& stats() const { return stats_; }
+
+ private:
+  struct Pending {
+    uint64_t key;   // Device, or HUB_CONTROL_KEY
+    HubFrame* frame;
+  };
+
+  struct Sub {
+    int fd;
+    bool open = false;        // Handshake done
+    bool closing = false;     // Close once the queue drains
+    bool wantWrite = false;   // EPOLLOUT registered
+    size_t openIndex = 0;     // Position in open_
+    HubFrame* inflight = nullptr;
+    size_t offset = 0;        // Bytes of inflight already written
+    std::vector<Pending> pending;
+    size_t rxLen = 0;
+    char rx[HUB_RX_SIZE];
+  };
+
+  HubFrame* alloc_frame() {
+    HubFrame* f = free_;
+    if (f) {
+      free_ = f->next;
+    } else {
+      pool_.emplace_back(new HubFrame());
+      f = pool_.back().get();
+      stats_.frames++;
+    }
+    f->refs = 1;
+    f->len = 0;
+    return f;
+  }
+
+  void unref(HubFrame* f) {
+    if (--f->refs == 0) {
+      f->next = free_;
+      free_ = f;
+    }
+  }
+
+  // Unmasked server frame: FIN + opcode, 7- or 16-bit length, payload
+  HubFrame* frame(uint8_t opcode, const char* payload, size_t len) {
+    size_t head = len < 126 ? 2 : 4;
+    if (head + len > HUB_FRAME_SIZE) {
+      return nullptr;
+    }
+    HubFrame* f = alloc_frame();
+    f->data[0] = (char)(0x80 | opcode);
+    if (len < 126) {
+      f->data[1] = (char)len;
+    } else {
+      f->data[1] = 126;
+      f->data[2] = (char)(len >> 8);
+      f->data[3] = (char)len;
+    }
+    memcpy(f->data + head, payload, len);
+    f->len = (uint32_t)(head + len);
+    return f;
+  }
+
+  Sub* add(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (fd >= (int)subs_.size()) {
+      subs_.resize(fd + 1);
+    }
+    subs_[fd].reset(new Sub());
+    subs_[fd]->fd = fd;
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close(fd);
+      subs_[fd].reset();
+      return nullptr;
+    }
+    return subs_[fd].get();
+  }
+
+  void accept_all() {
+    for (;;) {
+      int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        return;
+      }
+      add(fd);
+    }
+  }
+
+  void drop(Sub& s, bool error) {
+    int fd = s.fd;
+    if (s.inflight) {
+      unref(s.inflight);
+    }
+    for (Pending& p : s.pending) {
+      unref(p.frame);
+    }
+    if (s.open) {
+      Sub* last = open_.back();
+      open_[s.openIndex] = last;
+      last->openIndex = s.openIndex;
+      open_.pop_back();
+      stats_.subscribers--;
+    }
+    if (error) {
+      stats_.dropped++;
+    }
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    subs_[fd].reset();
+  }
+
+  // Takes a reference to f
+  void enqueue(Sub& s, uint64_t key, HubFrame* f) {
+    f->refs++;
+    if (!s.inflight && s.pending.empty()) {
+      s.inflight = f;
+      s.offset = 0;
+      drain(s);
+      return;
+    }
+    for (Pending& p : s.pending) {
+      if (p.key == key) {
+        unref(p.frame);
+        p.frame = f;
+        stats_.coalesced++;
+        return;
+      }
+    }
+    s.pending.push_back(Pending{ key, f });
+  }
+
+  // Write queued frames until the socket would block
+  void drain(Sub& s) {
+    while (s.inflight) {
+      HubFrame* f = s.inflight;
+      ssize_t n = send(s.fd, f->data + s.offset, f->len - s.offset, MSG_NOSIGNAL);
+      if (n > 0) {
+        s.offset += n;
+        if (s.offset == f->len) {
+          unref(f);
+          stats_.delivered++;
+          s.inflight = nullptr;
+          s.offset = 0;
+          if (!s.pending.empty()) {
+            s.inflight = s.pending.front().frame;
+            s.pending.erase(s.pending.begin());
+          }
+        }
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        break;
+      }
+      drop(s, true);
+      return;
+    }
+    if (!s.inflight && s.closing) {
+      drop(s, false);
+      return;
+    }
+    bool wantWrite = s.inflight != nullptr;
+    if (wantWrite != s.wantWrite) {
+      s.wantWrite = wantWrite;
+      epoll_event ev = {};
+      ev.events = EPOLLIN | (wantWrite ? (uint32_t)EPOLLOUT : 0u);
+      ev.data.fd = s.fd;
+      epoll_ctl(epollFd_, EPOLL_CTL_MOD, s.fd, &ev);
+    }
+  }
+
+  void on_readable(Sub& s) {
+    for (;;) {
+      if (s.rxLen == sizeof(s.rx)) {
+        drop(s, true);   // Handshake or client frame too large
+        return;
+      }
+      ssize_t n = recv(s.fd, s.rx + s.rxLen, sizeof(s.rx) - s.rxLen, 0);
+      if (n > 0) {
+        s.rxLen += n;
+        if (!handle_input(s)) {
+          return;
+        }
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        break;
+      }
+      drop(s, n < 0);   // Peer closed or reset
+      return;
+    }
+    drain(s);
+  }
+
+  // Handshake, then client frames; false once the connection is gone
+  bool handle_input(Sub& s) {
+    int fd = s.fd;
+    size_t pos = 0;
+    if (!s.open) {
+      const char* end = (const char*)memmem(s.rx, s.rxLen, "\r\n\r\n", 4);
+      if (!end) {
+        return true;
+      }
+      pos = end + 4 - s.rx;
+      if (!handshake(s, pos)) {
+        drop(s, true);
+        return false;
+      }
+    }
+    while (!s.closing) {
+      const uint8_t* p = (const uint8_t*)s.rx + pos;
+      size_t avail = s.rxLen - pos;
+      if (avail < 2) {
+        break;
+      }
+      uint8_t opcode = p[0] & 0x0F;
+      bool masked = p[1] & 0x80;
+      uint64_t len = p[1] & 0x7F;
+      size_t head = 2;
+      if (len == 126) {
+        head = 4;
+        len = avail >= 4 ? (uint64_t)p[2] << 8 | p[3] : 0;
+      } else if (len == 127) {
+        drop(s, true);   // Dashboards never send 64 KiB messages
+        return false;
+      }
+      if (!masked) {
+        drop(s, true);   // Client frames must be masked (RFC 6455 5.1)
+        return false;
+      }
+      head += 4;
+      if (avail < head || avail < head + len) {
+        break;
+      }
+      uint8_t payload[125];
+      if (opcode >= 0x8 && len <= sizeof(payload)) {
+        for (size_t i = 0; i < len; i++) {
+          payload[i] = p[head + i] ^ p[head - 4 + (i & 3)];
+        }
+        if (opcode == 0x8 || opcode == 0x9) {
+          HubFrame* f = frame(opcode == 0x8 ? 0x8 : 0xA, (const char*)payload, opcode == 0x8 && len > 2 ? 2 : len);
+          enqueue(s, HUB_CONTROL_KEY, f);
+          unref(f);
+          if (!subs_[fd]) {
+            return false;
+          }
+          s.closing |= opcode == 0x8;
+        }
+      }
+      pos += head + len;
+    }
+    memmove(s.rx, s.rx + pos, s.rxLen - pos);
+    s.rxLen -= pos;
+    return true;
+  }
+
+  // Validate GET /water-monitor with a Sec-WebSocket-Key and queue the
+  // 101 response followed by every device's latest frame
+  bool handshake(Sub& s, size_t headerLen) {
+    const char* p = s.rx;
+    const char* end = s.rx + headerLen;
+    if (!is_subscribe_request(p, headerLen)) {
+      return false;
+    }
+    const char* key = nullptr;
+    size_t keyLen = 0;
+    for (const char* line = (const char*)memmem(p, headerLen, "\r\n", 2) + 2; line < end - 2;) {
+      const char* eol = (const char*)memmem(line, end - line, "\r\n", 2);
+      const char* colon = (const char*)memchr(line, ':', eol - line);
+      if (colon && colon - line == 17 && strncasecmp(line, "sec-websocket-key", 17) == 0) {
+        key = colon + 1;
+        while (key < eol && *key == ' ') {
+          key++;
+        }
+        keyLen = eol - key;
+      }
+      line = eol + 2;
+    }
+    if (!key || keyLen == 0) {
+      return false;
+    }
+    char accept[29];
+    websocket_accept(key, keyLen, accept);
+    HubFrame* f = alloc_frame();
+    f->len = (uint32_t)snprintf(f->data, sizeof(f->data),
+                                "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                                "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n",
+                                accept);
+    s.open = true;
+    s.openIndex = open_.size();
+    open_.push_back(&s);
+    stats_.subscribers++;
+    stats_.handshakes++;
+    // Handshake first, then each device's latest state in its own slot
+    s.inflight = f;
+    s.offset = 0;
+    for (auto& kv : latest_) {
+      kv.second->refs++;
+      s.pending.push_back(Pending{ kv.first, kv.second });
+    }
+    return true;
+  }
+
+  int listenFd_ = -1;
+  int epollFd_ = -1;
+  uint16_t port_ = 0;
+  std::vector<std::unique_ptr<Sub>> subs_;
+  std::vector<Sub*> open_;
+  std::unordered_map<uint64_t, HubFrame*> latest_;
+  std::vector<std::unique_ptr<HubFrame>> pool_;
+  HubFrame* free_ = nullptr;
+  HubStats stats_;
+};
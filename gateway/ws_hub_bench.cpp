@@ -0,0 +1,271 @@
+/*
+  Fan-out benchmark for the WebSocket hub with thousands of local
+  dashboard subscribers.
+
+  An in-process hub publishes the dashboard message (format_latest()) for
+  --devices boards at --rate updates/s each. Subscribers connect over
+  loopback, do the real handshake and decode every frame; the latency of
+  a delivery is the subscriber's receive time minus the "pub" stamp inside
+  the message. A --slow fraction of subscribers never reads, with a small
+  receive buffer, so their queues back up and updates coalesce instead of
+  piling up.
+
+  Build:
+    g++ -std=gnu++17 -O2 gateway/ws_hub_bench.cpp -lpthread -o ws_hub_bench
+
+  Run (raise the open-file limit above twice the subscriber count):
+    ./ws_hub_bench --subscribers 10000 --rate 10 --seconds 10 --slow 0.01
+*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ws_hub.h"
+
+struct BenchConfig {
+  int subscribers = 10000;
+  int devices = 1;
+  double rate = 10;      // Updates/s per device
+  double seconds = 5;
+  double slow = 0.01;    // Fraction of subscribers that never read
+};
+
+struct Subscriber {
+  int fd;
+  bool open = false;
+  std::string buf;
+  uint64_t frames = 0;
+};
+
+static double wall_s() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(uint16_t port, bool slow) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (slow) {
+    int size = 4096;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  }
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  static const char REQUEST[] =
+      "GET /water-monitor HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+  if (send(fd, REQUEST, sizeof(REQUEST) - 1, MSG_NOSIGNAL) != (ssize_t)(sizeof(REQUEST) - 1)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Consume the 101 response and every complete frame in s.buf; false on a
+// protocol error
+static bool decode(Subscriber& s, std::vector<uint32_t>& latencyUs) {
+  size_t pos = 0;
+  if (!s.open) {
+    size_t end = s.buf.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      return true;
+    }
+    // RFC 6455 1.3 example key and its accept value
+    if (s.buf.compare(0, 12, "HTTP/1.1 101") != 0
+        || s.buf.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == std::string::npos) {
+      return false;
+    }
+    s.open = true;
+    pos = end + 4;
+  }
+  double now = wall_s();
+  while (s.buf.size() - pos >= 2) {
+    const uint8_t* p = (const uint8_t*)s.buf.data() + pos;
+    size_t len = p[1] & 0x7F;
+    size_t head = 2;
+    if (len == 126) {
+      if (s.buf.size() - pos < 4) {
+        break;
+      }
+      len = (size_t)p[2] << 8 | p[3];
+      head = 4;
+    }
+    if (s.buf.size() - pos < head + len) {
+      break;
+    }
+    if ((p[0] & 0x0F) == 0x1) {
+      const char* msg = s.buf.data() + pos + head;
+      const char* pub = (const char*)memmem(msg, len, "\"pub\":", 6);
+      if (pub) {
+        latencyUs.push_back((uint32_t)std::max(0.0, (now - strtod(pub + 6, nullptr)) * 1e6));
+      }
+      s.frames++;
+    }
+    pos += head + len;
+  }
+  s.buf.erase(0, pos);
+  return true;
+}
+
+static bool parse_args(int argc, char** argv, BenchConfig& cfg) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    const char* value = argv[i + 1];
+    if (flag == "--subscribers") {
+      cfg.subscribers = atoi(value);
+    } else if (flag == "--devices") {
+      cfg.devices = atoi(value);
+    } else if (flag == "--rate") {
+      cfg.rate = atof(value);
+    } else if (flag == "--seconds") {
+      cfg.seconds = atof(value);
+    } else if (flag == "--slow") {
+      cfg.slow = atof(value);
+    } else {
+      return false;
+    }
+  }
+  return (argc % 2) == 1 && cfg.subscribers > 0 && cfg.devices > 0 && cfg.rate > 0;
+}
+
+int main(int argc, char** argv) {
+  BenchConfig cfg;
+  if (!parse_args(argc, argv, cfg)) {
+    fprintf(stderr, "usage: ws_hub_bench [--subscribers N] [--devices N] [--rate R] [--seconds S] [--slow F]\n");
+    return 2;
+  }
+
+  WsHub hub;
+  if (!hub.start(0)) {
+    perror("ws_hub_bench: hub");
+    return 1;
+  }
+  std::atomic<int> phase(0);   // 0 connecting, 1 publishing, 2 done
+  std::atomic<uint64_t> handshakes(0);
+  std::thread hubThread([&] {
+    LatestValue latest = {};
+    Reading r;
+    r.present = 0x07;
+    r.hasTrace = true;
+    char message[HUB_FRAME_SIZE];
+    double interval = 1.0 / (cfg.rate * cfg.devices);
+    double next = 0;
+    uint32_t seq = 0;
+    while (phase.load() < 2) {
+      hub.run_once(1);
+      handshakes = hub.stats().handshakes;
+      if (phase.load() != 1) {
+        continue;
+      }
+      double now = wall_s();
+      if (next == 0) {
+        next = now;
+      }
+      while (next <= now) {
+        r.seq = seq++;
+        r.acquiredMs = seq * 100;
+        r.sentMs = r.acquiredMs + 20;
+        for (int i = 0; i < NUM_SENSOR_CHANNELS; i++) {
+          r.centi[i] = 10000 + (int32_t)(seq % 500) + 100 * i;
+        }
+        latest.merge(r);
+        r.device = 0x020000000000ULL + seq % cfg.devices;
+        size_t len = format_latest(message, sizeof(message), r.device, latest, now, wall_s());
+        hub.publish(r.device, message, len);
+        next += interval;
+      }
+    }
+  });
+
+  // Connect everyone, then read until the hub stops publishing
+  int epfd = epoll_create1(0);
+  std::vector<Subscriber> subs;
+  subs.reserve(cfg.subscribers);
+  int slowEvery = cfg.slow > 0 ? std::max(1, (int)(1 / cfg.slow)) : 0;
+  int failed = 0;
+  for (int i = 0; i < cfg.subscribers; i++) {
+    bool slow = slowEvery && i % slowEvery == 0;
+    int fd = connect_to(hub.port(), slow);
+    if (fd < 0) {
+      failed++;
+      continue;
+    }
+    subs.emplace_back();
+    subs.back().fd = fd;
+    if (!slow) {
+      epoll_event ev = {};
+      ev.events = EPOLLIN;
+      ev.data.u32 = (uint32_t)(subs.size() - 1);
+      epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+  }
+  while (handshakes.load() < subs.size()) {
+    usleep(10000);
+  }
+  printf("Subscribers %zu connected (%d failed), %d slow\n", subs.size(), failed,
+         slowEvery ? (cfg.subscribers + slowEvery - 1) / slowEvery : 0);
+
+  std::vector<uint32_t> latencyUs;
+  latencyUs.reserve(1 << 22);
+  bool protocolError = false;
+  double start = wall_s();
+  phase = 1;
+  char chunk[16384];
+  epoll_event events[256];
+  while (wall_s() - start < cfg.seconds + 0.5) {
+    if (wall_s() - start >= cfg.seconds) {
+      phase = 2;   // Drain what is still in flight
+    }
+    int n = epoll_wait(epfd, events, 256, 10);
+    for (int i = 0; i < n; i++) {
+      Subscriber& s = subs[events[i].data.u32];
+      ssize_t got;
+      while ((got = recv(s.fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0) {
+        s.buf.append(chunk, got);
+      }
+      protocolError |= !decode(s, latencyUs);
+    }
+  }
+  phase = 2;
+  hubThread.join();
+
+  const HubStats& h = hub.stats();
+  uint64_t fastFrames = 0;
+  size_t fast = 0;
+  for (size_t i = 0; i < subs.size(); i++) {
+    if (!(slowEvery && (int)i % slowEvery == 0)) {
+      fastFrames += subs[i].frames;
+      fast++;
+    }
+    close(subs[i].fd);
+  }
+  std::sort(latencyUs.begin(), latencyUs.end());
+  auto pct = [&latencyUs](double p) {
+    return latencyUs.empty() ? 0 : latencyUs[std::min(latencyUs.size() - 1, (size_t)(p / 100 * latencyUs.size()))];
+  };
+  printf("Published   %llu updates (%.0f/s), encoded once each, %llu pooled frames\n",
+         (unsigned long long)h.published, h.published / cfg.seconds, (unsigned long long)h.frames);
+  printf("Delivered   %llu frames (%.0f/s), coalesced %llu, dropped %llu\n", (unsigned long long)h.delivered,
+         h.delivered / cfg.seconds, (unsigned long long)h.coalesced, (unsigned long long)h.dropped);
+  printf("Fast subs   %.1f frames each of %llu published\n", fast ? (double)fastFrames / fast : 0.0,
+         (unsigned long long)h.published);
+  printf("Latency us  p50 %u  p90 %u  p99 %u  max %u\n", pct(50), pct(90), pct(99),
+         latencyUs.empty() ? 0 : latencyUs.back());
+  return protocolError ? 1 : 0;
+}
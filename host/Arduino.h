@@ -0,0 +1,218 @@
+/*
+  Host (Linux) stand-in for the Arduino core used by water_monitor.c.
+
+  Time is simulated: millis()/micros() read sim::clockUs, and delay() /
+  delayMicroseconds() advance it instead of sleeping, so firmware code that
+  waits in busy loops runs at full host speed. After sim::start_real_time()
+  the clock follows CLOCK_MONOTONIC and delays sleep, for end-to-end runs
+  against real servers. analogRead() returns values
+  from a pluggable ADC source, through the ADC comparator model in
+  ra4m1_adc.h. Serial output is counted and discarded unless
+  sim::echoSerial is set.
+*/
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#define PI 3.1415926535897932384626433832795
+#define HEX 16
+#define DEC 10
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+template <class A, class B>
+inline auto min(A a, B b) -> decltype(a + b) { return a < b ? a : b; }
+template <class A, class B>
+inline auto max(A a, B b) -> decltype(a + b) { return a > b ? a : b; }
+
+namespace sim {
+// Simulated time in microseconds
+inline unsigned long clockUs = 0;
+// Cost charged per analogRead() conversion (RA4M1 at 12 bits: ~2 us)
+inline unsigned long adcConversionUs = 2;
+// ADC source: raw 12-bit value for a pin at the current simulated time
+inline int (*adcSource)(uint8_t pin) = [](uint8_t) { return 2048; };
+// Hook run on every clock advance (e.g. peripheral models)
+inline void (*onAdvance)(unsigned long us) = nullptr;
+inline bool echoSerial = false;
+inline unsigned long serialBytes = 0;
+// Pin levels written with digitalWrite(), and when each last changed
+inline uint8_t pinLevel[32];
+inline unsigned long pinChangeUs[32];
+// Real-time mode: clockUs follows the monotonic clock (see start_real_time)
+inline bool realTime = false;
+inline unsigned long long realBaseUs = 0;
+
+inline unsigned long long monotonic_us() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Switch to real time, continuing from the current simulated time
+inline void start_real_time() {
+  realBaseUs = monotonic_us() - clockUs;
+  realTime = true;
+}
+
+// Wall-clock time (ms since the epoch) at which millis() was 0, so host
+// tools can map device timestamps onto server timestamps
+inline unsigned long long epoch_at_start_ms() {
+  timespec wall;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  unsigned long long nowMs = (unsigned long long)wall.tv_sec * 1000ULL + wall.tv_nsec / 1000000;
+  return nowMs - (monotonic_us() - realBaseUs) / 1000;
+}
+
+inline void advance(unsigned long us) {
+  if (realTime) {
+    timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+    nanosleep(&ts, nullptr);
+    return;
+  }
+  clockUs += us;
+  if (onAdvance) {
+    onAdvance(us);
+  }
+}
+}  // namespace sim
+
+inline unsigned long micros() {
+  if (sim::realTime) {
+    sim::clockUs = (unsigned long)(sim::monotonic_us() - sim::realBaseUs);
+  }
+  return sim::clockUs;
+}
+inline unsigned long millis() { return micros() / 1000; }
+inline void delay(unsigned long ms) { sim::advance(ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { sim::advance(us); }
+inline void yield() {}
+
+#include "ra4m1_adc.h"
+
+inline void analogReadResolution(int) {}
+inline int analogRead(uint8_t pin) { return sim::adc_convert(pin); }
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t pin, uint8_t level) {
+  if (sim::pinLevel[pin & 31] != level) {
+    sim::pinLevel[pin & 31] = level;
+    sim::pinChangeUs[pin & 31] = micros();
+  }
+}
+inline int digitalRead(uint8_t pin) { return sim::pinLevel[pin & 31]; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// Heap-backed like the Arduino String, so allocation counters see it
+class String {
+ public:
+  String() {}
+  String(const char* s) : s_(s) {}
+  unsigned length() const { return s_.size(); }
+  const char* c_str() const { return s_.c_str(); }
+  bool operator==(const char* o) const { return s_ == o; }
+  bool operator<(const char* o) const { return s_ < o; }
+  String& operator+=(char c) { s_ += c; return *this; }
+
+ private:
+  std::string s_;
+};
+
+class IPAddress {
+ public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : b_{ a, b, c, d } {}
+  uint8_t operator[](int i) const { return b_[i]; }
+
+ private:
+  uint8_t b_[4] = { 0, 0, 0, 0 };
+};
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t* buf, size_t len) = 0;
+  size_t write(const char* buf, size_t len) { return write((const uint8_t*)buf, len); }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const String& s) { return print(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned long v, int base = DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", v);
+    return print(buf);
+  }
+  size_t print(long v, int base = DEC) {
+    if (base == HEX) {
+      return print((unsigned long)v, base);
+    }
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", v);
+    return print(buf);
+  }
+  size_t print(unsigned v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(double v, int digits = 2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, v);
+    return print(buf);
+  }
+  size_t print(const IPAddress& ip) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    return print(buf);
+  }
+
+  size_t println() { return print("\r\n"); }
+  template <class T>
+  size_t println(const T& v) { return print(v) + println(); }
+  template <class T>
+  size_t println(const T& v, int fmt) { return print(v, fmt) + println(); }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() { return -1; }
+  void setTimeout(unsigned long) {}
+};
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+  operator bool() const { return true; }
+  using Print::write;
+  size_t write(const uint8_t* buf, size_t len) override {
+    sim::serialBytes += len;
+    if (sim::echoSerial) {
+      fwrite(buf, 1, len, stdout);
+    }
+    return len;
+  }
+  int availableForWrite() override { return 4096; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+};
+
+inline HardwareSerial Serial;
@@ -0,0 +1,37 @@
+/*
+  Host stand-in for the UNO R4 core's IRQManager: peripheral events get a
+  handler through addGenericInterrupt(), which the register models in
+  ra4m1_adc.h call when the event fires.
+*/
+#pragma once
+
+#include "Arduino.h"
+
+typedef int IRQn_Type;
+#define FSP_INVALID_VECTOR ((IRQn_Type)-32)
+
+typedef void (*Irq_f)(void);
+
+struct GenericIrqCfg_t {
+  IRQn_Type irq;
+  uint8_t ipl;
+  elc_event_t event;
+};
+
+class IRQManager {
+ public:
+  static IRQManager& getInstance() {
+    static IRQManager instance;
+    return instance;
+  }
+
+  // Picks a free vector (cfg.irq) for cfg.event and attaches fnc
+  bool addGenericInterrupt(GenericIrqCfg_t& cfg, Irq_f fnc = nullptr) {
+    cfg.irq = (IRQn_Type)cfg.event;
+    sim::irqHandler[cfg.event] = fnc;
+    return true;
+  }
+};
+
+inline IRQn_Type R_FSP_CurrentIrqGet() { return (IRQn_Type)sim::currentEvent; }
+inline void R_BSP_IrqStatusClear(IRQn_Type) {}
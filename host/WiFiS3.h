@@ -0,0 +1,351 @@
+/*
+  Host (Linux) stand-in for the WiFiS3 library used by water_monitor.c.
+
+  WiFiClient talks to an in-memory server by default: every byte the
+  firmware writes is counted in sim::net, and each flush() (end of a
+  request) queues sim::net.response for the firmware to read back. Setting
+  sim::net.tcpPort redirects connections to a real TCP server at
+  sim::net.tcpHost instead. WiFiServer accepts no LAN clients unless
+  sim::net.lanServer is set: then begin() listens on 127.0.0.1 at
+  sim::net.lanPort (a free port when 0, written back) and available()
+  accepts without blocking, handing over a client on the accepted socket.
+  WiFi.status() reports sim::net.wifiStatus;
+  while it is not WL_CONNECTED, connects fail and open sockets drop their
+  response and close. sim::set_wifi_status() changes it and calls the
+  callback WiFi.onLinkChange() registered, as a bridge library with link
+  notifications would.
+
+  On the board each of these calls is an AT transaction with the ESP32-S3
+  bridge, and the client keeps a local receive FIFO as the WiFiS3 library
+  does: read() pulls up to a FIFO's worth with one AT+CLIENTRECEIVE when
+  the FIFO holds too little, available() only queries the bridge when the
+  FIFO is empty, and write(), connected(), connect(), stop() and
+  WiFi.status() are one transaction each. sim::modem counts them by kind.
+  With sim::modem.timed set, every transaction also costs the bridge's
+  turnaround plus its bytes over the UART at sim::modem.baud (set by
+  modem.begin()), and an in-memory response arrives sim::net.responseUs
+  after the request.
+*/
+#pragma once
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+
+#define WL_NO_SHIELD 255
+#define WL_NO_MODULE WL_NO_SHIELD
+#define WL_IDLE_STATUS 0
+#define WL_CONNECTED 3
+#define WL_CONNECT_FAILED 4
+#define WL_CONNECTION_LOST 5
+#define WL_DISCONNECTED 6
+#define WIFI_FIRMWARE_LATEST_VERSION "0.4.1"
+
+namespace sim {
+enum AtCommand { AT_CONNECT, AT_SEND, AT_RECEIVE, AT_AVAILABLE, AT_CONNECTED, AT_STOP, AT_STATUS, AT_KINDS };
+inline const char* const AT_NAMES[AT_KINDS] = { "connect", "send", "receive", "available", "connected", "stop",
+                                                "status" };
+
+struct Modem {
+  bool timed = false;
+  unsigned long turnaroundUs = 1000;   // Bridge command processing and reply
+  unsigned long baud = 115200;
+  size_t fifoSize = 1024;              // WiFiClient receive FIFO
+  unsigned long commands = 0;
+  unsigned long byKind[AT_KINDS] = {};
+  unsigned long long busyUs = 0;       // Time spent in transactions
+};
+inline Modem modem;
+
+// One AT transaction carrying payload bytes (besides the ~24 of command
+// and reply framing)
+inline void at_command(AtCommand kind, size_t payload = 0) {
+  modem.commands++;
+  modem.byKind[kind]++;
+  if (modem.timed) {
+    unsigned long us = modem.turnaroundUs + (unsigned long)((24 + payload) * 10 * 1000000ULL / modem.baud);
+    modem.busyUs += us;
+    advance(us);
+  }
+}
+
+struct Network {
+  int wifiStatus = WL_CONNECTED;
+  void (*linkCallback)(int) = nullptr;  // WiFi.onLinkChange()
+  bool acceptConnections = true;
+  // Response queued after every request (flush)
+  std::string response = "HTTP/1.1 200 OK\r\ncontent-length: 0\r\n\r\n";
+  unsigned long responseUs = 0;      // Server time before the response arrives
+  // Counters
+  unsigned long connects = 0;
+  unsigned long writeCalls = 0;      // One AT transaction each on the real board
+  unsigned long readCalls = 0;
+  unsigned long statusCalls = 0;
+  unsigned long bytesSent = 0;
+  unsigned long bytesReceived = 0;
+  std::string lastRequest;           // Bytes written since the last flush
+  // Real TCP backend (0 = in-memory server)
+  const char* tcpHost = "127.0.0.1";
+  uint16_t tcpPort = 0;
+  // Real listener behind WiFiServer
+  bool lanServer = false;
+  uint16_t lanPort = 0;              // 0: any free port, set by begin()
+  unsigned long lanAccepts = 0;
+};
+inline Network net;
+
+// The access point comes or goes
+inline void set_wifi_status(int s) {
+  if (s != net.wifiStatus) {
+    net.wifiStatus = s;
+    if (net.linkCallback) {
+      net.linkCallback(s);
+    }
+  }
+}
+}  // namespace sim
+
+class WiFiClient : public Stream {
+ public:
+  // Reserve up front so the backend itself does not show up in allocs/op
+  WiFiClient() {
+    rx_.reserve(4096);
+    sim::net.lastRequest.reserve(4096);
+  }
+
+  int connect(const char*, uint16_t) {
+    sim::at_command(sim::AT_CONNECT);
+    if (!sim::net.acceptConnections || sim::net.wifiStatus != WL_CONNECTED) {
+      return 0;
+    }
+    stop();
+    if (sim::net.tcpPort) {
+      fd_ = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(sim::net.tcpPort);
+      inet_pton(AF_INET, sim::net.tcpHost, &addr.sin_addr);
+      if (::connect(fd_, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        ::close(fd_);
+        fd_ = -1;
+        return 0;
+      }
+      int one = 1;
+      setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    sim::net.connects++;
+    open_ = true;
+    return 1;
+  }
+  int connect(IPAddress, uint16_t port) { return connect("", port); }
+  uint8_t connected() {
+    sim::at_command(sim::AT_CONNECTED);
+    if (fd_ >= 0) {
+      char c;
+      ssize_t n = recv(fd_, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+      return n > 0 || (n < 0 && errno == EAGAIN);
+    }
+    return open_ || rxPos_ < rx_.size();
+  }
+  operator bool() { return open_; }
+  void stop() {
+    if (open_) {
+      sim::at_command(sim::AT_STOP);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+    open_ = false;
+    rx_.clear();
+    rxPos_ = 0;
+    fifo_ = 0;
+    responseDue_ = false;
+  }
+
+  using Print::write;
+  size_t write(const uint8_t* buf, size_t len) override {
+    if (!open_) {
+      return 0;
+    }
+    if (pendingFlush_ == false) {
+      sim::net.lastRequest.clear();
+      pendingFlush_ = true;
+    }
+    sim::at_command(sim::AT_SEND, len);
+    sim::net.writeCalls++;
+    sim::net.bytesSent += len;
+    sim::net.lastRequest.append((const char*)buf, len);
+    if (fd_ >= 0 && send(fd_, buf, len, MSG_NOSIGNAL) != (ssize_t)len) {
+      stop();
+      return 0;
+    }
+    return len;
+  }
+  void flush() override {
+    if (open_ && pendingFlush_) {
+      if (fd_ < 0) {
+        responseDue_ = true;
+        responseAt_ = micros() + sim::net.responseUs;
+      }
+      pendingFlush_ = false;
+    }
+  }
+
+  // Bytes in the FIFO, else the bridge's count (one query)
+  int available() override {
+    if (fifo_ > 0) {
+      return (int)fifo_;
+    }
+    sim::at_command(sim::AT_AVAILABLE);
+    fill();
+    return (int)(rx_.size() - rxPos_);
+  }
+  int read() override {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  int read(uint8_t* buf, size_t len) {
+    sim::net.readCalls++;
+    if (fifo_ < len) {
+      receive();
+    }
+    size_t n = min(len, fifo_);
+    memcpy(buf, rx_.data() + rxPos_, n);
+    rxPos_ += n;
+    fifo_ -= n;
+    sim::net.bytesReceived += n;
+    return (int)n;
+  }
+
+ private:
+  // AT+CLIENTRECEIVE: move what the bridge holds into the FIFO
+  void receive() {
+    fill();
+    size_t n = min(rx_.size() - rxPos_ - fifo_, sim::modem.fifoSize - 1 - fifo_);
+    sim::at_command(sim::AT_RECEIVE, n);
+    fifo_ += n;
+  }
+
+  // Pull whatever the server has sent to the bridge into rx_ without
+  // blocking
+  void fill() {
+    if (rxPos_ == rx_.size()) {
+      rx_.clear();
+      rxPos_ = 0;
+    }
+    if (sim::net.wifiStatus != WL_CONNECTED) {
+      open_ = false;
+      responseDue_ = false;
+      return;
+    }
+    if (responseDue_ && (long)(micros() - responseAt_) >= 0) {
+      rx_.append(sim::net.response);
+      responseDue_ = false;
+    }
+    if (fd_ < 0) {
+      return;
+    }
+    char buf[1024];
+    ssize_t n = recv(fd_, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) {
+      rx_.append(buf, n);
+    } else if (n == 0) {
+      open_ = false;
+    }
+  }
+
+  // A LAN client accepted by WiFiServer
+  friend class WiFiServer;
+  explicit WiFiClient(int fd) : WiFiClient() {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fd_ = fd;
+    open_ = true;
+  }
+
+  int fd_ = -1;
+  bool open_ = false;
+  bool pendingFlush_ = false;
+  bool responseDue_ = false;
+  unsigned long responseAt_ = 0;
+  std::string rx_;                   // From rxPos_: the FIFO, then the bridge
+  size_t rxPos_ = 0;
+  size_t fifo_ = 0;
+};
+
+// Without sim::net.lanServer the board never receives LAN connections
+class WiFiServer {
+ public:
+  explicit WiFiServer(uint16_t) {}
+  void begin() {
+    if (!sim::net.lanServer || fd_ >= 0) {
+      return;
+    }
+    fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(sim::net.lanPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd_, (sockaddr*)&addr, len) != 0 || listen(fd_, 4) != 0 ||
+        getsockname(fd_, (sockaddr*)&addr, &len) != 0) {
+      ::close(fd_);
+      fd_ = -1;
+      return;
+    }
+    sim::net.lanPort = ntohs(addr.sin_port);
+  }
+  // A pending connection, else a closed client; never blocks
+  WiFiClient available() {
+    if (fd_ < 0 || sim::net.wifiStatus != WL_CONNECTED) {
+      return WiFiClient();
+    }
+    int fd = accept(fd_, nullptr, nullptr);
+    if (fd < 0) {
+      return WiFiClient();
+    }
+    sim::net.lanAccepts++;
+    return WiFiClient(fd);
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+class CWifi {
+ public:
+  int status() {
+    sim::at_command(sim::AT_STATUS);
+    sim::net.statusCalls++;
+    return sim::net.wifiStatus;
+  }
+  String firmwareVersion() { return String(WIFI_FIRMWARE_LATEST_VERSION); }
+  int begin(const char*) { return status(); }
+  int begin(const char*, const char*) { return status(); }
+  void onLinkChange(void (*callback)(int)) { sim::net.linkCallback = callback; }
+  const char* SSID() { return "simulated"; }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+  uint8_t* macAddress(uint8_t* mac) {
+    static const uint8_t simMac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    memcpy(mac, simMac, 6);
+    return mac;
+  }
+};
+
+inline CWifi WiFi;
+
+// The bridge UART; begin() sets its rate
+class ModemClass {
+ public:
+  void begin(int baud = 115200) { sim::modem.baud = baud; }
+};
+
+inline ModemClass modem;
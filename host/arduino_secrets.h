@@ -0,0 +1,6 @@
+/*
+  Placeholder credentials for host builds; the board build uses the
+  arduino_secrets.h kept next to the sketch.
+*/
+#define SECRET_SSID "simulated"
+#define SECRET_PASS ""
@@ -0,0 +1,249 @@
+/*
+  Microbenchmarks for the firmware hot paths on the host build.
+
+  Build (ArduinoJson 6 from the Arduino libraries folder, Google Benchmark):
+    g++ -std=gnu++20 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        host/bench_firmware.cpp -lbenchmark -lpthread -o bench_firmware
+
+  Run and compare against the stored baseline:
+    ./bench_firmware --benchmark_repetitions=5 --benchmark_report_aggregates_only=true \
+        --benchmark_out=bench.json --benchmark_out_format=json
+    python tools/bench_compare.py bench.json host/bench_baseline.json
+
+  host/bench_baseline.json holds the medians of such a run on a 2 GHz x86
+  build host. Timings only compare on the same machine: refresh it there
+  first with bench_compare.py --update. It leaves out BM_JsonSerialize and
+  BM_SendSensorData, whose cost is ArduinoJson's and was not measured with
+  the library release the firmware ships with; they show as "solo en
+  actual" until a baseline with them is stored.
+
+  Besides ns/op, each stage reports bytes/op (bytes produced or sent) and
+  allocs/op (malloc/new calls, counted by interposing the allocator).
+  Delays inside the firmware advance the simulated clock instead of
+  sleeping, so read_adc() measures the conversion loop, not its spacing.
+*/
+#include <benchmark/benchmark.h>
+#include <math.h>
+#include <new>
+
+#include "firmware_sim.h"
+
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+
+static unsigned long allocCount = 0;
+
+extern "C" void* malloc(size_t size) {
+  allocCount++;
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size) {
+  allocCount++;
+  return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, size_t size) {
+  allocCount++;
+  return __libc_realloc(p, size);
+}
+
+// Report bytes/op and allocs/op next to the timing
+static void set_counters(benchmark::State& state, unsigned long allocs, double bytes) {
+  state.counters["allocs/op"] = benchmark::Counter(allocs, benchmark::Counter::kAvgIterations);
+  state.counters["bytes/op"] = benchmark::Counter(bytes, benchmark::Counter::kAvgIterations);
+}
+
+static int noisy_adc(uint8_t pin) {
+  return 1800 + pin * 40 + (int)((sim::clockUs * 2654435761UL) >> 28);
+}
+
+static void mark_all_pending() {
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    channels[i].value = 123.45f + i;
+    channels[i].pending = true;
+  }
+}
+
+static void BM_ReadAdc(benchmark::State& state) {
+  sim::adcSource = noisy_adc;
+  const uint8_t pins[] = { TURBIDITY_PIN, PH_PIN, CONDUCT_PIN };
+  uint16_t raw[3];
+  unsigned long allocs = allocCount;
+  for (auto _ : state) {
+    read_adc(pins, raw, 3);
+    benchmark::DoNotOptimize(raw);
+  }
+  set_counters(state, allocCount - allocs, 0);
+}
+BENCHMARK(BM_ReadAdc);
+
+static void BM_Convert(benchmark::State& state) {
+  uint16_t raw = 0;
+  unsigned long allocs = allocCount;
+  for (auto _ : state) {
+    raw = (raw + 97) & 0x0FFF;
+    benchmark::DoNotOptimize(convert_turbidity(raw));
+    benchmark::DoNotOptimize(convert_ph(raw));
+    benchmark::DoNotOptimize(convert_conductivity(raw));
+  }
+  set_counters(state, allocCount - allocs, 0);
+}
+BENCHMARK(BM_Convert);
+
+static void BM_AcquisitionTick(benchmark::State& state) {
+  sim::adcSource = noisy_adc;
+  unsigned long allocs = allocCount;
+  for (auto _ : state) {
+    run_acquisition_tick();
+    tickCount++;
+  }
+  set_counters(state, allocCount - allocs, 0);
+}
+BENCHMARK(BM_AcquisitionTick);
+
+// Demodulation of one lock-in burst; excitation/s inverts to the time per
+// excitation cycle (multiply by the core clock for cycles per cycle)
+static void BM_LockinDemod(benchmark::State& state) {
+  for (int n = 0; n < LOCKIN_SAMPLES; n++) {
+    lockinBuf[n] = (n & 3) < 2 ? 2848 + n % 5 : 1248 - n % 3;
+  }
+  unsigned long allocs = allocCount;
+  for (auto _ : state) {
+    int32_t i, q;
+    lockin_demodulate(lockinBuf, LOCKIN_CYCLES, i, q);
+    benchmark::DoNotOptimize(i);
+    benchmark::DoNotOptimize(q);
+    benchmark::ClobberMemory();
+  }
+  set_counters(state, allocCount - allocs, 0);
+  state.counters["excitation/s"] = benchmark::Counter(LOCKIN_CYCLES, benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_LockinDemod);
+
+static void BM_LockinRead(benchmark::State& state) {
+  sim::adcSource = noisy_adc;
+  unsigned long allocs = allocCount;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(read_conductivity_lockin());
+  }
+  set_counters(state, allocCount - allocs, 0);
+}
+BENCHMARK(BM_LockinRead);
+
+// A conductivity capture window: mains at 50.1 Hz with its third harmonic
+// near full scale, so the FFT stages run at their headroom
+static void mains_window(uint16_t* window) {
+  for (int n = 0; n < FFT_SIZE; n++) {
+    double t = n * SPECTRAL_SAMPLE_US / 1e6;
+    window[n] = (uint16_t)(2048 + 1500 * sin(2 * M_PI * 50.1 * t) + 400 * sin(2 * M_PI * 150.3 * t + 1));
+  }
+}
+
+// Windowed real FFT and power spectrum of one capture
+static void BM_SpectralFft(benchmark::State& state) {
+  init_fft_tables();
+  static uint16_t window[FFT_SIZE];
+  mains_window(window);
+  unsigned long allocs = allocCount;
+  for (auto _ : state) {
+    rfft_power_q15(window, fftPower);
+    benchmark::ClobberMemory();
+  }
+  set_counters(state, allocCount - allocs, 0);
+  state.counters["windows/s"] = benchmark::Counter(1, benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_SpectralFft);
+
+// Everything after the capture: FFT, peak search and notch autotune. The
+// 256 ms capture itself paces the ADC and is not CPU work.
+static void BM_SpectralAnalysis(benchmark::State& state) {
+  init_fft_tables();
+  static uint16_t window[FFT_SIZE];
+  mains_window(window);
+  unsigned long spacing = adcSampleSpacingUs;
+  unsigned long allocs = allocCount;
+  for (auto _ : state) {
+    analyze_spectrum(window);
+    benchmark::DoNotOptimize(spectral);
+  }
+  set_counters(state, allocCount - allocs, 0);
+  state.counters["windows/s"] = benchmark::Counter(1, benchmark::Counter::kIsIterationInvariantRate);
+  adcSampleSpacingUs = spacing;
+}
+BENCHMARK(BM_SpectralAnalysis);
+
+static void BM_JsonSerialize(benchmark::State& state) {
+  unsigned long allocs = allocCount;
+  double bytes = 0;
+  for (auto _ : state) {
+    mark_all_pending();
+    bytes += build_uplink_frame();
+  }
+  set_counters(state, allocCount - allocs, bytes);
+}
+BENCHMARK(BM_JsonSerialize);
+
+static void BM_HttpFraming(benchmark::State& state) {
+  mark_all_pending();
+  size_t jsonLen = build_uplink_frame();
+  open_server_connection();
+  unsigned long allocs = allocCount;
+  unsigned long sent = sim::net.bytesSent;
+  unsigned long writes = sim::net.writeCalls;
+  for (auto _ : state) {
+    write_uplink_request(jsonLen);
+  }
+  set_counters(state, allocCount - allocs, sim::net.bytesSent - sent);
+  state.counters["writes/op"] = benchmark::Counter(sim::net.writeCalls - writes,
+                                                   benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_HttpFraming);
+
+static void BM_ResponseParse(benchmark::State& state) {
+  sim::net.response = "HTTP/1.1 200 OK\r\ndate: Sat, 17 Oct 2026 10:00:00 GMT\r\n"
+                      "server: uvicorn\r\ncontent-length: 4\r\n\r\nnull";
+  client.connect(server_host, server_port);
+  unsigned long allocs = allocCount;
+  unsigned long received = sim::net.bytesReceived;
+  for (auto _ : state) {
+    client.write((const uint8_t*)"x", 1);
+    client.flush();  // Queues the canned response
+    int matched = 0;
+    while (matched < 4 && client.available()) {
+      matched = match_header_end(matched, client.read());
+    }
+    while (client.available()) {
+      client.read();
+    }
+  }
+  set_counters(state, allocCount - allocs, sim::net.bytesReceived - received);
+}
+BENCHMARK(BM_ResponseParse);
+
+static void BM_SendSensorData(benchmark::State& state) {
+  isConnected = false;
+  unsigned long allocs = allocCount;
+  unsigned long sent = sim::net.bytesSent;
+  for (auto _ : state) {
+    mark_all_pending();
+    send_sensor_data();
+  }
+  set_counters(state, allocCount - allocs, sim::net.bytesSent - sent);
+}
+BENCHMARK(BM_SendSensorData);
+
+static void BM_FormatSnapshots(benchmark::State& state) {
+  unsigned long allocs = allocCount;
+  double bytes = 0;
+  for (auto _ : state) {
+    sim::clockUs = 0;  // Uptime and ages render with the same width each time
+    format_snapshots(0);
+    bytes += metricsLen[0] + latestLen[0];
+  }
+  set_counters(state, allocCount - allocs, bytes);
+}
+BENCHMARK(BM_FormatSnapshots);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,96 @@
+/*
+  Probe fault flags from boot: a clean input is never flagged, a floating
+  one is.
+
+  Runs the firmware in simulated time from setup() with every channel at
+  mid-scale plus a few LSB of conversion noise, and checks that no report
+  carries a quality flag, the first one after boot included. Then the
+  inputs float (wide random swings around mid-scale) and the noise check
+  must flag every channel within a few of its samples.
+
+  Build (ArduinoJson 6 from the Arduino libraries folder):
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        host/channel_health_test.cpp -o channel_health_test
+
+  Run:
+    ./channel_health_test
+
+  Exits 1 if any check fails.
+*/
+#include <stdio.h>
+
+#include "firmware_sim.h"
+
+static unsigned long long rng = 88172645463325252ULL;
+static int spread = 4;             // Input swing around mid-scale, +/- LSB
+
+static int noisy_mid_scale(uint8_t) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return 2048 + (int)(rng % (2 * spread + 1)) - spread;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("FAIL %s\n", what);
+    failures++;
+  }
+}
+
+// Run loop() for ms of simulated time; per channel, the reports seen and
+// the OR of their quality flags
+static void run(unsigned long ms, unsigned long* reports, uint8_t* flags) {
+  unsigned long last[NUM_CHANNELS];
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    last[i] = channels[i].reportTime;
+    reports[i] = 0;
+    flags[i] = 0;
+  }
+  unsigned long end = millis() + ms;
+  while ((long)(millis() - end) < 0) {
+    firmware_loop();
+    delayMicroseconds(200);
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+      if (channels[i].reportTime != last[i]) {
+        last[i] = channels[i].reportTime;
+        reports[i]++;
+        flags[i] |= channels[i].quality;
+      }
+    }
+  }
+}
+
+int main() {
+  unsigned long reports[NUM_CHANNELS];
+  uint8_t flags[NUM_CHANNELS];
+
+  sim::adcSource = noisy_mid_scale;
+  firmware_setup();
+
+  // The first reports after boot included
+  run(60000, reports, flags);
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    printf("clean    %-3s reports %3lu  flags 0x%02x\n", channels[i].key, reports[i], flags[i]);
+    check(reports[i] > 0, "clean input: channel reported");
+    check(flags[i] == 0, "clean input: no quality flag");
+  }
+
+  // Even averaged over ADC_SAMPLES conversions, successive samples differ
+  // by about 300 LSB, twice NOISE_MAX_LSB
+  spread = 1500;
+  run(30000, reports, flags);
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    printf("floating %-3s reports %3lu  flags 0x%02x\n", channels[i].key, reports[i], flags[i]);
+    check((flags[i] & QF_NOISY) != 0, "floating input: flagged noisy");
+  }
+
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All channel health checks passed\n");
+  return 0;
+}
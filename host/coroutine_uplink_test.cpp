@@ -0,0 +1,249 @@
+/*
+  Uplink and WiFi reassociation coroutines side by side over real sockets.
+
+  Runs the coroutine build of the firmware in real time against a small
+  HTTP server on 127.0.0.1, through the WiFiClient TCP backend. The server
+  holds every response for HOLD_MS, so the uplink task waits in readable()
+  on each request. Midway the access point drops for OUTAGE_MS: the
+  uplink gives up on its response, the WiFi task reassociates, sleeping
+  in sleep_ms() between attempts, and the uplink waits in until() for it.
+  Checks that
+    - the server receives the frames in order (trace IDs strictly
+      increasing), and frames again after the outage;
+    - both tasks stay in the frame pool, with no allocation failure;
+    - acquisition keeps to its tick grid while the tasks wait: no tick
+      starts more than TICK_BUDGET_MS late, and every response hold and
+      the reassociation span the ticks their length calls for.
+
+  Build (ArduinoJson 6 from the Arduino libraries folder):
+    g++ -std=gnu++20 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        host/coroutine_uplink_test.cpp -o coroutine_uplink_test -lpthread
+
+  Run:
+    ./coroutine_uplink_test
+
+  Exits 1 if any check fails.
+*/
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "firmware_sim.h"
+
+#if !USE_COROUTINES
+#error "needs C++20 coroutines (-std=gnu++20)"
+#endif
+
+const unsigned long HOLD_MS = 300;       // Server time before each response
+const unsigned long WARMUP_MS = 2000;
+const unsigned long OUTAGE_AT_MS = 4000; // From the end of the warm-up
+const unsigned long OUTAGE_MS = 3000;
+const unsigned long RUN_MS = 16000;
+// A quarter tick: far from the next grid point, so no sample slot is lost
+const unsigned long TICK_BUDGET_MS = SCHEDULER_TICK / 4;
+
+// Keep-alive HTTP server: one connection at a time, as the firmware holds
+// one; records the trace ID ("S") of every frame it receives
+struct FrameServer {
+  int listenFd = -1;
+  uint16_t port = 0;
+  std::atomic<bool> stop{ false };
+  std::atomic<bool> holding{ false };   // A response is being held
+  std::atomic<unsigned long> frames{ 0 };
+  std::vector<long> seqs;               // Read once the thread is joined
+
+  void start() {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listenFd, (sockaddr*)&addr, len) != 0 || listen(listenFd, 4) != 0 ||
+        getsockname(listenFd, (sockaddr*)&addr, &len) != 0) {
+      perror("frame server");
+      exit(1);
+    }
+    port = ntohs(addr.sin_port);
+  }
+
+  // One complete request at the front of buf: its length, else 0
+  static size_t request_length(const std::string& buf) {
+    size_t end = buf.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      return 0;
+    }
+    size_t body = 0;
+    size_t cl = buf.find("Content-Length: ");
+    if (cl != std::string::npos && cl < end) {
+      body = strtoul(buf.c_str() + cl + 16, nullptr, 10);
+    }
+    return buf.size() >= end + 4 + body ? end + 4 + body : 0;
+  }
+
+  void serve() {
+    int conn = -1;
+    std::string buf;
+    while (!stop) {
+      pollfd fds[2] = { { listenFd, POLLIN, 0 }, { conn, POLLIN, 0 } };
+      if (poll(fds, conn >= 0 ? 2 : 1, 20) <= 0) {
+        continue;
+      }
+      if (fds[0].revents & POLLIN) {
+        if (conn >= 0) {
+          close(conn);
+        }
+        conn = accept(listenFd, nullptr, nullptr);
+        buf.clear();
+        continue;
+      }
+      char chunk[2048];
+      ssize_t n = recv(conn, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        close(conn);
+        conn = -1;
+        continue;
+      }
+      buf.append(chunk, n);
+      size_t len;
+      while ((len = request_length(buf)) > 0) {
+        const char* s = strstr(buf.c_str(), "\"S\":");
+        if (s != nullptr && s < buf.c_str() + len) {
+          seqs.push_back(strtol(s + 4, nullptr, 10));
+          frames++;
+        }
+        buf.erase(0, len);
+        holding = true;
+        usleep(HOLD_MS * 1000);
+        holding = false;
+        const char* response = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+        send(conn, response, strlen(response), MSG_NOSIGNAL);
+      }
+    }
+    if (conn >= 0) {
+      close(conn);
+    }
+    close(listenFd);
+  }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("FAIL %s\n", what);
+    failures++;
+  }
+}
+
+// Ticks inside one wait against the grid points it spans
+struct WaitSpan {
+  bool open = false;
+  unsigned long startMs = 0;
+  unsigned long startTick = 0;
+  unsigned long spans = 0;
+  unsigned long short_ = 0;   // Spans with fewer ticks than their length calls for
+
+  void update(bool waiting, const char* what) {
+    if (waiting && !open) {
+      open = true;
+      startMs = millis();
+      startTick = tickCount;
+    } else if (!waiting && open) {
+      open = false;
+      unsigned long ms = millis() - startMs;
+      unsigned long ticks = tickCount - startTick;
+      unsigned long expected = ms / SCHEDULER_TICK > 0 ? ms / SCHEDULER_TICK - 1 : 0;
+      spans++;
+      if (ticks < expected) {
+        printf("%s of %lu ms ran %lu ticks\n", what, ms, ticks);
+        short_++;
+      }
+    }
+  }
+};
+
+int main() {
+  FrameServer server;
+  server.start();
+  std::thread serverThread(&FrameServer::serve, &server);
+  sim::net.tcpPort = server.port;
+
+  // WiFi association waits out its delays on the simulated clock
+  firmware_setup();
+  sim::start_real_time();
+
+  unsigned long start = millis();
+  while (millis() - start < WARMUP_MS) {
+    firmware_loop();
+    delayMicroseconds(200);
+  }
+  // From here on: the setup stall is not a scheduling delay
+  tickLateMaxMs = 0;
+  start = millis();
+  unsigned long startTicks = tickCount;
+  unsigned long framesBeforeRestore = 0;
+  int minPending = executor.pending();
+  int maxPending = minPending;
+  bool down = false;
+  bool restored = false;
+  WaitSpan holdSpan;
+  WaitSpan reassocSpan;
+
+  while (millis() - start < RUN_MS) {
+    unsigned long t = millis() - start;
+    if (!down && !restored && t >= OUTAGE_AT_MS) {
+      sim::set_wifi_status(WL_DISCONNECTED);
+      down = true;
+    } else if (down && t >= OUTAGE_AT_MS + OUTAGE_MS) {
+      sim::set_wifi_status(WL_CONNECTED);
+      down = false;
+      restored = true;
+      framesBeforeRestore = server.frames;
+    }
+    firmware_loop();
+    delayMicroseconds(200);
+
+    int pending = executor.pending();
+    minPending = pending < minPending ? pending : minPending;
+    maxPending = pending > maxPending ? pending : maxPending;
+    holdSpan.update(server.holding, "response hold");
+    reassocSpan.update(!wifiUp, "reassociation");
+  }
+
+  server.stop = true;
+  serverThread.join();
+
+  bool ordered = true;
+  for (size_t i = 1; i < server.seqs.size(); i++) {
+    ordered = ordered && server.seqs[i] > server.seqs[i - 1];
+  }
+  printf("frames %lu (uplinks %lu, failures %lu)  after the outage %lu\n", (unsigned long)server.frames,
+         uplinkCount, uplinkFailures, server.frames - framesBeforeRestore);
+  printf("tasks %d..%d  pool failures %lu  executor passes %lu\n", minPending, maxPending,
+         FramePool::failures, executor.resumes);
+  printf("ticks %lu in %lu ms  late max %lu ms  holds %lu  reassociations %lu\n", tickCount - startTicks,
+         RUN_MS, tickLateMaxMs, holdSpan.spans, reassocSpan.spans);
+
+  check(server.frames >= RUN_MS / 1000 / 2, "frames delivered");
+  check(ordered, "frames in order");
+  check(server.frames > framesBeforeRestore, "frames after the outage");
+  check(minPending == 2 && maxPending == 2, "both tasks alive throughout");
+  check(FramePool::failures == 0, "frame pool never exhausted");
+  check(holdSpan.spans > 0 && reassocSpan.spans > 0, "tasks waited on responses and the link");
+  check(holdSpan.short_ == 0, "ticks run while a response is awaited");
+  check(reassocSpan.short_ == 0, "ticks run while reassociating");
+  check(tickLateMaxMs <= TICK_BUDGET_MS, "tick lateness within budget");
+
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All coroutine uplink checks passed\n");
+  return 0;
+}
@@ -0,0 +1,75 @@
+/*
+  Runs the firmware in real time against a real server, for end-to-end
+  latency tracing (tools/e2e_latency.py drives it).
+
+  Build (ArduinoJson 6 from the Arduino libraries folder):
+    g++ -std=gnu++20 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        host/e2e_device.cpp -o e2e_device
+
+  Run:
+    ./e2e_device 127.0.0.1 8000 30
+
+  Prints "EPOCH_MS <ms>" first: the wall-clock time at which the device's
+  millis() was 0, so the host tool can place the frame timestamps (TA, TS)
+  on the server's clock. Host and server share the clock, so the network
+  hop is measured exactly instead of being folded into the acquisition age.
+
+  The uplink mode is chosen at build time (tools/uplink_report.py builds
+  one binary per mode), e.g. -DUSE_KEEP_ALIVE=false or -DUPLINK_BATCH=5.
+  The last line, NET, gives the connections, writes (AT commands on the
+  board) and payload bytes of the run, and UPLINK_CPU_US: the CPU time of
+  the loop() passes that touched the socket, which in the blocking build
+  includes spinning on the response as the board does.
+*/
+#include <stdlib.h>
+#include <time.h>
+
+#include "firmware_sim.h"
+
+static unsigned long long thread_cpu_us() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Socket operations so far (status polls are not uplink work)
+static unsigned long net_ops() {
+  return sim::net.connects + sim::net.writeCalls + sim::net.readCalls;
+}
+
+int main(int argc, char** argv) {
+  const char* host = argc > 1 ? argv[1] : "127.0.0.1";
+  uint16_t port = argc > 2 ? (uint16_t)atoi(argv[2]) : 8000;
+  unsigned long seconds = argc > 3 ? strtoul(argv[3], nullptr, 10) : 30;
+
+  sim::echoSerial = getenv("E2E_ECHO") != nullptr;
+  sim::net.tcpHost = host;
+  sim::net.tcpPort = port;
+  // Slowly varying readings so every frame carries fresh values
+  sim::adcSource = [](uint8_t pin) {
+    return 2048 + (int)(400.0 * sin(millis() / 5000.0 + pin));
+  };
+
+  // WiFi association waits out its delays on the simulated clock
+  firmware_setup();
+  sim::start_real_time();
+  printf("EPOCH_MS %llu\n", sim::epoch_at_start_ms());
+  fflush(stdout);
+
+  unsigned long end = millis() + seconds * 1000UL;
+  unsigned long long uplinkCpuUs = 0;
+  while ((long)(millis() - end) < 0) {
+    unsigned long ops = net_ops();
+    unsigned long long cpu = thread_cpu_us();
+    firmware_loop();
+    if (net_ops() != ops) {
+      uplinkCpuUs += thread_cpu_us() - cpu;
+    }
+    // loop() does not sleep on its own; keep the host from spinning a core
+    delayMicroseconds(200);
+  }
+  printf("FRAMES %lu FAILURES %lu\n", uplinkCount, uplinkFailures);
+  printf("NET CONNECTS %lu WRITES %lu SENT %lu RECEIVED %lu UPLINK_CPU_US %llu\n", sim::net.connects,
+         sim::net.writeCalls, sim::net.bytesSent, sim::net.bytesReceived, uplinkCpuUs);
+  return 0;
+}
@@ -0,0 +1,13 @@
+/*
+  Host build of the firmware: compiles water_monitor.c against the
+  simulated Arduino core and WiFiS3 in this directory. setup() and loop()
+  are renamed to firmware_setup() / firmware_loop() so host programs can
+  drive them.
+*/
+#pragma once
+
+#define setup firmware_setup
+#define loop firmware_loop
+#include "../water_monitor.c"
+#undef setup
+#undef loop
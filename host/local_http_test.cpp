@@ -0,0 +1,193 @@
+/*
+  LAN pull endpoint under a tight polling loop: scrapes never hold up
+  acquisition.
+
+  Runs the firmware in real time with the WiFiServer stand-in on a real
+  loopback socket, while a client thread requests /metrics and /latest
+  back to back, a new connection per request, as fast as they are served.
+  Checks that
+    - every response is a 200 with its full Content-Length of body, the
+      metrics in Prometheus text and the latest values as JSON;
+    - responses keep coming, at least one of each a second, so the
+      endpoint never stalls;
+    - no acquisition tick starts more than TICK_BUDGET_MS late meanwhile,
+      by tickLateMaxMs and by the "late" the endpoint itself reports.
+
+  Build (ArduinoJson 6 from the Arduino libraries folder):
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        host/local_http_test.cpp -o local_http_test -lpthread
+
+  Run:
+    ./local_http_test [seconds]
+
+  Exits 1 if any check fails.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "firmware_sim.h"
+
+const unsigned long WARMUP_MS = 2000;
+// A quarter tick: far from the next grid point, so no sample slot is lost
+const unsigned long TICK_BUDGET_MS = SCHEDULER_TICK / 4;
+
+struct Scraper {
+  uint16_t port = 0;
+  std::atomic<bool> stop{ false };
+  std::atomic<bool> finished{ false };
+  std::atomic<unsigned long> metrics{ 0 };
+  std::atomic<unsigned long> latest{ 0 };
+  std::atomic<unsigned long> bad{ 0 };    // Short, malformed or not 200
+  std::atomic<unsigned long> reportedLateMax{ 0 };
+  std::string lastBad;                    // Read once the thread is joined
+
+  // One request on a new connection; the whole response, or empty
+  std::string get(const char* path) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    std::string response;
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+      std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: device\r\n\r\n";
+      send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+      char buf[2048];
+      ssize_t n;
+      while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        response.append(buf, n);
+      }
+    }
+    close(fd);
+    return response;
+  }
+
+  // Status line, and a body of exactly Content-Length bytes
+  static bool well_formed(const std::string& r, std::string& body) {
+    size_t end = r.find("\r\n\r\n");
+    size_t cl = r.find("Content-Length: ");
+    if (r.compare(0, 15, "HTTP/1.1 200 OK") != 0 || end == std::string::npos || cl == std::string::npos) {
+      return false;
+    }
+    body = r.substr(end + 4);
+    return body.size() == strtoul(r.c_str() + cl + 16, nullptr, 10);
+  }
+
+  void record_bad(const std::string& r) {
+    bad++;
+    lastBad = r.substr(0, 200);
+  }
+
+  void run() {
+    for (bool scrapeMetrics = true; !stop; scrapeMetrics = !scrapeMetrics) {
+      std::string r = get(scrapeMetrics ? "/metrics" : "/latest");
+      std::string body;
+      if (!well_formed(r, body)) {
+        record_bad(r);
+      } else if (scrapeMetrics) {
+        if (body.find("water_reading{") == std::string::npos ||
+            body.find("water_tick_late_max_ms ") == std::string::npos) {
+          record_bad(r);
+        } else {
+          metrics++;
+        }
+      } else {
+        size_t late = body.find("\"late\":");
+        if (body.compare(0, 6, "{\"D\":\"") != 0 || body.back() != '}' || late == std::string::npos) {
+          record_bad(r);
+        } else {
+          latest++;
+          unsigned long ms = strtoul(body.c_str() + late + 7, nullptr, 10);
+          if (ms > reportedLateMax) {
+            reportedLateMax = ms;
+          }
+        }
+      }
+    }
+    finished = true;
+  }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("FAIL %s\n", what);
+    failures++;
+  }
+}
+
+int main(int argc, char** argv) {
+  unsigned long seconds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10;
+
+  sim::net.lanServer = true;
+  // Every socket call costs its AT transaction with the bridge, as on the
+  // board; writing a chunk takes a good part of a tick
+  sim::modem.timed = true;
+  sim::adcSource = [](uint8_t pin) {
+    return 2048 + (int)(400.0 * sin(millis() / 5000.0 + pin));
+  };
+
+  // WiFi association waits out its delays on the simulated clock
+  firmware_setup();
+  sim::start_real_time();
+  if (sim::net.lanPort == 0) {
+    printf("FAIL no LAN listener\n");
+    return 1;
+  }
+
+  unsigned long start = millis();
+  while (millis() - start < WARMUP_MS) {
+    firmware_loop();
+    delayMicroseconds(200);
+  }
+  // From here on: the setup stall is not a scheduling delay
+  tickLateMaxMs = 0;
+  snapshotDirty = true;
+
+  Scraper scraper;
+  scraper.port = sim::net.lanPort;
+  std::thread scraperThread(&Scraper::run, &scraper);
+  start = millis();
+  unsigned long startTicks = tickCount;
+  unsigned long startAccepts = sim::net.lanAccepts;
+  while (millis() - start < seconds * 1000UL) {
+    firmware_loop();
+    delayMicroseconds(200);
+  }
+  scraper.stop = true;
+  // Serve the request in flight so the client thread can finish
+  while (!scraper.finished) {
+    firmware_loop();
+    delayMicroseconds(200);
+  }
+  scraperThread.join();
+
+  unsigned long served = scraper.metrics + scraper.latest;
+  printf("served %lu (/metrics %lu, /latest %lu)  bad %lu  accepts %lu\n", served, (unsigned long)scraper.metrics,
+         (unsigned long)scraper.latest, (unsigned long)scraper.bad, sim::net.lanAccepts - startAccepts);
+  printf("ticks %lu in %lu s  late max %lu ms  reported %lu ms  uplinks %lu\n", tickCount - startTicks, seconds,
+         tickLateMaxMs, (unsigned long)scraper.reportedLateMax, uplinkCount);
+  if (scraper.bad) {
+    printf("last bad response: %s\n", scraper.lastBad.c_str());
+  }
+
+  check(scraper.bad == 0, "every response complete and well formed");
+  // A /metrics body is half a dozen chunks, each a loop() pass of its own
+  check(scraper.metrics >= seconds && scraper.latest >= seconds, "both endpoints served throughout");
+  check(tickCount - startTicks >= seconds * 1000 / SCHEDULER_TICK - 1, "acquisition ticks kept running");
+  check(tickLateMaxMs <= TICK_BUDGET_MS, "tick lateness within budget");
+  check(scraper.reportedLateMax <= TICK_BUDGET_MS, "reported lateness within budget");
+
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All local HTTP checks passed\n");
+  return 0;
+}
@@ -0,0 +1,189 @@
+/*
+  Signal-model test of the conductivity lock-in against the DC reading it
+  replaces, at the same sample budget.
+
+  The cell model behind analogRead(CONDUCT_PIN) has a slowly varying true
+  response plus what a DC reading cannot tell apart from it: electrode
+  polarization that builds while the cell is driven with DC, an ADC and
+  electrode offset that wanders, mains at 50.1 Hz with its third harmonic,
+  a pump motor at 83 Hz, and white conversion noise. With AC excitation
+  the node swings around mid-rail by half the response, following
+  EXCITE_PIN with the cell's settling time constant.
+
+  Each scenario takes readings every 500 ms for --seconds, both ways:
+    dc       40 conversions over 20 ms, averaged (read_adc() with 40 samples)
+    lock-in  read_conductivity_lockin(): 40 conversions over 20 ms demodulated
+  and prints the bias, spread and RMS of the error in uS/cm.
+
+  Build (ArduinoJson 6 from the Arduino libraries folder):
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        host/lockin_signal_test.cpp -o lockin_signal_test
+
+  Run:
+    ./lockin_signal_test --seconds 600
+
+  Exits 1 if the lock-in RMS error in the full model is not at least
+  --min-db below the DC one, or its quadrature exceeds 2% of the in-phase
+  sum on the resistive cell (the reference has slipped).
+*/
+#define LOCKIN_CONDUCTIVITY true
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "firmware_sim.h"
+
+struct Model {
+  const char* name;
+  double polarization;     // Fractional loss after long DC drive
+  double offsetWalk;       // Offset random walk, counts per sqrt(ms)
+  double mains;            // 50.1 Hz amplitude (third harmonic: a quarter)
+  double motor;            // 83 Hz amplitude
+  double white;            // Conversion noise, counts RMS
+};
+
+static const Model MODELS[] = {
+  { "full", 0.12, 0.05, 40, 25, 6 },
+  { "noise only", 0, 0, 40, 25, 6 },
+  { "white only", 0, 0, 0, 0, 6 },
+};
+
+static const Model* model;
+static bool dcDrive = false;
+static const double SETTLE_US = 30;     // Cell settling after an edge
+static unsigned long long rng = 88172645463325252ULL;
+static double offset = 0;
+static unsigned long offsetUs = 0;
+static unsigned long edgeUs = 0;
+static uint8_t lastLevel = LOW;
+
+static double uniform() {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return ((rng >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double gaussian() {
+  return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+// True response in counts: what a polarization-free DC reading would give
+static double true_counts(unsigned long us) {
+  return 1600 + 20 * sin(2 * M_PI * us / 600e6);
+}
+
+static int cell_adc(uint8_t pin) {
+  if (pin != CONDUCT_PIN) {
+    return 2048;
+  }
+  unsigned long now = sim::clockUs;
+  for (; offsetUs + 1000 <= now; offsetUs += 1000) {
+    offset += model->offsetWalk * gaussian();
+  }
+  double t = now / 1e6;
+  double v = offset + model->mains * sin(2 * M_PI * 50.1 * t) + model->mains / 4 * sin(2 * M_PI * 150.3 * t + 1)
+             + model->motor * sin(2 * M_PI * 83 * t + 2) + model->white * gaussian();
+  double a = true_counts(now);
+  if (dcDrive) {
+    v += a * (1 - model->polarization * (1 - exp(-t / 120)));
+  } else {
+    uint8_t level = sim::pinLevel[EXCITE_PIN];
+    double settled = 1 - 2 * exp(-(double)(now - edgeUs) / SETTLE_US);
+    v += 2048 + (level ? a / 2 : -a / 2) * settled;
+  }
+  return (int)lround(fmin(4095, fmax(0, v)));
+}
+
+// Note excitation edges as time moves on from the digitalWrite()
+static void watch_edges(unsigned long us) {
+  uint8_t level = sim::pinLevel[EXCITE_PIN];
+  if (level != lastLevel) {
+    lastLevel = level;
+    edgeUs = sim::clockUs - us;
+  }
+}
+
+struct Stats {
+  double sum = 0, sumSq = 0;
+  int n = 0;
+  void add(double e) {
+    sum += e;
+    sumSq += e * e;
+    n++;
+  }
+  double bias() const { return sum / n; }
+  double rms() const { return sqrt(sumSq / n); }
+  double spread() const { return sqrt(fmax(0, sumSq / n - bias() * bias())); }
+};
+
+static Stats run(const Model& m, bool dc, double seconds, double& worstQ) {
+  model = &m;
+  dcDrive = dc;
+  sim::clockUs = 0;
+  offset = 0;
+  offsetUs = 0;
+  digitalWrite(EXCITE_PIN, dc ? HIGH : LOW);
+  Stats s;
+  for (unsigned long t = 500000; t < seconds * 1e6; t += 500000) {
+    sim::advance(t - sim::clockUs);
+    unsigned long start = sim::clockUs;
+    uint16_t raw;
+    if (dc) {
+      uint32_t sum = 0;
+      for (int i = 0; i < LOCKIN_SAMPLES; i++) {
+        sum += analogRead(CONDUCT_PIN);
+        delayMicroseconds(LOCKIN_CYCLES * LOCKIN_PERIOD_US / LOCKIN_SAMPLES);
+      }
+      raw = sum / LOCKIN_SAMPLES;
+    } else {
+      raw = read_conductivity_lockin();
+      worstQ = fmax(worstQ, fabs((double)lockinQ) / fabs((double)lockinI));
+    }
+    double truth = true_counts((start + sim::clockUs) / 2);
+    s.add(convert_conductivity(raw) - 1500.0 * truth / 4095.0);
+  }
+  return s;
+}
+
+int main(int argc, char** argv) {
+  double seconds = 600;
+  double minDb = 20;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    if (flag == "--seconds") {
+      seconds = atof(argv[i + 1]);
+    } else if (flag == "--min-db") {
+      minDb = atof(argv[i + 1]);
+    } else {
+      argc = 0;
+    }
+  }
+  if (argc % 2 == 0 || seconds < 1) {
+    fprintf(stderr, "usage: lockin_signal_test [--seconds S] [--min-db DB]\n");
+    return 2;
+  }
+
+  sim::adcSource = cell_adc;
+  sim::onAdvance = watch_edges;
+  printf("%d conversions per reading both ways, %.0f s of readings every 500 ms\n", LOCKIN_SAMPLES, seconds);
+  printf("model       method   bias uS/cm  spread uS/cm  rms uS/cm  gain dB\n");
+  bool ok = true;
+  double worstQ = 0;
+  for (const Model& m : MODELS) {
+    double unused = 0;
+    Stats dc = run(m, true, seconds, unused);
+    Stats ac = run(m, false, seconds, worstQ);
+    double gain = 20 * log10(dc.rms() / ac.rms());
+    printf("%-10s  dc       %10.3f  %12.3f  %9.3f\n", m.name, dc.bias(), dc.spread(), dc.rms());
+    printf("%-10s  lock-in  %10.3f  %12.3f  %9.3f  %7.1f\n", m.name, ac.bias(), ac.spread(), ac.rms(), gain);
+    if (&m == &MODELS[0]) {
+      ok &= gain >= minDb;
+    }
+  }
+  printf("Worst |Q| / |I|: %.4f\n", worstQ);
+  ok &= worstQ < 0.02;
+  return ok ? 0 : 1;
+}
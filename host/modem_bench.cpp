@@ -0,0 +1,163 @@
+/*
+  AT transactions per reading over the simulated WiFiS3 bridge.
+
+  Runs the firmware in simulated time against the in-memory server with
+  the modem model of WiFiS3.h timed: each AT transaction costs the
+  bridge's turnaround plus its bytes over the UART, and the server answers
+  --server-ms after each request. loop() runs back to back as on the
+  board, with --loop-us standing in for the rest of its work per pass.
+
+  Prints the transactions per uplinked reading by command, the modem time
+  they take, and the loop rate. With --drop-at the access point goes away
+  for --drop-s seconds at that time, and the bench reports how long the
+  firmware took to notice. Build once per transport or link check to
+  compare:
+
+  Build (ArduinoJson 6 from the Arduino libraries folder):
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        host/modem_bench.cpp -o modem_bench
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        -DMODEM_BULK=false host/modem_bench.cpp -o modem_bench_legacy
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        -DLINK_CACHE=false host/modem_bench.cpp -o modem_bench_status
+  -DLINK_NOTIFY=true takes link changes from WiFi.onLinkChange().
+
+  Run:
+    ./modem_bench --seconds 60 --baud 921600 --turnaround-us 1000 --server-ms 30
+    ./modem_bench --seconds 60 --drop-at 20 --drop-s 3
+
+  --baud overrides the rate modem.begin(MODEM_BAUD) set, as a build with
+  that MODEM_BAUD (and a bridge firmware to match) would.
+*/
+#include <stdlib.h>
+
+#include <string>
+
+#include "firmware_sim.h"
+
+struct BenchConfig {
+  double seconds = 60;
+  unsigned long baud = 0;            // 0: MODEM_BAUD
+  unsigned long turnaroundUs = 1000;
+  unsigned long serverMs = 30;
+  unsigned long loopUs = 20;
+  double dropAt = 0;                 // 0: the link stays up
+  double dropS = 3;
+};
+
+// Link drop: when it starts and ends, and when the firmware noticed
+static unsigned long dropStartUs = 0;
+static unsigned long dropEndUs = 0;
+static bool dropped = false;
+static long detectUs = -1;
+
+static void watch_link(unsigned long) {
+  if (!dropStartUs) {
+    return;
+  }
+  if (!dropped && sim::clockUs >= dropStartUs && sim::clockUs < dropEndUs) {
+    dropped = true;
+    sim::set_wifi_status(WL_CONNECTION_LOST);
+  } else if (dropped && sim::clockUs >= dropEndUs) {
+    dropped = false;
+    sim::set_wifi_status(WL_CONNECTED);
+  }
+  if (detectUs < 0 && sim::clockUs >= dropStartUs && !wifiUp) {
+    detectUs = (long)(sim::clockUs - dropStartUs);
+  }
+}
+
+static bool parse_args(int argc, char** argv, BenchConfig& cfg) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    double value = atof(argv[i + 1]);
+    if (flag == "--seconds") {
+      cfg.seconds = value;
+    } else if (flag == "--baud") {
+      cfg.baud = (unsigned long)value;
+    } else if (flag == "--turnaround-us") {
+      cfg.turnaroundUs = (unsigned long)value;
+    } else if (flag == "--server-ms") {
+      cfg.serverMs = (unsigned long)value;
+    } else if (flag == "--loop-us") {
+      cfg.loopUs = (unsigned long)value;
+    } else if (flag == "--drop-at") {
+      cfg.dropAt = value;
+    } else if (flag == "--drop-s") {
+      cfg.dropS = value;
+    } else {
+      return false;
+    }
+  }
+  return (argc % 2) == 1 && cfg.seconds > 0;
+}
+
+int main(int argc, char** argv) {
+  BenchConfig cfg;
+  if (!parse_args(argc, argv, cfg)) {
+    fprintf(stderr, "usage: modem_bench [--seconds S] [--baud B] [--turnaround-us US] [--server-ms MS] [--loop-us US]\n"
+                    "                   [--drop-at S] [--drop-s S]\n");
+    return 2;
+  }
+
+  firmware_setup();
+  sim::modem.timed = true;
+  sim::modem.turnaroundUs = cfg.turnaroundUs;
+  if (cfg.baud) {
+    sim::modem.baud = cfg.baud;
+  }
+  sim::net.responseUs = cfg.serverMs * 1000;
+
+  sim::Modem before = sim::modem;
+  unsigned long readings = uplinkCount;
+  unsigned long start = sim::clockUs;
+  unsigned long end = start + (unsigned long)(cfg.seconds * 1e6);
+  if (cfg.dropAt > 0) {
+    dropStartUs = start + (unsigned long)(cfg.dropAt * 1e6);
+    dropEndUs = dropStartUs + (unsigned long)(cfg.dropS * 1e6);
+    sim::onAdvance = watch_link;
+  }
+  unsigned long passes = 0;
+  unsigned long long uplinkPassUs = 0;
+  while (sim::clockUs < end) {
+    unsigned long sends = sim::modem.byKind[sim::AT_SEND];
+    unsigned long passStart = sim::clockUs;
+    firmware_loop();
+    delayMicroseconds(cfg.loopUs);
+    passes++;
+    if (sim::modem.byKind[sim::AT_SEND] != sends) {
+      uplinkPassUs += sim::clockUs - passStart;
+    }
+  }
+  readings = uplinkCount - readings;
+  double elapsed = (sim::clockUs - start) / 1e6;
+
+  printf("MODEM_BULK=%d LINK_CACHE=%d LINK_NOTIFY=%d, %lu baud, %lu us turnaround, server %lu ms: %.0f s, "
+         "%lu readings, %.0f loop passes/s, %.1f status queries/s\n",
+         MODEM_BULK ? 1 : 0, LINK_CACHE ? 1 : 0, LINK_NOTIFY ? 1 : 0, sim::modem.baud, cfg.turnaroundUs,
+         cfg.serverMs, elapsed, readings, passes / elapsed,
+         (sim::modem.byKind[sim::AT_STATUS] - before.byKind[sim::AT_STATUS]) / elapsed);
+  if (dropStartUs) {
+    if (detectUs < 0) {
+      printf("Link drop of %.1f s at %.1f s not noticed\n", cfg.dropS, cfg.dropAt);
+      return 1;
+    }
+    printf("Link drop of %.1f s at %.1f s noticed after %.1f ms\n", cfg.dropS, cfg.dropAt, detectUs / 1000.0);
+  }
+  if (readings == 0) {
+    printf("No readings uplinked\n");
+    return 1;
+  }
+  printf("AT per reading:");
+  double uplinkAt = 0;
+  for (int k = 0; k < sim::AT_KINDS; k++) {
+    double per = (double)(sim::modem.byKind[k] - before.byKind[k]) / readings;
+    printf(" %s %.2f", sim::AT_NAMES[k], per);
+    uplinkAt += k == sim::AT_STATUS ? 0 : per;
+  }
+  printf("\nUplink AT per reading %.2f, modem busy %.1f ms per reading (%.1f%% of the time), "
+         "uplink passes %.1f ms per reading\n",
+         uplinkAt, (sim::modem.busyUs - before.busyUs) / 1000.0 / readings,
+         100.0 * (sim::modem.busyUs - before.busyUs) / (elapsed * 1e6), uplinkPassUs / 1000.0 / readings);
+  return 0;
+}
@@ -0,0 +1,173 @@
+/*
+  Host stand-in for the RA4M1 registers the sketch programs directly: the
+  ADC14 compare unit (R_ADC0, FSP names) and __WFI(). On the board the
+  core's Arduino.h pulls these in from the FSP; here Arduino.h includes
+  this file.
+
+  Every conversion goes through sim::adc_convert(): analogRead() and, while
+  the CPU sleeps in __WFI() with a continuous scan started (ADCSR.ADST with
+  ADCS = continuous), back-to-back scans of the ADANSA channels. Each
+  result is checked against window A (ADCMPANSR channels, ADCMPDR0/1) and
+  window B (ADCMPBNSR channel, ADWINLLB/ULB) as the hardware does: a match
+  sets the status flag and, with the interrupt enabled, runs the handler
+  registered for ELC_EVENT_ADC0_COMPARE_A/B (IRQManager.h). __WFI() returns
+  after that interrupt or at the next 1 ms core tick.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Analog pins of the UNO R4 WiFi: A0 = P014 (AN009), A1 = P000 (AN000),
+// A2 = P001 (AN001), A3 = P002 (AN002), A4 = P101 (AN021), A5 = P100 (AN022)
+#define SIM_ANALOG_PINS { 14, 15, 16, 17, 18, 19 }
+#define SIM_ANALOG_CHANNELS { 9, 0, 1, 2, 21, 22 }
+
+struct R_ADC0_Type {
+  uint16_t ADCSR;
+  uint16_t ADANSA[2];
+  uint16_t ADCMPCR;
+  uint16_t ADCMPANSR[2];
+  uint16_t ADCMPLR[2];
+  uint16_t ADCMPDR0;
+  uint16_t ADCMPDR1;
+  uint16_t ADCMPSR[2];
+  uint8_t ADCMPBNSR;
+  uint16_t ADWINLLB;
+  uint16_t ADWINULB;
+  uint8_t ADCMPBSR;
+};
+
+#define R_ADC0_ADCSR_ADST_Msk 0x8000
+#define R_ADC0_ADCSR_ADCS_Pos 13
+#define R_ADC0_ADCSR_ADCS_Msk 0x6000
+#define R_ADC0_ADCMPCR_CMPAIE_Msk 0x8000
+#define R_ADC0_ADCMPCR_WCMPE_Msk 0x4000
+#define R_ADC0_ADCMPCR_CMPBIE_Msk 0x2000
+#define R_ADC0_ADCMPCR_CMPAE_Msk 0x0800
+#define R_ADC0_ADCMPCR_CMPBE_Msk 0x0200
+#define R_ADC0_ADCMPBNSR_CMPCHB_Msk 0x3F
+#define R_ADC0_ADCMPBNSR_CMPLB_Msk 0x80
+#define R_ADC0_ADCMPBSR_CMPSTB_Msk 0x01
+
+typedef enum {
+  ELC_EVENT_ADC0_COMPARE_A,
+  ELC_EVENT_ADC0_COMPARE_B,
+  SIM_ELC_EVENTS
+} elc_event_t;
+
+namespace sim {
+inline R_ADC0_Type adc0;
+// Handlers attached with IRQManager::addGenericInterrupt()
+inline void (*irqHandler[SIM_ELC_EVENTS])() = {};
+inline elc_event_t currentEvent;
+inline bool interrupted = false;   // An interrupt ran (ends __WFI())
+// Time spent in __WFI() and how many times it was entered
+inline unsigned long long sleepUs = 0;
+inline unsigned long sleeps = 0;
+
+inline int adc_pin_of(uint8_t channel) {
+  static const uint8_t pins[] = SIM_ANALOG_PINS;
+  static const uint8_t channels[] = SIM_ANALOG_CHANNELS;
+  for (unsigned i = 0; i < sizeof(channels); i++) {
+    if (channels[i] == channel) {
+      return pins[i];
+    }
+  }
+  return -1;
+}
+
+inline int adc_channel_of(uint8_t pin) {
+  static const uint8_t pins[] = SIM_ANALOG_PINS;
+  static const uint8_t channels[] = SIM_ANALOG_CHANNELS;
+  for (unsigned i = 0; i < sizeof(pins); i++) {
+    if (pins[i] == pin) {
+      return channels[i];
+    }
+  }
+  return -1;
+}
+
+inline void raise(elc_event_t event) {
+  if (irqHandler[event]) {
+    currentEvent = event;
+    interrupted = true;
+    irqHandler[event]();
+  }
+}
+
+// Window test of ADCMPCR.WCMPE; inside selects the in-window condition
+inline bool compare_match(uint16_t v, uint16_t low, uint16_t high, bool inside, bool window) {
+  if (!window) {
+    return inside ? v > low : v < low;
+  }
+  return inside ? (low < v && v < high) : (v < low || v > high);
+}
+
+// Check one conversion result against windows A and B
+inline void adc_compare(uint8_t channel, uint16_t v) {
+  R_ADC0_Type& r = adc0;
+  bool window = r.ADCMPCR & R_ADC0_ADCMPCR_WCMPE_Msk;
+  uint16_t bit = (uint16_t)(1u << (channel & 15));
+  int reg = channel >> 4;
+  if ((r.ADCMPCR & R_ADC0_ADCMPCR_CMPAE_Msk) && (r.ADCMPANSR[reg] & bit)
+      && compare_match(v, r.ADCMPDR0, r.ADCMPDR1, r.ADCMPLR[reg] & bit, window)) {
+    r.ADCMPSR[reg] |= bit;
+    if (r.ADCMPCR & R_ADC0_ADCMPCR_CMPAIE_Msk) {
+      raise(ELC_EVENT_ADC0_COMPARE_A);
+    }
+  }
+  if ((r.ADCMPCR & R_ADC0_ADCMPCR_CMPBE_Msk) && (r.ADCMPBNSR & R_ADC0_ADCMPBNSR_CMPCHB_Msk) == channel
+      && compare_match(v, r.ADWINLLB, r.ADWINULB, r.ADCMPBNSR & R_ADC0_ADCMPBNSR_CMPLB_Msk, window)) {
+    r.ADCMPBSR |= R_ADC0_ADCMPBSR_CMPSTB_Msk;
+    if (r.ADCMPCR & R_ADC0_ADCMPCR_CMPBIE_Msk) {
+      raise(ELC_EVENT_ADC0_COMPARE_B);
+    }
+  }
+}
+
+// One conversion of pin: costs adcConversionUs and feeds the comparator
+inline int adc_convert(uint8_t pin) {
+  advance(adcConversionUs);
+  int v = adcSource(pin);
+  int channel = adc_channel_of(pin);
+  if (channel >= 0) {
+    adc_compare((uint8_t)channel, (uint16_t)v);
+  }
+  return v;
+}
+}  // namespace sim
+
+#define R_ADC0 (&sim::adc0)
+
+// Sleep mode: wakes on the next 1 ms tick or any interrupt, converting in
+// the background meanwhile if a continuous scan is running
+inline void __WFI() {
+  unsigned long start = micros();
+  unsigned long tick = (start / 1000 + 1) * 1000;
+  sim::sleeps++;
+  const R_ADC0_Type& r = sim::adc0;
+  bool scanning = (r.ADCSR & R_ADC0_ADCSR_ADST_Msk)
+                  && ((r.ADCSR & R_ADC0_ADCSR_ADCS_Msk) >> R_ADC0_ADCSR_ADCS_Pos) == 2;
+  if (!scanning || sim::realTime) {
+    sim::advance(tick - start);
+    sim::sleepUs += tick - start;
+    return;
+  }
+  sim::interrupted = false;
+  while (!sim::interrupted && sim::clockUs < tick) {
+    bool any = false;
+    for (int ch = 0; ch < 32 && !sim::interrupted; ch++) {
+      if (r.ADANSA[ch >> 4] & (1u << (ch & 15))) {
+        int pin = sim::adc_pin_of((uint8_t)ch);
+        if (pin >= 0) {
+          sim::adc_convert((uint8_t)pin);
+          any = true;
+        }
+      }
+    }
+    if (!any) {
+      sim::advance(tick - sim::clockUs);
+    }
+  }
+  sim::sleepUs += sim::clockUs - start;
+}
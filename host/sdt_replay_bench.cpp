@@ -0,0 +1,254 @@
+/*
+  Swing-door compression replayed over a trace: points kept versus the
+  error of rebuilding the reported values from the kept ones.
+
+  Reads a capture of tools/stream_receiver.py (seq,t_us,ch0,ch1,ch2 raw
+  counts), averages each channel over its report period as the firmware
+  does, converts, and feeds the values to the firmware's swing_door().
+  Without a capture it replays a synthetic day: slow drift, a few steps
+  and sensor noise. Each channel's deviation is swept over --scales times
+  its table value; the values are rebuilt by joining the kept points with
+  straight lines, as a historian would. Then the firmware runs through a
+  server outage long enough to fill the queue of kept points, with every
+  connect failing, and must come out of it holding the newest points.
+
+  Build (ArduinoJson 6 from the Arduino libraries folder):
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        host/sdt_replay_bench.cpp -o sdt_replay_bench
+
+  Run:
+    ./sdt_replay_bench
+    ./sdt_replay_bench --trace captura.csv --scales 0.5,1,2 --max-s 600
+
+  Exits 1 if any rebuilt value is further than the deviation from the
+  reported one, or if the queue kept stale points over fresh ones during
+  the outage.
+*/
+#define SWING_DOOR true
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "firmware_sim.h"
+
+struct Point {
+  unsigned long t;   // ms
+  float v;
+};
+
+// Raw samples of the trace: time and one count per channel
+struct Sample {
+  unsigned long long tUs;
+  int raw[NUM_CHANNELS];
+};
+
+static bool load_trace(const char* path, std::vector<Sample>& out) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    return false;
+  }
+  char line[256];
+  fgets(line, sizeof(line), f);  // Header
+  while (fgets(line, sizeof(line), f)) {
+    Sample s;
+    unsigned long seq;
+    if (sscanf(line, "%lu,%llu,%d,%d,%d", &seq, &s.tUs, &s.raw[0], &s.raw[1], &s.raw[2]) == 5) {
+      out.push_back(s);
+    }
+  }
+  fclose(f);
+  return !out.empty();
+}
+
+// A day at 10 Hz: diurnal drift, steps (a valve, a dosing pump) and noise
+static void synthetic_trace(std::vector<Sample>& out) {
+  static const int BASE[NUM_CHANNELS] = { 3000, 2048, 1600 };
+  static const int DRIFT[NUM_CHANNELS] = { 150, 60, 200 };
+  unsigned long rng = 12345;
+  int step[NUM_CHANNELS] = {};
+  for (unsigned long long t = 0; t < 86400ULL * 1000000; t += 100000) {
+    Sample s;
+    s.tUs = t;
+    double day = t / 86400e6 * 2 * M_PI;
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+      rng = rng * 1103515245 + 12345;
+      if ((rng >> 16) % 20000 == 0) {
+        step[i] = (int)((rng >> 8) % 401) - 200;
+      }
+      rng = rng * 1103515245 + 12345;
+      int noise = (int)((rng >> 16) % 9) - 4;
+      s.raw[i] = BASE[i] + (int)(DRIFT[i] * sin(day + i)) + step[i] + noise;
+    }
+    out.push_back(s);
+  }
+}
+
+// Reported values of channel i: trace averages over its report period
+static std::vector<Point> reports(const std::vector<Sample>& trace, int i) {
+  std::vector<Point> out;
+  unsigned long long period = channels[i].reportPeriod * 1000ULL;
+  unsigned long long end = trace.front().tUs + period;
+  unsigned long sum = 0, count = 0;
+  for (const Sample& s : trace) {
+    while (s.tUs >= end) {
+      if (count) {
+        out.push_back({ (unsigned long)(end / 1000), channels[i].convert(sum / count) });
+      }
+      sum = count = 0;
+      end += period;
+    }
+    sum += s.raw[i];
+    count++;
+  }
+  return out;
+}
+
+// Run channel i's reports through swing_door(), draining the queue
+static std::vector<Point> compress(int i, const std::vector<Point>& in) {
+  SensorChannel& ch = channels[i];
+  ch.sdtStarted = false;
+  ch.sdtHeld = false;
+  sdtHead = sdtCount = 0;
+  std::vector<Point> kept;
+  for (const Point& p : in) {
+    swing_door(i, p.t, p.v, 0);
+    for (; sdtCount; sdtCount--, sdtHead = (sdtHead + 1) % SDT_QUEUE) {
+      kept.push_back({ sdtQueue[sdtHead].time, sdtQueue[sdtHead].value });
+    }
+  }
+  // The held point goes out with the next one kept; close the line there
+  if (ch.sdtHeld) {
+    kept.push_back({ ch.heldTime, ch.heldValue });
+  }
+  return kept;
+}
+
+// Max and RMS distance of the reports from the line through the kept points
+static void rebuild_error(const std::vector<Point>& in, const std::vector<Point>& kept, double& maxErr,
+                          double& rms) {
+  maxErr = 0;
+  double sq = 0;
+  size_t k = 0;
+  for (const Point& p : in) {
+    while (k + 1 < kept.size() && kept[k + 1].t < p.t) {
+      k++;
+    }
+    double v = kept[k].v;
+    if (k + 1 < kept.size() && p.t > kept[k].t) {
+      const Point& a = kept[k];
+      const Point& b = kept[k + 1];
+      v = a.v + (double)(b.v - a.v) * (p.t - a.t) / (b.t - a.t);
+    }
+    double e = fabs(p.v - v);
+    maxErr = e > maxErr ? e : maxErr;
+    sq += e * e;
+  }
+  rms = in.empty() ? 0 : sqrt(sq / in.size());
+}
+
+// The firmware from setup() against a server that refuses every
+// connection for outageS: the full queue must keep dropping its oldest
+// points, so at the end it holds the newest ones
+static bool outage_check(double outageS) {
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    channels[i].sdtStarted = false;
+    channels[i].sdtHeld = false;
+  }
+  sdtHead = sdtCount = 0;
+  sdtPointsKept = sdtDropped = 0;
+  sim::adcSource = [](uint8_t pin) {
+    return 2048 + (int)(400.0 * sin(millis() / 5000.0 + pin));
+  };
+  firmware_setup();
+  sim::net.acceptConnections = false;
+  unsigned long end = millis() + (unsigned long)(outageS * 1000);
+  while ((long)(millis() - end) < 0) {
+    firmware_loop();
+    delayMicroseconds(200);
+  }
+
+  unsigned long newest = 0;
+  for (uint8_t n = 0; n < sdtCount; n++) {
+    unsigned long t = sdtQueue[(sdtHead + n) % SDT_QUEUE].time;
+    newest = (long)(t - newest) > 0 ? t : newest;
+  }
+  unsigned long age = millis() - newest;
+  printf("outage %.0f s: %lu points kept, %lu dropped, %u queued, newest %.1f s old\n", outageS, sdtPointsKept,
+         sdtDropped, sdtCount, age / 1000.0);
+  // A channel keeps a point at least once per max interval
+  unsigned long maxInterval = 0;
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    maxInterval = max(maxInterval, channels[i].sdtMaxInterval + channels[i].reportPeriod);
+  }
+  return sdtCount == SDT_QUEUE && sdtDropped > 0 && age <= maxInterval;
+}
+
+int main(int argc, char** argv) {
+  const char* tracePath = nullptr;
+  std::string scales = "0.5,1,2,4";
+  double maxS = 0;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    if (flag == "--trace") {
+      tracePath = argv[i + 1];
+    } else if (flag == "--scales") {
+      scales = argv[i + 1];
+    } else if (flag == "--max-s") {
+      maxS = atof(argv[i + 1]);
+    } else {
+      argc = 0;
+    }
+  }
+  if (argc % 2 == 0) {
+    fprintf(stderr, "usage: sdt_replay_bench [--trace CSV] [--scales A,B,..] [--max-s S]\n");
+    return 2;
+  }
+
+  std::vector<Sample> trace;
+  if (tracePath) {
+    if (!load_trace(tracePath, trace)) {
+      fprintf(stderr, "cannot read %s\n", tracePath);
+      return 2;
+    }
+  } else {
+    synthetic_trace(trace);
+  }
+  printf("%s, %.0f s\n", tracePath ? tracePath : "synthetic day",
+         (trace.back().tUs - trace.front().tUs) / 1e6);
+  printf("channel  deviation  max s  reports    kept  kept %%  max err   rms err\n");
+
+  bool ok = true;
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    SensorChannel& ch = channels[i];
+    float baseDeviation = ch.sdtDeviation;
+    if (maxS > 0) {
+      ch.sdtMaxInterval = (unsigned long)(maxS * 1000);
+    }
+    std::vector<Point> in = reports(trace, i);
+    if (in.empty()) {
+      continue;
+    }
+    for (size_t pos = 0; pos < scales.size();) {
+      size_t comma = scales.find(',', pos);
+      ch.sdtDeviation = baseDeviation * (float)atof(scales.c_str() + pos);
+      pos = comma == std::string::npos ? scales.size() : comma + 1;
+
+      std::vector<Point> kept = compress(i, in);
+      double maxErr, rms;
+      rebuild_error(in, kept, maxErr, rms);
+      printf("%-7s  %9.3f  %5lu  %7zu  %6zu  %6.2f  %7.3f  %8.4f\n", ch.key, ch.sdtDeviation,
+             ch.sdtMaxInterval / 1000, in.size(), kept.size(), 100.0 * kept.size() / in.size(), maxErr, rms);
+      ok &= maxErr <= ch.sdtDeviation * 1.001 + 1e-4;
+    }
+    ch.sdtDeviation = baseDeviation;
+  }
+  if (!outage_check(1800)) {
+    printf("Stale points kept through the outage\n");
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+/*
+  Threshold alarm latency with the ADC window comparator, in simulated time.
+
+  Builds the firmware with WINDOW_ALARMS and runs it against the in-memory
+  server. Every --every seconds one channel (in turn) steps past a danger
+  limit for --hold seconds. For each crossing it records when the alarm
+  frame ("AL") went out and when the channel's next regular report carried
+  the dangerous value, which is all an alarm gets without the comparator
+  (a short crossing can vanish into a report period's average).
+  Channels with a hardware window are caught by the comparator while the
+  CPU sleeps; the rest by the software check as they are sampled. Then
+  the pH probe floats for --float-s seconds, jumping to a random level
+  every 50 ms: inside its limits at first, until the quality checks flag
+  it, then across them. A faulty probe must raise no alarm.
+
+  Build (ArduinoJson 6 from the Arduino libraries folder):
+    g++ -std=gnu++17 -O2 -Ihost -I ~/Arduino/libraries/ArduinoJson/src \
+        host/window_alarm_sim.cpp -o window_alarm_sim
+  Add -DUPLINK_BATCH=5 to check that alarms skip the batch.
+
+  Run:
+    ./window_alarm_sim --seconds 300 --every 20 --hold 3
+
+  Exits 1 if a crossing raised no alarm, an alarm came without a crossing
+  (the floating probe's included), or a hardware-window alarm took longer
+  than --bound-ms.
+*/
+#define WINDOW_ALARMS true
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "firmware_sim.h"
+
+struct SimConfig {
+  double seconds = 300;
+  double every = 20;      // Seconds between crossings
+  double hold = 3;        // Seconds each crossing lasts
+  double boundMs = 100;   // Hardware-window alarm deadline
+  double floatS = 30;     // Floating pH probe at the end
+};
+
+// Safe and dangerous raw levels per channel (T inverted: low raw = turbid)
+static const int SAFE_RAW[NUM_CHANNELS] = { 3000, 2048, 1600 };
+static const int DANGER_RAW[NUM_CHANNELS] = { 400, 300, 3950 };
+
+struct Crossing {
+  int channel;
+  unsigned long startUs;
+  unsigned long endUs;
+  long alarmUs = -1;    // First alarm frame, relative to the start
+  long reportUs = -1;   // First regular report with the dangerous value
+};
+
+static std::vector<Crossing> crossings;
+static unsigned long falseAlarms = 0;
+
+// Floating pH probe: from floatStartUs, and across its limits from
+// floatCrossUs (0: not floating)
+static unsigned long floatStartUs = 0;
+static unsigned long floatCrossUs = 0;
+
+// The crossing in progress at time us, if any
+static Crossing* active_at(unsigned long us) {
+  for (Crossing& c : crossings) {
+    if (us >= c.startUs && us < c.endUs + 2000000) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+static int sim_adc(uint8_t pin) {
+  int channel = pin == TURBIDITY_PIN ? 0 : pin == PH_PIN ? 1 : 2;
+  if (channel == 1 && floatStartUs && sim::clockUs >= floatStartUs) {
+    unsigned long h = (unsigned long)((sim::clockUs / 50000) * 2654435761UL) >> 8;
+    int swing = sim::clockUs >= floatCrossUs ? 1700 : 1200;
+    return 2048 + (int)(h % (2 * swing + 1)) - swing;
+  }
+  int noise = (int)((sim::clockUs * 2654435761UL) >> 29) % 7 - 3;
+  Crossing* c = active_at(sim::clockUs);
+  bool danger = c && c->channel == channel && sim::clockUs < c->endUs;
+  return (danger ? DANGER_RAW[channel] : SAFE_RAW[channel]) + noise;
+}
+
+// Value of "key": in a JSON object, or false
+static bool find_number(const std::string& json, const std::string& key, double& v) {
+  size_t at = json.find("\"" + key + "\":");
+  if (at == std::string::npos) {
+    return false;
+  }
+  v = strtod(json.c_str() + at + key.size() + 3, nullptr);
+  return true;
+}
+
+// Inspect one request the firmware sent at time us
+static void observe(const std::string& request, unsigned long us) {
+  size_t body = request.find("\r\n\r\n");
+  if (body == std::string::npos) {
+    return;
+  }
+  std::string json = request.substr(body + 4);
+  size_t al = json.find("\"AL\":{");
+  Crossing* c = active_at(us);
+  if (al != std::string::npos) {
+    std::string alarms = json.substr(al, json.find('}', al) - al);
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+      if (alarms.find(std::string("\"") + channels[i].key + "\"") == std::string::npos) {
+        continue;
+      }
+      if (c && c->channel == i && c->alarmUs < 0) {
+        c->alarmUs = (long)(us - c->startUs);
+      } else if (!c || c->channel != i) {
+        falseAlarms++;
+      }
+    }
+    return;
+  }
+  // Regular reports, possibly several frames of a batch
+  if (c && c->reportUs < 0) {
+    const SensorChannel& ch = channels[c->channel];
+    for (size_t pos = 0; (pos = json.find('{', pos)) != std::string::npos; pos++) {
+      double v;
+      std::string frame = json.substr(pos, json.find('}', pos) - pos);
+      if (find_number(frame, ch.key, v) && (v < ch.dangerLow || v > ch.dangerHigh)) {
+        c->reportUs = (long)(us - c->startUs);
+        break;
+      }
+    }
+  }
+}
+
+static bool parse_args(int argc, char** argv, SimConfig& cfg) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    double value = atof(argv[i + 1]);
+    if (flag == "--seconds") {
+      cfg.seconds = value;
+    } else if (flag == "--every") {
+      cfg.every = value;
+    } else if (flag == "--hold") {
+      cfg.hold = value;
+    } else if (flag == "--bound-ms") {
+      cfg.boundMs = value;
+    } else if (flag == "--float-s") {
+      cfg.floatS = value;
+    } else {
+      return false;
+    }
+  }
+  return (argc % 2) == 1 && cfg.seconds > 0 && cfg.hold > 0 && cfg.every > cfg.hold + 2;
+}
+
+static long pct(std::vector<long> v, double p) {
+  if (v.empty()) {
+    return -1;
+  }
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p / 100 * v.size()))];
+}
+
+int main(int argc, char** argv) {
+  SimConfig cfg;
+  if (!parse_args(argc, argv, cfg)) {
+    fprintf(stderr, "usage: window_alarm_sim [--seconds S] [--every S] [--hold S] [--bound-ms MS] [--float-s S]\n");
+    return 2;
+  }
+
+  sim::adcSource = sim_adc;
+  firmware_setup();
+  unsigned long start = sim::clockUs;
+  for (int k = 0; (k + 1) * cfg.every < cfg.seconds; k++) {
+    Crossing c;
+    c.channel = k % NUM_CHANNELS;
+    // Off the scheduler grid, so crossings land between samples
+    c.startUs = start + (unsigned long)(((k + 1) * cfg.every + 0.037 * (k % 10)) * 1e6);
+    c.endUs = c.startUs + (unsigned long)(cfg.hold * 1e6);
+    crossings.push_back(c);
+  }
+
+  unsigned long end = start + (unsigned long)(cfg.seconds * 1e6);
+  unsigned long long sleepStart = sim::sleepUs;
+  while (sim::clockUs < end) {
+    unsigned long sent = sim::net.bytesSent;
+    firmware_loop();
+    if (sim::net.bytesSent != sent) {
+      observe(sim::net.lastRequest, sim::clockUs);
+    }
+  }
+
+  bool ok = falseAlarms == 0;
+  printf("%.0f s simulated, %zu crossings of %.1f s, CPU asleep %.1f%% of the time\n", cfg.seconds,
+         crossings.size(), cfg.hold, 100.0 * (sim::sleepUs - sleepStart) / (end - start));
+  printf("channel  window    crossings  alarms  alarm p50/max ms  reported  report p50/max ms\n");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    std::vector<long> alarm, report;
+    int n = 0;
+    for (const Crossing& c : crossings) {
+      if (c.channel != i) {
+        continue;
+      }
+      n++;
+      if (c.alarmUs >= 0) {
+        alarm.push_back(c.alarmUs / 1000);
+      }
+      if (c.reportUs >= 0) {
+        report.push_back(c.reportUs / 1000);
+      }
+    }
+    const char* window = channels[i].window == WINDOW_A ? "A" : channels[i].window == WINDOW_B ? "B" : "software";
+    printf("%-7s  %-8s  %9d  %6zu  %8ld / %-6ld  %8zu  %8ld / %-6ld\n", channels[i].key, window, n, alarm.size(),
+           pct(alarm, 50), pct(alarm, 100), report.size(), pct(report, 50), pct(report, 100));
+    ok &= (int)alarm.size() == n;
+    if (channels[i].window != WINDOW_NONE) {
+      ok &= pct(alarm, 100) <= cfg.boundMs;
+    }
+  }
+  printf("False alarms %lu, alarm frames %lu\n", falseAlarms, alarmCount);
+
+  // Flagged within a couple of its samples; give it one report period
+  if (cfg.floatS > 0) {
+    unsigned long alarmsBefore = alarmCount;
+    floatStartUs = sim::clockUs;
+    floatCrossUs = floatStartUs + channels[1].reportPeriod * 1000;
+    unsigned long floatEnd = floatCrossUs + (unsigned long)(cfg.floatS * 1e6);
+    while (sim::clockUs < floatEnd) {
+      firmware_loop();
+    }
+    printf("Floating %s probe for %.0f s: quality 0x%02x, %lu alarms\n", channels[1].key, cfg.floatS,
+           channels[1].quality, alarmCount - alarmsBefore);
+    ok &= alarmCount == alarmsBefore && (channels[1].quality & QF_NOISY);
+  }
+  return ok ? 0 : 1;
+}
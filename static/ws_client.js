@@ -31,6 +31,26 @@ const THRESHOLDS = {
     }
 };
 
+// Banderas de calidad enviadas por el Arduino para canales con falla
+const QUALITY_FLAGS = {
+    0x01: 'señal en riel bajo (sonda en corto o desconectada)',
+    0x02: 'señal en riel alto (sonda abierta)',
+    0x04: 'lectura congelada',
+    0x08: 'ruido anómalo'
+};
+
+// Devuelve la descripción de falla de un canal o null si está sano
+function sensorFault(data, key) {
+    const flags = data.Q ? data.Q[key] : 0;
+    if (!flags) {
+        return null;
+    }
+    return Object.keys(QUALITY_FLAGS)
+        .filter(bit => flags & bit)
+        .map(bit => QUALITY_FLAGS[bit])
+        .join(', ');
+}
+
 // Inicializar gráficos separados
 function initCharts() {
     // Configuración común para todos los gráficos
@@ -134,9 +154,10 @@ function updateCharts(data) {
     
     // Añadir nuevo punto de datos
     chartData.time.push(timeStr);
-    chartData.turbidity.push(data.T);
-    chartData.ph.push(data.PH);
-    chartData.conductivity.push(data.C);
+    // Los canales con falla se dejan como huecos en lugar de picos falsos
+    chartData.turbidity.push(sensorFault(data, 'T') ? null : data.T);
+    chartData.ph.push(sensorFault(data, 'PH') ? null : data.PH);
+    chartData.conductivity.push(sensorFault(data, 'C') ? null : data.C);
     
     // Limitar el número de puntos
     if (chartData.time.length > MAX_DATA_POINTS) {
@@ -168,7 +189,8 @@ function formatValues(data) {
     return {
         T: parseFloat(data.T).toFixed(2),
         PH: parseFloat(data.PH).toFixed(2),
-        C: parseFloat(data.C).toFixed(0)
+        C: parseFloat(data.C).toFixed(0),
+        Q: data.Q
     };
 }
 
@@ -303,10 +325,18 @@ function checkThresholds(data) {
     const turbidity = parseFloat(data.T);
     const conductivity = parseFloat(data.C);
     
-    // Actualizar indicadores de estado individuales
-    const phEvaluation = evaluatePh(ph);
-    const turbidityEvaluation = evaluateTurbidity(turbidity);
-    const conductivityEvaluation = evaluateConductivity(conductivity);
+    // Actualizar indicadores de estado individuales; un canal con falla de
+    // sensor no dispara alarmas de calidad del agua
+    const faultStatus = (fault) => ({
+        status: `Falla de sensor: ${fault}`,
+        class: "alert-info"
+    });
+    const phFault = sensorFault(data, 'PH');
+    const turbidityFault = sensorFault(data, 'T');
+    const conductivityFault = sensorFault(data, 'C');
+    const phEvaluation = phFault ? faultStatus(phFault) : evaluatePh(ph);
+    const turbidityEvaluation = turbidityFault ? faultStatus(turbidityFault) : evaluateTurbidity(turbidity);
+    const conductivityEvaluation = conductivityFault ? faultStatus(conductivityFault) : evaluateConductivity(conductivity);
     
     // Actualizar clase y mensaje de estado para cada sensor
     const phStatus = document.getElementById('phStatus');
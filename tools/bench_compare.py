@@ -0,0 +1,95 @@
+"""
+Compara los resultados de host/bench_firmware con una línea base guardada.
+
+Lee la salida JSON de Google Benchmark (--benchmark_out_format=json) y, por
+cada benchmark, compara ns/op, bytes/op y allocs/op contra la línea base.
+Termina con código 1 si alguna métrica supera su umbral de regresión.
+
+Uso:
+    python tools/bench_compare.py bench.json host/bench_baseline.json
+    python tools/bench_compare.py bench.json host/bench_baseline.json --time-threshold 5
+    python tools/bench_compare.py bench.json host/bench_baseline.json --update
+"""
+import argparse
+import json
+import shutil
+import sys
+
+TIME_SCALE = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+    """Métricas por benchmark: {nombre: {"ns/op": .., "bytes/op": .., "allocs/op": ..}}"""
+    with open(path) as f:
+        data = json.load(f)
+    results = {}
+    for bench in data.get("benchmarks", []):
+        if bench.get("run_type") == "aggregate" and bench.get("aggregate_name") != "median":
+            continue
+        name = bench.get("run_name", bench["name"])
+        results[name] = {
+            "ns/op": bench["cpu_time"] * TIME_SCALE[bench.get("time_unit", "ns")],
+            "bytes/op": bench.get("bytes/op", 0.0),
+            "allocs/op": bench.get("allocs/op", 0.0),
+        }
+    return results
+
+
+def regression(metric, base, current, args):
+    """True si el cambio supera el umbral configurado para la métrica"""
+    if metric == "ns/op":
+        return base > 0 and (current - base) / base * 100 > args.time_threshold
+    if metric == "bytes/op":
+        return current - base > base * args.bytes_threshold / 100
+    # Las asignaciones del propio framework aparecen como fracciones mínimas
+    return round(current - base, 2) > args.allocs_threshold
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Detección de regresiones en los benchmarks del firmware")
+    parser.add_argument("current", help="JSON de la ejecución actual")
+    parser.add_argument("baseline", help="JSON de la línea base")
+    parser.add_argument("--time-threshold", type=float, default=10.0,
+                        help="Aumento máximo de ns/op en %% (por defecto 10)")
+    parser.add_argument("--bytes-threshold", type=float, default=1.0,
+                        help="Aumento máximo de bytes/op en %% (por defecto 1)")
+    parser.add_argument("--allocs-threshold", type=float, default=0.0,
+                        help="Aumento máximo absoluto de allocs/op (por defecto 0)")
+    parser.add_argument("--json-out", help="Escribir la comparación en JSON")
+    parser.add_argument("--update", action="store_true", help="Reemplazar la línea base con la ejecución actual")
+    args = parser.parse_args()
+
+    if args.update:
+        shutil.copyfile(args.current, args.baseline)
+        print(f"Línea base actualizada: {args.baseline}")
+        return 0
+
+    current = load(args.current)
+    baseline = load(args.baseline)
+    rows = []
+    failed = False
+
+    print(f"{'Benchmark':<24}{'métrica':<11}{'base':>12}{'actual':>12}{'cambio':>9}")
+    for name in sorted(set(current) | set(baseline)):
+        if name not in baseline or name not in current:
+            print(f"{name:<24}{'(solo en ' + ('actual' if name in current else 'base') + ')'}")
+            continue
+        for metric in ("ns/op", "bytes/op", "allocs/op"):
+            base, value = baseline[name][metric], current[name][metric]
+            change = (value - base) / base * 100 if base else 0.0
+            bad = regression(metric, base, value, args)
+            failed |= bad
+            rows.append({"benchmark": name, "metric": metric, "baseline": base,
+                         "current": value, "change_pct": change, "regression": bad})
+            print(f"{name:<24}{metric:<11}{base:>12.2f}{value:>12.2f}{change:>8.1f}%"
+                  + ("  REGRESIÓN" if bad else ""))
+
+    if args.json_out:
+        with open(args.json_out, "w") as f:
+            json.dump({"regression": failed, "results": rows}, f, indent=2)
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
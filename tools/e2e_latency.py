@@ -0,0 +1,169 @@
+"""
+Traza de latencia extremo a extremo: muestra del Arduino -> suscriptor.
+
+Levanta el servidor (uvicorn main:app), lo pasa a modo real, ejecuta el
+firmware en el host contra él (host/e2e_device) y se suscribe por WebSocket
+a /water-monitor. Cada trama lleva su secuencia (S) y los millis() de
+adquisición (TA) y de armado (TS); el servidor agrega la hora de recepción,
+de publicación y de envío al cliente (campo "trace"). Como el dispositivo
+simulado y el servidor comparten reloj, se mide cada salto por separado:
+
+    adq->trama      TS - TA, en el dispositivo
+    red             recepción HTTP - (EPOCH_MS + TS)
+    recv->pub       parseo, merge y publicación pubsub
+    recv->push      espera hasta el envío por el WebSocket del cliente
+    push->sub       entrega al suscriptor
+    total           suscriptor - (EPOCH_MS + TA)
+
+Requiere el ejecutable compilado según el encabezado de host/e2e_device.cpp.
+
+Uso:
+    python tools/e2e_latency.py --device ./e2e_device --seconds 60
+    python tools/e2e_latency.py --device ./e2e_device --no-server --port 8000
+"""
+import argparse
+import asyncio
+import json
+import os
+import subprocess
+import sys
+import time
+
+import websockets
+
+HOPS = ["adq->trama", "red", "recv->pub", "recv->push", "push->sub", "total"]
+
+
+def percentile(values, pct):
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, max(0, round(pct / 100 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def hop_latencies(trace, received_at, epoch_ms):
+    """Latencia de cada salto en ms para una lectura (None si falta un dato)"""
+    sent_at = (epoch_ms + trace["ts"]) / 1000.0
+    acquired_at = (epoch_ms + trace["ta"]) / 1000.0
+    hops = {
+        "adq->trama": trace["ts"] - trace["ta"],
+        "red": (trace["recv"] - sent_at) * 1000,
+        "recv->pub": (trace["pub"] - trace["recv"]) * 1000 if "pub" in trace else None,
+        "recv->push": (trace["push"] - trace["recv"]) * 1000,
+        "push->sub": (received_at - trace["push"]) * 1000,
+        "total": (received_at - acquired_at) * 1000,
+    }
+    return {hop: value for hop, value in hops.items() if value is not None}
+
+
+async def wait_for_server(port, timeout=15.0):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            _, writer = await asyncio.open_connection("127.0.0.1", port)
+            writer.close()
+            return
+        except OSError:
+            await asyncio.sleep(0.2)
+    raise RuntimeError(f"el servidor no respondió en el puerto {port}")
+
+
+async def set_real_mode(port):
+    async with websockets.connect(f"ws://127.0.0.1:{port}/water-monitor/publish") as ws:
+        await ws.send(json.dumps({"command": "use_mock_data", "value": False}))
+        print(f"Servidor: {await ws.recv()}")
+
+
+async def subscribe(port, samples, stop):
+    """Guardar la primera llegada de cada secuencia (el servidor reenvía
+    la última lectura periódicamente)"""
+    async with websockets.connect(f"ws://127.0.0.1:{port}/water-monitor") as ws:
+        while not stop.is_set():
+            try:
+                message = await asyncio.wait_for(ws.recv(), timeout=0.5)
+            except asyncio.TimeoutError:
+                continue
+            received_at = time.time()
+            trace = json.loads(message).get("trace")
+            if trace and trace["id"] not in samples:
+                samples[trace["id"]] = (trace, received_at)
+
+
+async def run(args):
+    server = None
+    if not args.no_server:
+        server = subprocess.Popen(
+            [sys.executable, "-m", "uvicorn", "main:app", "--port", str(args.port), "--log-level", "warning"],
+            cwd=os.path.join(os.path.dirname(__file__), ".."))
+    try:
+        await wait_for_server(args.port)
+        await set_real_mode(args.port)
+
+        samples = {}
+        stop = asyncio.Event()
+        subscriber = asyncio.create_task(subscribe(args.port, samples, stop))
+        device = await asyncio.create_subprocess_exec(
+            args.device, "127.0.0.1", str(args.port), str(args.seconds), stdout=asyncio.subprocess.PIPE)
+        epoch_ms = None
+        async for line in device.stdout:
+            fields = line.decode().split()
+            if fields and fields[0] == "EPOCH_MS":
+                epoch_ms = int(fields[1])
+            elif fields and fields[0] == "FRAMES":
+                print(f"Dispositivo: {line.decode().strip()}")
+        await device.wait()
+        # Dar tiempo al último envío periódico del servidor
+        await asyncio.sleep(args.drain)
+        stop.set()
+        await subscriber
+    finally:
+        if server:
+            server.terminate()
+            server.wait()
+
+    if epoch_ms is None:
+        raise RuntimeError("el dispositivo no informó EPOCH_MS")
+    return epoch_ms, samples
+
+
+def report(epoch_ms, samples):
+    per_hop = {hop: [] for hop in HOPS}
+    for trace, received_at in samples.values():
+        for hop, value in hop_latencies(trace, received_at, epoch_ms).items():
+            per_hop[hop].append(value)
+
+    print(f"Lecturas trazadas: {len(samples)}")
+    print(f"{'salto':<14}{'p50':>10}{'p90':>10}{'p99':>10}{'máx':>10}  (ms)")
+    for hop in HOPS:
+        values = per_hop[hop]
+        if not values:
+            print(f"{hop:<14}{'-':>10}")
+            continue
+        row = [percentile(values, p) for p in (50, 90, 99)] + [max(values)]
+        print(f"{hop:<14}" + "".join(f"{v:>10.1f}" for v in row))
+    return per_hop
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Latencia extremo a extremo por salto")
+    parser.add_argument("--device", default="./e2e_device", help="Ejecutable de host/e2e_device.cpp")
+    parser.add_argument("--port", type=int, default=8000, help="Puerto del servidor")
+    parser.add_argument("--seconds", type=int, default=30, help="Duración de la corrida del dispositivo")
+    parser.add_argument("--drain", type=float, default=3.5,
+                        help="Espera tras el dispositivo para el último envío periódico (s)")
+    parser.add_argument("--no-server", action="store_true", help="Usar un servidor ya levantado")
+    parser.add_argument("--json-out", help="Escribir las latencias por salto en JSON")
+    args = parser.parse_args()
+
+    epoch_ms, samples = asyncio.run(run(args))
+    if not samples:
+        print("No llegó ninguna lectura trazada al suscriptor")
+        return 1
+    per_hop = report(epoch_ms, samples)
+    if args.json_out:
+        with open(args.json_out, "w") as f:
+            json.dump(per_hop, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
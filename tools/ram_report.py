@@ -0,0 +1,77 @@
+"""
+Reporte de RAM estática por subsistema del firmware.
+
+Lee la tabla de símbolos del ELF compilado (arduino-cli compile
+--output-dir build ...) con arm-none-eabi-nm y agrupa .data/.bss por
+subsistema. Como el firmware no usa heap en tiempo de ejecución
+(HEAP_GUARD), la RAM estática más la pila es su consumo pico.
+
+Uso:
+    python tools/ram_report.py build/water_monitor.ino.elf
+    python tools/ram_report.py firmware.elf --nm /ruta/arm-none-eabi-nm --sram 32768
+"""
+import argparse
+import re
+import subprocess
+import sys
+
+# Subsistemas del sketch según el nombre (demangled) de sus globales;
+# el primero que coincide gana
+SUBSYSTEMS = [
+    ("espectral (FFT)", r"^(fft|spectral|lastSpectral|run_spectral_diagnostics\(\)::)"),
+    ("stream USB", r"^(stream|send_stream_packet\(\)::)"),
+    ("endpoint local", r"^(localServer|localConn|metrics|latest(Buf|Len)|snapshot)"),
+    ("adquisición", r"^(channels|NUM_CHANNELS|tick|lastTick|adcSampleSpacing|windowTripped|alarm|sdt|lockin|settleSkips)"),
+    ("enlace HTTP", r"^(client|jsonBuf|batch|uplink|modem(Tx|Rx)|send_sensor_data\(\)::|server_|isConnected|lastConnection|lastUpdate|status$|wifiUp|link(CheckedAt|Suspect|Event)|ssid|pass)"),
+    ("heap guard", r"^(setupDone|heapGuard|heapOps)"),
+    ("WiFiS3 / ArduinoJson", r"(WiFi|modem|Modem|CWifi|ArduinoJson)"),
+]
+
+RAM_TYPES = {"b": ".bss", "B": ".bss", "d": ".data", "D": ".data"}
+
+
+def read_symbols(elf, nm):
+    output = subprocess.run([nm, "-S", "-C", "--size-sort", elf],
+                            check=True, capture_output=True, text=True).stdout
+    for line in output.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) != 4 or parts[2] not in RAM_TYPES:
+            continue
+        yield parts[3], int(parts[1], 16), RAM_TYPES[parts[2]]
+
+
+def classify(name):
+    for subsystem, pattern in SUBSYSTEMS:
+        if re.search(pattern, name):
+            return subsystem
+    return "core / otros"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="RAM estática por subsistema")
+    parser.add_argument("elf", help="ELF del firmware")
+    parser.add_argument("--nm", default="arm-none-eabi-nm", help="Herramienta nm a usar")
+    parser.add_argument("--sram", type=int, default=32 * 1024, help="SRAM total (RA4M1: 32 KB)")
+    parser.add_argument("--top", type=int, default=3, help="Símbolos más grandes por subsistema")
+    args = parser.parse_args()
+
+    groups = {}
+    for name, size, section in read_symbols(args.elf, args.nm):
+        group = groups.setdefault(classify(name), {"data": 0, "bss": 0, "symbols": []})
+        group["data" if section == ".data" else "bss"] += size
+        group["symbols"].append((size, name))
+
+    total = sum(g["data"] + g["bss"] for g in groups.values())
+    print(f"{'Subsistema':<24}{'.data':>8}{'.bss':>8}{'total':>8}{'% SRAM':>8}")
+    for name, group in sorted(groups.items(), key=lambda kv: -(kv[1]["data"] + kv[1]["bss"])):
+        size = group["data"] + group["bss"]
+        print(f"{name:<24}{group['data']:>8}{group['bss']:>8}{size:>8}{100.0 * size / args.sram:>7.1f}%")
+        for sym_size, sym in sorted(group["symbols"], reverse=True)[:args.top]:
+            print(f"    {sym_size:>6}  {sym}")
+    print(f"{'TOTAL':<24}{'':>8}{'':>8}{total:>8}{100.0 * total / args.sram:>7.1f}%")
+    print(f"Libre para pila: {args.sram - total} bytes")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,251 @@
+"""
+Receptor del modo de streaming binario USB del Arduino (STREAM_MODE).
+
+Lee tramas COBS delimitadas por 0x00 desde un puerto serie (o un pty),
+verifica el CRC-16, desempaqueta las muestras de 12 bits y las escribe en
+un archivo CSV. Cada segundo muestra el throughput y las tramas perdidas,
+detectadas por huecos en el número de secuencia.
+
+Uso:
+    python tools/stream_receiver.py /dev/ttyACM0 -o captura.csv
+    python tools/stream_receiver.py --simulate -o captura.csv --duration 5
+"""
+import argparse
+import math
+import os
+import select
+import struct
+import sys
+import threading
+import time
+import tty
+
+STREAM_VERSION = 2
+# versión, canales, secuencia, t0 (us), periodo (us), conjuntos, id de dispositivo
+HEADER = struct.Struct("<BBHIHB6s")
+
+
+def crc16_ccitt(data: bytes) -> int:
+    """CRC-16/CCITT-FALSE, igual que crc16_ccitt() del firmware"""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_encode(data: bytes) -> bytes:
+    out = bytearray([0])
+    code_pos, code = 0, 1
+    for byte in data:
+        if byte == 0:
+            out[code_pos] = code
+            code_pos, code = len(out), 1
+            out.append(0)
+            continue
+        out.append(byte)
+        code += 1
+        if code == 0xFF:
+            out[code_pos] = code
+            code_pos, code = len(out), 1
+            out.append(0)
+    out[code_pos] = code
+    return bytes(out)
+
+
+def cobs_decode(data: bytes) -> bytes:
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise ValueError("COBS inválido")
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def pack_samples(samples) -> bytes:
+    """Dos muestras de 12 bits en tres bytes, como send_stream_packet()"""
+    out = bytearray()
+    for i in range(0, len(samples), 2):
+        a = samples[i]
+        b = samples[i + 1] if i + 1 < len(samples) else 0
+        out.append(a & 0xFF)
+        out.append((a >> 8) | ((b & 0x0F) << 4))
+        if i + 1 < len(samples):
+            out.append(b >> 4)
+    return bytes(out)
+
+
+def unpack_samples(data: bytes, count: int):
+    samples = []
+    i = 0
+    while len(samples) < count:
+        a = data[i] | ((data[i + 1] & 0x0F) << 8)
+        samples.append(a)
+        if len(samples) < count:
+            samples.append((data[i + 1] >> 4) | (data[i + 2] << 4))
+        i += 3
+    return samples
+
+
+def parse_packet(packet: bytes):
+    """Devuelve (cabecera, muestras) o lanza ValueError"""
+    if len(packet) < HEADER.size + 2:
+        raise ValueError("trama corta")
+    body, crc = packet[:-2], struct.unpack("<H", packet[-2:])[0]
+    if crc16_ccitt(body) != crc:
+        raise ValueError("CRC")
+    version, channels, seq, t0, period, sets, device = HEADER.unpack_from(body)
+    if version != STREAM_VERSION:
+        raise ValueError(f"versión {version}")
+    count = channels * sets
+    if len(body) - HEADER.size < (count * 3 + 1) // 2:
+        raise ValueError("longitud")
+    samples = unpack_samples(body[HEADER.size:], count)
+    return (channels, seq, t0, period, sets, device.hex()), samples
+
+
+def build_packet(seq, t0, period, samples_by_set, device=bytes.fromhex("020000000001")) -> bytes:
+    """Construir una trama igual que el firmware (usado por --simulate)"""
+    channels = len(samples_by_set[0])
+    flat = [s for sample_set in samples_by_set for s in sample_set]
+    body = HEADER.pack(STREAM_VERSION, channels, seq & 0xFFFF, t0 & 0xFFFFFFFF,
+                       period, len(samples_by_set), device) + pack_samples(flat)
+    body += struct.pack("<H", crc16_ccitt(body))
+    return cobs_encode(body) + b"\x00"
+
+
+class StreamStats:
+    def __init__(self):
+        self.frames = 0
+        self.samples = 0
+        self.wire_bytes = 0
+        self.dropped = 0
+        self.crc_errors = 0
+        self.decode_errors = 0
+        self.last_seq = None
+        self.device = None
+
+    def on_frame(self, seq, sample_count):
+        if self.last_seq is not None:
+            self.dropped += (seq - self.last_seq - 1) & 0xFFFF
+        self.last_seq = seq
+        self.frames += 1
+        self.samples += sample_count
+
+    def line(self, elapsed):
+        total = self.frames + self.dropped
+        loss = 100.0 * self.dropped / total if total else 0.0
+        return (f"{elapsed:6.1f}s tramas={self.frames} muestras/s={self.samples / elapsed:,.0f} "
+                f"KB/s={self.wire_bytes / elapsed / 1024:.1f} perdidas={self.dropped} ({loss:.2f}%) "
+                f"crc={self.crc_errors} cobs={self.decode_errors}")
+
+
+def open_port(path):
+    fd = os.open(path, os.O_RDONLY | os.O_NOCTTY)
+    if os.isatty(fd):
+        tty.setraw(fd)
+    return fd
+
+
+def simulate_device(fd, channels, period_us, sets, drop_every, stop):
+    """Escribir tramas sintéticas en el extremo maestro de un pty"""
+    seq, t = 0, 0
+    frame_time = period_us * sets / 1e6
+    next_frame = time.monotonic()
+    while not stop.is_set():
+        samples = [[int(2048 + 1500 * math.sin(2 * math.pi * 50 * (t + i * period_us) / 1e6 + c))
+                    for c in range(channels)] for i in range(sets)]
+        if not (drop_every and seq % drop_every == drop_every - 1):
+            os.write(fd, build_packet(seq, t, period_us, samples))
+        seq += 1
+        t += period_us * sets
+        next_frame += frame_time
+        time.sleep(max(0.0, next_frame - time.monotonic()))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Receptor del streaming binario USB")
+    parser.add_argument("port", nargs="?", help="Puerto serie, p. ej. /dev/ttyACM0")
+    parser.add_argument("-o", "--output", default="stream.csv", help="Archivo CSV de salida")
+    parser.add_argument("--duration", type=float, default=0, help="Segundos a capturar (0 = sin límite)")
+    parser.add_argument("--simulate", action="store_true",
+                        help="Generar tramas como el firmware a través de un pty")
+    parser.add_argument("--drop-every", type=int, default=0,
+                        help="En --simulate, omitir una de cada N tramas")
+    args = parser.parse_args()
+
+    stop = threading.Event()
+    if args.simulate:
+        master, slave = os.openpty()
+        tty.setraw(slave)
+        fd = slave
+        threading.Thread(target=simulate_device, daemon=True,
+                         args=(master, 3, 1000, 32, args.drop_every, stop)).start()
+        print(f"Simulando dispositivo en {os.ttyname(slave)}")
+    elif args.port:
+        fd = open_port(args.port)
+    else:
+        parser.error("se requiere un puerto o --simulate")
+
+    stats = StreamStats()
+    buffer = bytearray()
+    start = time.monotonic()
+    last_report = start
+
+    with open(args.output, "w") as out:
+        out.write("seq,t_us," + ",".join(f"ch{i}" for i in range(3)) + "\n")
+        try:
+            while not args.duration or time.monotonic() - start < args.duration:
+                ready, _, _ = select.select([fd], [], [], 0.2)
+                if ready:
+                    chunk = os.read(fd, 4096)
+                    if not chunk:
+                        break
+                    stats.wire_bytes += len(chunk)
+                    buffer += chunk
+                    while True:
+                        end = buffer.find(b"\x00")
+                        if end < 0:
+                            break
+                        frame, buffer = bytes(buffer[:end]), buffer[end + 1:]
+                        if not frame:
+                            continue
+                        try:
+                            (channels, seq, t0, period, sets, device), samples = parse_packet(cobs_decode(frame))
+                        except ValueError as e:
+                            if str(e) == "CRC":
+                                stats.crc_errors += 1
+                            else:
+                                stats.decode_errors += 1
+                            continue
+                        if device != stats.device:
+                            stats.device = device
+                            print(f"Dispositivo {device}")
+                        stats.on_frame(seq, len(samples))
+                        for i in range(sets):
+                            values = samples[i * channels:(i + 1) * channels]
+                            out.write(f"{seq},{(t0 + i * period) & 0xFFFFFFFF},"
+                                      + ",".join(map(str, values)) + "\n")
+
+                now = time.monotonic()
+                if now - last_report >= 1.0:
+                    last_report = now
+                    print(stats.line(now - start))
+        except KeyboardInterrupt:
+            pass
+        finally:
+            stop.set()
+
+    print("Resumen: " + stats.line(max(time.monotonic() - start, 1e-6)))
+    return 0 if stats.crc_errors == 0 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,271 @@
+"""
+Informe de carga de los modos de enlace del firmware, de extremo a extremo.
+
+Por cada combinación de modo, codificación y perfil de red compila
+host/e2e_device.cpp con los flags del modo, lo ejecuta en tiempo real
+contra un servidor sustituto local (que acepta lo mismo que el gateway de
+ingesta: un objeto o un arreglo de tramas) y pone en medio un proxy TCP
+que imita a netem: retardo, jitter y pérdida por dirección.
+
+Modos (--modes, separados por comas):
+    close           una conexión por lectura (USE_KEEP_ALIVE=false)
+    keepalive:MS    keep-alive, reciclada cada MS ms (UPLINK_RECYCLE_MS)
+    batch:N         keep-alive con N tramas por POST (UPLINK_BATCH)
+Codificaciones (--encodings): full (cabeceras actuales) y lean (solo las
+que el servidor necesita, UPLINK_LEAN_HEADERS). El enlace solo habla JSON;
+el modo binario COBS es del USB.
+Perfiles de red (--netem, repetible): RETARDO_MS[/JITTER_MS[/PÉRDIDA_%]]
+en cada dirección.
+
+Un TCP en espacio de usuario no pierde bytes, así que la pérdida se
+modela como TCP la vive: el segmento perdido llega un RTO más tarde
+(200 ms mínimo de Linux más un RTT) y retiene a los que le siguen. Cada
+conexión nueva espera un RTT de handshake, más 1 s si se pierde el SYN.
+
+Columnas por ejecución:
+    lect/s          lecturas (tramas) recibidas por segundo
+    B/lect          bytes de carga útil TCP del dispositivo (enviados y
+                    recibidos) por lectura recibida
+    escr/lect       escrituras al socket por lectura: cada una es un
+                    comando AT por el UART en la placa
+    con/lect        conexiones TCP abiertas por lectura
+    CPU us/lect     CPU de las pasadas de loop() que tocaron el socket; el
+                    build bloqueante (el de la placa) incluye la espera
+                    activa de la respuesta
+    p50/p90/p99     ms desde la adquisición (TA) hasta la recepción
+
+Uso:
+    python tools/uplink_report.py --arduinojson ~/Arduino/libraries/ArduinoJson/src
+    python tools/uplink_report.py --modes close,batch:10 --netem 0 --netem 150/30/2 --seconds 30
+"""
+import argparse
+import asyncio
+import json
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+MIN_RTO_S = 0.2
+SYN_RTO_S = 1.0
+
+
+def mode_flags(mode, encoding):
+    """Flags -D del firmware para un modo y una codificación"""
+    name, _, arg = mode.partition(":")
+    if name == "close":
+        flags = ["-DUSE_KEEP_ALIVE=false"]
+    elif name == "keepalive":
+        flags = ["-DUSE_KEEP_ALIVE=true", f"-DUPLINK_RECYCLE_MS={int(arg or 60000)}"]
+    elif name == "batch":
+        flags = ["-DUSE_KEEP_ALIVE=true", f"-DUPLINK_BATCH={int(arg or 5)}"]
+    else:
+        raise ValueError(f"modo desconocido: {mode}")
+    if encoding == "lean":
+        flags.append("-DUPLINK_LEAN_HEADERS=true")
+    elif encoding != "full":
+        raise ValueError(f"codificación desconocida: {encoding}")
+    return flags
+
+
+def parse_netem(spec):
+    """"RETARDO[/JITTER[/PÉRDIDA]]" -> (retardo s, jitter s, pérdida 0..1)"""
+    parts = [float(p) for p in spec.split("/")] + [0.0, 0.0]
+    return parts[0] / 1000, parts[1] / 1000, parts[2] / 100
+
+
+def build_device(args, flags, out_dir):
+    """Compilar host/e2e_device.cpp con los flags del modo; devuelve la ruta"""
+    exe = os.path.join(out_dir, "e2e_device_" + "_".join(f.lstrip("-D").replace("=", "-") for f in flags))
+    if not os.path.exists(exe):
+        cmd = [args.cxx, f"-std={args.std}", "-O2", "-Ihost", "-I", os.path.expanduser(args.arduinojson),
+               *flags, "host/e2e_device.cpp", "-o", exe]
+        subprocess.run(cmd, cwd=ROOT, check=True)
+    return exe
+
+
+class Link:
+    """Una dirección del proxy: instante de entrega de cada segmento"""
+
+    def __init__(self, delay, jitter, loss, rng):
+        self.delay, self.jitter, self.loss, self.rng = delay, jitter, loss, rng
+        self.last = 0.0
+
+    def release_at(self, now):
+        at = now + max(0.0, self.delay + self.rng.uniform(-self.jitter, self.jitter))
+        if self.rng.random() < self.loss:
+            at += MIN_RTO_S + 2 * self.delay
+        # TCP entrega en orden: un segmento retrasado retiene a los siguientes
+        self.last = max(self.last, at)
+        return self.last
+
+
+async def pump(reader, writer, link):
+    """Copiar reader -> writer, entregando cada lectura en su instante"""
+    loop = asyncio.get_running_loop()
+    queue = asyncio.Queue()
+
+    async def deliver():
+        while True:
+            at, data = await queue.get()
+            await asyncio.sleep(max(0.0, at - loop.time()))
+            if not data:
+                break
+            writer.write(data)
+            await writer.drain()
+
+    sender = asyncio.create_task(deliver())
+    try:
+        while True:
+            data = await reader.read(65536)
+            queue.put_nowait((link.release_at(loop.time()), data))
+            if not data:
+                break
+        await sender
+    except (ConnectionError, OSError):
+        sender.cancel()
+    finally:
+        writer.close()
+
+
+async def start_proxy(upstream_port, netem, rng):
+    """Proxy TCP local hacia upstream_port con el perfil netem dado"""
+    delay, jitter, loss = netem
+
+    async def handle(dev_reader, dev_writer):
+        # Handshake con el servidor: un RTT, o el RTO inicial si se pierde el SYN
+        handshake = 2 * delay + (SYN_RTO_S if rng.random() < loss else 0.0)
+        await asyncio.sleep(handshake)
+        try:
+            srv_reader, srv_writer = await asyncio.open_connection("127.0.0.1", upstream_port)
+        except OSError:
+            dev_writer.close()
+            return
+        await asyncio.gather(pump(dev_reader, srv_writer, Link(delay, jitter, loss, rng)),
+                             pump(srv_reader, dev_writer, Link(delay, jitter, loss, rng)))
+
+    return await asyncio.start_server(handle, "127.0.0.1", 0)
+
+
+async def start_stand_in(received):
+    """Servidor sustituto: POST con Content-Length; guarda (hora, trama)"""
+
+    async def handle(reader, writer):
+        try:
+            while True:
+                head = await reader.readuntil(b"\r\n\r\n")
+                length, close = 0, False
+                for line in head.decode("latin-1").split("\r\n")[1:]:
+                    name, _, value = line.partition(":")
+                    name, value = name.strip().lower(), value.strip().lower()
+                    if name == "content-length":
+                        length = int(value)
+                    elif name == "connection":
+                        close = value == "close"
+                body = await reader.readexactly(length)
+                now = time.time()
+                try:
+                    frames = json.loads(body)
+                    frames = frames if isinstance(frames, list) else [frames]
+                    received.extend((now, f) for f in frames)
+                    status = b"200 OK"
+                except ValueError:
+                    status = b"400 Bad Request"
+                writer.write(b"HTTP/1.1 " + status + b"\r\ncontent-length: 0\r\n"
+                             + (b"connection: close\r\n" if close else b"") + b"\r\n")
+                await writer.drain()
+                if close:
+                    break
+        except (asyncio.IncompleteReadError, ConnectionError, asyncio.LimitOverrunError):
+            pass
+        finally:
+            writer.close()
+
+    return await asyncio.start_server(handle, "127.0.0.1", 0)
+
+
+def percentile(values, pct):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, max(0, round(pct / 100 * (len(ordered) - 1))))]
+
+
+async def run_once(exe, netem, seconds, seed):
+    """Una ejecución del dispositivo a través del proxy; devuelve las métricas"""
+    received = []
+    stand_in = await start_stand_in(received)
+    proxy = await start_proxy(stand_in.sockets[0].getsockname()[1], netem, random.Random(seed))
+    device = await asyncio.create_subprocess_exec(
+        exe, "127.0.0.1", str(proxy.sockets[0].getsockname()[1]), str(seconds), stdout=asyncio.subprocess.PIPE)
+    epoch_ms, net = None, {}
+    async for line in device.stdout:
+        fields = line.decode().split()
+        if fields and fields[0] == "EPOCH_MS":
+            epoch_ms = int(fields[1])
+        elif fields and fields[0] == "NET":
+            net = {fields[i]: int(fields[i + 1]) for i in range(1, len(fields) - 1, 2)}
+    await device.wait()
+    # Lo que quede en vuelo en el proxy al terminar se descarta
+    proxy.close()
+    stand_in.close()
+    if epoch_ms is None or not net:
+        raise RuntimeError(f"{exe} no informó EPOCH_MS / NET")
+
+    readings = len(received)
+    latencies = [(at - (epoch_ms + f["TA"]) / 1000.0) * 1000 for at, f in received if "TA" in f]
+    per = (lambda v: v / readings) if readings else (lambda v: float("nan"))
+    return {
+        "rate": readings / seconds,
+        "bytes": per(net["SENT"] + net["RECEIVED"]),
+        "writes": per(net["WRITES"]),
+        "connects": per(net["CONNECTS"]),
+        "cpu": per(net["UPLINK_CPU_US"]),
+        "p50": percentile(latencies, 50) if latencies else float("nan"),
+        "p90": percentile(latencies, 90) if latencies else float("nan"),
+        "p99": percentile(latencies, 99) if latencies else float("nan"),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--modes", default="close,keepalive:10000,keepalive:60000,batch:5")
+    parser.add_argument("--encodings", default="full,lean")
+    parser.add_argument("--netem", action="append", help="RETARDO_MS[/JITTER_MS[/PÉRDIDA_%%]] (repetible)")
+    parser.add_argument("--seconds", type=int, default=20, help="duración de cada ejecución")
+    parser.add_argument("--arduinojson", default="~/Arduino/libraries/ArduinoJson/src")
+    parser.add_argument("--cxx", default="g++")
+    parser.add_argument("--std", default="gnu++17",
+                        help="gnu++17: enlace bloqueante, como la placa; gnu++20: corrutinas")
+    parser.add_argument("--build-dir", help="dónde dejar los binarios (por defecto uno temporal)")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    modes = args.modes.split(",")
+    encodings = args.encodings.split(",")
+    profiles = args.netem or ["0", "100/20/1"]
+    build_dir = args.build_dir or tempfile.mkdtemp(prefix="uplink_report_")
+    os.makedirs(build_dir, exist_ok=True)
+
+    header = (f"{'modo':<16} {'codif.':<6} {'red':<12} {'lect/s':>6} {'B/lect':>7} {'escr/lect':>9} "
+              f"{'con/lect':>8} {'CPU us/lect':>11} {'p50 ms':>7} {'p90 ms':>7} {'p99 ms':>7}")
+    rows = []
+    for mode in modes:
+        for encoding in encodings:
+            exe = build_device(args, mode_flags(mode, encoding), build_dir)
+            for profile in profiles:
+                r = asyncio.run(run_once(exe, parse_netem(profile), args.seconds, args.seed))
+                rows.append(f"{mode:<16} {encoding:<6} {profile:<12} {r['rate']:>6.2f} {r['bytes']:>7.0f} "
+                            f"{r['writes']:>9.1f} {r['connects']:>8.2f} {r['cpu']:>11.0f} "
+                            f"{r['p50']:>7.0f} {r['p90']:>7.0f} {r['p99']:>7.0f}")
+                print(rows[-1] if len(rows) > 1 else header + "\n" + rows[-1], flush=True)
+
+    print()
+    print(header)
+    print("\n".join(rows))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -6,9 +6,19 @@
 */
 
 #include "WiFiS3.h"
+#include "IRQManager.h"
 #include <ArduinoJson.h>
 #include "arduino_secrets.h"
 
+// Network code runs as coroutines when the toolchain has C++20 coroutines
+// (-std=gnu++20 -fcoroutines); otherwise the blocking uplink is used
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define USE_COROUTINES true
+#include "async_io.h"
+#else
+#define USE_COROUTINES false
+#endif
+
 // WiFi credentials from arduino_secrets.h
 char ssid[] = SECRET_SSID;
 char pass[] = SECRET_PASS;
@@ -18,8 +28,65 @@ char pass[] = SECRET_PASS;
 #define PH_PIN        A1
 #define CONDUCT_PIN   A2
 
+// Uplink mode. Build flags (-D) override these; tools/uplink_report.py
+// compares them. Batches (UPLINK_BATCH > 1) post a JSON array of frames,
+// which the ingest gateway (gateway/) accepts; the Python server takes
+// single frames only.
+#ifndef USE_KEEP_ALIVE
 #define USE_KEEP_ALIVE true
-const unsigned long RECONNECT_INTERVAL = 60000; // 1 minute
+#endif
+#ifndef UPLINK_RECYCLE_MS
+#define UPLINK_RECYCLE_MS 60000       // Keep-alive connection lifetime (1 minute)
+#endif
+#ifndef UPLINK_BATCH
+#define UPLINK_BATCH 1                // Frames per request
+#endif
+#ifndef UPLINK_LEAN_HEADERS
+#define UPLINK_LEAN_HEADERS false     // Send only the headers a server needs
+#endif
+
+// Modem link. Every WiFiClient and WiFi call is an AT transaction with the
+// ESP32-S3 bridge over a UART: each print() one AT+CLIENTSEND, each
+// connected() and each available() on an empty receive FIFO one query.
+// MODEM_BULK sends a request with one write() from modemTx, reads the
+// response in chunks into modemRx, and polls the socket every
+// MODEM_POLL_US while waiting instead of spinning on it. MODEM_BAUD must
+// match the UART of the bridge firmware (115200 on the stock one).
+#ifndef MODEM_BULK
+#define MODEM_BULK true
+#endif
+#ifndef MODEM_BAUD
+#define MODEM_BAUD 115200
+#endif
+#define MODEM_TX_SIZE 512
+#define MODEM_RX_SIZE 128
+const unsigned long MODEM_POLL_US = 2000;
+const unsigned long MODEM_LINK_CHECK_MS = 100;   // connected() while waiting
+char modemTx[MODEM_BULK ? MODEM_TX_SIZE : 1];
+uint8_t modemRx[MODEM_BULK ? MODEM_RX_SIZE : 1];
+
+// Link state. WiFi.status() is one more AT round trip, so loop() reads the
+// cached wifiUp instead: refreshed every LINK_CHECK_MS, and on the next
+// pass after a failed connect or a request left without a response, which
+// is how a drop shows up first while uplinks run. LINK_CACHE false queries
+// the bridge on every pass, as before. A bridge library that reports link
+// changes can call link_notify() from its callback (LINK_NOTIFY); the
+// stock WiFiS3 has none, so that is off by default, and when on the
+// periodic check only backs it up.
+#ifndef LINK_CACHE
+#define LINK_CACHE true
+#endif
+#ifndef LINK_NOTIFY
+#define LINK_NOTIFY false
+#endif
+#ifndef LINK_CHECK_MS
+#define LINK_CHECK_MS (LINK_NOTIFY ? 10000 : 5000)
+#endif
+unsigned long linkCheckedAt = 0;
+bool linkSuspect = false;          // A socket error: recheck on the next pass
+volatile int linkEvent = -1;       // Status from link_notify(), -1 when none
+
+const unsigned long RECONNECT_INTERVAL = UPLINK_RECYCLE_MS;
 unsigned long lastConnectionTime = 0;
 bool isConnected = false;
 
@@ -28,42 +95,464 @@ const char* server_host = "51.92.64.38";
 const int server_port = 8000;
 const char* server_path = "/water-monitor/publish";
 
+// Device identity sent in every uplink format: 12 hex digits (48 bits).
+// Empty derives it from the WiFi module's MAC address.
+const char* DEVICE_ID = "";
+
 // Update interval (milliseconds)
 const unsigned long UPDATE_INTERVAL = 1000;
+const unsigned long RESPONSE_TIMEOUT = 1000;    // Wait for response headers
+const unsigned long WIFI_CHECK_INTERVAL = LINK_CHECK_MS;  // Link check cadence
+
+// Acquisition scheduler tick (milliseconds). Channel sample and report
+// periods are whole multiples of it, so channels that fall due together
+// share one wakeup and one interleaved ADC burst.
+const unsigned long SCHEDULER_TICK = 100;
+
+// Probe power gating. Each probe with a power pin is switched on only
+// ahead of its samples: warm-up (the probe) plus settling (the front end)
+// before the tick it is due, and off again after its ADC window. When one
+// probe's power-up falls due, others due within POWER_BATCH_MS are switched
+// on in the same pass. A sample is never taken before settling; an
+// unsettled channel skips that tick. Probes watched by a hardware alarm
+// window stay on.
+#ifndef POWER_GATING
+#define POWER_GATING false
+#endif
+#define NO_POWER_PIN 0xFF
+const unsigned long POWER_BATCH_MS = 5;
+
+// Sensor fault diagnostics (raw 12-bit ADC units, per averaged sample)
+const uint16_t RAIL_LOW_LSB = 8;          // Shorted / disconnected to GND
+const uint16_t RAIL_HIGH_LSB = 4087;      // Open probe pulled to VREF
+const uint16_t STUCK_SAMPLES = 30;        // Identical samples -> stuck-at
+const uint16_t NOISE_MAX_LSB = 150;       // Mean |delta| of a floating input
+#define QF_RAIL_LOW  0x01
+#define QF_RAIL_HIGH 0x02
+#define QF_STUCK     0x04
+#define QF_NOISY     0x08
+
+// Threshold alarms from the ADC compare unit (RA4M1 ADC14 windows A and
+// B). The first two channels with danger limits get a hardware window; a
+// conversion outside it interrupts, and loop() sends an alarm frame at
+// once instead of with the channel's next report. Between passes of
+// loop() the CPU sleeps in __WFI() while the ADC scans the windowed
+// channels on its own. Other channels with limits are checked in software
+// as they are sampled.
+#ifndef WINDOW_ALARMS
+#define WINDOW_ALARMS false
+#endif
+const uint16_t ALARM_HYSTERESIS_LSB = 40; // Back inside by this much re-arms
+const uint8_t WINDOW_ALARM_IPL = 12;      // Compare interrupt priority
+#define WINDOW_NONE 0
+#define WINDOW_A    1
+#define WINDOW_B    2
+
+// Swing-door trending (SDT) of the reported values, as process historians
+// store them. Each channel keeps a point only when no straight line from
+// its last kept point passes within its deviation of every value since,
+// or when its max interval has passed; the line between kept points
+// reconstructs the rest within the deviation. Uplinks then carry only the
+// kept points, each with its own TA, as a JSON array of frames (the
+// ingest gateway stores them in time order; the Python server takes
+// single frames only).
+#ifndef SWING_DOOR
+#define SWING_DOOR false
+#endif
+#define SDT_QUEUE 32                       // Kept points waiting for an uplink
+#define SDT_BODY_SIZE 1024
+
+// Local pull endpoint for LAN consumers (GET /metrics, GET /latest)
+#define ENABLE_LOCAL_HTTP true
+const uint16_t LOCAL_HTTP_PORT = 80;
+const unsigned long LOCAL_HTTP_TIMEOUT = 2000;  // Drop idle LAN clients
+const size_t LOCAL_HTTP_CHUNK = 256;            // Max bytes written per loop()
+const unsigned long AGG_WINDOW = 60000;         // Window aggregate length
+#define METRICS_BUF_SIZE 1536
+#define LATEST_BUF_SIZE 384
+
+// Binary USB streaming mode for bench capture. Replaces WiFi uplink and
+// human-readable output with COBS-framed packets of raw 12-bit samples.
+#ifndef STREAM_MODE
+#define STREAM_MODE false
+#endif
+const unsigned long STREAM_BAUD = 2000000;      // Ignored by USB CDC
+const unsigned long STREAM_SAMPLE_US = 1000;    // Sample-set period (1 kHz)
+#define STREAM_SETS 32                          // Sample sets per packet
+#define STREAM_VERSION 2
+#define STREAM_HEADER_SIZE 17
+#define STREAM_PAYLOAD_MAX (STREAM_HEADER_SIZE + (STREAM_SETS * NUM_CHANNELS * 3 + 1) / 2 + 2)
+
+// ADC averaging: samples per reading and spacing between them (microseconds).
+// 10 x 2000 us spans 20 ms, which already nulls 50 Hz mains; the spacing is
+// re-tuned at runtime when spectral diagnostics find a different interferer.
+const int ADC_SAMPLES = 10;
+const unsigned long ADC_DEFAULT_SPACING_US = 2000;
+unsigned long adcSampleSpacingUs = ADC_DEFAULT_SPACING_US;
+
+// Conductivity by square-wave excitation and software lock-in instead of
+// a DC level. EXCITE_PIN drives the cell; the burst samples it at the
+// middle of each quarter period on the same micros() grid that toggles
+// the pin, so the reference stays in phase by construction. The electrodes
+// see no net DC and do not polarize, and the ADC offset and slow drift
+// cancel in the in-phase (I) and quadrature (Q) sums.
+#ifndef LOCKIN_CONDUCTIVITY
+#define LOCKIN_CONDUCTIVITY false
+#endif
+#define EXCITE_PIN 3
+const unsigned long LOCKIN_PERIOD_US = 2000;  // 500 Hz excitation
+#define LOCKIN_CYCLES 10                      // Demodulated: 20 ms, a mains period
+#define LOCKIN_SETTLE_CYCLES 1                // Driven but not sampled
+#define LOCKIN_SAMPLES (LOCKIN_CYCLES * 4)
+uint16_t lockinBuf[LOCKIN_SAMPLES];
+int32_t lockinI = 0, lockinQ = 0;             // Sums of the last burst
+uint32_t lockinCyclesPerCycle = 0;            // Demodulation cost per excitation cycle
+
+// Spectral diagnostics of the conductivity line (fixed-point real FFT)
+#ifndef ENABLE_SPECTRAL_DIAG
+#define ENABLE_SPECTRAL_DIAG false
+#endif
+#ifndef ENABLE_NOTCH_AUTOTUNE
+#define ENABLE_NOTCH_AUTOTUNE true
+#endif
+#define FFT_SIZE 256                     // Real samples per capture window
+#define FFT_HALF (FFT_SIZE / 2)          // Complex FFT length after packing
+const unsigned long SPECTRAL_INTERVAL = 60000;   // Capture once per minute
+const unsigned long SPECTRAL_SAMPLE_US = 1000;   // 1 kHz -> 3.9 Hz per bin
+const unsigned long SPECTRAL_LATE_US = SPECTRAL_SAMPLE_US / 2;  // Later restarts the window
+const float MAINS_BAND_LOW_HZ = 45.0;
+const float MAINS_BAND_HIGH_HZ = 65.0;
+const uint16_t NOTCH_MIN_PERMILLE = 150;  // Dominant bin share to re-tune
+const uint32_t CPU_MHZ = 48;              // RA4M1 core clock
+#define SPECTRAL_PEAKS 3
+
+// Static memory budget: every runtime buffer is a fixed global, and with
+// HEAP_GUARD enabled any malloc inside a sketch hot-path section traps.
+// The WiFiS3 AT layer still allocates internally; those calls are counted.
+#ifndef HEAP_GUARD
+#define HEAP_GUARD false
+#endif
+#define JSON_BUF_SIZE 200
 
 // WiFi client
 WiFiClient client;
+char jsonBuf[JSON_BUF_SIZE];       // Serialized uplink frame
+#if UPLINK_BATCH > 1
+char batchBuf[UPLINK_BATCH * JSON_BUF_SIZE + 2];  // "[frame,frame,..]"
+size_t batchLen = 0;
+int batchFrames = 0;
+#endif
+const char* uplinkBody = jsonBuf;  // Body of the next request
 
 // Global variables
 unsigned long lastUpdateTime = 0;
 int status = WL_IDLE_STATUS;
+bool wifiUp = false;
+unsigned long frameSeq = 0;        // Trace ID of the next uplink frame
+uint8_t deviceId[6];               // Device identity, big-endian
+char deviceIdHex[13];              // Same, as sent in "D" and device labels
+
+#if USE_COROUTINES
+Executor executor;
+#endif
+
+// Per-channel acquisition configuration and state
+struct SensorChannel {
+  const char* key;              // JSON key in the uplink frame
+  uint8_t pin;
+  unsigned long samplePeriod;   // ms between averaged ADC samples
+  unsigned long reportPeriod;   // ms between reported values
+  float (*convert)(uint16_t raw);
+  float dangerLow, dangerHigh;  // Alarm limits in channel units (NAN: none)
+  float sdtDeviation;           // Swing-door tolerance in channel units
+  unsigned long sdtMaxInterval; // ms after which a point is kept regardless
+  uint8_t powerPin;             // Probe supply enable, or NO_POWER_PIN
+  unsigned long warmupMs;       // Power-on to a stable probe output
+  unsigned long settleMs;       // Then until the ADC input has settled
+  // Runtime state below; the table leaves it out and it starts zeroed
+  uint32_t sum = 0;             // Raw samples accumulated this report period
+  uint16_t count = 0;
+  float value = 0;              // Last reported value
+  bool pending = false;         // Reported but not yet uplinked
+  // Fault diagnostics, updated in O(1) per sample
+  bool seeded = false;          // lastRaw holds a sample
+  uint16_t lastRaw = 0;
+  uint16_t flatRun = 0;         // Consecutive identical samples
+  uint16_t noiseQ4 = 0;         // EWMA of |sample delta|, Q4 fixed point
+  uint8_t faultFlags = 0;       // QF_* seen during this report period
+  uint8_t quality = 0;          // QF_* attached to the last report
+  unsigned long reportTime = 0; // millis() of the last report
+  // Aggregates of reported values: current and last completed window
+  float winMin = 0, winMax = 0, winSum = 0;
+  uint16_t winCount = 0;
+  float aggMin = 0, aggMax = 0, aggMean = 0;
+  uint16_t aggCount = 0;
+  // Threshold alarm: the danger limits as the raw range that is safe
+  uint16_t alarmLow = 0, alarmHigh = 0;
+  uint8_t window = WINDOW_NONE; // WINDOW_A/B, or WINDOW_NONE (software)
+  bool alarmActive = false;     // Outside its limits; re-armed once back
+  uint8_t alarmFaults = 0;      // QF_* of the probe when it crossed
+  bool alarmMasked = false;     // Crossed while faulty: raised once healthy
+  // Swing door: last kept point, the newest point not yet kept, and the
+  // slopes (per ms) that still fit every point since the kept one
+  bool sdtStarted = false, sdtHeld = false;
+  unsigned long sdtTime = 0, heldTime = 0;
+  float sdtValue = 0, heldValue = 0;
+  uint8_t sdtQuality = 0, heldQuality = 0;
+  float slopeLow = 0, slopeHigh = 0;
+  // Probe power: on since poweredAtUs (micros()), and on-time so far
+  bool powered = false;
+  unsigned long poweredAtUs = 0;
+  unsigned long poweredMs = 0;
+};
 
-// Function prototypes
-uint16_t read_adc(uint8_t pin);
 float convert_turbidity(uint16_t raw);
 float convert_ph(uint16_t raw);
 float convert_conductivity(uint16_t raw);
+
+SensorChannel channels[] = {
+  // key, pin,         sample, report, convert,             danger low/high, SDT deviation, max ms, power pin, warm-up/settle ms
+  { "T",  TURBIDITY_PIN,  100,   1000, convert_turbidity,    NAN, 800,       2.0,  60000,  4,  20,  5 },
+  { "PH", PH_PIN,        1000,  10000, convert_ph,           2,   12,        0.05, 60000,  5, 300, 100 },
+  { "C",  CONDUCT_PIN,    500,   1000, convert_conductivity, NAN, 1400,      5.0,  60000,  6,  50, 10 },
+};
+const int NUM_CHANNELS = sizeof(channels) / sizeof(channels[0]);
+unsigned long lastTickTime = 0;
+unsigned long tickCount = 0;
+unsigned long uplinkWriteMs = 0;   // Bridge time of the request about to go out
+
+// Self-telemetry
+unsigned long uplinkCount = 0;
+unsigned long uplinkFailures = 0;
+unsigned long tickLateMs = 0;      // Lateness of the last scheduler tick
+unsigned long tickLateMaxMs = 0;
+unsigned long alarmCount = 0;
+unsigned long settleSkips = 0;     // Samples skipped on unsettled probes
+
+// Swing-door queue of kept points and the body of their uplink
+struct KeptPoint {
+  unsigned long time;
+  float value;
+  uint8_t channel;
+  uint8_t quality;
+};
+KeptPoint sdtQueue[SDT_QUEUE];
+uint8_t sdtHead = 0;
+uint8_t sdtCount = 0;
+uint8_t sdtInBody = 0;             // Queued points in the body built, until written
+unsigned long sdtPointsIn = 0;
+unsigned long sdtPointsKept = 0;   // Queued for the uplink
+unsigned long sdtDropped = 0;      // Lost to a full queue, queued or not
+char sdtBody[SWING_DOOR ? SDT_BODY_SIZE : 1];
+
+// Threshold alarm state
+volatile uint8_t windowTripped = 0;  // Channel bits latched by a compare match
+uint8_t alarmChannels = 0;         // Channel bits of the next alarm frame
+
+// Local pull endpoint: single connection slot, served from preformatted
+// double buffers so a slow LAN client never holds up acquisition
+WiFiServer localServer(LOCAL_HTTP_PORT);
+struct LocalHttpConn {
+  WiFiClient client;
+  bool active;
+  char request[64];               // Request line only; headers are skipped
+  uint8_t requestLen;
+  char header[128];               // Status line and headers, ~101 bytes for /metrics
+  size_t headerLen;
+  const char* body;
+  size_t bodyLen;
+  size_t sent;                    // Bytes of header + body written so far
+  unsigned long started;
+};
+LocalHttpConn localConn;
+char metricsBuf[2][METRICS_BUF_SIZE];
+char latestBuf[2][LATEST_BUF_SIZE];
+size_t metricsLen[2];
+size_t latestLen[2];
+uint8_t snapshotIndex = 0;         // Buffers currently published
+bool snapshotDirty = true;
+
+// Binary stream state
+uint16_t streamRaw[STREAM_SETS * NUM_CHANNELS];
+int streamSets = 0;
+uint16_t streamSeq = 0;
+unsigned long streamFrameStart = 0;
+unsigned long streamNextSample = 0;
+unsigned long streamDrops = 0;     // Packets skipped for lack of USB buffer
+
+// Heap guard state
+bool setupDone = false;
+volatile bool heapGuardArmed = false;
+volatile unsigned long heapOpsAfterSetup = 0;
+
+// Spectral diagnostics state
+struct SpectralReport {
+  bool valid;
+  float peakHz[SPECTRAL_PEAKS];      // Dominant interference frequencies
+  uint16_t peakPermille[SPECTRAL_PEAKS]; // Share of total AC energy per peak
+  uint16_t bandPermille;             // Share of AC energy in the mains band
+  uint32_t cyclesPerWindow;          // FFT + analysis cost of one window
+};
+SpectralReport spectral = {};
+unsigned long lastSpectralTime = 0;
+// Capture in progress: one sample per SPECTRAL_SAMPLE_US slot, taken from
+// loop() and from the waits inside the acquisition burst and the uplink
+uint16_t spectralWindow[FFT_SIZE];
+int spectralSamples = -1;            // Taken so far; -1 when not capturing
+unsigned long spectralNextUs = 0;    // micros() of the next slot
+unsigned long spectralRestarts = 0;  // Windows restarted after a missed slot
+int16_t fftRe[FFT_HALF];
+int16_t fftIm[FFT_HALF];
+int16_t fftCos[FFT_HALF + 1];        // cos(2*pi*k/FFT_SIZE), Q15
+uint32_t fftPower[FFT_HALF];
+
+// Function prototypes
+void init_device_id();
+void read_adc(const uint8_t* pins, uint16_t* raw, int count);
+uint16_t read_conductivity_lockin();
+void lockin_demodulate(const uint16_t* samples, int cycles, int32_t& i, int32_t& q);
+uint32_t isqrt32(uint32_t v);
+void run_acquisition_tick();
+void update_channel_health(SensorChannel& ch, uint16_t raw);
+void serve_local_http();
+void format_snapshots(uint8_t index);
+void run_binary_stream();
+void send_stream_packet();
+void heap_guard_enter();
+void heap_guard_exit();
 void connect_wifi();
+bool link_up();
+void link_suspect();
+void link_notify(int linkStatus);
 void send_sensor_data();
+size_t build_uplink_frame();
+size_t batch_uplink_frame();
+bool open_server_connection();
+void write_uplink_request(size_t bodyLen);
+void release_uplink_body();
+void complete_uplink();
+void send_request_bulk(size_t bodyLen);
+unsigned long bridge_send_ms(size_t len);
+bool ends_before_tick(unsigned long ms);
+int read_modem_chunk();
+bool await_response_headers();
+int match_header_end(int matched, char c);
+#if USE_COROUTINES
+Task wifi_task();
+Task uplink_task();
+#endif
+void init_fft_tables();
+void fft_q15(int16_t* re, int16_t* im);
+void rfft_power_q15(const uint16_t* samples, uint32_t* power);
+void run_spectral_diagnostics();
+void service_spectral_capture();
+void wait_us(unsigned long us);
+void analyze_spectrum(const uint16_t* window);
+void autotune_notch(float hz);
+uint8_t adc_channel(uint8_t pin);
+uint16_t raw_at(const SensorChannel& ch, float value);
+void init_window_alarms();
+void arm_window(int i);
+void window_alarm_isr();
+void check_alarm(int i, uint16_t raw);
+void confirm_alarms();
+void sleep_until_interrupt();
+size_t next_uplink_body();
+void swing_door(int i, unsigned long t, float v, uint8_t quality);
+void keep_point(int i, unsigned long t, float v, uint8_t quality);
+size_t build_sdt_body();
+bool power_gated(const SensorChannel& ch);
+void init_probe_power();
+void set_probe_power(SensorChannel& ch, bool on);
+void service_probe_power();
 
 void setup() {
   // Initialize serial
-  Serial.begin(9600);
+  Serial.begin(STREAM_MODE ? STREAM_BAUD : 9600);
   while (!Serial) {
     ; // Wait for serial port to connect
   }
   
   // Configure ADC for 12-bit resolution
   analogReadResolution(12);
+  if (LOCKIN_CONDUCTIVITY) {
+    pinMode(EXCITE_PIN, OUTPUT);
+    digitalWrite(EXCITE_PIN, LOW);
+  }
+  if (POWER_GATING) {
+    init_probe_power();
+  }
+
+  // Snap channel periods onto the scheduler tick grid
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    SensorChannel& ch = channels[i];
+    ch.samplePeriod = max(SCHEDULER_TICK, ch.samplePeriod / SCHEDULER_TICK * SCHEDULER_TICK);
+    ch.reportPeriod = max(ch.samplePeriod, ch.reportPeriod / ch.samplePeriod * ch.samplePeriod);
+  }
+
+  if (ENABLE_SPECTRAL_DIAG) {
+    init_fft_tables();
+  }
+
+  init_device_id();
+
+  // Bench capture runs without the network
+  if (STREAM_MODE) {
+    streamNextSample = micros();
+    setupDone = true;
+    return;
+  }
+
+  // Bridge UART rate, before the first AT command
+  modem.begin(MODEM_BAUD);
+
+  // One-time firmware check; WiFi.firmwareVersion() returns a heap String
+  if (WiFi.status() != WL_NO_MODULE) {
+    String fv = WiFi.firmwareVersion();
+    if (fv < WIFI_FIRMWARE_LATEST_VERSION) {
+      Serial.println("Please update the firmware");
+    }
+  }
   
+  if (WINDOW_ALARMS) {
+    init_window_alarms();
+  }
+
+#if LINK_NOTIFY
+  WiFi.onLinkChange(link_notify);
+#endif
+
   // Connect to WiFi
   connect_wifi();
+
+  if (ENABLE_LOCAL_HTTP) {
+    localServer.begin();
+  }
+
+#if USE_COROUTINES
+  if (!executor.spawn(wifi_task()) || !executor.spawn(uplink_task())) {
+    Serial.println("Coroutine frame pool exhausted");
+  }
+#endif
+
+  // From here on, heap use is counted (and trapped in guarded sections)
+  setupDone = true;
 }
 
 void loop() {
-  // Check WiFi connection
-  if (WiFi.status() != WL_CONNECTED) {
+  if (STREAM_MODE) {
+    heap_guard_enter();
+    run_binary_stream();
+    heap_guard_exit();
+    return;
+  }
+
+#if !USE_COROUTINES
+  // Check WiFi connection (cached; a bridge query only when due)
+  if (!link_up()) {
     Serial.println("Reconnecting to WiFi...");
+    client.stop();
+    isConnected = false;
     connect_wifi();
     return;
   }
@@ -77,13 +566,85 @@ void loop() {
       lastConnectionTime = currentTime;
     }
   }
+#endif
   
-  // Check if it's time to send an update
+  if (POWER_GATING) {
+    service_probe_power();
+  }
+
+  // Run the acquisition scheduler on its tick grid
   unsigned long currentTime = millis();
-  if (currentTime - lastUpdateTime >= UPDATE_INTERVAL) {
+  if (currentTime - lastTickTime >= SCHEDULER_TICK) {
+    // Resynchronize after long stalls (WiFi reconnects) instead of bursting
+    tickLateMs = currentTime - lastTickTime - SCHEDULER_TICK;
+    if (tickLateMs > tickLateMaxMs) {
+      tickLateMaxMs = tickLateMs;
+    }
+    if (currentTime - lastTickTime >= 2 * SCHEDULER_TICK) {
+      lastTickTime = currentTime;
+    } else {
+      lastTickTime += SCHEDULER_TICK;
+    }
+    heap_guard_enter();
+    run_acquisition_tick();
+    heap_guard_exit();
+    tickCount++;
+  }
+
+  // Confirm compare matches; real crossings go out as an alarm frame now
+  if (WINDOW_ALARMS && windowTripped) {
+    confirm_alarms();
+  }
+
+#if USE_COROUTINES
+  // Advance the uplink and WiFi tasks; each resumes only when ready
+  executor.run_once();
+#else
+  // Check if it's time to send an update (alarms do not wait)
+  if (alarmChannels) {
+    send_sensor_data();
+  } else if (currentTime - lastUpdateTime >= UPDATE_INTERVAL) {
     lastUpdateTime = currentTime;
     send_sensor_data();
   }
+#endif
+
+  // Periodic high-rate capture of the conductivity line, a sample at a time
+  if (ENABLE_SPECTRAL_DIAG) {
+    run_spectral_diagnostics();
+  }
+
+  // Advance the LAN pull endpoint by at most one chunk
+  if (ENABLE_LOCAL_HTTP && wifiUp) {
+    serve_local_http();
+  }
+
+  if (WINDOW_ALARMS) {
+    sleep_until_interrupt();
+  }
+}
+
+// DEVICE_ID when configured, else the MAC (read over the AT bridge, which
+// answers before the link is associated)
+void init_device_id() {
+  size_t n = strlen(DEVICE_ID);
+  if (n == 12) {
+    for (int i = 0; i < 6; i++) {
+      char pair[3] = { DEVICE_ID[2 * i], DEVICE_ID[2 * i + 1], 0 };
+      deviceId[i] = (uint8_t)strtoul(pair, NULL, 16);
+    }
+  } else {
+    if (n != 0) {
+      Serial.println("DEVICE_ID must be 12 hex digits; using the MAC");
+    }
+    WiFi.macAddress(deviceId);
+  }
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+  for (int i = 0; i < 6; i++) {
+    deviceIdHex[2 * i] = HEX_DIGITS[deviceId[i] >> 4];
+    deviceIdHex[2 * i + 1] = HEX_DIGITS[deviceId[i] & 0x0F];
+  }
+  deviceIdHex[12] = '\0';
 }
 
 void connect_wifi() {
@@ -93,11 +654,6 @@ void connect_wifi() {
     while (true); // Do not continue
   }
   
-  String fv = WiFi.firmwareVersion();
-  if (fv < WIFI_FIRMWARE_LATEST_VERSION) {
-    Serial.println("Please update the firmware");
-  }
-  
   // Try to connect to WiFi network
   while (status != WL_CONNECTED) {
     Serial.print("Attempting to connect to SSID: ...");
@@ -121,83 +677,535 @@ void connect_wifi() {
   IPAddress ip = WiFi.localIP();
   Serial.print("IP Address: ");
   Serial.println(ip);
+  wifiUp = true;
+  linkCheckedAt = millis();
+}
+
+// Cached link state, refreshed from the bridge when the check is due, a
+// socket error made it suspect, or a link notification arrived
+bool link_up() {
+  if (LINK_NOTIFY && linkEvent >= 0) {
+    noInterrupts();
+    status = linkEvent;
+    linkEvent = -1;
+    interrupts();
+    wifiUp = status == WL_CONNECTED;
+    linkCheckedAt = millis();
+  }
+  if (!LINK_CACHE || linkSuspect || millis() - linkCheckedAt >= WIFI_CHECK_INTERVAL) {
+    status = WiFi.status();
+    wifiUp = status == WL_CONNECTED;
+    linkCheckedAt = millis();
+    linkSuspect = false;
+  }
+  return wifiUp;
+}
+
+// A connect failed or a request went unanswered: the link may be down
+void link_suspect() {
+  linkSuspect = true;
+}
+
+// Link change callback of the bridge library; may run in interrupt context
+void link_notify(int linkStatus) {
+  linkEvent = linkStatus;
+}
+
+#if USE_COROUTINES
+// Readiness hooks for the async_io.h awaitables. WiFiS3 writes are
+// synchronous AT commands, so a connected socket is always writable.
+bool socket_readable(WiFiClient& c) {
+  // Each poll is one or two AT queries; space them out
+  if (MODEM_BULK) {
+    static unsigned long lastPoll = 0;
+    if (micros() - lastPoll < MODEM_POLL_US) {
+      return false;
+    }
+    lastPoll = micros();
+  }
+  return c.available() > 0 || !c.connected();
+}
+
+bool socket_writable(WiFiClient& c) {
+  return c.connected();
+}
+
+// Wait conditions of the tasks below. Named functions, not lambdas: a
+// lambda's closure type is local to this file, and GCC warns
+// (-Wsubobject-linkage) when the awaiter holding it lands in a frame.
+bool link_check_requested() {
+  return linkSuspect || linkEvent >= 0;
+}
+
+bool wifi_ready() {
+  return wifiUp;
+}
+
+bool alarm_pending() {
+  return alarmChannels != 0;
+}
+
+// An alarm behind the request does not wait for room either
+bool uplink_write_fits() {
+  return alarmChannels != 0 || ends_before_tick(uplinkWriteMs);
+}
+
+// Watch the link and reassociate without holding up loop()
+Task wifi_task() {
+  for (;;) {
+    co_await until(link_check_requested, WIFI_CHECK_INTERVAL);
+    if (link_up()) {
+      continue;
+    }
+
+    Serial.println("Reconnecting to WiFi...");
+    wifiUp = false;
+    client.stop();
+    isConnected = false;
+    status = WL_IDLE_STATUS;
+    while (status != WL_CONNECTED) {
+      status = strlen(pass) == 0 ? WiFi.begin(ssid) : WiFi.begin(ssid, pass);
+      co_await sleep_ms(5000);
+      status = WiFi.status();
+    }
+    Serial.println("Connected to WiFi");
+    wifiUp = true;
+    linkCheckedAt = millis();
+  }
+}
+
+// One uplink per UPDATE_INTERVAL; the response is awaited, not polled
+Task uplink_task() {
+  for (;;) {
+    co_await until(wifi_ready);
+    unsigned long elapsed = millis() - lastUpdateTime;
+    if (elapsed < UPDATE_INTERVAL && !alarmChannels) {
+      co_await until(alarm_pending, UPDATE_INTERVAL - elapsed);
+    }
+    if (!alarmChannels) {
+      lastUpdateTime = millis();
+    }
+
+    // Recycle the keep-alive connection between requests
+    if (USE_KEEP_ALIVE && isConnected && lastUpdateTime - lastConnectionTime >= RECONNECT_INTERVAL) {
+      client.stop();
+      isConnected = false;
+      lastConnectionTime = lastUpdateTime;
+    }
+
+    size_t bodyLen = next_uplink_body();
+    if (bodyLen == 0 || !open_server_connection()) {
+      release_uplink_body();
+      continue;
+    }
+    if (!co_await writable(client, RESPONSE_TIMEOUT)) {
+      release_uplink_body();
+      client.stop();
+      isConnected = false;
+      uplinkFailures++;
+      link_suspect();
+      continue;
+    }
+    // Alarm frames go out at once; anything else is written where it
+    // ends before the next tick (headers are under 128 bytes)
+    if (!alarmChannels) {
+      uplinkWriteMs = bridge_send_ms(bodyLen + 128);
+      co_await until(uplink_write_fits);
+    }
+    write_uplink_request(bodyLen);
+
+    unsigned long start = millis();
+    int matched = 0;
+    while (matched < 4 && client.connected()) {
+      unsigned long waited = millis() - start;
+      if (waited >= RESPONSE_TIMEOUT || !co_await readable(client, RESPONSE_TIMEOUT - waited)) {
+        break;
+      }
+      if (MODEM_BULK) {
+        int n;
+        while (matched < 4 && (n = read_modem_chunk()) > 0) {
+          for (int k = 0; k < n && matched < 4; k++) {
+            matched = match_header_end(matched, modemRx[k]);
+          }
+        }
+        continue;
+      }
+      while (matched < 4 && client.available()) {
+        matched = match_header_end(matched, client.read());
+      }
+    }
+    if (matched < 4) {
+      link_suspect();
+    }
+    complete_uplink();
+  }
+}
+#endif
+
+// Sample every channel due on this tick in one interleaved burst, then
+// publish averages for channels whose report period has elapsed
+void run_acquisition_tick() {
+  uint8_t pins[NUM_CHANNELS];
+  uint16_t raw[NUM_CHANNELS];
+  int due[NUM_CHANNELS];
+  int count = 0;
+
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    if (tickCount % (channels[i].samplePeriod / SCHEDULER_TICK) == 0) {
+      SensorChannel& ch = channels[i];
+      if (power_gated(ch) && (!ch.powered || micros() - ch.poweredAtUs < (ch.warmupMs + ch.settleMs) * 1000)) {
+        settleSkips++;
+        set_probe_power(ch, true);
+        continue;
+      }
+      due[count] = i;
+      pins[count] = channels[i].pin;
+      count++;
+    }
+  }
+  if (count == 0) {
+    return;
+  }
+
+  read_adc(pins, raw, count);
+
+  // Off until the next power-up, unless that would be right away
+  for (int n = 0; n < count; n++) {
+    SensorChannel& ch = channels[due[n]];
+    if (power_gated(ch)) {
+      unsigned long next = lastTickTime + ch.samplePeriod;
+      if ((long)(next - millis()) > (long)(ch.warmupMs + ch.settleMs + POWER_BATCH_MS)) {
+        set_probe_power(ch, false);
+      }
+    }
+  }
+
+  for (int n = 0; n < count; n++) {
+    SensorChannel& ch = channels[due[n]];
+    // Against the probe's health before this sample: a step across a
+    // limit is one large delta, which the noise check would count
+    if (WINDOW_ALARMS) {
+      check_alarm(due[n], raw[n]);
+    }
+    update_channel_health(ch, raw[n]);
+    ch.sum += raw[n];
+    ch.count++;
+    if (tickCount % (ch.reportPeriod / SCHEDULER_TICK) == 0) {
+      ch.value = ch.convert(ch.sum / ch.count);
+      ch.quality = ch.faultFlags;
+      ch.reportTime = millis();
+      ch.pending = true;
+      ch.sum = 0;
+      ch.count = 0;
+      ch.faultFlags = 0;
+      if (SWING_DOOR) {
+        swing_door(due[n], ch.reportTime, ch.value, ch.quality);
+      }
+
+      if (ch.winCount == 0 || ch.value < ch.winMin) ch.winMin = ch.value;
+      if (ch.winCount == 0 || ch.value > ch.winMax) ch.winMax = ch.value;
+      ch.winSum += ch.value;
+      ch.winCount++;
+      snapshotDirty = true;
+    }
+  }
+
+  // Close the aggregate window for every channel on the same tick
+  if ((tickCount + 1) % (AGG_WINDOW / SCHEDULER_TICK) == 0) {
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+      SensorChannel& ch = channels[i];
+      ch.aggMin = ch.winMin;
+      ch.aggMax = ch.winMax;
+      ch.aggMean = ch.winCount ? ch.winSum / ch.winCount : 0;
+      ch.aggCount = ch.winCount;
+      ch.winSum = 0;
+      ch.winCount = 0;
+    }
+  }
 }
 
+// Blocking uplink, used when coroutines are not available
 void send_sensor_data() {
-  // Read sensors
-  uint16_t turbidity_raw = read_adc(TURBIDITY_PIN);
-  uint16_t ph_raw = read_adc(PH_PIN);
-  uint16_t conductivity_raw = read_adc(CONDUCT_PIN);
-  
-  // Convert values
-  float turbidity = convert_turbidity(turbidity_raw);
-  float ph = convert_ph(ph_raw);
-  float conductivity = convert_conductivity(conductivity_raw);
+  size_t bodyLen = next_uplink_body();
+  if (bodyLen == 0 || !open_server_connection()) {
+    release_uplink_body();
+    return;
+  }
+  write_uplink_request(bodyLen);
+  if (!await_response_headers()) {
+    link_suspect();
+  }
+  complete_uplink();
+}
+
+// Minimal response processing: match the blank line ending the headers
+// instead of buffering lines in Strings. True once the headers ended.
+bool await_response_headers() {
+  unsigned long start = millis();
+  int matched = 0;
+  if (!MODEM_BULK) {
+    while (client.connected() && (millis() - start < RESPONSE_TIMEOUT) && matched < 4) {
+      if (client.available()) {
+        matched = match_header_end(matched, client.read());
+      }
+    }
+    return matched == 4;
+  }
+
+  unsigned long linkChecked = start;
+  while (matched < 4 && millis() - start < RESPONSE_TIMEOUT) {
+    int n = read_modem_chunk();
+    for (int k = 0; k < n && matched < 4; k++) {
+      matched = match_header_end(matched, modemRx[k]);
+    }
+    if (n > 0) {
+      continue;
+    }
+    if (millis() - linkChecked >= MODEM_LINK_CHECK_MS) {
+      linkChecked = millis();
+      if (!client.connected()) {
+        break;
+      }
+    }
+    wait_us(MODEM_POLL_US);
+  }
+  return matched == 4;
+}
+
+// Up to MODEM_RX_SIZE response bytes into modemRx: a FIFO or bridge count
+// (one query when the FIFO is empty), then one receive for all of them
+int read_modem_chunk() {
+  int avail = client.available();
+  if (avail <= 0) {
+    return 0;
+  }
+  return client.read(modemRx, min(avail, MODEM_RX_SIZE));
+}
+
+// Track "\r\n\r\n" across reads; returns 4 once the headers have ended
+int match_header_end(int matched, char c) {
+  const char* headerEnd = "\r\n\r\n";
+  return (c == headerEnd[matched]) ? matched + 1 : (c == '\r' ? 1 : 0);
+}
+
+// Serialize the pending channels into jsonBuf; 0 when nothing is pending
+size_t build_uplink_frame() {
+  // Only channels with a fresh report go into this frame
+  bool anyPending = false;
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    anyPending |= channels[i].pending;
+  }
+  if (!anyPending) {
+    return 0;
+  }
   
   // Reduce serial output frequency
   static int print_counter = 0;
   if (++print_counter >= 5) {
     print_counter = 0;
-    Serial.print("Data: T:");
-    Serial.print(turbidity, 2);
-    Serial.print(";PH:");
-    Serial.print(ph, 2);
-    Serial.print(";C:");
-    Serial.println(conductivity, 2);
+    Serial.print("Data:");
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+      Serial.print(i == 0 ? " " : ";");
+      Serial.print(channels[i].key);
+      Serial.print(":");
+      Serial.print(channels[i].value, 2);
+      if (channels[i].quality) {
+        Serial.print("!");
+        Serial.print(channels[i].quality, 16);
+      }
+    }
+    Serial.println();
+    if (spectral.valid) {
+      Serial.print("Spectrum: ");
+      for (int i = 0; i < SPECTRAL_PEAKS; i++) {
+        Serial.print(spectral.peakHz[i], 1);
+        Serial.print("Hz/");
+        Serial.print(spectral.peakPermille[i]);
+        Serial.print(i < SPECTRAL_PEAKS - 1 ? "; " : "");
+      }
+      Serial.print(" mains:");
+      Serial.print(spectral.bandPermille);
+      Serial.print(" cyc:");
+      Serial.println(spectral.cyclesPerWindow);
+    }
+    if (LOCKIN_CONDUCTIVITY) {
+      Serial.print("Lock-in: I:");
+      Serial.print(lockinI);
+      Serial.print(" Q:");
+      Serial.print(lockinQ);
+      Serial.print(" cyc/exc:");
+      Serial.println(lockinCyclesPerCycle);
+    }
   }
   
   // Create JSON
-  StaticJsonDocument<200> doc;
-  doc["T"] = round(turbidity * 100) / 100.0;
-  doc["PH"] = round(ph * 100) / 100.0;
-  doc["C"] = round(conductivity * 100) / 100.0;
-  
-  String json;
-  serializeJson(doc, json);
+  heap_guard_enter();
+  StaticJsonDocument<256> doc;
+  doc["D"] = (const char*)deviceIdHex;  // Stored by pointer, not copied
+  unsigned long frameTime = millis();
+  unsigned long acquiredAt = frameTime;
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    if (channels[i].pending) {
+      if ((long)(channels[i].reportTime - acquiredAt) < 0) {
+        acquiredAt = channels[i].reportTime;
+      }
+      doc[channels[i].key] = round(channels[i].value * 100) / 100.0;
+      // Quality flags only for channels with a detected fault
+      if (channels[i].quality) {
+        doc["Q"][channels[i].key] = channels[i].quality;
+      }
+    }
+  }
+  // Alarm frame: crossed channels, -1 below the low limit, 1 above the high
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    if (alarmChannels & (1 << i)) {
+      doc["AL"][channels[i].key] = channels[i].value < channels[i].dangerLow ? -1 : 1;
+    }
+  }
+  if (spectral.valid) {
+    // Compact noise diagnostics: dominant frequency and mains band share
+    doc["NF"] = round(spectral.peakHz[0] * 10) / 10.0;
+    doc["NE"] = spectral.bandPermille;
+  }
+
+  // Latency tracing: trace ID plus device-clock acquisition and frame
+  // times. The server maps them to wall time through its receive time.
+  doc["S"] = frameSeq++;
+  doc["TA"] = acquiredAt;
+  doc["TS"] = frameTime;
   
+  size_t jsonLen = serializeJson(doc, jsonBuf, sizeof(jsonBuf));
+  heap_guard_exit();
+  return jsonLen;
+}
+
+// Body of the next request: an alarm frame goes out on its own, anything
+// else through the batch
+size_t next_uplink_body() {
+  if (alarmChannels) {
+    uplinkBody = jsonBuf;
+    return build_uplink_frame();
+  }
+  if (SWING_DOOR) {
+    uplinkBody = sdtBody;
+    return build_sdt_body();
+  }
+  return batch_uplink_frame();
+}
+
+// Build a frame and queue it. Returns the length of the request body at
+// uplinkBody once UPLINK_BATCH frames are queued, else 0. A full batch
+// whose request failed is sent again before a new frame is built, so no
+// sequence number goes to a frame that is never sent; the channels stay
+// pending meanwhile, as with a single frame.
+size_t batch_uplink_frame() {
+#if UPLINK_BATCH > 1
+  if (batchFrames < UPLINK_BATCH) {
+    size_t jsonLen = build_uplink_frame();
+    if (jsonLen == 0) {
+      return 0;
+    }
+    batchBuf[batchLen++] = batchFrames == 0 ? '[' : ',';
+    memcpy(batchBuf + batchLen, jsonBuf, jsonLen);
+    batchLen += jsonLen;
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+      channels[i].pending = false;
+    }
+    if (++batchFrames < UPLINK_BATCH) {
+      return 0;
+    }
+    batchBuf[batchLen++] = ']';
+  }
+  uplinkBody = batchBuf;
+  return batchLen;
+#else
+  return build_uplink_frame();
+#endif
+}
+
+bool open_server_connection() {
   // Manage connection
   if (!isConnected) {
     if (!client.connect(server_host, server_port)) {
       Serial.println("Failed to connect to server");
-      return;
+      uplinkFailures++;
+      link_suspect();
+      return false;
     }
     isConnected = true;
     Serial.println("Connected to server");
   }
+  return true;
+}
+
+void write_uplink_request(size_t bodyLen) {
+  // The frame is committed to the socket below (batched frames were
+  // committed when queued)
+  if (uplinkBody == jsonBuf) {
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+      channels[i].pending = false;
+    }
+    alarmChannels = 0;
+  }
   
-  // Minimized HTTP request
-  client.print("POST ");
-  client.print(server_path);
-  client.println(" HTTP/1.1");
-  client.print("Host: ");
-  client.println(server_host);
-  client.println(USE_KEEP_ALIVE ? "Connection: keep-alive" : "Connection: close");
-  client.println("Content-Type: application/json");
-  client.print("Content-Length: ");
-  client.println(json.length());
-  client.println();  // Blank line is crucial
-  client.print(json);
+  // Minimized HTTP request. Every print is one AT command on the board;
+  // lean headers drop the type and the keep-alive HTTP/1.1 implies.
+  if (MODEM_BULK) {
+    send_request_bulk(bodyLen);
+  } else {
+    client.print("POST ");
+    client.print(server_path);
+    client.println(" HTTP/1.1");
+    client.print("Host: ");
+    client.println(server_host);
+    if (!UPLINK_LEAN_HEADERS || !USE_KEEP_ALIVE) {
+      client.println(USE_KEEP_ALIVE ? "Connection: keep-alive" : "Connection: close");
+    }
+    if (!UPLINK_LEAN_HEADERS) {
+      client.println("Content-Type: application/json");
+    }
+    client.print("Content-Length: ");
+    client.println(bodyLen);
+    client.println();  // Blank line is crucial
+    client.write((const uint8_t*)uplinkBody, bodyLen);
+  }
   client.flush();  // Force data transmission
-  
-  // Minimal response processing
-  unsigned long timeout = millis();
-  bool headerEnded = false;
-  
-  while (client.connected() && (millis() - timeout < 1000)) {
-    if (client.available()) {
-      String line = client.readStringUntil('\n');
-      if (line == "\r") {
-        headerEnded = true;
-        break;
-      }
+  if (uplinkBody == sdtBody) {
+    sdtHead = (sdtHead + sdtInBody) % SDT_QUEUE;
+    sdtCount -= sdtInBody;
+    sdtInBody = 0;
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+      channels[i].pending = false;
     }
   }
-  
+#if UPLINK_BATCH > 1
+  if (uplinkBody == batchBuf) {
+    batchLen = 0;
+    batchFrames = 0;
+  }
+#endif
+}
+
+// The body built for this request was not written: its swing-door points
+// are queued like any other again, and are rebuilt into the next body
+void release_uplink_body() {
+  sdtInBody = 0;
+}
+
+void complete_uplink() {
   // Drain any remaining response data
-  while (client.available()) {
-    client.read();
+  if (MODEM_BULK) {
+    while (read_modem_chunk() > 0) {
+    }
+  } else {
+    while (client.available()) {
+      client.read();
+    }
   }
 
+  uplinkCount++;
+  snapshotDirty = true;
+
   // Handle connection based on keep-alive setting
   if (!USE_KEEP_ALIVE) {
     client.stop();
@@ -205,30 +1213,1234 @@ void send_sensor_data() {
   }
 }
 
-// Function to read ADC with averaging
-uint16_t read_adc(uint8_t pin) {
-  uint32_t sum = 0;
-  const int samples = 10;
-  
-  for (int i = 0; i < samples; i++) {
-    sum += analogRead(pin);
-    delay(2);
+// Heap guard. newlib takes __malloc_lock() around every malloc, realloc and
+// free, so overriding it observes all heap traffic without linker flags.
+#if HEAP_GUARD
+extern "C" void __malloc_lock(struct _reent* r) {
+  (void)r;
+  if (!setupDone) {
+    return;
+  }
+  heapOpsAfterSetup++;
+  if (heapGuardArmed) {
+    heapGuardArmed = false;  // Printing below must not re-enter the trap
+    Serial.print("HEAP GUARD: heap use after setup from 0x");
+    Serial.println((unsigned long)__builtin_return_address(0), 16);
+    while (true); // Do not continue
   }
-  
-  return sum / samples;
 }
 
-// Function to convert raw turbidity value (inverted)
-float convert_turbidity(uint16_t raw) {
-  return 1000.0 * (1.0 - (float)raw / 4095.0);
+extern "C" void __malloc_unlock(struct _reent* r) {
+  (void)r;
 }
+#endif
 
-// Function to convert raw pH value
-float convert_ph(uint16_t raw) {
-  return 14.0 * ((float)raw / 4095.0);
+void heap_guard_enter() {
+  heapGuardArmed = HEAP_GUARD && setupDone;
 }
 
-// Function to convert raw conductivity value
-float convert_conductivity(uint16_t raw) {
-  return 1500.0 * ((float)raw / 4095.0);
-}
\ No newline at end of file
+void heap_guard_exit() {
+  heapGuardArmed = false;
+}
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) over a packet
+uint16_t crc16_ccitt(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Consistent Overhead Byte Stuffing: removes every 0x00 from the packet so
+// 0x00 can delimit frames. Returns the encoded length (len + len/254 + 1).
+size_t cobs_encode(const uint8_t* in, size_t len, uint8_t* out) {
+  size_t code_pos = 0;
+  size_t out_pos = 1;
+  uint8_t code = 1;
+  for (size_t i = 0; i < len; i++) {
+    if (in[i] == 0) {
+      out[code_pos] = code;
+      code_pos = out_pos++;
+      code = 1;
+      continue;
+    }
+    out[out_pos++] = in[i];
+    if (++code == 0xFF) {
+      out[code_pos] = code;
+      code_pos = out_pos++;
+      code = 1;
+    }
+  }
+  out[code_pos] = code;
+  return out_pos;
+}
+
+// Collect one sample set per STREAM_SAMPLE_US on the micros() grid and ship
+// a packet every STREAM_SETS sets. Never blocks on the USB link.
+void run_binary_stream() {
+  unsigned long now = micros();
+  if ((long)(now - streamNextSample) < 0) {
+    return;
+  }
+  if (streamSets == 0) {
+    streamFrameStart = streamNextSample;
+  }
+  streamNextSample += STREAM_SAMPLE_US;
+
+  uint16_t* set = &streamRaw[streamSets * NUM_CHANNELS];
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    set[i] = analogRead(channels[i].pin);
+  }
+  if (++streamSets == STREAM_SETS) {
+    send_stream_packet();
+    streamSets = 0;
+  }
+}
+
+// Packet (little-endian): version, channel count, seq, t0 micros, period us,
+// set count, device ID (6 bytes, as sent), samples packed two per three
+// bytes, CRC-16 of everything before
+void send_stream_packet() {
+  static uint8_t packet[STREAM_PAYLOAD_MAX];
+  static uint8_t encoded[STREAM_PAYLOAD_MAX + STREAM_PAYLOAD_MAX / 254 + 2];
+
+  size_t n = 0;
+  packet[n++] = STREAM_VERSION;
+  packet[n++] = NUM_CHANNELS;
+  packet[n++] = streamSeq & 0xFF;
+  packet[n++] = streamSeq >> 8;
+  for (int i = 0; i < 4; i++) {
+    packet[n++] = (streamFrameStart >> (8 * i)) & 0xFF;
+  }
+  packet[n++] = STREAM_SAMPLE_US & 0xFF;
+  packet[n++] = (STREAM_SAMPLE_US >> 8) & 0xFF;
+  packet[n++] = STREAM_SETS;
+  memcpy(packet + n, deviceId, sizeof(deviceId));
+  n += sizeof(deviceId);
+
+  int count = STREAM_SETS * NUM_CHANNELS;
+  for (int i = 0; i < count; i += 2) {
+    uint16_t a = streamRaw[i];
+    uint16_t b = i + 1 < count ? streamRaw[i + 1] : 0;
+    packet[n++] = a & 0xFF;
+    packet[n++] = (a >> 8) | ((b & 0x0F) << 4);
+    if (i + 1 < count) {
+      packet[n++] = b >> 4;
+    }
+  }
+
+  uint16_t crc = crc16_ccitt(packet, n);
+  packet[n++] = crc & 0xFF;
+  packet[n++] = crc >> 8;
+
+  size_t len = cobs_encode(packet, n, encoded);
+  encoded[len++] = 0x00;
+
+  // Sequence numbers advance even for skipped packets so the host can
+  // count drops from the gaps
+  streamSeq++;
+  if ((size_t)Serial.availableForWrite() < len) {
+    streamDrops++;
+    return;
+  }
+  Serial.write(encoded, len);
+}
+
+// Minimal append-only text formatting for the snapshot buffers. Avoids
+// printf float support and never writes past the buffer.
+struct TextBuf {
+  char* data;
+  size_t cap;
+  size_t len;
+};
+
+void append_str(TextBuf& b, const char* str) {
+  while (*str && b.len + 1 < b.cap) {
+    b.data[b.len++] = *str++;
+  }
+  b.data[b.len] = '\0';
+}
+
+void append_uint(TextBuf& b, unsigned long v) {
+  char tmp[21];  // Enough for a 64-bit unsigned long on host builds
+  int n = 0;
+  do {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (n && b.len + 1 < b.cap) {
+    b.data[b.len++] = tmp[--n];
+  }
+  b.data[b.len] = '\0';
+}
+
+// Two-decimal fixed point, matching the precision of the uplink JSON
+void append_fixed2(TextBuf& b, float v) {
+  long cents = lround(v * 100);
+  if (cents < 0) {
+    append_str(b, "-");
+    cents = -cents;
+  }
+  append_uint(b, cents / 100);
+  append_str(b, ".");
+  append_uint(b, (cents / 10) % 10);
+  append_uint(b, cents % 10);
+}
+
+// Swing-door step for channel i's new point (t, v). The doors are the
+// steepest and shallowest lines from the kept point that pass within the
+// deviation of every point since. The newest point is held while the line
+// to it stays between the doors; once it falls outside, the held point is
+// kept and the doors restart from it. The max interval keeps the held
+// point too, and a quality change keeps both so no line spans it.
+void swing_door(int i, unsigned long t, float v, uint8_t quality) {
+  SensorChannel& ch = channels[i];
+  sdtPointsIn++;
+  if (!ch.sdtStarted || quality != ch.sdtQuality || (ch.sdtHeld && quality != ch.heldQuality)) {
+    if (ch.sdtStarted && ch.sdtHeld) {
+      keep_point(i, ch.heldTime, ch.heldValue, ch.heldQuality);
+    }
+    keep_point(i, t, v, quality);
+    ch.sdtStarted = true;
+    ch.sdtHeld = false;
+    return;
+  }
+
+  if (ch.sdtHeld) {
+    float slope = (v - ch.sdtValue) / (float)(t - ch.sdtTime);
+    if (slope < ch.slopeLow || slope > ch.slopeHigh || t - ch.sdtTime >= ch.sdtMaxInterval) {
+      keep_point(i, ch.heldTime, ch.heldValue, ch.heldQuality);
+      ch.sdtHeld = false;
+    }
+  }
+  float dt = (float)(t - ch.sdtTime);
+  float high = (v + ch.sdtDeviation - ch.sdtValue) / dt;
+  float low = (v - ch.sdtDeviation - ch.sdtValue) / dt;
+  ch.slopeHigh = ch.sdtHeld ? min(ch.slopeHigh, high) : high;
+  ch.slopeLow = ch.sdtHeld ? max(ch.slopeLow, low) : low;
+  ch.sdtHeld = true;
+  ch.heldTime = t;
+  ch.heldValue = v;
+  ch.heldQuality = quality;
+}
+
+// Make (t, v) channel i's kept point and queue it for the uplink; a full
+// queue drops its oldest point, or this one while the oldest are in a
+// request waiting for the socket
+void keep_point(int i, unsigned long t, float v, uint8_t quality) {
+  SensorChannel& ch = channels[i];
+  ch.sdtTime = t;
+  ch.sdtValue = v;
+  ch.sdtQuality = quality;
+  if (sdtCount == SDT_QUEUE) {
+    sdtDropped++;
+    if (sdtInBody > 0) {
+      return;
+    }
+    sdtHead = (sdtHead + 1) % SDT_QUEUE;
+    sdtCount--;
+  }
+  sdtPointsKept++;
+  KeptPoint& p = sdtQueue[(sdtHead + sdtCount) % SDT_QUEUE];
+  p.time = t;
+  p.value = v;
+  p.channel = (uint8_t)i;
+  p.quality = quality;
+  sdtCount++;
+}
+
+// Kept points as a JSON array of frames in sdtBody, one frame per
+// timestamp in queue order; 0 when none are queued. The points stay
+// queued until write_uplink_request() commits them.
+size_t build_sdt_body() {
+  TextBuf b = { sdtBody, sizeof(sdtBody), 0 };
+  unsigned long now = millis();
+  uint8_t n = 0;
+  append_str(b, "[");
+  // Room for one more frame with every channel and flags
+  while (n < sdtCount && b.len + 64 + 32 * NUM_CHANNELS < sizeof(sdtBody)) {
+    const KeptPoint& first = sdtQueue[(sdtHead + n) % SDT_QUEUE];
+    append_str(b, n == 0 ? "{\"D\":\"" : ",{\"D\":\"");
+    append_str(b, deviceIdHex);
+    append_str(b, "\"");
+    uint8_t flagged = 0;
+    uint8_t end = n;
+    while (end < sdtCount && sdtQueue[(sdtHead + end) % SDT_QUEUE].time == first.time) {
+      const KeptPoint& p = sdtQueue[(sdtHead + end) % SDT_QUEUE];
+      append_str(b, ",\"");
+      append_str(b, channels[p.channel].key);
+      append_str(b, "\":");
+      append_fixed2(b, p.value);
+      flagged |= p.quality ? 1 : 0;
+      end++;
+    }
+    if (flagged) {
+      append_str(b, ",\"Q\":{");
+      bool comma = false;
+      for (uint8_t k = n; k < end; k++) {
+        const KeptPoint& p = sdtQueue[(sdtHead + k) % SDT_QUEUE];
+        if (p.quality) {
+          append_str(b, comma ? ",\"" : "\"");
+          append_str(b, channels[p.channel].key);
+          append_str(b, "\":");
+          append_uint(b, p.quality);
+          comma = true;
+        }
+      }
+      append_str(b, "}");
+    }
+    append_str(b, ",\"S\":");
+    append_uint(b, frameSeq++);
+    append_str(b, ",\"TA\":");
+    append_uint(b, first.time);
+    append_str(b, ",\"TS\":");
+    append_uint(b, now);
+    append_str(b, "}");
+    n = end;
+  }
+  append_str(b, "]");
+  sdtInBody = n;
+  return n ? b.len : 0;
+}
+
+// Bridge time of one AT send carrying len bytes, command framing and
+// turnaround included (~25 ms for 256 bytes at 115200 baud)
+unsigned long bridge_send_ms(size_t len) {
+  return 2 + (len + 24) * 10 * 1000 / MODEM_BAUD;
+}
+
+// Whether a bridge transfer of ms started now ends before the next
+// scheduler tick falls due. One longer than half a tick only starts in
+// the first half, which keeps it from being put off indefinitely.
+bool ends_before_tick(unsigned long ms) {
+  if (ms > SCHEDULER_TICK / 2) {
+    ms = SCHEDULER_TICK / 2;
+  }
+  return millis() - lastTickTime + ms < SCHEDULER_TICK;
+}
+
+// The request headers in modemTx, and the body too when it fits: one
+// AT+CLIENTSEND, or two for the larger batch and swing-door bodies
+void send_request_bulk(size_t bodyLen) {
+  TextBuf h = { modemTx, sizeof(modemTx), 0 };
+  append_str(h, "POST ");
+  append_str(h, server_path);
+  append_str(h, " HTTP/1.1\r\nHost: ");
+  append_str(h, server_host);
+  append_str(h, "\r\n");
+  if (!UPLINK_LEAN_HEADERS || !USE_KEEP_ALIVE) {
+    append_str(h, USE_KEEP_ALIVE ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+  }
+  if (!UPLINK_LEAN_HEADERS) {
+    append_str(h, "Content-Type: application/json\r\n");
+  }
+  append_str(h, "Content-Length: ");
+  append_uint(h, bodyLen);
+  append_str(h, "\r\n\r\n");
+  if (h.len + bodyLen < sizeof(modemTx)) {
+    memcpy(modemTx + h.len, uplinkBody, bodyLen);
+    client.write((const uint8_t*)modemTx, h.len + bodyLen);
+  } else {
+    client.write((const uint8_t*)modemTx, h.len);
+    client.write((const uint8_t*)uplinkBody, bodyLen);
+  }
+}
+
+void append_label(TextBuf& b, const char* name, const char* channel) {
+  append_str(b, name);
+  append_str(b, "{channel=\"");
+  append_str(b, channel);
+  append_str(b, "\"} ");
+}
+
+void append_metric(TextBuf& b, const char* name, const char* channel, float v) {
+  append_label(b, name, channel);
+  append_fixed2(b, v);
+  append_str(b, "\n");
+}
+
+void append_metric_uint(TextBuf& b, const char* name, const char* channel, unsigned long v) {
+  append_label(b, name, channel);
+  append_uint(b, v);
+  append_str(b, "\n");
+}
+
+// Render /metrics (Prometheus text) and /latest (compact JSON) into the
+// given buffer pair
+void format_snapshots(uint8_t index) {
+  unsigned long now = millis();
+
+  TextBuf m = { metricsBuf[index], METRICS_BUF_SIZE, 0 };
+  // Identity as an info metric; scrape configs attach it as a target label
+  append_str(m, "# TYPE water_device_info gauge\nwater_device_info{device=\"");
+  append_str(m, deviceIdHex);
+  append_str(m, "\"} 1\n# TYPE water_reading gauge\n");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_metric(m, "water_reading", channels[i].key, channels[i].value);
+  }
+  append_str(m, "# TYPE water_reading_quality gauge\n");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_metric_uint(m, "water_reading_quality", channels[i].key, channels[i].quality);
+  }
+  append_str(m, "# TYPE water_reading_age_ms gauge\n");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_metric_uint(m, "water_reading_age_ms", channels[i].key, now - channels[i].reportTime);
+  }
+  append_str(m, "# TYPE water_window_min gauge\n");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_metric(m, "water_window_min", channels[i].key, channels[i].aggMin);
+  }
+  append_str(m, "# TYPE water_window_max gauge\n");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_metric(m, "water_window_max", channels[i].key, channels[i].aggMax);
+  }
+  append_str(m, "# TYPE water_window_mean gauge\n");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_metric(m, "water_window_mean", channels[i].key, channels[i].aggMean);
+  }
+  append_str(m, "# TYPE water_window_count gauge\n");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_metric_uint(m, "water_window_count", channels[i].key, channels[i].aggCount);
+  }
+  append_str(m, "# TYPE water_uptime_seconds counter\nwater_uptime_seconds ");
+  append_uint(m, now / 1000);
+  append_str(m, "\n# TYPE water_uplink_total counter\nwater_uplink_total{result=\"ok\"} ");
+  append_uint(m, uplinkCount);
+  append_str(m, "\nwater_uplink_total{result=\"fail\"} ");
+  append_uint(m, uplinkFailures);
+  append_str(m, "\n# TYPE water_alarms_total counter\nwater_alarms_total ");
+  append_uint(m, alarmCount);
+  if (SWING_DOOR) {
+    append_str(m, "\n# TYPE water_sdt_points_total counter\nwater_sdt_points_total{kept=\"false\"} ");
+    append_uint(m, sdtPointsIn - sdtPointsKept);
+    append_str(m, "\nwater_sdt_points_total{kept=\"true\"} ");
+    append_uint(m, sdtPointsKept);
+    append_str(m, "\n# TYPE water_sdt_dropped_total counter\nwater_sdt_dropped_total ");
+    append_uint(m, sdtDropped);
+  }
+  if (POWER_GATING) {
+    append_str(m, "\n# TYPE water_probe_powered_ms_total counter\n");
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+      append_metric_uint(m, "water_probe_powered_ms_total", channels[i].key, channels[i].poweredMs);
+    }
+    append_str(m, "# TYPE water_settle_skips_total counter\nwater_settle_skips_total ");
+    append_uint(m, settleSkips);
+  }
+  append_str(m, "\n# TYPE water_tick_late_ms gauge\nwater_tick_late_ms ");
+  append_uint(m, tickLateMs);
+  append_str(m, "\nwater_tick_late_max_ms ");
+  append_uint(m, tickLateMaxMs);
+  append_str(m, "\n# TYPE water_heap_ops_total counter\nwater_heap_ops_total ");
+  append_uint(m, heapOpsAfterSetup);
+  append_str(m, "\n");
+  metricsLen[index] = m.len;
+
+  TextBuf j = { latestBuf[index], LATEST_BUF_SIZE, 0 };
+  append_str(j, "{\"D\":\"");
+  append_str(j, deviceIdHex);
+  append_str(j, "\",\"ts\":");
+  append_uint(j, now);
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_str(j, ",\"");
+    append_str(j, channels[i].key);
+    append_str(j, "\":");
+    append_fixed2(j, channels[i].value);
+  }
+  append_str(j, ",\"Q\":{");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_str(j, i ? ",\"" : "\"");
+    append_str(j, channels[i].key);
+    append_str(j, "\":");
+    append_uint(j, channels[i].quality);
+  }
+  // Window aggregates as [min, max, mean, count]
+  append_str(j, "},\"win\":{");
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    append_str(j, i ? ",\"" : "\"");
+    append_str(j, channels[i].key);
+    append_str(j, "\":[");
+    append_fixed2(j, channels[i].aggMin);
+    append_str(j, ",");
+    append_fixed2(j, channels[i].aggMax);
+    append_str(j, ",");
+    append_fixed2(j, channels[i].aggMean);
+    append_str(j, ",");
+    append_uint(j, channels[i].aggCount);
+    append_str(j, "]");
+  }
+  append_str(j, "},\"up\":");
+  append_uint(j, now / 1000);
+  append_str(j, ",\"tx\":[");
+  append_uint(j, uplinkCount);
+  append_str(j, ",");
+  append_uint(j, uplinkFailures);
+  append_str(j, "],\"late\":");
+  append_uint(j, tickLateMaxMs);
+  append_str(j, "}");
+  latestLen[index] = j.len;
+}
+
+// Non-blocking LAN endpoint. Each call does at most one bounded step:
+// accept, read part of the request line, or write one chunk.
+void serve_local_http() {
+  LocalHttpConn& c = localConn;
+
+  // Keep the bridge free for the tick that is about to fall due
+  if (!ends_before_tick(bridge_send_ms(LOCAL_HTTP_CHUNK))) {
+    return;
+  }
+
+  // Refresh the idle buffer pair, unless the open response still points at it
+  if (snapshotDirty) {
+    uint8_t next = snapshotIndex ^ 1;
+    bool inUse = c.active && (c.body == metricsBuf[next] || c.body == latestBuf[next]);
+    if (!inUse) {
+      heap_guard_enter();
+      format_snapshots(next);
+      heap_guard_exit();
+      snapshotIndex = next;
+      snapshotDirty = false;
+    }
+  }
+
+  if (!c.active) {
+    c.client = localServer.available();
+    if (!c.client) {
+      return;
+    }
+    c.active = true;
+    c.requestLen = 0;
+    c.body = NULL;
+    c.sent = 0;
+    c.started = millis();
+    return;
+  }
+
+  if (millis() - c.started > LOCAL_HTTP_TIMEOUT || !c.client.connected()) {
+    c.client.stop();
+    c.active = false;
+    return;
+  }
+
+  // Collect the request line, then pick the preformatted body
+  if (c.body == NULL) {
+    int avail = c.client.available();
+    while (avail-- > 0 && c.requestLen < sizeof(c.request) - 1) {
+      char ch = c.client.read();
+      if (ch == '\n') {
+        break;
+      }
+      c.request[c.requestLen++] = ch;
+    }
+    c.request[c.requestLen] = '\0';
+    bool lineDone = strchr(c.request, '\r') != NULL || c.requestLen == sizeof(c.request) - 1;
+    if (!lineDone) {
+      return;
+    }
+
+    const char* type;
+    const char* status = "200 OK";
+    if (strncmp(c.request, "GET /metrics", 12) == 0) {
+      c.body = metricsBuf[snapshotIndex];
+      c.bodyLen = metricsLen[snapshotIndex];
+      type = "text/plain; version=0.0.4";
+    } else if (strncmp(c.request, "GET /latest", 11) == 0) {
+      c.body = latestBuf[snapshotIndex];
+      c.bodyLen = latestLen[snapshotIndex];
+      type = "application/json";
+    } else {
+      c.body = "";
+      c.bodyLen = 0;
+      type = "text/plain";
+      status = "404 Not Found";
+    }
+
+    TextBuf h = { c.header, sizeof(c.header), 0 };
+    append_str(h, "HTTP/1.1 ");
+    append_str(h, status);
+    append_str(h, "\r\nContent-Type: ");
+    append_str(h, type);
+    append_str(h, "\r\nConnection: close\r\nContent-Length: ");
+    append_uint(h, c.bodyLen);
+    append_str(h, "\r\n\r\n");
+    c.headerLen = h.len;
+    return;
+  }
+
+  // Write one chunk of header + body
+  size_t total = c.headerLen + c.bodyLen;
+  if (c.sent < total) {
+    const char* src = c.sent < c.headerLen ? c.header + c.sent : c.body + (c.sent - c.headerLen);
+    size_t left = c.sent < c.headerLen ? c.headerLen - c.sent : total - c.sent;
+    size_t n = min(left, LOCAL_HTTP_CHUNK);
+    c.sent += c.client.write((const uint8_t*)src, n);
+    return;
+  }
+
+  // Any unread request headers are discarded with the connection
+  c.client.stop();
+  c.active = false;
+}
+
+// Rail, stuck-at and noise-floor checks on one averaged sample. A few
+// compares and one shift per sample, negligible next to the ADC burst.
+void update_channel_health(SensorChannel& ch, uint16_t raw) {
+  uint8_t flags = 0;
+
+  if (raw <= RAIL_LOW_LSB) {
+    flags |= QF_RAIL_LOW;
+  } else if (raw >= RAIL_HIGH_LSB) {
+    flags |= QF_RAIL_HIGH;
+  }
+
+  // The first sample only seeds the delta; there is none to judge yet
+  if (!ch.seeded) {
+    ch.seeded = true;
+    ch.lastRaw = raw;
+    ch.faultFlags |= flags;
+    return;
+  }
+
+  uint16_t delta = raw > ch.lastRaw ? raw - ch.lastRaw : ch.lastRaw - raw;
+  if (delta == 0) {
+    if (ch.flatRun < STUCK_SAMPLES) {
+      ch.flatRun++;
+    }
+  } else {
+    ch.flatRun = 0;
+  }
+  if (ch.flatRun >= STUCK_SAMPLES) {
+    flags |= QF_STUCK;
+  }
+
+  // noise += (|delta| - noise) / 8, kept in Q4 to retain sub-LSB resolution
+  int32_t noise = ch.noiseQ4;
+  noise += (((int32_t)delta << 4) - noise) >> 3;
+  ch.noiseQ4 = (uint16_t)noise;
+  if ((ch.noiseQ4 >> 4) > NOISE_MAX_LSB) {
+    flags |= QF_NOISY;
+  }
+
+  ch.lastRaw = raw;
+  ch.faultFlags |= flags;
+}
+
+// ADC channel (ANnnn) of an analog pin on the UNO R4 WiFi
+uint8_t adc_channel(uint8_t pin) {
+  static const uint8_t AN[] = { 9, 0, 1, 2, 21, 22 };   // A0..A5
+  return AN[pin - A0];
+}
+
+// Raw count at which ch.convert() reaches value (conversions are monotonic)
+uint16_t raw_at(const SensorChannel& ch, float value) {
+  bool rising = ch.convert(4095) > ch.convert(0);
+  uint16_t lo = 0, hi = 4095;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if ((ch.convert(mid) >= value) == rising) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+// Turn the danger limits into raw ranges, give the first two channels
+// with limits a compare window and attach the compare interrupts
+void init_window_alarms() {
+  uint8_t next = WINDOW_A;
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    SensorChannel& ch = channels[i];
+    bool rising = ch.convert(4095) > ch.convert(0);
+    uint16_t lowEdge = isnan(ch.dangerLow) ? (rising ? 0 : 4095) : raw_at(ch, ch.dangerLow);
+    uint16_t highEdge = isnan(ch.dangerHigh) ? (rising ? 4095 : 0) : raw_at(ch, ch.dangerHigh);
+    ch.alarmLow = min(lowEdge, highEdge);
+    ch.alarmHigh = max(lowEdge, highEdge);
+    ch.window = WINDOW_NONE;
+    if ((!isnan(ch.dangerLow) || !isnan(ch.dangerHigh)) && next <= WINDOW_B) {
+      ch.window = next++;
+    }
+  }
+
+  // Window mode; ADCMPLR and ADCMPBNSR.CMPLB stay 0: match outside the window
+  R_ADC0->ADCMPCR = R_ADC0_ADCMPCR_WCMPE_Msk;
+  for (int r = 0; r < 2; r++) {
+    R_ADC0->ADCMPANSR[r] = 0;
+    R_ADC0->ADCMPLR[r] = 0;
+  }
+  GenericIrqCfg_t cfg = { FSP_INVALID_VECTOR, WINDOW_ALARM_IPL, ELC_EVENT_ADC0_COMPARE_A };
+  IRQManager::getInstance().addGenericInterrupt(cfg, window_alarm_isr);
+  cfg = { FSP_INVALID_VECTOR, WINDOW_ALARM_IPL, ELC_EVENT_ADC0_COMPARE_B };
+  IRQManager::getInstance().addGenericInterrupt(cfg, window_alarm_isr);
+
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    arm_window(i);
+  }
+}
+
+// Program channel i's window with its safe range and enable its interrupt
+void arm_window(int i) {
+  SensorChannel& ch = channels[i];
+  uint8_t an = adc_channel(ch.pin);
+  if (ch.window == WINDOW_A) {
+    R_ADC0->ADCMPDR0 = ch.alarmLow;
+    R_ADC0->ADCMPDR1 = ch.alarmHigh;
+    R_ADC0->ADCMPSR[an >> 4] &= (uint16_t)~(1u << (an & 15));
+    R_ADC0->ADCMPANSR[an >> 4] |= (uint16_t)(1u << (an & 15));
+    R_ADC0->ADCMPCR |= R_ADC0_ADCMPCR_CMPAE_Msk | R_ADC0_ADCMPCR_CMPAIE_Msk;
+  } else if (ch.window == WINDOW_B) {
+    R_ADC0->ADWINLLB = ch.alarmLow;
+    R_ADC0->ADWINULB = ch.alarmHigh;
+    R_ADC0->ADCMPBNSR = an;
+    R_ADC0->ADCMPBSR = 0;
+    R_ADC0->ADCMPCR |= R_ADC0_ADCMPCR_CMPBE_Msk | R_ADC0_ADCMPCR_CMPBIE_Msk;
+  }
+}
+
+// Compare match (window A or B): latch and disarm the channel so a
+// lasting crossing interrupts once; loop() confirms it
+void window_alarm_isr() {
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    SensorChannel& ch = channels[i];
+    uint8_t an = adc_channel(ch.pin);
+    uint16_t bit = (uint16_t)(1u << (an & 15));
+    if (ch.window == WINDOW_A && (R_ADC0->ADCMPSR[an >> 4] & bit)) {
+      R_ADC0->ADCMPANSR[an >> 4] &= (uint16_t)~bit;
+      R_ADC0->ADCMPSR[an >> 4] &= (uint16_t)~bit;
+      ch.alarmFaults = ch.quality | ch.faultFlags;
+      windowTripped = windowTripped | (1 << i);
+    } else if (ch.window == WINDOW_B && (R_ADC0->ADCMPBSR & R_ADC0_ADCMPBSR_CMPSTB_Msk)) {
+      R_ADC0->ADCMPCR &= (uint16_t)~(R_ADC0_ADCMPCR_CMPBE_Msk | R_ADC0_ADCMPCR_CMPBIE_Msk);
+      R_ADC0->ADCMPBSR = 0;
+      ch.alarmFaults = ch.quality | ch.faultFlags;
+      windowTripped = windowTripped | (1 << i);
+    }
+  }
+  R_BSP_IrqStatusClear(R_FSP_CurrentIrqGet());
+}
+
+// Per sample, before the sample's health checks: re-arm a channel once it
+// is back inside its limits by the hysteresis, and retry a crossing masked
+// by a fault once the probe is healthy again; channels without a window
+// trip here instead
+void check_alarm(int i, uint16_t raw) {
+  SensorChannel& ch = channels[i];
+  uint8_t faults = ch.quality | ch.faultFlags;
+  bool outside = raw < ch.alarmLow || raw > ch.alarmHigh;
+  if (ch.alarmActive) {
+    if ((ch.alarmLow == 0 || raw >= ch.alarmLow + ALARM_HYSTERESIS_LSB)
+        && (ch.alarmHigh == 4095 || raw + ALARM_HYSTERESIS_LSB <= ch.alarmHigh)) {
+      ch.alarmActive = false;
+      ch.alarmMasked = false;
+      arm_window(i);
+    } else if (ch.alarmMasked && !faults && outside) {
+      noInterrupts();
+      ch.alarmFaults = 0;
+      windowTripped = windowTripped | (1 << i);
+      interrupts();
+    }
+  } else if (ch.window == WINDOW_NONE && outside) {
+    noInterrupts();
+    ch.alarmFaults = faults;
+    windowTripped = windowTripped | (1 << i);
+    interrupts();
+  }
+}
+
+// Confirm latched crossings with an averaged read, so one noisy conversion
+// raises no alarm, and queue an alarm frame with the confirmed channels.
+// A probe on a rail, or flagged by the quality checks when it crossed, is
+// a fault, not an alarm, as for the reports: it stays latched silently,
+// and check_alarm() retries it once the probe is healthy.
+void confirm_alarms() {
+  noInterrupts();
+  uint8_t tripped = windowTripped;
+  windowTripped = 0;
+  interrupts();
+
+  uint8_t pins[NUM_CHANNELS];
+  uint16_t raw[NUM_CHANNELS];
+  int idx[NUM_CHANNELS];
+  int count = 0;
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    if (tripped & (1 << i)) {
+      idx[count] = i;
+      pins[count++] = channels[i].pin;
+    }
+  }
+  read_adc(pins, raw, count);
+
+  for (int n = 0; n < count; n++) {
+    SensorChannel& ch = channels[idx[n]];
+    if (raw[n] >= ch.alarmLow && raw[n] <= ch.alarmHigh) {
+      ch.alarmActive = false;
+      ch.alarmMasked = false;
+      arm_window(idx[n]);   // Back inside already: a glitch
+      continue;
+    }
+    ch.alarmActive = true;
+    ch.alarmMasked = ch.alarmFaults || raw[n] <= RAIL_LOW_LSB || raw[n] >= RAIL_HIGH_LSB;
+    if (ch.alarmMasked) {
+      continue;
+    }
+    ch.value = ch.convert(raw[n]);
+    ch.reportTime = millis();
+    ch.pending = true;
+    alarmChannels |= 1 << idx[n];
+    alarmCount++;
+    snapshotDirty = true;
+  }
+}
+
+// Sleep until the next interrupt (the 1 ms core tick, the modem UART or a
+// compare match), with the ADC scanning the armed windows meanwhile
+void sleep_until_interrupt() {
+  if (windowTripped || alarmChannels) {
+    return;
+  }
+  uint16_t scan[2] = { 0, 0 };
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    if (channels[i].window != WINDOW_NONE && !channels[i].alarmActive) {
+      uint8_t an = adc_channel(channels[i].pin);
+      scan[an >> 4] |= (uint16_t)(1u << (an & 15));
+    }
+  }
+  if (!scan[0] && !scan[1]) {
+    __WFI();
+    return;
+  }
+
+  // Continuous scan of the windowed channels, then back to what
+  // analogRead() set up; ADCS may only change while ADST is 0
+  uint16_t adcsr = R_ADC0->ADCSR & (uint16_t)~R_ADC0_ADCSR_ADST_Msk;
+  uint16_t ansa0 = R_ADC0->ADANSA[0];
+  uint16_t ansa1 = R_ADC0->ADANSA[1];
+  uint16_t continuous = (adcsr & (uint16_t)~R_ADC0_ADCSR_ADCS_Msk) | (2 << R_ADC0_ADCSR_ADCS_Pos);
+  R_ADC0->ADANSA[0] = scan[0];
+  R_ADC0->ADANSA[1] = scan[1];
+  R_ADC0->ADCSR = continuous;
+  R_ADC0->ADCSR = continuous | R_ADC0_ADCSR_ADST_Msk;
+  __WFI();
+  R_ADC0->ADCSR = continuous;
+  R_ADC0->ADCSR = adcsr;
+  R_ADC0->ADANSA[0] = ansa0;
+  R_ADC0->ADANSA[1] = ansa1;
+}
+
+// Whether the scheduler switches this probe's power
+bool power_gated(const SensorChannel& ch) {
+  return POWER_GATING && ch.powerPin != NO_POWER_PIN && !(WINDOW_ALARMS && ch.window != WINDOW_NONE);
+}
+
+// Power pins as outputs: gated probes start off, the rest stay on; only
+// called under POWER_GATING, so default builds leave the pins alone
+void init_probe_power() {
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    SensorChannel& ch = channels[i];
+    if (ch.powerPin != NO_POWER_PIN) {
+      pinMode(ch.powerPin, OUTPUT);
+      digitalWrite(ch.powerPin, LOW);
+      ch.powered = false;
+      // The binary stream samples every probe continuously
+      set_probe_power(ch, STREAM_MODE || !power_gated(ch));
+    }
+  }
+}
+
+void set_probe_power(SensorChannel& ch, bool on) {
+  if (on == ch.powered) {
+    return;
+  }
+  digitalWrite(ch.powerPin, on ? HIGH : LOW);
+  unsigned long now = micros();
+  if (on) {
+    ch.poweredAtUs = now;
+  } else if (ch.powered) {
+    ch.poweredMs += (now - ch.poweredAtUs) / 1000;
+  }
+  ch.powered = on;
+}
+
+// Switch probes on ahead of their next sample. Runs every loop() pass;
+// the next tick is number tickCount, due SCHEDULER_TICK after the last.
+void service_probe_power() {
+  unsigned long now = millis();
+  long slack[NUM_CHANNELS];   // ms left before each probe must be on
+  bool batch = false;
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    SensorChannel& ch = channels[i];
+    if (!power_gated(ch) || ch.powered) {
+      slack[i] = -1;
+      continue;
+    }
+    unsigned long every = ch.samplePeriod / SCHEDULER_TICK;
+    unsigned long ticks = (every - tickCount % every) % every + 1;
+    unsigned long next = lastTickTime + ticks * SCHEDULER_TICK;
+    // One ms more: the tick may run as soon as millis() reaches it
+    slack[i] = max(0L, (long)(next - now) - (long)(ch.warmupMs + ch.settleMs + 1));
+    batch |= slack[i] == 0;
+  }
+  if (!batch) {
+    return;
+  }
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    if (slack[i] >= 0 && slack[i] <= (long)POWER_BATCH_MS) {
+      set_probe_power(channels[i], true);
+    }
+  }
+}
+
+// Function to read ADC with averaging. Conversions for all requested pins
+// are interleaved inside each spacing slot, so several channels share the
+// same averaging window (and its notch) instead of queuing one after another.
+// With LOCKIN_CONDUCTIVITY the conductivity pin gets its own lock-in burst.
+void read_adc(const uint8_t* pins, uint16_t* raw, int count) {
+  uint32_t sum[NUM_CHANNELS] = { 0 };
+  
+  for (int i = 0; i < ADC_SAMPLES; i++) {
+    for (int n = 0; n < count; n++) {
+      if (!LOCKIN_CONDUCTIVITY || pins[n] != CONDUCT_PIN) {
+        sum[n] += analogRead(pins[n]);
+      }
+    }
+    wait_us(adcSampleSpacingUs);
+  }
+  
+  for (int n = 0; n < count; n++) {
+    if (LOCKIN_CONDUCTIVITY && pins[n] == CONDUCT_PIN) {
+      raw[n] = read_conductivity_lockin();
+    } else {
+      raw[n] = sum[n] / ADC_SAMPLES;
+    }
+  }
+}
+
+// One excitation burst on the conductivity cell. The grid has 8 slots per
+// period: the pin rises on slot 0 and falls on slot 4, and the odd slots
+// sample. Returns the peak-to-peak response in ADC counts, the level a DC
+// reading with the pin high would give, so convert_conductivity() applies.
+uint16_t read_conductivity_lockin() {
+  const unsigned long slotUs = LOCKIN_PERIOD_US / 8;
+  unsigned long next = micros();
+  int n = 0;
+  for (int slot = 0; slot < (LOCKIN_SETTLE_CYCLES + LOCKIN_CYCLES) * 8; slot++) {
+    long wait = (long)(next - micros());
+    if (wait > 0) {
+      delayMicroseconds(wait);
+    }
+    next += slotUs;
+    int phase = slot & 7;
+    if (phase == 0 || phase == 4) {
+      digitalWrite(EXCITE_PIN, phase == 0 ? HIGH : LOW);
+    } else if ((phase & 1) && slot >= LOCKIN_SETTLE_CYCLES * 8) {
+      lockinBuf[n++] = analogRead(CONDUCT_PIN);
+    }
+  }
+
+  unsigned long start = micros();
+  lockin_demodulate(lockinBuf, LOCKIN_CYCLES, lockinI, lockinQ);
+  // |I, Q| per cycle in Q3: each cycle adds 2 * peak-to-peak to I, and
+  // 2 * 4095 * 8 squared twice still fits 32 bits
+  int32_t i3 = lockinI * 4 / LOCKIN_CYCLES;
+  int32_t q3 = lockinQ * 4 / LOCKIN_CYCLES;
+  uint32_t mag = (isqrt32((uint32_t)(i3 * i3) + (uint32_t)(q3 * q3)) + 4) >> 3;
+  lockinCyclesPerCycle = (micros() - start) * CPU_MHZ / LOCKIN_CYCLES;
+  return (uint16_t)min(mag, 4095UL);
+}
+
+// Synchronous demodulation of whole cycles of 4 samples taken at 45, 135,
+// 225 and 315 degrees. The square references are +1 +1 -1 -1 (I) and
+// -1 +1 +1 -1 (Q); each cycle is an integrate-and-dump, and summing whole
+// cycles is a boxcar low-pass with nulls at multiples of 1 / burst.
+void lockin_demodulate(const uint16_t* samples, int cycles, int32_t& i, int32_t& q) {
+  int32_t si = 0, sq = 0;
+  for (int c = 0; c < cycles; c++, samples += 4) {
+    int32_t a = (int32_t)samples[0] - samples[2];
+    int32_t b = (int32_t)samples[1] - samples[3];
+    si += a + b;
+    sq += b - a;
+  }
+  i = si;
+  q = sq;
+}
+
+// Integer square root, bit by bit
+uint32_t isqrt32(uint32_t v) {
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > v) {
+    bit >>= 2;
+  }
+  while (bit) {
+    if (v >= root + bit) {
+      v -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+// Function to convert raw turbidity value (inverted)
+float convert_turbidity(uint16_t raw) {
+  return 1000.0 * (1.0 - (float)raw / 4095.0);
+}
+
+// Function to convert raw pH value
+float convert_ph(uint16_t raw) {
+  return 14.0 * ((float)raw / 4095.0);
+}
+
+// Function to convert raw conductivity value
+float convert_conductivity(uint16_t raw) {
+  return 1500.0 * ((float)raw / 4095.0);
+}
+
+// Build the Q15 cosine table shared by the FFT stages and the split step
+void init_fft_tables() {
+  for (int k = 0; k <= FFT_HALF; k++) {
+    float v = cos(2.0 * PI * k / FFT_SIZE) * 32767.0;
+    fftCos[k] = (int16_t)round(v);
+  }
+}
+
+// sin(2*pi*k/FFT_SIZE) for 0 <= k <= FFT_HALF, derived from the cosine table
+static inline int16_t fft_sin(int k) {
+  int idx = k - FFT_SIZE / 4;
+  return fftCos[idx < 0 ? -idx : idx];
+}
+
+static inline int16_t mul_q15(int16_t a, int16_t b) {
+  return (int16_t)(((int32_t)a * b) >> 15);
+}
+
+// In-place radix-2 DIT complex FFT of FFT_HALF points, scaled by 1/2 per
+// stage (CMSIS arm_cfft_q15 convention) so the output never overflows
+void fft_q15(int16_t* re, int16_t* im) {
+  // Bit-reversal permutation
+  for (int i = 1, j = 0; i < FFT_HALF; i++) {
+    int bit = FFT_HALF >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      int16_t t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+
+  for (int len = 2; len <= FFT_HALF; len <<= 1) {
+    int half = len >> 1;
+    int step = FFT_SIZE / len;  // Twiddle stride in the FFT_SIZE table
+    for (int i = 0; i < FFT_HALF; i += len) {
+      for (int j = 0; j < half; j++) {
+        int16_t wr = fftCos[j * step];
+        int16_t wi = -fft_sin(j * step);
+        int a = i + j;
+        int b = a + half;
+        // Rotated value can reach 2^15 * sqrt(2): scale before narrowing
+        int16_t tr = (int16_t)(((int32_t)mul_q15(re[b], wr) - mul_q15(im[b], wi)) >> 1);
+        int16_t ti = (int16_t)(((int32_t)mul_q15(re[b], wi) + mul_q15(im[b], wr)) >> 1);
+        int16_t ar = re[a] >> 1;
+        int16_t ai = im[a] >> 1;
+        re[a] = ar + tr;
+        im[a] = ai + ti;
+        re[b] = ar - tr;
+        im[b] = ai - ti;
+      }
+    }
+  }
+}
+
+// Power spectrum of FFT_SIZE real samples: the input is packed into an
+// FFT_HALF-point complex FFT and unpacked with the real-FFT split step.
+// A Hann window limits leakage from the large mains component.
+void rfft_power_q15(const uint16_t* samples, uint32_t* power) {
+  int32_t mean = 0;
+  for (int n = 0; n < FFT_SIZE; n++) {
+    mean += samples[n];
+  }
+  mean /= FFT_SIZE;
+
+  for (int n = 0; n < FFT_SIZE; n++) {
+    // 12-bit ADC -> Q15 (x8), then Hann: 0.5 - 0.5 * cos(2*pi*n/N)
+    int16_t x = (int16_t)((samples[n] - mean) << 3);
+    int16_t c = fftCos[n <= FFT_HALF ? n : FFT_SIZE - n];
+    int16_t w = 16384 - (c >> 1);
+    x = mul_q15(x, w);
+    if (n & 1) {
+      fftIm[n >> 1] = x;
+    } else {
+      fftRe[n >> 1] = x;
+    }
+  }
+
+  fft_q15(fftRe, fftIm);
+
+  for (int k = 0; k < FFT_HALF; k++) {
+    int m = (FFT_HALF - k) & (FFT_HALF - 1);
+    int32_t zr = fftRe[k], zi = fftIm[k];
+    int32_t cr = fftRe[m], ci = fftIm[m];
+    // Even/odd halves of the real input spectrum
+    int32_t er = (zr + cr) >> 1;
+    int32_t ei = (zi - ci) >> 1;
+    int32_t orr = (zi + ci) >> 1;
+    int32_t oi = (cr - zr) >> 1;
+    // X[k] = E[k] + W^k * O[k], W = exp(-2*pi*j*k/N)
+    int32_t wc = fftCos[k];
+    int32_t ws = fft_sin(k);
+    int32_t xr = er + ((orr * wc + oi * ws) >> 15);
+    int32_t xi = ei + ((oi * wc - orr * ws) >> 15);
+    power[k] = (uint32_t)(xr * xr) + (uint32_t)(xi * xi);
+  }
+}
+
+// Runs every loop() pass: starts a capture of the conductivity line once
+// per SPECTRAL_INTERVAL, takes its due sample, and summarizes the spectrum
+// once the window is complete. Never waits for a slot.
+void run_spectral_diagnostics() {
+  if (spectralSamples < 0 && millis() - lastSpectralTime >= SPECTRAL_INTERVAL) {
+    lastSpectralTime = millis();
+    spectralSamples = 0;
+    spectralNextUs = micros();
+  }
+  service_spectral_capture();
+  if (spectralSamples == FFT_SIZE) {
+    spectralSamples = -1;
+    analyze_spectrum(spectralWindow);
+  }
+}
+
+// Take the capture's sample if its slot has come. The window must be on
+// the micros() grid: a slot missed by more than SPECTRAL_LATE_US (a
+// blocking write to the bridge, a lock-in burst) starts it over.
+void service_spectral_capture() {
+  if (spectralSamples < 0 || spectralSamples == FFT_SIZE) {
+    return;
+  }
+  unsigned long now = micros();
+  long late = (long)(now - spectralNextUs);
+  if (late < 0) {
+    return;
+  }
+  if (late > (long)SPECTRAL_LATE_US && spectralSamples > 0) {
+    spectralSamples = 0;
+    spectralNextUs = now;
+    spectralRestarts++;
+  }
+  spectralWindow[spectralSamples++] = analogRead(CONDUCT_PIN);
+  spectralNextUs += SPECTRAL_SAMPLE_US;
+}
+
+// delayMicroseconds() that keeps a spectral capture on its grid meanwhile
+void wait_us(unsigned long us) {
+  unsigned long end = micros() + us;
+  while (ENABLE_SPECTRAL_DIAG && spectralSamples >= 0 && spectralSamples < FFT_SIZE
+         && (long)(spectralNextUs - end) < 0) {
+    long wait = (long)(spectralNextUs - micros());
+    if (wait > 0) {
+      delayMicroseconds(wait);
+    }
+    service_spectral_capture();
+  }
+  long left = (long)(end - micros());
+  if (left > 0) {
+    delayMicroseconds(left);
+  }
+}
+
+// Dominant interference bins and mains band energy of one captured
+// window; re-tunes the ADC notch to the strongest interferer
+void analyze_spectrum(const uint16_t* window) {
+  unsigned long start = micros();
+  rfft_power_q15(window, fftPower);
+
+  const float binHz = 1000000.0 / SPECTRAL_SAMPLE_US / FFT_SIZE;
+  int lowBin = (int)(MAINS_BAND_LOW_HZ / binHz);
+  int highBin = (int)(MAINS_BAND_HIGH_HZ / binHz + 0.5);
+  uint64_t total = 0, band = 0;
+  int peaks[SPECTRAL_PEAKS] = { 0 };
+
+  // Bins 0-1 carry the DC level and window skirt, not interference
+  for (int k = 2; k < FFT_HALF; k++) {
+    uint32_t p = fftPower[k];
+    total += p;
+    if (k >= lowBin && k <= highBin) {
+      band += p;
+    }
+    // Keep the strongest local maxima, sorted by power
+    if (p < fftPower[k - 1] || (k + 1 < FFT_HALF && p < fftPower[k + 1])) {
+      continue;
+    }
+    for (int i = 0; i < SPECTRAL_PEAKS; i++) {
+      if (peaks[i] == 0 || p > fftPower[peaks[i]]) {
+        for (int j = SPECTRAL_PEAKS - 1; j > i; j--) {
+          peaks[j] = peaks[j - 1];
+        }
+        peaks[i] = k;
+        break;
+      }
+    }
+  }
+
+  for (int i = 0; i < SPECTRAL_PEAKS; i++) {
+    int k = peaks[i];
+    if (k == 0 || total == 0) {
+      spectral.peakHz[i] = 0;
+      spectral.peakPermille[i] = 0;
+      continue;
+    }
+    // Parabolic interpolation between neighbouring bins
+    float delta = 0;
+    if (k + 1 < FFT_HALF) {
+      float a = fftPower[k - 1], b = fftPower[k], c = fftPower[k + 1];
+      float d = a - 2 * b + c;
+      if (d != 0) {
+        delta = 0.5 * (a - c) / d;
+      }
+    }
+    spectral.peakHz[i] = (k + delta) * binHz;
+    spectral.peakPermille[i] = (uint16_t)(fftPower[k] * 1000ULL / total);
+  }
+  spectral.bandPermille = total ? (uint16_t)(band * 1000 / total) : 0;
+  spectral.cyclesPerWindow = (micros() - start) * CPU_MHZ;
+  spectral.valid = true;
+
+  if (ENABLE_NOTCH_AUTOTUNE && spectral.peakPermille[0] >= NOTCH_MIN_PERMILLE) {
+    autotune_notch(spectral.peakHz[0]);
+  }
+}
+
+// The ADC average is a boxcar filter with nulls at multiples of
+// 1 / (ADC_SAMPLES * spacing). Stretch or shrink the spacing so the window
+// covers a whole number of interferer periods, keeping it close to 20 ms.
+void autotune_notch(float hz) {
+  if (hz < 10.0) {
+    return;
+  }
+  const float defaultWindowUs = ADC_SAMPLES * ADC_DEFAULT_SPACING_US;
+  float periodUs = 1000000.0 / hz;
+  long periods = lround(defaultWindowUs / periodUs);
+  if (periods < 1) {
+    periods = 1;
+  }
+  unsigned long spacing = lround(periods * periodUs / ADC_SAMPLES);
+  if (spacing < ADC_DEFAULT_SPACING_US / 2 || spacing > ADC_DEFAULT_SPACING_US * 2) {
+    return;
+  }
+  if (spacing != adcSampleSpacingUs) {
+    adcSampleSpacingUs = spacing;
+    Serial.print("Notch tuned to ");
+    Serial.print(hz, 1);
+    Serial.print(" Hz, ADC spacing us: ");
+    Serial.println(spacing);
+  }
+}
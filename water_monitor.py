@@ -7,6 +7,7 @@ import asyncio
 from datetime import datetime
 import os
 import random
+import time
 from fastapi_websocket_pubsub import PubSubEndpoint
 
 logger = logging.getLogger(__name__)
@@ -25,9 +26,71 @@ latest_data = {
 use_mock_data = True
 mock_data_task = None
 
+# Canales que puede enviar el Arduino
+SENSOR_KEYS = ("T", "PH", "C")
+
+def merge_reading(json_data) -> bool:
+    """Fusionar una trama (posiblemente parcial) en latest_data.
+
+    El Arduino muestrea cada canal a su propio ritmo, así que una trama puede
+    traer solo algunos de los canales. Devuelve False si no trae ninguno.
+    """
+    global latest_data
+    update = {key: float(json_data[key]) for key in SENSOR_KEYS if key in json_data}
+    if not update:
+        return False
+
+    # Banderas de calidad por canal (riel, valor pegado, ruido); un canal
+    # actualizado sin bandera vuelve a considerarse sano
+    quality = dict(latest_data.get("Q", {}))
+    flags = json_data.get("Q", {})
+    for key in update:
+        if flags.get(key):
+            quality[key] = int(flags[key])
+        else:
+            quality.pop(key, None)
+
+    latest_data = {**latest_data, **update}
+    if quality:
+        latest_data["Q"] = quality
+    else:
+        latest_data.pop("Q", None)
+    return True
+
+def build_trace(json_data, received_at: float):
+    """Traza de latencia de una trama del Arduino, o None si no la trae.
+
+    El Arduino no tiene reloj de pared: envía su millis() de adquisición (TA)
+    y de armado de la trama (TS). La hora de adquisición se estima restando
+    esa edad a la hora de recepción (sin contar el tránsito por la red).
+    """
+    if not all(key in json_data for key in ("S", "TA", "TS")):
+        return None
+    age = (int(json_data["TS"]) - int(json_data["TA"])) / 1000.0
+    return {
+        "id": int(json_data["S"]),
+        "ta": int(json_data["TA"]),
+        "ts": int(json_data["TS"]),
+        "acq": received_at - age,
+        "recv": received_at,
+    }
+
+async def publish_reading(data):
+    """Publicar una lectura, marcando en su traza la hora real de publicación"""
+    if "trace" in data:
+        data["trace"]["pub"] = time.time()
+    await pubsub_endpoint.publish("water_data", data)
+
+def stamp_push(data):
+    """Copia de los datos con la hora de envío al cliente en la traza"""
+    if "trace" not in data:
+        return data
+    return {**data, "trace": {**data["trace"], "push": time.time()}}
+
 async def http_publisher_endpoint(request: Request):
     """Optimized HTTP endpoint for Arduino"""
     global latest_data, use_mock_data
+    received_at = time.time()
     
     try:
         # Use more efficient body parsing
@@ -40,15 +103,15 @@ async def http_publisher_endpoint(request: Request):
             logger.debug(f"Data received: {len(body)} bytes")
             
             # Update data if not in mock mode
-            if not use_mock_data and all(key in json_data for key in ["T", "PH", "C"]):
-                latest_data = {
-                    "T": float(json_data["T"]),
-                    "PH": float(json_data["PH"]),
-                    "C": float(json_data["C"])
-                }
-                
+            if not use_mock_data and merge_reading(json_data):
+                trace = build_trace(json_data, received_at)
+                if trace:
+                    latest_data["trace"] = trace
+                else:
+                    latest_data.pop("trace", None)
+
                 # Publish to clients immediately
-                asyncio.create_task(pubsub_endpoint.publish("water_data", latest_data))
+                asyncio.create_task(publish_reading(latest_data))
                 
                 # Minimal response
                 return Response(status_code=200)
@@ -84,12 +147,7 @@ async def publisher_endpoint(websocket: WebSocket):
                         continue
                 
                 # Si no estamos en modo mock, actualizar datos
-                if not use_mock_data and all(key in json_data for key in ["T", "PH", "C"]):
-                    latest_data = {
-                        "T": float(json_data["T"]),
-                        "PH": float(json_data["PH"]),
-                        "C": float(json_data["C"])
-                    }
+                if not use_mock_data and merge_reading(json_data):
                     logger.info(f"Datos actualizados: {latest_data}")
                     await websocket.send_json({"status": "ok", "message": "Datos recibidos"})
                 else:
@@ -117,7 +175,7 @@ async def client_endpoint(websocket: WebSocket):
     async def send_periodic_updates():
         while True:
             try:
-                await websocket.send_json(latest_data)
+                await websocket.send_json(stamp_push(latest_data))
                 await asyncio.sleep(3.0)  # Usar el mismo intervalo que generate_mock_data
             except Exception:
                 # Si hay un error, terminar la tarea
@@ -128,7 +186,7 @@ async def client_endpoint(websocket: WebSocket):
     
     try:
         # Enviar datos iniciales inmediatamente
-        await websocket.send_json(latest_data)
+        await websocket.send_json(stamp_push(latest_data))
         
         # Mantener conexión abierta para procesar mensajes del cliente
         while True: